@@ -10,95 +10,191 @@
  */
 
 #include "OMXsonien.h"
+#include "trace.h"
 
-OMXsonien_BUFFERMANAGER* bufferManagerRefs[256];
+OMXsonien_INSTANCE* pInstanceDefault = NULL;
 void (*OMXsonienErrorCallback)(OMX_ERRORTYPE);
+OMXsonien_CALLSITE* pCallSites = NULL;
 
-void OMXsonienErrorCallbackDefault(OMX_ERRORTYPE err) {
+static void OMXsonienErrorHandlerDefault(OMX_ERRORTYPE err, OMX_PTR pAppData) {
 	printf("OMX > ERROR [0x%08x]\n", err);
 }
 
+/* Default instance takes the callback of OMXsonienSetErrorCallback(). */
+static void OMXsonienErrorHandlerLegacy(OMX_ERRORTYPE err, OMX_PTR pAppData) {
+	OMXsonienErrorCallback(err);
+}
+
+static OMXsonien_INSTANCE* OMXsonienInstanceOf(OMXsonien_INSTANCE* pInstance) {
+	return pInstance ? pInstance : pInstanceDefault;
+}
+
 void OMXsonienInit() {
-	memset(bufferManagerRefs, 0x00, sizeof(OMXsonien_BUFFERMANAGER*) * 256);
-	OMXsonienSetErrorCallback(OMXsonienErrorCallbackDefault);
+	pInstanceDefault = OMXsonienCreate();
 }
 
 void OMXsonienDeinit() {
-	for(int i = 0; i < 256; i++) {
-		if(bufferManagerRefs[i] != NULL) {
-			pthread_mutex_destroy(&(bufferManagerRefs[i]->mutex));
-			free(bufferManagerRefs[i]);
-			bufferManagerRefs[i] = NULL;
-		}
-	}
+	OMXsonienCallDump();
+
+	OMXsonienDestroy(pInstanceDefault);
+	pInstanceDefault = NULL;
 }
 
 void OMXsonienSetErrorCallback(void (*callback)(OMX_ERRORTYPE)) {
 	OMXsonienErrorCallback = callback;
+	OMXsonienSetErrorHandler(NULL, OMXsonienErrorHandlerLegacy, NULL);
+}
+
+OMX_ERRORTYPE (OMXsonienCheckError)(OMX_ERRORTYPE err) {
+	return (OMXsonienCheckErrorIn)(NULL, err);
 }
 
-OMX_ERRORTYPE OMXsonienCheckError(OMX_ERRORTYPE err) {
+OMXsonien_INSTANCE* OMXsonienCreate() {
+	OMXsonien_INSTANCE* pInstance = calloc(1, sizeof(OMXsonien_INSTANCE));
+
+	pInstance->onError = OMXsonienErrorHandlerDefault;
+	pthread_mutex_init(&pInstance->mutex, NULL);
+
+	return pInstance;
+}
+
+void OMXsonienDestroy(
+		OMX_IN OMXsonien_INSTANCE* pInstance) {
+	if(pInstance == NULL) return;
+
+	OMXsonien_BUFFERMANAGER* pManager = pInstance->pManagers;
+	while(pManager) {
+		OMXsonien_BUFFERMANAGER* pNext = pManager->pNext;
+		OMXsonienBufferStats(pManager);
+		pthread_mutex_destroy(&(pManager->mutex));
+		free(pManager->pBufferState);
+		free(pManager);
+		pManager = pNext;
+	}
+
+	pthread_mutex_destroy(&pInstance->mutex);
+	free(pInstance);
+}
+
+void OMXsonienSetErrorHandler(
+		OMX_IN OMXsonien_INSTANCE* pInstance,
+		OMX_IN void (*onError)(OMX_ERRORTYPE err, OMX_PTR pAppData),
+		OMX_IN OMX_PTR pAppData) {
+	pInstance = OMXsonienInstanceOf(pInstance);
+	pInstance->onError	= onError ? onError : OMXsonienErrorHandlerDefault;
+	pInstance->pAppData	= pAppData;
+}
+
+OMX_ERRORTYPE (OMXsonienCheckErrorIn)(
+		OMX_IN OMXsonien_INSTANCE* pInstance,
+		OMX_IN OMX_ERRORTYPE err) {
 	if(err != OMX_ErrorNone) {
-		OMXsonienErrorCallback(err);
+		pInstance = OMXsonienInstanceOf(pInstance);
+		pInstance->onError(err, pInstance->pAppData);
 	}
 
 	return err;
 }
 
+void OMXsonienCallRecord(OMXsonien_CALLSITE* pCallSite, unsigned long long nLatency) {
+	if(!__atomic_load_n(&pCallSite->isRegistered, __ATOMIC_ACQUIRE)
+			&& !__atomic_exchange_n(&pCallSite->isRegistered, 1, __ATOMIC_ACQ_REL)) {
+		pCallSite->pNext = __atomic_load_n(&pCallSites, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&pCallSites, &pCallSite->pNext, pCallSite, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+
+	stats_histogram_add(&pCallSite->latency, nLatency);
+}
+
+void OMXsonienCallDump() {
+	OMXsonien_CALLSITE* pCallSite = __atomic_load_n(&pCallSites, __ATOMIC_ACQUIRE);
+	if(pCallSite == NULL) return;
+
+	printf("OMX > %-24s %8s %10s %9s %9s %9s %9s  %s\n", "SITE", "COUNT", "TOTAL(ms)", "MEAN(us)", "P50(us)", "P99(us)", "MAX(us)", "CALL");
+	for(; pCallSite; pCallSite = pCallSite->pNext) {
+		STATS_HISTOGRAM* pLatency = &pCallSite->latency;
+		char site[256];
+		snprintf(site, sizeof(site), "%s:%d", pCallSite->pFile, pCallSite->nLine);
+		printf("OMX > %-24s %8llu %10.3f %9.1f %9.1f %9.1f %9.1f  %.48s\n",
+				site,
+				pLatency->nCount,
+				pLatency->nSum / 1000000.0,
+				stats_histogram_mean(pLatency) / 1000.0,
+				stats_histogram_percentile(pLatency, 50) / 1000.0,
+				stats_histogram_percentile(pLatency, 99) / 1000.0,
+				pLatency->nMax / 1000.0,
+				pCallSite->pCall);
+	}
+}
+
 OMXsonien_BUFFERMANAGER* OMXsonienAllocateBuffer(
 		OMX_IN OMX_HANDLETYPE hComponent,
         OMX_IN OMX_U32 nPortIndex,
         OMX_IN OMX_PTR pAppPrivate,
 		OMX_IN OMX_U32 nSize,
         OMX_IN OMX_U32 nCount) {
+	return OMXsonienAllocateBufferIn(NULL, hComponent, nPortIndex, pAppPrivate, nSize, nCount);
+}
 
-	int refID	= -1;
-	for(int i = 0; i < 256; i++) {
-		if(bufferManagerRefs[i] != NULL) {
-			continue;
-		}
-		else {
-			refID = i;
-			break;
-		}
-	}
-	bufferManagerRefs[refID] = malloc(sizeof(OMXsonien_BUFFERMANAGER));
-	OMXsonien_BUFFERMANAGER* pBufferManager = bufferManagerRefs[refID];
+OMXsonien_BUFFERMANAGER* OMXsonienAllocateBufferIn(
+		OMX_IN OMXsonien_INSTANCE* pInstance,
+		OMX_IN OMX_HANDLETYPE hComponent,
+        OMX_IN OMX_U32 nPortIndex,
+        OMX_IN OMX_PTR pAppPrivate,
+		OMX_IN OMX_U32 nSize,
+        OMX_IN OMX_U32 nCount) {
+
+	pInstance = OMXsonienInstanceOf(pInstance);
+	OMXsonien_BUFFERMANAGER* pBufferManager = calloc(1, sizeof(OMXsonien_BUFFERMANAGER));
+	pBufferManager->pInstance		= pInstance;
 	pBufferManager->hComponent 		= hComponent;
 	pBufferManager->nPortIndex		= nPortIndex;
 	pBufferManager->eBufferSetType	= AllocateBuffer;	// Currently the only supported type
 
-	if(!nSize || !nCount) {
-		OMX_PARAM_PORTDEFINITIONTYPE 	portDef;
-		OMX_INIT_STRUCTURE(portDef);
+	OMX_PARAM_PORTDEFINITIONTYPE 	portDef;
+	OMX_INIT_STRUCTURE(portDef);
 
-		portDef.nPortIndex = nPortIndex;
-		OMX_GetParameter(hComponent, OMX_IndexParamPortDefinition, &portDef);
+	portDef.nPortIndex = nPortIndex;
+	OMXsonienCall(OMX_GetParameter(hComponent, OMX_IndexParamPortDefinition, &portDef));
+	pBufferManager->eDir = portDef.eDir;
 
-		if(!nSize) {
-			nSize = portDef.nBufferSize;
-		}
+	if(!nSize) {
+		nSize = portDef.nBufferSize;
+	}
 
-		if(!nCount) {
-			nCount = portDef.nBufferCountActual;
-		}
+	if(!nCount) {
+		nCount = portDef.nBufferCountActual;
 	}
-	printf("0x%08x : Buffer Size = %d / Count = %d\n", hComponent, nSize, nCount);
+	printf("%p : Buffer Size = %d / Count = %d\n", hComponent, nSize, nCount);
 	pBufferManager->pBufferPtrPool = malloc(sizeof(OMX_BUFFERHEADERTYPE*) * nCount);
 	for(int i = 0; i < nCount; i++) {
 		OMX_BUFFERHEADERTYPE*	pBufferHeader;	// pBufferManager->pBufferPtrPool + i
-		printf("0x%08x : New Buffer #%d\n", hComponent, i);
-		OMXsonienCheckError(OMX_AllocateBuffer(hComponent, &pBufferHeader, nPortIndex, pAppPrivate, nSize));
-		printf("0x%08x : At 0x%08x\n", hComponent, pBufferHeader->pBuffer);
+		printf("%p : New Buffer #%d\n", hComponent, i);
+		OMXsonienCheckErrorIn(pInstance, OMX_AllocateBuffer(hComponent, &pBufferHeader, nPortIndex, pAppPrivate, nSize));
+		printf("%p : At %p\n", hComponent, pBufferHeader->pBuffer);
 		pBufferManager->pBufferPtrPool[i] = pBufferHeader;
 	}
 
 	pBufferManager->pBufferPtrHead 	= pBufferManager->pBufferPtrPool;
 	pBufferManager->pBufferPtrTail 	= pBufferManager->pBufferPtrPool+(nCount - 1);
 	pBufferManager->pBufferPtrNow	= pBufferManager->pBufferPtrHead;
+	pBufferManager->nBufferCount	= nCount;
 	pBufferManager->nBufferRemain	= nCount;
 	pthread_mutex_init(&pBufferManager->mutex, NULL);
 
+	unsigned long long nNow = stats_now();
+	pBufferManager->pBufferState = malloc(sizeof(OMXsonien_BUFFERSTATE) * nCount);
+	for(int i = 0; i < nCount; i++) {
+		pBufferManager->pBufferState[i].eOwner	= OwnerQueued;
+		pBufferManager->pBufferState[i].nSince	= nNow;
+	}
+	memset(&pBufferManager->stats, 0x00, sizeof(OMXsonien_BUFFERSTATS));
+
+	pthread_mutex_lock(&pInstance->mutex);
+	pBufferManager->pNext	= pInstance->pManagers;
+	pInstance->pManagers	= pBufferManager;
+	pthread_mutex_unlock(&pInstance->mutex);
+
 	return pBufferManager;
 }
 
@@ -106,8 +202,16 @@ void OMXsonienFreeBuffer(
 		OMX_IN OMXsonien_BUFFERMANAGER* pManager) {
 	OMX_BUFFERHEADERTYPE** pBufferPtr = pManager->pBufferPtrHead;
 
+	for(int i = 0; i < pManager->nBufferCount; i++) {
+		if(pManager->pBufferState[i].eOwner != OwnerQueued) {
+			printf("%p : Buffer %p is leaked. Owned by %s\n", pManager->hComponent, pManager->pBufferPtrPool[i],
+					pManager->pBufferState[i].eOwner == OwnerClient ? "client" : "component");
+			pManager->stats.nLeaked++;
+		}
+	}
+
 	while(pBufferPtr <= pManager->pBufferPtrTail) {
-		OMX_FreeBuffer(pManager->hComponent, pManager->nPortIndex, *pBufferPtr);
+		OMXsonienCall(OMX_FreeBuffer(pManager->hComponent, pManager->nPortIndex, *pBufferPtr));
 		pBufferPtr++;
 	}
 
@@ -119,6 +223,47 @@ void OMXsonienFreeBuffer(
 	pManager->pBufferPtrPool 	= NULL;
 }
 
+/*
+ * Index of buffer header in the pool. Pool is small enough for linear search.
+ */
+static int OMXsonienBufferIndex(
+		OMXsonien_BUFFERMANAGER* pManager,
+		OMX_BUFFERHEADERTYPE* pBuffer) {
+	for(int i = 0; i < pManager->nBufferCount; i++) {
+		if(pManager->pBufferPtrPool[i] == pBuffer) return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Move buffer to new owner and account the time it spent with old owner.
+ * Must be called with mutex locked.
+ */
+static void OMXsonienBufferMove(
+		OMXsonien_BUFFERMANAGER* pManager,
+		int index,
+		OMXsonien_BUFFEROWNERTYPE eOwner) {
+	OMXsonien_BUFFERSTATE*	pState	= &pManager->pBufferState[index];
+	unsigned long long		nNow	= stats_now();
+	unsigned long long		nHeld	= nNow - pState->nSince;
+
+	switch(pState->eOwner) {
+	case OwnerQueued :
+		pManager->stats.nTimeQueued += nHeld;
+		break;
+	case OwnerClient :
+		pManager->stats.nTimeClient += nHeld;
+		break;
+	case OwnerComponent :
+		pManager->stats.nTimeComponent += nHeld;
+		break;
+	}
+
+	pState->eOwner	= eOwner;
+	pState->nSince	= nNow;
+}
+
 OMX_BUFFERHEADERTYPE* OMXsonienBufferGet(
 		OMX_IN OMXsonien_BUFFERMANAGER* pManager) {
 
@@ -126,27 +271,110 @@ OMX_BUFFERHEADERTYPE* OMXsonienBufferGet(
 
 	pthread_mutex_lock(&(pManager->mutex));
 	if(pManager->nBufferRemain == 0) {
+		pManager->stats.nStarvation++;
+		pthread_mutex_unlock(&(pManager->mutex));
+		TRACE_INSTANT("OMXsonienBufferGet starved");
 		return NULL;
 	}
 
+	// Buffers may come back out of order. Take the next queued one.
+	while(pManager->pBufferState[pManager->pBufferPtrNow - pManager->pBufferPtrHead].eOwner != OwnerQueued) {
+		pManager->pBufferPtrNow++;
+		if(pManager->pBufferPtrNow > pManager->pBufferPtrTail) {
+			pManager->pBufferPtrNow = pManager->pBufferPtrHead;
+		}
+	}
+
 	pNextBuffer = *(pManager->pBufferPtrNow);
+	OMXsonienBufferMove(pManager, pManager->pBufferPtrNow - pManager->pBufferPtrHead, OwnerClient);
 	pManager->pBufferPtrNow++;
 	if(pManager->pBufferPtrNow > pManager->pBufferPtrTail) {
 		pManager->pBufferPtrNow = pManager->pBufferPtrHead;
 	}
 	--(pManager->nBufferRemain);
+	if(pManager->nBufferCount - pManager->nBufferRemain > pManager->stats.nMaxOutstanding) {
+		pManager->stats.nMaxOutstanding = pManager->nBufferCount - pManager->nBufferRemain;
+	}
+	TRACE_COUNTER("nBufferRemain", pManager->nBufferRemain);
 	pthread_mutex_unlock(&(pManager->mutex));
 	return pNextBuffer;
 }
 
+OMX_ERRORTYPE OMXsonienBufferSend(
+		OMX_IN OMXsonien_BUFFERMANAGER* pManager,
+		OMX_BUFFERHEADERTYPE* pBuffer) {
+	pthread_mutex_lock(&(pManager->mutex));
+	int index = OMXsonienBufferIndex(pManager, pBuffer);
+	if(index < 0) {
+		pManager->stats.nUnknown++;
+	}
+	else {
+		OMXsonienBufferMove(pManager, index, OwnerComponent);
+	}
+	pthread_mutex_unlock(&(pManager->mutex));
+
+	// Component may call back before this returns, so the state is changed first.
+	OMX_ERRORTYPE err;
+	if(pManager->eDir == OMX_DirInput) {
+		err = OMXsonienCall(OMX_EmptyThisBuffer(pManager->hComponent, pBuffer));
+	}
+	else {
+		err = OMXsonienCall(OMX_FillThisBuffer(pManager->hComponent, pBuffer));
+	}
+
+	// Rejected buffer never comes back by callback. Queue it again as it is.
+	if(err != OMX_ErrorNone && index >= 0) {
+		pthread_mutex_lock(&(pManager->mutex));
+		if(pManager->pBufferState[index].eOwner == OwnerComponent) {
+			OMXsonienBufferMove(pManager, index, OwnerQueued);
+			++(pManager->nBufferRemain);
+		}
+		TRACE_COUNTER("nBufferRemain", pManager->nBufferRemain);
+		pthread_mutex_unlock(&(pManager->mutex));
+	}
+	return err;
+}
+
 void OMXsonienBufferPut(
 		OMX_IN OMXsonien_BUFFERMANAGER* pManager,
 		OMX_BUFFERHEADERTYPE* pBuffer) {
 	pthread_mutex_lock(&(pManager->mutex));
-	++(pManager->nBufferRemain);
+	int index = OMXsonienBufferIndex(pManager, pBuffer);
+	if(index < 0) {
+		pManager->stats.nUnknown++;
+	}
+	else if(pManager->pBufferState[index].eOwner == OwnerQueued) {
+		pManager->stats.nDoublePut++;
+	}
+	else {
+		OMXsonienBufferMove(pManager, index, OwnerQueued);
+		++(pManager->nBufferRemain);
+	}
+	TRACE_COUNTER("nBufferRemain", pManager->nBufferRemain);
 	pthread_mutex_unlock(&(pManager->mutex));
 }
 
+void OMXsonienBufferStats(
+		OMX_IN OMXsonien_BUFFERMANAGER* pManager) {
+	OMXsonien_BUFFERSTATS stats;
+
+	// Take time of buffers which are still held.
+	pthread_mutex_lock(&(pManager->mutex));
+	for(int i = 0; i < pManager->nBufferCount; i++) {
+		OMXsonienBufferMove(pManager, i, pManager->pBufferState[i].eOwner);
+	}
+	stats = pManager->stats;
+	pthread_mutex_unlock(&(pManager->mutex));
+
+	unsigned long long nTotal = stats.nTimeQueued + stats.nTimeClient + stats.nTimeComponent;
+	if(nTotal == 0) nTotal = 1;
+	printf("%p : Port #%d, %d buffers. Held by client %.1f%%, component %.1f%%, queued %.1f%%\n",
+			pManager->hComponent, pManager->nPortIndex, pManager->nBufferCount,
+			stats.nTimeClient * 100.0 / nTotal, stats.nTimeComponent * 100.0 / nTotal, stats.nTimeQueued * 100.0 / nTotal);
+	printf("%p : Max outstanding %d, starvation %d, double put %d, unknown %d, leaked %d\n",
+			pManager->hComponent, stats.nMaxOutstanding, stats.nStarvation, stats.nDoublePut, stats.nUnknown, stats.nLeaked);
+}
+
 OMX_BUFFERHEADERTYPE* OMXsonienBufferNow(
 		OMX_IN OMXsonien_BUFFERMANAGER* pManager) {
 	return *(pManager->pBufferPtrNow);
@@ -20,24 +20,121 @@
 #include <IL/OMX_Broadcom.h>
 
 #include "common.h"
+#include "stats.h"
+#include "trace.h"
 
 typedef enum OMXsonien_BUFFERASSIGNTYPE {
 	AllocateBuffer	= 0x00,
 	UseBuffer
 } OMXsonien_BUFFERASSIGNTYPE;
 
+/*
+ * Owner of a buffer header.
+ * Queued -(Get)-> Client -(Send)-> Component -(Put)-> Queued
+ */
+typedef enum OMXsonien_BUFFEROWNERTYPE {
+	OwnerQueued		= 0x00,
+	OwnerClient,
+	OwnerComponent
+} OMXsonien_BUFFEROWNERTYPE;
+
+typedef struct OMXsonien_BUFFERSTATE {
+	OMXsonien_BUFFEROWNERTYPE	eOwner;
+	unsigned long long			nSince;				// nsec, time of last transition
+} OMXsonien_BUFFERSTATE;
+
+typedef struct OMXsonien_BUFFERSTATS {
+	unsigned long long			nTimeQueued;		// nsec, sum of every buffer
+	unsigned long long			nTimeClient;
+	unsigned long long			nTimeComponent;
+	unsigned int				nMaxOutstanding;	// Max number of buffers not queued
+	unsigned int				nStarvation;		// OMXsonienBufferGet() found no buffer
+	unsigned int				nDoublePut;			// Put of a buffer already queued
+	unsigned int				nUnknown;			// Buffer of other manager
+	unsigned int				nLeaked;			// Not queued when freed
+} OMXsonien_BUFFERSTATS;
+
+struct OMXsonien_INSTANCE;
+
 typedef struct OMXsonien_BUFFERMANAGER {
+	struct OMXsonien_INSTANCE*	pInstance;
+	struct OMXsonien_BUFFERMANAGER*	pNext;			// Managers of the instance
 	OMX_HANDLETYPE 				hComponent;
 	OMX_U32						nPortIndex;
+	OMX_DIRTYPE					eDir;
 	OMXsonien_BUFFERASSIGNTYPE 	eBufferSetType;
 	OMX_BUFFERHEADERTYPE**		pBufferPtrHead;
 	OMX_BUFFERHEADERTYPE**		pBufferPtrTail;
 	OMX_BUFFERHEADERTYPE**		pBufferPtrNow;
 	OMX_BUFFERHEADERTYPE**		pBufferPtrPool;
+	OMXsonien_BUFFERSTATE*		pBufferState;		// Same order with pBufferPtrPool
+	unsigned int				nBufferCount;
 	unsigned int				nBufferRemain;
+	OMXsonien_BUFFERSTATS		stats;
 	pthread_mutex_t 			mutex;
 } OMXsonien_BUFFERMANAGER;
 
+/*
+ * Scope of OMXsonien. Buffer managers and error handler belong to an
+ * instance, so pipelines with their own instance share no state and may
+ * run concurrently. Functions take NULL as the default instance, which
+ * OMXsonienInit() creates for programs with a single pipeline.
+ */
+typedef struct OMXsonien_INSTANCE {
+	OMXsonien_BUFFERMANAGER*	pManagers;
+	void						(*onError)(OMX_ERRORTYPE err, OMX_PTR pAppData);
+	OMX_PTR						pAppData;			// Passed to onError
+	pthread_mutex_t				mutex;
+} OMXsonien_INSTANCE;
+
+/*
+ * Statistics of one call site of OMX IL. Used by OMXsonienCall().
+ */
+typedef struct OMXsonien_CALLSITE {
+	const char*					pFile;
+	int							nLine;
+	const char*					pCall;
+	int							isRegistered;
+	STATS_HISTOGRAM				latency;
+	struct OMXsonien_CALLSITE*	pNext;
+} OMXsonien_CALLSITE;
+
+/*
+ * OMXsonienCall(call) times an OMX IL call at its call site.
+ * With -DOMX_PROFILE, count, total, max and percentile latency of each call
+ * site are collected and printed by OMXsonienDeinit().
+ * With -DTRACE, each call is recorded as a span of trace.
+ * Otherwise it is just the call itself.
+ *
+ * OMXsonienCheckError(call) does the same before checking the error.
+ */
+#ifdef OMX_PROFILE
+#define OMXSONIEN_PROFILE_BEGIN(name) \
+	static OMXsonien_CALLSITE _callsite = { __FILE__, __LINE__, name }; \
+	unsigned long long _begin = stats_now();
+#define OMXSONIEN_PROFILE_END() \
+	OMXsonienCallRecord(&_callsite, stats_now() - _begin);
+#else
+#define OMXSONIEN_PROFILE_BEGIN(name)
+#define OMXSONIEN_PROFILE_END()
+#endif
+
+#if defined(OMX_PROFILE) || defined(TRACE)
+#define OMXsonienCallNamed(call, name) ({ \
+	TRACE_BEGIN(name); \
+	OMXSONIEN_PROFILE_BEGIN(name) \
+	OMX_ERRORTYPE _err = (call); \
+	OMXSONIEN_PROFILE_END() \
+	TRACE_END(name); \
+	_err; })
+#else
+#define OMXsonienCallNamed(call, name)	(call)
+#endif
+
+#define OMXsonienCall(call)			OMXsonienCallNamed(call, #call)
+#define OMXsonienCheckError(call)	(OMXsonienCheckError)(OMXsonienCallNamed(call, #call))
+#define OMXsonienCheckErrorIn(pInstance, call)	(OMXsonienCheckErrorIn)(pInstance, OMXsonienCallNamed(call, #call))
+
 /**
  * OMXsonien Helper 를 초기화 한다.
  */
@@ -47,6 +144,45 @@ void OMXsonienDeinit();
 
 void OMXsonienSetErrorCallback(void (*callback)(OMX_ERRORTYPE));
 
+/*
+ * Call error callback if err is not OMX_ErrorNone. Returns err as it is.
+ */
+OMX_ERRORTYPE (OMXsonienCheckError)(OMX_ERRORTYPE err);
+
+/*
+ * Create an instance. Its error handler only prints until one is set.
+ */
+OMXsonien_INSTANCE* OMXsonienCreate();
+
+/*
+ * Print statistics and free every buffer manager of the instance, then the
+ * instance. Buffers must be freed by OMXsonienFreeBuffer() already.
+ */
+void OMXsonienDestroy(
+		OMX_IN OMXsonien_INSTANCE* pInstance);
+
+void OMXsonienSetErrorHandler(
+		OMX_IN OMXsonien_INSTANCE* pInstance,
+		OMX_IN void (*onError)(OMX_ERRORTYPE err, OMX_PTR pAppData),
+		OMX_IN OMX_PTR pAppData);
+
+/*
+ * Call error handler of the instance if err is not OMX_ErrorNone. Returns err as it is.
+ */
+OMX_ERRORTYPE (OMXsonienCheckErrorIn)(
+		OMX_IN OMXsonien_INSTANCE* pInstance,
+		OMX_IN OMX_ERRORTYPE err);
+
+/*
+ * Record latency of a call site. Used by OMXsonienCall() when OMX_PROFILE.
+ */
+void OMXsonienCallRecord(OMXsonien_CALLSITE* pCallSite, unsigned long long nLatency);
+
+/*
+ * Print statistics of every recorded call site.
+ */
+void OMXsonienCallDump();
+
 OMXsonien_BUFFERMANAGER* OMXsonienAllocateBuffer(
 		OMX_IN OMX_HANDLETYPE hComponent,
         OMX_IN OMX_U32 nPortIndex,
@@ -54,16 +190,50 @@ OMXsonien_BUFFERMANAGER* OMXsonienAllocateBuffer(
 		OMX_IN OMX_U32 nSize,
         OMX_IN OMX_U32 nCount);
 
+/*
+ * Same as OMXsonienAllocateBuffer() but the manager belongs to pInstance.
+ */
+OMXsonien_BUFFERMANAGER* OMXsonienAllocateBufferIn(
+		OMX_IN OMXsonien_INSTANCE* pInstance,
+		OMX_IN OMX_HANDLETYPE hComponent,
+        OMX_IN OMX_U32 nPortIndex,
+        OMX_IN OMX_PTR pAppPrivate,
+		OMX_IN OMX_U32 nSize,
+        OMX_IN OMX_U32 nCount);
+
 void OMXsonienFreeBuffer(
 		OMX_IN OMXsonien_BUFFERMANAGER* pManager);
 
+/*
+ * Get a queued buffer. The client owns it until OMXsonienBufferSend().
+ * Returns NULL if every buffer is owned by the client or the component.
+ */
 OMX_BUFFERHEADERTYPE* OMXsonienBufferGet(
 		OMX_IN OMXsonien_BUFFERMANAGER* pManager);
 
+/*
+ * Hand a buffer to the component. OMX_EmptyThisBuffer() for input port and
+ * OMX_FillThisBuffer() for output port. A buffer the component rejects is
+ * queued again, as if it came back.
+ */
+OMX_ERRORTYPE OMXsonienBufferSend(
+		OMX_IN OMXsonien_BUFFERMANAGER* pManager,
+		OMX_BUFFERHEADERTYPE* pBuffer);
+
+/*
+ * Return a buffer to the queue. Usually called by EmptyBufferDone or
+ * FillBufferDone callback. A buffer already queued is ignored and counted.
+ */
 void OMXsonienBufferPut(
 		OMX_IN OMXsonien_BUFFERMANAGER* pManager,
 		OMX_BUFFERHEADERTYPE* pBuffer);
 
+/*
+ * Print ownership statistics of the manager.
+ */
+void OMXsonienBufferStats(
+		OMX_IN OMXsonien_BUFFERMANAGER* pManager);
+
 OMX_BUFFERHEADERTYPE* OMXsonienBufferNow(
 		OMX_IN OMXsonien_BUFFERMANAGER* pManager);
 
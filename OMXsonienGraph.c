@@ -0,0 +1,447 @@
+/*
+ ============================================================================
+ Name        : OMXsonienGraph.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Component graph of OMXsonien.
+ ============================================================================
+ */
+
+#include "OMXsonienGraph.h"
+
+#define OMXsonien_GRAPH_TIMEOUT		(5 * 1000 * 1000 * 1000ULL)	// nsec, per transition
+
+static const OMX_INDEXTYPE portDomains[] = {
+	OMX_IndexParamAudioInit,
+	OMX_IndexParamImageInit,
+	OMX_IndexParamVideoInit,
+	OMX_IndexParamOtherInit
+};
+
+/*
+ * Port of the node, declared on first use.
+ */
+static OMXsonien_GRAPHPORT* OMXsonienGraphPort(
+		OMXsonien_GRAPHNODE* pNode,
+		OMX_U32 nPortIndex) {
+	for(int i = 0; i < pNode->nPorts; i++) {
+		if(pNode->ports[i].nPortIndex == nPortIndex) return &pNode->ports[i];
+	}
+	if(pNode->nPorts == OMXsonien_NODE_PORTS) {
+		print_log("GRAPH : Too many ports of %s", pNode->pName);
+		return NULL;
+	}
+
+	OMXsonien_GRAPHPORT* pPort = &pNode->ports[pNode->nPorts++];
+	memset(pPort, 0x00, sizeof(OMXsonien_GRAPHPORT));
+	pPort->nPortIndex = nPortIndex;
+
+	return pPort;
+}
+
+static OMXsonien_GRAPHEDGE* OMXsonienGraphEdge(
+		OMXsonien_GRAPH* pGraph,
+		OMXsonien_EDGETYPE eType,
+		OMXsonien_GRAPHNODE* pSource,
+		OMX_U32 nSourcePort,
+		OMXsonien_GRAPHNODE* pSink,
+		OMX_U32 nSinkPort) {
+	if(pGraph->nEdges == OMXsonien_GRAPH_EDGES) {
+		print_log("GRAPH : Too many edges");
+		return NULL;
+	}
+
+	OMXsonien_GRAPHEDGE* pEdge = &pGraph->edges[pGraph->nEdges++];
+	pEdge->eType		= eType;
+	pEdge->pSource		= pSource;
+	pEdge->nSourcePort	= nSourcePort;
+	pEdge->pSink		= pSink;
+	pEdge->nSinkPort	= nSinkPort;
+	pEdge->isConnected	= OMX_FALSE;
+
+	if(pSource) OMXsonienGraphPort(pSource, nSourcePort);
+	if(pSink)	OMXsonienGraphPort(pSink, nSinkPort);
+
+	return pEdge;
+}
+
+/*
+ * Sort nodes so that every source comes before its sinks.
+ * Nodes out of any edge keep the order of declaration.
+ */
+static void OMXsonienGraphSort(
+		OMXsonien_GRAPH* pGraph) {
+	OMX_BOOL	isPlaced[OMXsonien_GRAPH_NODES];
+	int			nPlaced = 0;
+
+	memset(isPlaced, 0x00, sizeof(isPlaced));
+	while(nPlaced < pGraph->nNodes) {
+		int nPlacedBefore = nPlaced;
+
+		for(int i = 0; i < pGraph->nNodes; i++) {
+			OMXsonien_GRAPHNODE* pNode = &pGraph->nodes[i];
+			if(isPlaced[i]) continue;
+
+			OMX_BOOL isReady = OMX_TRUE;
+			for(int j = 0; j < pGraph->nEdges; j++) {
+				OMXsonien_GRAPHEDGE* pEdge = &pGraph->edges[j];
+				if(pEdge->pSink == pNode && pEdge->pSource && !isPlaced[pEdge->pSource - pGraph->nodes]) {
+					isReady = OMX_FALSE;
+					break;
+				}
+			}
+			if(isReady) {
+				isPlaced[i] = OMX_TRUE;
+				pGraph->order[nPlaced++] = pNode;
+			}
+		}
+
+		// A cycle. Place the rest as declared.
+		if(nPlaced == nPlacedBefore) {
+			for(int i = 0; i < pGraph->nNodes; i++) {
+				if(!isPlaced[i]) pGraph->order[nPlaced++] = &pGraph->nodes[i];
+			}
+		}
+	}
+}
+
+/*
+ * Disable every port of the component which is not declared in an edge.
+ */
+static void OMXsonienGraphDisablePorts(
+		OMXsonien_GRAPHNODE* pNode) {
+	OMX_PORT_PARAM_TYPE portParam;
+
+	for(int i = 0; i < sizeof(portDomains) / sizeof(portDomains[0]); i++) {
+		OMX_INIT_STRUCTURE(portParam);
+		if(OMX_GetParameter(pNode->hComponent, portDomains[i], &portParam) != OMX_ErrorNone) continue;
+
+		for(OMX_U32 nPortIndex = portParam.nStartPortNumber; nPortIndex < portParam.nStartPortNumber + portParam.nPorts; nPortIndex++) {
+			OMX_BOOL isUsed = OMX_FALSE;
+			for(int j = 0; j < pNode->nPorts; j++) {
+				if(pNode->ports[j].nPortIndex == nPortIndex) isUsed = OMX_TRUE;
+			}
+			if(!isUsed) {
+				print_log("GRAPH : %s #%d disabled", pNode->pName, nPortIndex);
+				OMX_SendCommand(pNode->hComponent, OMX_CommandPortDisable, nPortIndex, NULL);
+			}
+		}
+	}
+}
+
+static OMX_ERRORTYPE OMXsonienGraphSetFormat(
+		OMXsonien_GRAPH* pGraph,
+		OMXsonien_GRAPHNODE* pNode,
+		OMXsonien_GRAPHPORT* pPort) {
+	OMX_PARAM_PORTDEFINITIONTYPE portDef;
+	OMXsonien_VIDEOFORMAT* pFormat = &pPort->format;
+
+	OMX_INIT_STRUCTURE(portDef);
+	portDef.nPortIndex = pPort->nPortIndex;
+	OMXsonienCall(OMX_GetParameter(pNode->hComponent, OMX_IndexParamPortDefinition, &portDef));
+
+	OMX_VIDEO_PORTDEFINITIONTYPE* formatVideo = &portDef.format.video;
+	formatVideo->eColorFormat 		= pFormat->eColorFormat;
+	formatVideo->eCompressionFormat	= OMX_VIDEO_CodingUnused;
+	formatVideo->nFrameWidth		= pFormat->nFrameWidth;
+	formatVideo->nFrameHeight		= pFormat->nFrameHeight;
+	formatVideo->nStride			= pFormat->nStride ? pFormat->nStride : pFormat->nFrameWidth;	// Stride 0 -> Raise segment fault.
+	formatVideo->xFramerate			= pFormat->xFramerate;
+	if(pFormat->nSliceHeight) {
+		formatVideo->nSliceHeight	= pFormat->nSliceHeight;
+	}
+	if(pFormat->nBufferCount) {
+		portDef.nBufferCountActual	= pFormat->nBufferCount;
+	}
+	print_log("GRAPH : %s #%d %dx%d", pNode->pName, pPort->nPortIndex, pFormat->nFrameWidth, pFormat->nFrameHeight);
+
+	return OMXsonienCheckErrorIn(pGraph->pInstance, OMX_SetParameter(pNode->hComponent, OMX_IndexParamPortDefinition, &portDef));
+}
+
+/*
+ * Wait until every loaded component is in the state. All are polled together,
+ * so the wait is as long as the slowest one. Timeout is only returned, since
+ * OMXsonienGraphDestroy() waits too and may be called by the error handler.
+ */
+static OMX_ERRORTYPE OMXsonienGraphWait(
+		OMXsonien_GRAPH* pGraph,
+		OMX_STATETYPE state) {
+	unsigned long long	nBegin = stats_now();
+	OMX_STATETYPE		stateCurrent;
+
+	TRACE_BEGIN("OMXsonienGraphWait");
+	for(;;) {
+		OMX_BOOL isDone = OMX_TRUE;
+		for(int i = 0; i < pGraph->nNodes && isDone; i++) {
+			OMXsonien_GRAPHNODE* pNode = &pGraph->nodes[i];
+			if(pNode->hComponent == NULL) continue;
+
+			OMX_GetState(pNode->hComponent, &stateCurrent);
+			isDone = (stateCurrent == state);
+		}
+
+		if(isDone) break;
+		if(stats_now() - nBegin > OMXsonien_GRAPH_TIMEOUT) {
+			TRACE_END("OMXsonienGraphWait");
+			print_log("GRAPH : Timeout on waiting for state %d", state);
+			return OMX_ErrorTimeout;
+		}
+		usleep(100);
+	}
+	TRACE_END("OMXsonienGraphWait");
+	print_log("GRAPH : State %d reached in %.1f ms", state, (stats_now() - nBegin) / 1000000.0);
+
+	return OMX_ErrorNone;
+}
+
+OMXsonien_GRAPH* OMXsonienGraphCreate(
+		OMX_IN OMX_CALLBACKTYPE* pCallbacks,
+		OMX_IN OMX_PTR pAppData) {
+	return OMXsonienGraphCreateIn(NULL, pCallbacks, pAppData);
+}
+
+OMXsonien_GRAPH* OMXsonienGraphCreateIn(
+		OMX_IN OMXsonien_INSTANCE* pInstance,
+		OMX_IN OMX_CALLBACKTYPE* pCallbacks,
+		OMX_IN OMX_PTR pAppData) {
+	OMXsonien_GRAPH* pGraph = calloc(1, sizeof(OMXsonien_GRAPH));
+
+	pGraph->pInstance	= pInstance;
+	pGraph->callbacks	= *pCallbacks;
+	pGraph->pAppData	= pAppData;
+
+	return pGraph;
+}
+
+OMXsonien_GRAPHNODE* OMXsonienGraphAdd(
+		OMX_IN OMXsonien_GRAPH* pGraph,
+		OMX_IN const char* pName,
+		OMX_IN OMXsonien_NODECONFIGURE configure) {
+	if(pGraph->nNodes == OMXsonien_GRAPH_NODES) {
+		print_log("GRAPH : Too many components");
+		return NULL;
+	}
+
+	OMXsonien_GRAPHNODE* pNode = &pGraph->nodes[pGraph->nNodes++];
+	memset(pNode, 0x00, sizeof(OMXsonien_GRAPHNODE));
+	pNode->pName		= pName;
+	pNode->configure	= configure;
+
+	return pNode;
+}
+
+void OMXsonienGraphFormat(
+		OMX_IN OMXsonien_GRAPHNODE* pNode,
+		OMX_IN OMX_U32 nPortIndex,
+		OMX_IN OMXsonien_VIDEOFORMAT* pFormat) {
+	OMXsonien_GRAPHPORT* pPort = OMXsonienGraphPort(pNode, nPortIndex);
+	if(pPort == NULL) return;
+
+	pPort->isFormat	= OMX_TRUE;
+	pPort->format	= *pFormat;
+}
+
+void OMXsonienGraphTunnel(
+		OMX_IN OMXsonien_GRAPH* pGraph,
+		OMX_IN OMXsonien_GRAPHNODE* pSource,
+		OMX_IN OMX_U32 nSourcePort,
+		OMX_IN OMXsonien_GRAPHNODE* pSink,
+		OMX_IN OMX_U32 nSinkPort) {
+	OMXsonienGraphEdge(pGraph, EdgeTunnel, pSource, nSourcePort, pSink, nSinkPort);
+}
+
+void OMXsonienGraphClient(
+		OMX_IN OMXsonien_GRAPH* pGraph,
+		OMX_IN OMXsonien_GRAPHNODE* pSource,
+		OMX_IN OMX_U32 nSourcePort,
+		OMX_IN OMXsonien_GRAPHNODE* pSink,
+		OMX_IN OMX_U32 nSinkPort) {
+	if(OMXsonienGraphEdge(pGraph, EdgeClient, pSource, nSourcePort, pSink, nSinkPort) == NULL) return;
+
+	if(pSource) OMXsonienGraphPort(pSource, nSourcePort)->isClient	= OMX_TRUE;
+	if(pSink)	OMXsonienGraphPort(pSink, nSinkPort)->isClient		= OMX_TRUE;
+}
+
+OMX_ERRORTYPE OMXsonienGraphLoad(
+		OMX_IN OMXsonien_GRAPH* pGraph) {
+	OMX_ERRORTYPE err;
+
+	OMXsonienGraphSort(pGraph);
+
+	for(int i = 0; i < pGraph->nNodes; i++) {
+		OMXsonien_GRAPHNODE* pNode = pGraph->order[i];
+
+		print_log("Load %s", pNode->pName);
+		if((err = OMXsonienCheckErrorIn(pGraph->pInstance, OMX_GetHandle(&pNode->hComponent, (OMX_STRING)pNode->pName, pGraph->pAppData, &pGraph->callbacks))) != OMX_ErrorNone) {
+			pNode->hComponent = NULL;
+			return err;
+		}
+		print_log("Handler address : %p", pNode->hComponent);
+
+		OMXsonienGraphDisablePorts(pNode);
+		if(pNode->configure && (err = OMXsonienCheckErrorIn(pGraph->pInstance, pNode->configure(pNode->hComponent, pGraph->pAppData))) != OMX_ErrorNone) {
+			return err;
+		}
+		for(int j = 0; j < pNode->nPorts; j++) {
+			if(!pNode->ports[j].isFormat) continue;
+			if((err = OMXsonienGraphSetFormat(pGraph, pNode, &pNode->ports[j])) != OMX_ErrorNone) return err;
+		}
+	}
+
+	for(int i = 0; i < pGraph->nEdges; i++) {
+		OMXsonien_GRAPHEDGE* pEdge = &pGraph->edges[i];
+		if(pEdge->eType != EdgeTunnel) continue;
+
+		print_log("SETUP Tunnel. %s #%d -> %s #%d", pEdge->pSource->pName, pEdge->nSourcePort, pEdge->pSink->pName, pEdge->nSinkPort);
+		if((err = OMXsonienCheckErrorIn(pGraph->pInstance, OMX_SetupTunnel(pEdge->pSource->hComponent, pEdge->nSourcePort, pEdge->pSink->hComponent, pEdge->nSinkPort))) != OMX_ErrorNone) {
+			return err;
+		}
+		pEdge->isConnected = OMX_TRUE;
+	}
+
+	return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMXsonienGraphStart(
+		OMX_IN OMXsonien_GRAPH* pGraph) {
+	OMX_ERRORTYPE err;
+
+	// Loaded -> Idle. Component becomes Idle after every enabled port is populated.
+	print_log("STATE : GRAPH - IDLE request");
+	for(int i = 0; i < pGraph->nNodes; i++) {
+		OMXsonien_GRAPHNODE* pNode = pGraph->order[i];
+		if((err = OMXsonienCheckErrorIn(pGraph->pInstance, OMX_SendCommand(pNode->hComponent, OMX_CommandStateSet, OMX_StateIdle, NULL))) != OMX_ErrorNone) {
+			return err;
+		}
+	}
+	for(int i = 0; i < pGraph->nNodes; i++) {
+		OMXsonien_GRAPHNODE* pNode = pGraph->order[i];
+		for(int j = 0; j < pNode->nPorts; j++) {
+			OMXsonien_GRAPHPORT* pPort = &pNode->ports[j];
+			if(!pPort->isClient) continue;
+
+			print_log("Allocate buffer to %s #%d.", pNode->pName, pPort->nPortIndex);
+			pPort->pManager = OMXsonienAllocateBufferIn(pGraph->pInstance, pNode->hComponent, pPort->nPortIndex, pGraph->pAppData, 0, 0);
+		}
+	}
+	if((err = (OMXsonienCheckErrorIn)(pGraph->pInstance, OMXsonienGraphWait(pGraph, OMX_StateIdle))) != OMX_ErrorNone) return err;
+	print_log("STATE : IDLE OK!");
+
+	// Idle -> Executing. Sinks go first to be ready when sources start.
+	print_log("STATE : GRAPH - EXECUTING request");
+	for(int i = pGraph->nNodes - 1; i >= 0; i--) {
+		OMXsonien_GRAPHNODE* pNode = pGraph->order[i];
+		if((err = OMXsonienCheckErrorIn(pGraph->pInstance, OMX_SendCommand(pNode->hComponent, OMX_CommandStateSet, OMX_StateExecuting, NULL))) != OMX_ErrorNone) {
+			return err;
+		}
+	}
+	if((err = (OMXsonienCheckErrorIn)(pGraph->pInstance, OMXsonienGraphWait(pGraph, OMX_StateExecuting))) != OMX_ErrorNone) return err;
+	print_log("STATE : EXECUTING OK!");
+
+	return OMX_ErrorNone;
+}
+
+OMXsonien_BUFFERMANAGER* OMXsonienGraphManager(
+		OMX_IN OMXsonien_GRAPHNODE* pNode,
+		OMX_IN OMX_U32 nPortIndex) {
+	if(pNode == NULL) return NULL;
+
+	for(int i = 0; i < pNode->nPorts; i++) {
+		if(pNode->ports[i].nPortIndex == nPortIndex) return pNode->ports[i].pManager;
+	}
+
+	return NULL;
+}
+
+void OMXsonienGraphDestroy(
+		OMX_IN OMXsonien_GRAPH* pGraph) {
+	OMX_BOOL isWaiting;
+
+	if(pGraph == NULL) return;
+
+	// Nodes are sorted by OMXsonienGraphLoad(). Otherwise nothing is loaded.
+	if(pGraph->nNodes == 0 || pGraph->order[0] == NULL) {
+		free(pGraph);
+		return;
+	}
+
+	// Executing or Pause -> Idle, sinks first. Errors are ignored from here.
+	isWaiting = OMX_FALSE;
+	for(int i = pGraph->nNodes - 1; i >= 0; i--) {
+		OMXsonien_GRAPHNODE* pNode = pGraph->order[i];
+		if(isState(pNode->hComponent, OMX_StateExecuting) || isState(pNode->hComponent, OMX_StatePause)) {
+			OMX_SendCommand(pNode->hComponent, OMX_CommandStateSet, OMX_StateIdle, NULL);
+			isWaiting = OMX_TRUE;
+		}
+	}
+	if(isWaiting) OMXsonienGraphWait(pGraph, OMX_StateIdle);
+
+	// Idle -> Loaded. Component becomes Loaded after every buffer is freed.
+	isWaiting = OMX_FALSE;
+	for(int i = pGraph->nNodes - 1; i >= 0; i--) {
+		OMXsonien_GRAPHNODE* pNode = pGraph->order[i];
+		if(isState(pNode->hComponent, OMX_StateIdle)) {
+			OMX_SendCommand(pNode->hComponent, OMX_CommandStateSet, OMX_StateLoaded, NULL);
+			isWaiting = OMX_TRUE;
+		}
+		for(int j = 0; j < pNode->nPorts; j++) {
+			OMXsonien_GRAPHPORT* pPort = &pNode->ports[j];
+			if(pPort->pManager && pPort->pManager->pBufferPtrPool) {
+				OMXsonienFreeBuffer(pPort->pManager);
+			}
+		}
+	}
+	if(isWaiting) OMXsonienGraphWait(pGraph, OMX_StateLoaded);
+
+	for(int i = pGraph->nEdges - 1; i >= 0; i--) {
+		OMXsonien_GRAPHEDGE* pEdge = &pGraph->edges[i];
+		if(!pEdge->isConnected) continue;
+
+		OMX_SetupTunnel(pEdge->pSource->hComponent, pEdge->nSourcePort, NULL, 0);
+		OMX_SetupTunnel(NULL, 0, pEdge->pSink->hComponent, pEdge->nSinkPort);
+		pEdge->isConnected = OMX_FALSE;
+	}
+
+	for(int i = pGraph->nNodes - 1; i >= 0; i--) {
+		OMXsonien_GRAPHNODE* pNode = pGraph->order[i];
+		if(pNode->hComponent == NULL) continue;
+
+		OMX_FreeHandle(pNode->hComponent);
+		pNode->hComponent = NULL;
+	}
+
+	free(pGraph);
+}
+
+OMX_ERRORTYPE OMXsonienConfigureCamera(
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_PTR pAppData) {
+	return OMXsonienConfigureCameraDevice(hComponent, 0);	// Mostly zero
+}
+
+OMX_ERRORTYPE OMXsonienConfigureCameraDevice(
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_U32 nDevice) {
+	OMX_ERRORTYPE err;
+
+	// Configure OMX_IndexParamCameraDeviceNumber callback enable to ensure whether camera is initialized properly.
+	print_log("Configure DeviceNumber callback enable.");
+	OMX_CONFIG_REQUESTCALLBACKTYPE configCameraCallback;
+	OMX_INIT_STRUCTURE(configCameraCallback);
+	configCameraCallback.nPortIndex	= OMX_ALL;	// Must Be OMX_ALL
+	configCameraCallback.nIndex 	= OMX_IndexParamCameraDeviceNumber;
+	configCameraCallback.bEnable 	= OMX_TRUE;
+	if((err = OMX_SetConfig(hComponent, OMX_IndexConfigRequestCallback, &configCameraCallback)) != OMX_ErrorNone) {
+		return err;
+	}
+
+	// OMX CameraDeviceNumber set -> will trigger Camera Ready callback
+	print_log("Set CameraDeviceNumber parameter.");
+	OMX_PARAM_U32TYPE deviceNumber;
+	OMX_INIT_STRUCTURE(deviceNumber);
+	deviceNumber.nPortIndex = OMX_ALL;
+	deviceNumber.nU32 = nDevice;
+
+	return OMX_SetParameter(hComponent, OMX_IndexParamCameraDeviceNumber, &deviceNumber);
+}
@@ -0,0 +1,184 @@
+/*
+ ============================================================================
+ Name        : OMXsonienGraph.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Component graph of OMXsonien. Client declares components,
+               port formats and edges, then the graph loads and configures
+               every component and brings them through Loaded -> Idle ->
+               Executing together. Teardown goes in reverse order.
+
+               Edge is either a tunnel or client-mediated. For the port of a
+               client-mediated edge, the graph allocates buffers with
+               OMXsonienAllocateBuffer(). Either end of it may be NULL, which
+               is the client itself.
+
+               Every port which is not in any edge is disabled.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_OMXSONIENGRAPH_H_
+#define RPI_OMX_TUTORIAL_SRC_OMXSONIENGRAPH_H_
+
+#include "OMXsonien.h"
+
+#define OMXsonien_GRAPH_NODES		8
+#define OMXsonien_GRAPH_EDGES		8
+#define OMXsonien_NODE_PORTS		4
+
+/*
+ * Called after unused ports are disabled and before port formats are set.
+ * For component specific parameters and configs like camera device number
+ * or display region.
+ */
+typedef OMX_ERRORTYPE (*OMXsonien_NODECONFIGURE)(OMX_HANDLETYPE hComponent, OMX_PTR pAppData);
+
+typedef struct OMXsonien_VIDEOFORMAT {
+	OMX_COLOR_FORMATTYPE		eColorFormat;
+	OMX_U32						nFrameWidth;
+	OMX_U32						nFrameHeight;
+	OMX_S32						nStride;			// 0 : nFrameWidth
+	OMX_U32						nSliceHeight;		// 0 : Port default
+	OMX_U32						xFramerate;			// Q16
+	OMX_U32						nBufferCount;		// 0 : Port default
+} OMXsonien_VIDEOFORMAT;
+
+typedef struct OMXsonien_GRAPHPORT {
+	OMX_U32						nPortIndex;
+	OMX_BOOL					isFormat;
+	OMXsonien_VIDEOFORMAT		format;
+	OMX_BOOL					isClient;			// End of client-mediated edge
+	OMXsonien_BUFFERMANAGER*	pManager;			// Allocated on Idle if isClient
+} OMXsonien_GRAPHPORT;
+
+typedef struct OMXsonien_GRAPHNODE {
+	const char*					pName;
+	OMX_HANDLETYPE				hComponent;
+	OMXsonien_NODECONFIGURE		configure;
+	OMXsonien_GRAPHPORT			ports[OMXsonien_NODE_PORTS];
+	unsigned int				nPorts;
+} OMXsonien_GRAPHNODE;
+
+typedef enum OMXsonien_EDGETYPE {
+	EdgeTunnel		= 0x00,
+	EdgeClient
+} OMXsonien_EDGETYPE;
+
+typedef struct OMXsonien_GRAPHEDGE {
+	OMXsonien_EDGETYPE			eType;
+	OMXsonien_GRAPHNODE*		pSource;
+	OMX_U32						nSourcePort;
+	OMXsonien_GRAPHNODE*		pSink;
+	OMX_U32						nSinkPort;
+	OMX_BOOL					isConnected;		// Tunnel is set up
+} OMXsonien_GRAPHEDGE;
+
+typedef struct OMXsonien_GRAPH {
+	OMXsonien_INSTANCE*			pInstance;			// NULL for the default instance
+	OMX_CALLBACKTYPE			callbacks;
+	OMX_PTR						pAppData;
+	OMXsonien_GRAPHNODE			nodes[OMXsonien_GRAPH_NODES];
+	unsigned int				nNodes;
+	OMXsonien_GRAPHEDGE			edges[OMXsonien_GRAPH_EDGES];
+	unsigned int				nEdges;
+	OMXsonien_GRAPHNODE*		order[OMXsonien_GRAPH_NODES];	// Sources first, by OMXsonienGraphLoad()
+} OMXsonien_GRAPH;
+
+/*
+ * Create an empty graph. Every component is loaded with pCallbacks and pAppData.
+ */
+OMXsonien_GRAPH* OMXsonienGraphCreate(
+		OMX_IN OMX_CALLBACKTYPE* pCallbacks,
+		OMX_IN OMX_PTR pAppData);
+
+/*
+ * Same as OMXsonienGraphCreate() but errors and buffer managers go to pInstance.
+ */
+OMXsonien_GRAPH* OMXsonienGraphCreateIn(
+		OMX_IN OMXsonien_INSTANCE* pInstance,
+		OMX_IN OMX_CALLBACKTYPE* pCallbacks,
+		OMX_IN OMX_PTR pAppData);
+
+/*
+ * Declare a component. configure may be NULL.
+ */
+OMXsonien_GRAPHNODE* OMXsonienGraphAdd(
+		OMX_IN OMXsonien_GRAPH* pGraph,
+		OMX_IN const char* pName,
+		OMX_IN OMXsonien_NODECONFIGURE configure);
+
+/*
+ * Declare video format of a port.
+ */
+void OMXsonienGraphFormat(
+		OMX_IN OMXsonien_GRAPHNODE* pNode,
+		OMX_IN OMX_U32 nPortIndex,
+		OMX_IN OMXsonien_VIDEOFORMAT* pFormat);
+
+void OMXsonienGraphTunnel(
+		OMX_IN OMXsonien_GRAPH* pGraph,
+		OMX_IN OMXsonien_GRAPHNODE* pSource,
+		OMX_IN OMX_U32 nSourcePort,
+		OMX_IN OMXsonien_GRAPHNODE* pSink,
+		OMX_IN OMX_U32 nSinkPort);
+
+/*
+ * Client takes buffers from the source and hands them to the sink.
+ * pSource or pSink is NULL if the client produces or consumes by itself.
+ */
+void OMXsonienGraphClient(
+		OMX_IN OMXsonien_GRAPH* pGraph,
+		OMX_IN OMXsonien_GRAPHNODE* pSource,
+		OMX_IN OMX_U32 nSourcePort,
+		OMX_IN OMXsonien_GRAPHNODE* pSink,
+		OMX_IN OMX_U32 nSinkPort);
+
+/*
+ * Load every component, disable unused ports, call configure, set port
+ * formats and set up tunnels. Components stay Loaded.
+ */
+OMX_ERRORTYPE OMXsonienGraphLoad(
+		OMX_IN OMXsonien_GRAPH* pGraph);
+
+/*
+ * Loaded -> Idle -> Executing. Each transition is requested to every
+ * component at once, then waited together. A component which does not
+ * reach the state in time is reported to the error handler as
+ * OMX_ErrorTimeout.
+ */
+OMX_ERRORTYPE OMXsonienGraphStart(
+		OMX_IN OMXsonien_GRAPH* pGraph);
+
+/*
+ * Buffer manager of a port of client-mediated edge. NULL before Idle.
+ */
+OMXsonien_BUFFERMANAGER* OMXsonienGraphManager(
+		OMX_IN OMXsonien_GRAPHNODE* pNode,
+		OMX_IN OMX_U32 nPortIndex);
+
+/*
+ * Bring every component back to Loaded in reverse order, free buffers,
+ * tear down tunnels and free handles, from whatever state each one is.
+ * Buffer managers stay until OMXsonienDeinit() for their statistics.
+ */
+void OMXsonienGraphDestroy(
+		OMX_IN OMXsonien_GRAPH* pGraph);
+
+/*
+ * Configure hook of OMX.broadcom.camera. Sets device number 0 with its
+ * callback requested, so OMX_EventParamOrConfigChanged of
+ * OMX_IndexParamCameraDeviceNumber tells the camera is ready.
+ */
+OMX_ERRORTYPE OMXsonienConfigureCamera(
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_PTR pAppData);
+
+/*
+ * Same as OMXsonienConfigureCamera() with device number of the camera, for
+ * boards with more than one. Configure hook calls it with its own number.
+ */
+OMX_ERRORTYPE OMXsonienConfigureCameraDevice(
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_U32 nDevice);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_OMXSONIENGRAPH_H_ */
@@ -0,0 +1,76 @@
+/*
+ ============================================================================
+ Name        : adapt.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Adaptive framerate controller for rpi-omx-tutorial.
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include "common.h"
+#include "adapt.h"
+
+void adapt_init(ADAPT* pAdapt, unsigned int nFramerate, unsigned int nFramerateMin) {
+	memset(pAdapt, 0x00, sizeof(ADAPT));
+	pAdapt->nFramerateMax	= nFramerate;
+	pAdapt->nFramerateMin	= nFramerateMin < nFramerate ? nFramerateMin : nFramerate;
+	pAdapt->nFramerate		= nFramerate;
+}
+
+void adapt_frame(ADAPT* pAdapt, unsigned long long nBusy, unsigned int nDepth, unsigned int nDropped) {
+	pAdapt->nBusy		+= nBusy;
+	pAdapt->nFrames		++;
+	pAdapt->nDropped	+= nDropped;
+	if(nDepth > pAdapt->nDepthMax) pAdapt->nDepthMax = nDepth;
+}
+
+unsigned int adapt_update(ADAPT* pAdapt, unsigned long long nNow) {
+	if(pAdapt->nWindowBegin == 0) pAdapt->nWindowBegin = nNow;
+	if(nNow - pAdapt->nWindowBegin < ADAPT_WINDOW_MS * 1000000ULL) return 0;
+
+	// Share of frame interval spent in processing, in percent.
+	unsigned long long nInterval = 1000000000ULL / pAdapt->nFramerate;
+	unsigned int nBusy = pAdapt->nFrames ? pAdapt->nBusy / pAdapt->nFrames * 100 / nInterval : 0;
+	unsigned int nFramerate = pAdapt->nFramerate;
+
+	if(nBusy > ADAPT_BUSY_HIGH || pAdapt->nDropped > 0 || pAdapt->nDepthMax > ADAPT_DEPTH_HIGH) {
+		pAdapt->nHeadroom = 0;
+		if(++pAdapt->nOverload >= ADAPT_DOWN) {
+			pAdapt->nOverload = 0;
+			nFramerate = nFramerate * 3 / 4;
+		}
+	}
+	else {
+		unsigned int nRaised = nFramerate + (nFramerate / 10 ? nFramerate / 10 : 1);
+		pAdapt->nOverload = 0;
+		if(nBusy * nRaised / nFramerate >= ADAPT_BUSY_LOW) {
+			// Neither overloaded nor with headroom. Windows in a row start over.
+			pAdapt->nHeadroom = 0;
+		}
+		else if(++pAdapt->nHeadroom >= ADAPT_UP) {
+			pAdapt->nHeadroom = 0;
+			nFramerate = nRaised;
+		}
+	}
+	if(nFramerate < pAdapt->nFramerateMin) nFramerate = pAdapt->nFramerateMin;
+	if(nFramerate > pAdapt->nFramerateMax) nFramerate = pAdapt->nFramerateMax;
+
+	if(nFramerate != pAdapt->nFramerate) {
+		print_log("ADAPT : %d -> %d fps, busy %d%%, depth %d, dropped %d in %d frames",
+				pAdapt->nFramerate, nFramerate, nBusy, pAdapt->nDepthMax, pAdapt->nDropped, pAdapt->nFrames);
+	}
+
+	pAdapt->nWindowBegin	= nNow;
+	pAdapt->nBusy			= 0;
+	pAdapt->nFrames			= 0;
+	pAdapt->nDropped		= 0;
+	pAdapt->nDepthMax		= 0;
+	if(nFramerate == pAdapt->nFramerate) return 0;
+
+	pAdapt->nFramerate = nFramerate;
+	pAdapt->nChanges++;
+	return nFramerate;
+}
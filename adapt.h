@@ -0,0 +1,58 @@
+/*
+ ============================================================================
+ Name        : adapt.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Adaptive framerate controller for rpi-omx-tutorial.
+               Client reports processing time, queue depth and drops of
+               every frame. Each window of ADAPT_WINDOW_MS is judged as
+               overloaded, having headroom or neither. Framerate goes down
+               by a quarter after ADAPT_DOWN overloaded windows in a row and
+               up by a tenth after ADAPT_UP windows with headroom in a row,
+               so it settles below the limit of the board without retuning.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_ADAPT_H_
+#define RPI_OMX_TUTORIAL_SRC_ADAPT_H_
+
+#define ADAPT_WINDOW_MS		500
+#define ADAPT_DOWN			2
+#define ADAPT_UP			4
+#define ADAPT_BUSY_HIGH		85		// %, of frame interval spent in processing
+#define ADAPT_BUSY_LOW		60		// %, at the raised framerate
+#define ADAPT_DEPTH_HIGH	2		// Frames waiting between client and display
+
+typedef struct ADAPT {
+	unsigned int		nFramerateMin;
+	unsigned int		nFramerateMax;
+	unsigned int		nFramerate;			// Current
+
+	unsigned long long	nWindowBegin;		// nsec
+	unsigned long long	nBusy;				// nsec, processing time in the window
+	unsigned int		nFrames;
+	unsigned int		nDropped;
+	unsigned int		nDepthMax;
+
+	unsigned int		nOverload;			// Overloaded windows in a row
+	unsigned int		nHeadroom;			// Windows with headroom in a row
+	unsigned int		nChanges;
+} ADAPT;
+
+/*
+ * nFramerate is the requested one and never exceeded.
+ */
+void adapt_init(ADAPT* pAdapt, unsigned int nFramerate, unsigned int nFramerateMin);
+
+/*
+ * A frame took nBusy nsec of processing. nDepth frames are waiting and
+ * nDropped frames were lost since the last frame.
+ */
+void adapt_frame(ADAPT* pAdapt, unsigned long long nBusy, unsigned int nDepth, unsigned int nDropped);
+
+/*
+ * Judge the window if it is over. Returns new framerate to apply, or 0 to keep.
+ */
+unsigned int adapt_update(ADAPT* pAdapt, unsigned long long nNow);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_ADAPT_H_ */
@@ -0,0 +1,331 @@
+/*
+ ============================================================================
+ Name        : bench_buffer.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Contention benchmark of OMXsonien buffer manager.
+               Producer thread plays the client : OMXsonienBufferGet() and
+               hands the buffer over. Consumer thread plays the component :
+               takes the buffer back and OMXsonienBufferPut() as done
+               callbacks do. Buffers are allocated from port #90 of
+               video_render, but no buffer is sent to the component.
+
+               Usage : bench_buffer [-p 1,2,4,8,16] [-n ops] [-r producer Hz] [-c consumer Hz]
+               Rate 0 means as fast as possible.
+
+               STARVED% : Ops which found the pool empty.
+               NULL%    : Calls of OMXsonienBufferGet() which returned NULL.
+               WAIT.P99 : Time from the first NULL to a buffer, of starved ops.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <bcm_host.h>
+
+#include "common.h"
+#include "OMXsonien.h"
+#include "stats.h"
+
+#define BENCH_POOL_MAX		16
+#define BENCH_RING_SIZE		32		// Power of two, larger than BENCH_POOL_MAX
+
+typedef struct {
+	OMXsonien_BUFFERMANAGER*	pManager;
+	unsigned int				nOps;
+	unsigned int				nRateProducer;		// Hz, 0 : unlimited
+	unsigned int				nRateConsumer;
+
+	/* Single producer, single consumer ring of buffers held by "component" */
+	OMX_BUFFERHEADERTYPE*		ring[BENCH_RING_SIZE];
+	unsigned int				nRingHead;
+	unsigned int				nRingTail __attribute__((aligned(64)));	// Not on the line of nRingHead
+
+	unsigned long long			nGetCalls;
+	unsigned long long			nGetNull;
+	unsigned long long			nOpsStarved;		// Ops which found the pool empty at least once
+	STATS_HISTOGRAM				latencyGet;
+	STATS_HISTOGRAM				latencyPut;
+	STATS_HISTOGRAM				latencyStarved;		// From first NULL to next successful Get
+} BENCH;
+
+/* Sleep until next tick of the rate. Does nothing if rate is 0. */
+static void bench_pace(unsigned long long* pNext, unsigned int nRate) {
+	if(nRate == 0) return;
+
+	unsigned long long nNow = stats_now();
+	if(*pNext == 0) *pNext = nNow;
+	if(*pNext > nNow) {
+		struct timespec ts;
+		ts.tv_sec	= *pNext / 1000000000ULL;
+		ts.tv_nsec	= *pNext % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+	*pNext += 1000000000ULL / nRate;
+}
+
+static void* bench_producer(void* data) {
+	BENCH*				pBench	= (BENCH*)data;
+	unsigned long long	nNext	= 0;
+
+	for(unsigned int i = 0; i < pBench->nOps; i++) {
+		bench_pace(&nNext, pBench->nRateProducer);
+
+		OMX_BUFFERHEADERTYPE*	pBuffer			= NULL;
+		unsigned long long		nStarvedSince	= 0;
+		while(1) {
+			unsigned long long nBegin = stats_now();
+			pBuffer = OMXsonienBufferGet(pBench->pManager);
+			unsigned long long nEnd = stats_now();
+
+			stats_histogram_add(&pBench->latencyGet, nEnd - nBegin);
+			pBench->nGetCalls++;
+			if(pBuffer) break;
+
+			pBench->nGetNull++;
+			if(nStarvedSince == 0) nStarvedSince = nBegin;
+			sched_yield();
+		}
+		if(nStarvedSince) {
+			pBench->nOpsStarved++;
+			stats_histogram_add(&pBench->latencyStarved, stats_now() - nStarvedSince);
+		}
+
+		unsigned int nHead = __atomic_load_n(&pBench->nRingHead, __ATOMIC_RELAXED);
+		pBench->ring[nHead % BENCH_RING_SIZE] = pBuffer;
+		__atomic_store_n(&pBench->nRingHead, nHead + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static void* bench_consumer(void* data) {
+	BENCH*				pBench	= (BENCH*)data;
+	unsigned long long	nNext	= 0;
+
+	for(unsigned int i = 0; i < pBench->nOps; i++) {
+		bench_pace(&nNext, pBench->nRateConsumer);
+
+		unsigned int nTail = pBench->nRingTail;
+		while(__atomic_load_n(&pBench->nRingHead, __ATOMIC_ACQUIRE) == nTail) {
+			sched_yield();
+		}
+		OMX_BUFFERHEADERTYPE* pBuffer = pBench->ring[nTail % BENCH_RING_SIZE];
+		__atomic_store_n(&pBench->nRingTail, nTail + 1, __ATOMIC_RELEASE);
+
+		unsigned long long nBegin = stats_now();
+		OMXsonienBufferPut(pBench->pManager, pBuffer);
+		stats_histogram_add(&pBench->latencyPut, stats_now() - nBegin);
+	}
+
+	return NULL;
+}
+
+static void* bench_put_all(void* data) {
+	BENCH* pBench = (BENCH*)data;
+
+	while(pBench->nRingTail != pBench->nRingHead) {
+		OMXsonienBufferPut(pBench->pManager, pBench->ring[pBench->nRingTail++ % BENCH_RING_SIZE]);
+	}
+
+	return NULL;
+}
+
+/*
+ * Take every buffer and one more. The last Get must fail without keeping the
+ * mutex, and the buffers must be returned by another thread.
+ */
+static OMX_BOOL bench_exhaustion(BENCH* pBench, unsigned int nPool) {
+	OMX_BOOL isPassed = OMX_TRUE;
+
+	pBench->nRingHead = pBench->nRingTail = 0;
+	for(unsigned int i = 0; i < nPool; i++) {
+		OMX_BUFFERHEADERTYPE* pBuffer = OMXsonienBufferGet(pBench->pManager);
+		if(pBuffer == NULL) {
+			print_log("EXHAUSTION : Get #%d of %d returned NULL too early.", i + 1, nPool);
+			isPassed = OMX_FALSE;
+			break;
+		}
+		pBench->ring[pBench->nRingHead++ % BENCH_RING_SIZE] = pBuffer;
+	}
+
+	if(isPassed && OMXsonienBufferGet(pBench->pManager) != NULL) {
+		print_log("EXHAUSTION : Get of empty pool returned a buffer.");
+		isPassed = OMX_FALSE;
+	}
+
+	if(pthread_mutex_trylock(&pBench->pManager->mutex) == 0) {
+		pthread_mutex_unlock(&pBench->pManager->mutex);
+	}
+	else {
+		print_log("EXHAUSTION : Mutex is still held after Get of empty pool.");
+		isPassed = OMX_FALSE;
+	}
+
+	// Put from another thread. Must not dead-lock.
+	pthread_t thread;
+	struct timespec ts;
+	pthread_create(&thread, NULL, bench_put_all, pBench);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 1;
+	if(pthread_timedjoin_np(thread, NULL, &ts) != 0) {
+		print_log("EXHAUSTION : Put after exhaustion is blocked.");
+		return OMX_FALSE;	// The thread is left behind. Nothing more can be done with this manager.
+	}
+
+	if(pBench->pManager->nBufferRemain != nPool) {
+		print_log("EXHAUSTION : %d of %d buffers are back.", pBench->pManager->nBufferRemain, nPool);
+		isPassed = OMX_FALSE;
+	}
+
+	return isPassed;
+}
+
+static OMX_BOOL bench_run(OMX_HANDLETYPE hRender, unsigned int nPool, unsigned int nOps, unsigned int nRateProducer, unsigned int nRateConsumer) {
+	OMX_PARAM_PORTDEFINITIONTYPE portDef;
+	OMX_HANDLETYPE handles[] = { hRender, NULL };
+
+	OMX_INIT_STRUCTURE(portDef);
+	portDef.nPortIndex = 90;
+	OMXsonienCheckError(OMX_GetParameter(hRender, OMX_IndexParamPortDefinition, &portDef));
+	portDef.nBufferCountActual = nPool;
+	if(OMXsonienCheckError(OMX_SetParameter(hRender, OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone) {
+		return OMX_FALSE;
+	}
+
+	OMXsonienCheckError(OMX_SendCommand(hRender, OMX_CommandStateSet, OMX_StateIdle, NULL));
+	BENCH* pBench = calloc(1, sizeof(BENCH));
+	pBench->pManager		= OMXsonienAllocateBuffer(hRender, 90, NULL, 0, nPool);
+	pBench->nOps			= nOps;
+	pBench->nRateProducer	= nRateProducer;
+	pBench->nRateConsumer	= nRateConsumer;
+	block_until_state_change(OMX_StateIdle, handles);
+
+	OMX_BOOL isExhaustionPassed = bench_exhaustion(pBench, nPool);
+
+	pBench->nRingHead = pBench->nRingTail = 0;
+	pthread_t threadProducer, threadConsumer;
+	unsigned long long nBegin = stats_now();
+	pthread_create(&threadProducer, NULL, bench_producer, pBench);
+	pthread_create(&threadConsumer, NULL, bench_consumer, pBench);
+	pthread_setname_np(threadProducer, "producer");
+	pthread_setname_np(threadConsumer, "consumer");
+	pthread_join(threadProducer, NULL);
+	pthread_join(threadConsumer, NULL);
+	unsigned long long nElapsed = stats_now() - nBegin;
+
+	printf("%4u %9u %11.0f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.3f %8.3f %10.1f  %s\n",
+			nPool, nOps, nOps * 1e9 / nElapsed,
+			stats_histogram_percentile(&pBench->latencyGet, 50) / 1000.0,
+			stats_histogram_percentile(&pBench->latencyGet, 99) / 1000.0,
+			stats_histogram_percentile(&pBench->latencyGet, 99.9) / 1000.0,
+			stats_histogram_percentile(&pBench->latencyPut, 50) / 1000.0,
+			stats_histogram_percentile(&pBench->latencyPut, 99) / 1000.0,
+			stats_histogram_percentile(&pBench->latencyPut, 99.9) / 1000.0,
+			100.0 * pBench->nOpsStarved / nOps,
+			pBench->nGetCalls ? 100.0 * pBench->nGetNull / pBench->nGetCalls : 0.0,
+			stats_histogram_percentile(&pBench->latencyStarved, 99) / 1000.0,
+			isExhaustionPassed ? "PASS" : "FAIL");
+
+	OMXsonienCheckError(OMX_SendCommand(hRender, OMX_CommandStateSet, OMX_StateLoaded, NULL));
+	OMXsonienFreeBuffer(pBench->pManager);
+	block_until_state_change(OMX_StateLoaded, handles);
+	free(pBench);
+
+	return isExhaustionPassed;
+}
+
+static OMX_ERRORTYPE onOMXevent (
+        OMX_IN OMX_HANDLETYPE hComponent,
+        OMX_IN OMX_PTR pAppData,
+        OMX_IN OMX_EVENTTYPE eEvent,
+        OMX_IN OMX_U32 nData1,
+        OMX_IN OMX_U32 nData2,
+        OMX_IN OMX_PTR pEventData) {
+	if(eEvent == OMX_EventError) print_event(hComponent, eEvent, nData1, nData2);
+	return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE onEmptyBufferDone(
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_PTR pAppData,
+		OMX_IN OMX_BUFFERHEADERTYPE* pBuffer) {
+	return OMX_ErrorNone;
+}
+
+int main(int argc, char** argv) {
+	unsigned int	pools[BENCH_POOL_MAX]	= { 1, 2, 4, 8, 16 };
+	unsigned int	nPools					= 5;
+	unsigned int	nOps					= 200000;
+	unsigned int	nRateProducer			= 0;
+	unsigned int	nRateConsumer			= 0;
+	int				opt;
+
+	while((opt = getopt(argc, argv, "p:n:r:c:")) != -1) {
+		switch(opt) {
+		case 'p' : {
+			char* pToken = strtok(optarg, ",");
+			for(nPools = 0; pToken && nPools < BENCH_POOL_MAX; pToken = strtok(NULL, ",")) {
+				int nPool = atoi(pToken);
+				if(nPool >= 1 && nPool <= BENCH_POOL_MAX) pools[nPools++] = nPool;
+			}
+			break;
+		}
+		case 'n' :
+			nOps = atoi(optarg);
+			break;
+		case 'r' :
+			nRateProducer = atoi(optarg);
+			break;
+		case 'c' :
+			nRateConsumer = atoi(optarg);
+			break;
+		default :
+			fprintf(stderr, "Usage : %s [-p 1,2,4,8,16] [-n ops] [-r producer Hz] [-c consumer Hz]\n", argv[0]);
+			exit(-1);
+		}
+	}
+	if(nPools == 0 || nOps == 0) {
+		fprintf(stderr, "Nothing to run.\n");
+		exit(-1);
+	}
+
+	bcm_host_init();
+	OMXsonienInit();
+	if(OMXsonienCheckError(OMX_Init()) != OMX_ErrorNone) exit(-1);
+
+	OMX_CALLBACKTYPE callbackOMX;
+	callbackOMX.EventHandler	= onOMXevent;
+	callbackOMX.EmptyBufferDone	= onEmptyBufferDone;
+	callbackOMX.FillBufferDone	= NULL;
+
+	OMX_HANDLETYPE hRender = NULL;
+	if(OMXsonienCheckError(OMX_GetHandle(&hRender, "OMX.broadcom.video_render", NULL, &callbackOMX)) != OMX_ErrorNone) {
+		OMX_Deinit();
+		exit(-1);
+	}
+
+	print_log("%d ops per pool, producer %d Hz, consumer %d Hz (0 : unlimited). Latency in usec.", nOps, nRateProducer, nRateConsumer);
+	int nFailed = 0;
+	for(unsigned int i = 0; i < nPools; i++) {
+		// Allocation log of OMXsonien goes between rows, so header is printed for each.
+		printf("%4s %9s %11s %8s %8s %8s %8s %8s %8s %8s %8s %10s  %s\n",
+				"POOL", "OPS", "OPS/s", "GET.P50", "GET.P99", "GET.P999", "PUT.P50", "PUT.P99", "PUT.P999", "STARVED%", "NULL%", "WAIT.P99", "EXHAUST");
+		if(!bench_run(hRender, pools[i], nOps, nRateProducer, nRateConsumer)) nFailed++;
+	}
+
+	OMXsonienDeinit();
+	OMX_FreeHandle(hRender);
+	OMX_Deinit();
+	bcm_host_deinit();
+
+	return nFailed ? -1 : 0;
+}
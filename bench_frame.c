@@ -0,0 +1,317 @@
+/*
+ ============================================================================
+ Name        : bench_frame.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Benchmark of per-frame kernels which the non-tunnel loop may do
+               with the output of the camera. No OMX component is used.
+               Source is synthetic slices laid out like port #71 gives :
+               YUV420PackedPlanar, nStride aligned to 32, nSliceHeight rows
+               of Y followed by U and V of the slice.
+
+               copy    : Slices to packed planar frame. Same as capture loop.
+               repack  : Slices to NV12 (U and V interleaved).
+               convert : Slices to RGBA8888, BT.601 limited range.
+               scale   : Slices to half size planar frame, 2x2 average.
+
+               hot  : Same source and destination every iteration.
+               cold : Rotates over frames larger than last level cache.
+
+               Usage : bench_frame [-r WxH] [-s slice height] [-i iterations] [-k kernel]
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "stats.h"
+
+#define BENCH_COLD_BYTES	(64 * 1024 * 1024)	// Larger than any cache of Raspberry PI
+#define BENCH_ALIGN(x, a)	(((x) + (a) - 1) & ~((a) - 1))
+
+/*
+ * Layout of one frame of port #71, which arrives in nSlices buffers.
+ */
+typedef struct {
+	unsigned int	nWidth;
+	unsigned int	nHeight;
+	unsigned int	nStride;
+	unsigned int	nSliceHeight;
+	unsigned int	nSlices;
+	unsigned int	nSliceSize;		// Y + U + V of a slice
+} FRAME_LAYOUT;
+
+typedef void (*BENCH_KERNEL)(FRAME_LAYOUT* pLayout, OMX_U8* pSrc, OMX_U8* pDst);
+
+typedef struct {
+	const char*		pName;
+	BENCH_KERNEL	kernel;
+	unsigned int	nDstNum;		// Size of destination in nWidth * nHeight / nDstDen
+	unsigned int	nDstDen;
+} BENCH_KERNELTYPE;
+
+static inline unsigned int frame_rows(FRAME_LAYOUT* pLayout, unsigned int nSlice) {
+	unsigned int nRows = pLayout->nHeight - nSlice * pLayout->nSliceHeight;
+	return nRows < pLayout->nSliceHeight ? nRows : pLayout->nSliceHeight;
+}
+
+/* Slices to packed planar frame. Row by row only if stride is padded. */
+static void kernel_copy(FRAME_LAYOUT* pLayout, OMX_U8* pSrc, OMX_U8* pDst) {
+	unsigned int	nWidth	= pLayout->nWidth;
+	unsigned int	nStride	= pLayout->nStride;
+	OMX_U8*			pY		= pDst;
+	OMX_U8*			pU		= pY + nWidth * pLayout->nHeight;
+	OMX_U8*			pV		= pU + nWidth * pLayout->nHeight / 4;
+
+	for(unsigned int nSlice = 0; nSlice < pLayout->nSlices; nSlice++, pSrc += pLayout->nSliceSize) {
+		unsigned int	nRows	= frame_rows(pLayout, nSlice);
+		OMX_U8*			pSrcY	= pSrc;
+		OMX_U8*			pSrcU	= pSrcY + nStride * pLayout->nSliceHeight;
+		OMX_U8*			pSrcV	= pSrcU + nStride * pLayout->nSliceHeight / 4;
+
+		if(nStride == nWidth) {
+			memcpy(pY, pSrcY, nWidth * nRows);			pY += nWidth * nRows;
+			memcpy(pU, pSrcU, nWidth * nRows / 4);		pU += nWidth * nRows / 4;
+			memcpy(pV, pSrcV, nWidth * nRows / 4);		pV += nWidth * nRows / 4;
+			continue;
+		}
+
+		for(unsigned int row = 0; row < nRows; row++) {
+			memcpy(pY, pSrcY + row * nStride, nWidth);	pY += nWidth;
+		}
+		for(unsigned int row = 0; row < nRows / 2; row++) {
+			memcpy(pU, pSrcU + row * nStride / 2, nWidth / 2);	pU += nWidth / 2;
+			memcpy(pV, pSrcV + row * nStride / 2, nWidth / 2);	pV += nWidth / 2;
+		}
+	}
+}
+
+/* Slices to NV12 */
+static void kernel_repack(FRAME_LAYOUT* pLayout, OMX_U8* pSrc, OMX_U8* pDst) {
+	unsigned int	nWidth	= pLayout->nWidth;
+	unsigned int	nStride	= pLayout->nStride;
+	OMX_U8*			pY		= pDst;
+	OMX_U8*			pUV		= pY + nWidth * pLayout->nHeight;
+
+	for(unsigned int nSlice = 0; nSlice < pLayout->nSlices; nSlice++, pSrc += pLayout->nSliceSize) {
+		unsigned int	nRows	= frame_rows(pLayout, nSlice);
+		OMX_U8*			pSrcY	= pSrc;
+		OMX_U8*			pSrcU	= pSrcY + nStride * pLayout->nSliceHeight;
+		OMX_U8*			pSrcV	= pSrcU + nStride * pLayout->nSliceHeight / 4;
+
+		for(unsigned int row = 0; row < nRows; row++) {
+			memcpy(pY, pSrcY + row * nStride, nWidth);	pY += nWidth;
+		}
+		for(unsigned int row = 0; row < nRows / 2; row++) {
+			OMX_U8* pU = pSrcU + row * nStride / 2;
+			OMX_U8* pV = pSrcV + row * nStride / 2;
+			for(unsigned int col = 0; col < nWidth / 2; col++) {
+				*pUV++ = pU[col];
+				*pUV++ = pV[col];
+			}
+		}
+	}
+}
+
+static inline OMX_U8 clamp8(int value) {
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/* Slices to RGBA8888. 8bit fixed point of BT.601 limited range. */
+static void kernel_convert(FRAME_LAYOUT* pLayout, OMX_U8* pSrc, OMX_U8* pDst) {
+	unsigned int	nWidth	= pLayout->nWidth;
+	unsigned int	nStride	= pLayout->nStride;
+	OMX_U32*		pRGBA	= (OMX_U32*)pDst;
+
+	for(unsigned int nSlice = 0; nSlice < pLayout->nSlices; nSlice++, pSrc += pLayout->nSliceSize) {
+		unsigned int	nRows	= frame_rows(pLayout, nSlice);
+		OMX_U8*			pSrcY	= pSrc;
+		OMX_U8*			pSrcU	= pSrcY + nStride * pLayout->nSliceHeight;
+		OMX_U8*			pSrcV	= pSrcU + nStride * pLayout->nSliceHeight / 4;
+
+		for(unsigned int row = 0; row < nRows; row++) {
+			OMX_U8* pY = pSrcY + row * nStride;
+			OMX_U8* pU = pSrcU + (row / 2) * (nStride / 2);
+			OMX_U8* pV = pSrcV + (row / 2) * (nStride / 2);
+			for(unsigned int col = 0; col < nWidth; col++) {
+				int c = 298 * (pY[col] - 16);
+				int d = pU[col / 2] - 128;
+				int e = pV[col / 2] - 128;
+				OMX_U8 r = clamp8((c + 409 * e + 128) >> 8);
+				OMX_U8 g = clamp8((c - 100 * d - 208 * e + 128) >> 8);
+				OMX_U8 b = clamp8((c + 516 * d + 128) >> 8);
+				*pRGBA++ = r | (g << 8) | (b << 16) | 0xFF000000;
+			}
+		}
+	}
+}
+
+/* Slices to half size packed planar frame */
+static void kernel_scale(FRAME_LAYOUT* pLayout, OMX_U8* pSrc, OMX_U8* pDst) {
+	unsigned int	nWidth	= pLayout->nWidth;
+	unsigned int	nStride	= pLayout->nStride;
+	OMX_U8*			pY		= pDst;
+	OMX_U8*			pU		= pY + (nWidth / 2) * (pLayout->nHeight / 2);
+	OMX_U8*			pV		= pU + (nWidth / 4) * (pLayout->nHeight / 4);
+
+	for(unsigned int nSlice = 0; nSlice < pLayout->nSlices; nSlice++, pSrc += pLayout->nSliceSize) {
+		unsigned int	nRows	= frame_rows(pLayout, nSlice);
+		OMX_U8*			pSrcY	= pSrc;
+		OMX_U8*			pSrcU	= pSrcY + nStride * pLayout->nSliceHeight;
+		OMX_U8*			pSrcV	= pSrcU + nStride * pLayout->nSliceHeight / 4;
+
+		for(unsigned int row = 0; row + 1 < nRows; row += 2) {
+			OMX_U8* p0 = pSrcY + row * nStride;
+			OMX_U8* p1 = p0 + nStride;
+			for(unsigned int col = 0; col < nWidth / 2; col++) {
+				*pY++ = (p0[col * 2] + p0[col * 2 + 1] + p1[col * 2] + p1[col * 2 + 1] + 2) >> 2;
+			}
+		}
+		for(unsigned int row = 0; row + 1 < nRows / 2; row += 2) {
+			OMX_U8* pU0 = pSrcU + row * nStride / 2;
+			OMX_U8* pU1 = pU0 + nStride / 2;
+			OMX_U8* pV0 = pSrcV + row * nStride / 2;
+			OMX_U8* pV1 = pV0 + nStride / 2;
+			for(unsigned int col = 0; col < nWidth / 4; col++) {
+				*pU++ = (pU0[col * 2] + pU0[col * 2 + 1] + pU1[col * 2] + pU1[col * 2 + 1] + 2) >> 2;
+				*pV++ = (pV0[col * 2] + pV0[col * 2 + 1] + pV1[col * 2] + pV1[col * 2 + 1] + 2) >> 2;
+			}
+		}
+	}
+}
+
+static const BENCH_KERNELTYPE kernels[] = {
+	{ "copy",		kernel_copy,	3,	2 },
+	{ "repack",		kernel_repack,	3,	2 },
+	{ "convert",	kernel_convert,	4,	1 },
+	{ "scale",		kernel_scale,	3,	8 },
+};
+
+static void frame_layout(FRAME_LAYOUT* pLayout, unsigned int nWidth, unsigned int nHeight, unsigned int nSliceHeight) {
+	pLayout->nWidth			= nWidth;
+	pLayout->nHeight		= nHeight;
+	pLayout->nStride		= BENCH_ALIGN(nWidth, 32);
+	pLayout->nSliceHeight	= nSliceHeight;
+	pLayout->nSlices		= (nHeight + nSliceHeight - 1) / nSliceHeight;
+	pLayout->nSliceSize		= pLayout->nStride * nSliceHeight * 3 / 2;
+}
+
+/* Fill slices with a gradient. Padding of stride is filled too, as camera does. */
+static void frame_fill(FRAME_LAYOUT* pLayout, OMX_U8* pSrc, unsigned int nSeed) {
+	for(unsigned int i = 0; i < pLayout->nSliceSize * pLayout->nSlices; i++) {
+		pSrc[i] = (OMX_U8)(i * 7 + nSeed);
+	}
+}
+
+static void* bench_alloc(size_t nSize) {
+	void* p = NULL;
+	if(posix_memalign(&p, 64, nSize) != 0) return NULL;
+	memset(p, 0x00, nSize);	// Fault pages in before timing
+	return p;
+}
+
+static void bench_kernel(FRAME_LAYOUT* pLayout, const BENCH_KERNELTYPE* pKernel, unsigned int nIterations, OMX_BOOL isCold) {
+	size_t			nSrcSize	= (size_t)pLayout->nSliceSize * pLayout->nSlices;
+	size_t			nDstSize	= (size_t)pLayout->nWidth * pLayout->nHeight * pKernel->nDstNum / pKernel->nDstDen;
+	unsigned int	nFrames		= isCold ? (BENCH_COLD_BYTES / (nSrcSize + nDstSize) + 1) : 1;
+
+	OMX_U8** ppSrc = calloc(nFrames, sizeof(OMX_U8*));
+	OMX_U8** ppDst = calloc(nFrames, sizeof(OMX_U8*));
+	for(unsigned int i = 0; i < nFrames; i++) {
+		ppSrc[i] = bench_alloc(nSrcSize);
+		ppDst[i] = bench_alloc(nDstSize);
+		if(ppSrc[i] == NULL || ppDst[i] == NULL) {
+			print_log("Out of memory.");
+			exit(-1);
+		}
+		frame_fill(pLayout, ppSrc[i], i);
+	}
+
+	// One warm up run, so hot case starts hot.
+	pKernel->kernel(pLayout, ppSrc[0], ppDst[0]);
+
+	STATS_HISTOGRAM* pLatency = calloc(1, sizeof(STATS_HISTOGRAM));
+	unsigned long long nTotal = 0;
+	for(unsigned int i = 0; i < nIterations; i++) {
+		unsigned int n = (i + 1) % nFrames;
+		unsigned long long nBegin = stats_now();
+		pKernel->kernel(pLayout, ppSrc[n], ppDst[n]);
+		unsigned long long nElapsed = stats_now() - nBegin;
+		stats_histogram_add(pLatency, nElapsed);
+		nTotal += nElapsed;
+	}
+
+	// Bytes of frame actually read, padding of stride excluded.
+	double nBytes = (double)pLayout->nWidth * pLayout->nHeight * 3 / 2 + nDstSize;
+	printf("%-9s %5dx%-5d %-5s %10.1f %10.1f %10.1f %8.2f\n",
+			pKernel->pName, pLayout->nWidth, pLayout->nHeight, isCold ? "cold" : "hot",
+			nTotal / 1000.0 / nIterations,
+			stats_histogram_percentile(pLatency, 50) / 1000.0,
+			stats_histogram_percentile(pLatency, 99) / 1000.0,
+			nBytes * nIterations / nTotal);
+
+	for(unsigned int i = 0; i < nFrames; i++) {
+		free(ppSrc[i]);
+		free(ppDst[i]);
+	}
+	free(ppSrc);
+	free(ppDst);
+	free(pLatency);
+}
+
+int main(int argc, char** argv) {
+	unsigned int	resolutions[][2]	= { { 640, 480 }, { 1280, 960 }, { 1920, 1080 } };
+	unsigned int	nResolutions		= 3;
+	unsigned int	nSliceHeight		= 16;
+	unsigned int	nIterations			= 200;
+	const char*		pKernelName			= NULL;
+	int				opt;
+
+	while((opt = getopt(argc, argv, "r:s:i:k:")) != -1) {
+		switch(opt) {
+		case 'r' :
+			if(sscanf(optarg, "%ux%u", &resolutions[0][0], &resolutions[0][1]) != 2) {
+				fprintf(stderr, "Resolution must be WxH.\n");
+				exit(-1);
+			}
+			nResolutions = 1;
+			break;
+		case 's' :
+			nSliceHeight = atoi(optarg);
+			break;
+		case 'i' :
+			nIterations = atoi(optarg);
+			break;
+		case 'k' :
+			pKernelName = optarg;
+			break;
+		default :
+			fprintf(stderr, "Usage : %s [-r WxH] [-s slice height] [-i iterations] [-k copy|repack|convert|scale]\n", argv[0]);
+			exit(-1);
+		}
+	}
+	if(nSliceHeight == 0 || nSliceHeight % 2 || nIterations == 0) {
+		fprintf(stderr, "Slice height must be even, iterations must not be zero.\n");
+		exit(-1);
+	}
+
+	print_log("Slice height %d, %d iterations. Time in usec per frame, GB/s of bytes read and written.", nSliceHeight, nIterations);
+	printf("%-9s %11s %-5s %10s %10s %10s %8s\n", "KERNEL", "RESOLUTION", "CACHE", "MEAN", "P50", "P99", "GB/s");
+	for(unsigned int r = 0; r < nResolutions; r++) {
+		FRAME_LAYOUT layout;
+		frame_layout(&layout, resolutions[r][0], resolutions[r][1], nSliceHeight);
+
+		for(unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+			if(pKernelName && strcmp(pKernelName, kernels[k].pName)) continue;
+			bench_kernel(&layout, &kernels[k], nIterations, OMX_FALSE);
+			bench_kernel(&layout, &kernels[k], nIterations, OMX_TRUE);
+		}
+	}
+
+	return 0;
+}
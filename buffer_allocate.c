@@ -13,6 +13,7 @@
 #include <signal.h>
 #include <bcm_host.h>
 #include "common.h"
+#include "config.h"
 
 #include <IL/OMX_Core.h>
 #include <IL/OMX_Component.h>
@@ -24,9 +25,7 @@ typedef struct {
 	OMX_HANDLETYPE	pCamera;
 	OMX_BOOL		isCameraReady;
 
-	unsigned int	nWidth;
-	unsigned int	nHeight;
-	unsigned int	nFramerate;
+	CONFIG			config;
 
 	// Buffer Header pointer. OMX Component will allocate this..
 	OMX_BUFFERHEADERTYPE*	pBufferHeader;
@@ -57,16 +56,18 @@ OMX_ERRORTYPE onOMXevent (
 	return OMX_ErrorNone;
 }
 
-int main(void) {
+int main(int argc, char** argv) {
 	/* Temporary variables */
 	OMX_ERRORTYPE	err;
 	OMX_PARAM_PORTDEFINITIONTYPE	portDef;
 
 	/* Initialize application variables */
 	memset(&mContext, 0, (size_t)sizeof(mContext));
-	mContext.nWidth 	= 1280;
-	mContext.nHeight 	= 960;
-	mContext.nFramerate	= 1;
+	config_init(&mContext.config, 1280, 960, 1);
+	if(!config_parse(&mContext.config, argc, argv)) {
+		exit(-1);
+	}
+	config_print(&mContext.config);
 
 	// RPI initialize.
 	bcm_host_init();
@@ -138,10 +139,13 @@ int main(void) {
 	print_log("Set up parameters of video format.");
 	OMX_VIDEO_PORTDEFINITIONTYPE* formatVideo = &portDef.format.video;
 	formatVideo->eColorFormat 	= OMX_COLOR_FormatYUV420PackedPlanar;
-	formatVideo->nFrameWidth	= mContext.nWidth;
-	formatVideo->nFrameHeight	= mContext.nHeight;
-	formatVideo->xFramerate		= mContext.nFramerate << 16;	//
+	formatVideo->nFrameWidth	= mContext.config.nWidth;
+	formatVideo->nFrameHeight	= mContext.config.nHeight;
+	formatVideo->xFramerate		= mContext.config.nFramerate << 16;	//
 	formatVideo->nStride		= formatVideo->nFrameWidth;		// Stride 0 -> Raise segment fault.
+	if(mContext.config.nSliceHeight) {
+		formatVideo->nSliceHeight	= mContext.config.nSliceHeight;
+	}
 	if((err = OMX_SetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone) {
 		print_omx_error(err, "FAIL");
 		OMX_FreeHandle(mContext.pCamera);
@@ -0,0 +1,809 @@
+/*
+ ============================================================================
+ Name        : camera_fanout.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : One camera, several consumers of the same frames.
+               Each buffer of Camera #71 holds a whole frame and is published
+               to the fan-out as it is. The display, the motion analyser and
+               the recorder run on their own threads and read the camera
+               buffer in place. The buffer goes back to the camera when the
+               last of them releases it.
+
+               A consumer which lags behind by more than -L frames is
+               dropped, so capture never waits for it, and goes on from the
+               live frame. -L must be less than camera buffers by two, since
+               a consumer also holds the frame it is working on and the
+               snapshot holds the latest one.
+
+               Capture path also publishes the latest frame with its mean
+               luma as a snapshot. The control loop reads it every 5 msec
+               without waiting for anything, as a control loop would.
+
+               Usage : camera_fanout [options] [-s seconds] [-L frames] [-d msec] [-o record] [-x name] [-y prefix] [-p prefix] [-w y4m] [-H]
+               -L is the lag of a consumer before it is dropped. Default 2.
+               -d makes the motion analyser slower by the delay per frame.
+               -o records camera output to the file, as camera_render_fps -o.
+               -x exports frames to /dev/shm/name for other processes. See
+               export_reader.c.
+               -y records raw I420 to prefix-0000.yuv and on, a segment per
+               minute. Storage is written by a thread of its own.
+               -p keeps the last 5 seconds in prefix.ring. Start of motion
+               or SIGUSR1 copies them to prefix-0000.yuv and on.
+               -w writes a Y4M file, which camera_render_fps -i plays back.
+               -H runs without the display.
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <bcm_host.h>
+
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Component.h>
+#include <IL/OMX_Video.h>
+#include <IL/OMX_Broadcom.h>
+
+#include "common.h"
+#include "config.h"
+#include "OMXsonienGraph.h"
+#include "replay.h"
+#include "fanout.h"
+#include "latest.h"
+#include "shmring.h"
+#include "yuvrec.h"
+#include "preroll.h"
+#include "y4m.h"
+#include "metrics.h"
+
+#define	COMPONENT_CAMERA	"OMX.broadcom.camera"
+#define COMPONENT_RENDER	"OMX.broadcom.video_render"
+
+#define CAMERA_BUFFERS		4		// Default of camera buffers. Every consumer may hold some.
+#define MOTION_STEP			8		// Luma is sampled every 8th pixel and line
+#define MOTION_THRESHOLD	16		// Mean absolute difference of samples
+#define CONTROL_PERIOD		5		// msec
+#define EXPORT_SLOTS		8		// Frames of the shared memory ring
+#define YUV_SEGMENT			60		// Seconds of a raw YUV segment
+#define PREROLL_SECONDS		5		// Before a trigger
+
+/* Application variant */
+typedef struct {
+	OMXsonien_INSTANCE*			pOMXsonien;
+	OMXsonien_GRAPH*			pGraph;
+	OMXsonien_GRAPHNODE*		pNodeCamera;
+	OMXsonien_GRAPHNODE*		pNodeRender;		// NULL on headless
+	OMX_HANDLETYPE				pCamera;
+	OMX_BOOL					isCameraReady;
+	OMXsonien_BUFFERMANAGER*	pManagerCamera;
+	OMXsonien_BUFFERMANAGER*	pManagerRender;
+
+	CONFIG						config;
+	unsigned int				nSeconds;
+	unsigned int				nLagMax;
+	OMX_BOOL					isHeadless;
+	unsigned int				nSizeY;				// Of a camera buffer, padded
+
+	FANOUT						fanout;
+	FANOUT_CONSUMER				display;
+	FANOUT_CONSUMER				motion;
+	FANOUT_CONSUMER				recorder;
+	FANOUT_CONSUMER				exporter;
+	FANOUT_CONSUMER				yuv;
+	FANOUT_CONSUMER				preroll;
+	FANOUT_CONSUMER				y4m;
+	LATEST						latest;
+	unsigned int				nPublishing;		// FillBufferDone in progress
+	pthread_t					threads[FANOUT_CONSUMERS + 1];	// Consumers and control
+	unsigned int				nThreads;
+
+	unsigned int				nDisplayed;
+	unsigned int				nDisplaySkipped;	// Render held every buffer
+	unsigned int				nMotionDelay;		// msec, per frame
+	unsigned int				nMotionEvents;
+	REPLAY_RECORDER*			pRecorder;
+	const char*					pRecordPath;
+	SHMRING*					pExport;
+	const char*					pExportName;
+	YUVREC*						pYuv;
+	const char*					pYuvPrefix;
+	PREROLL*					pPreroll;
+	const char*					pPrerollPrefix;
+	Y4M_WRITER*					pY4m;
+	const char*					pY4mPath;
+	unsigned int				nControlFrames;		// New snapshots seen by the control loop
+	STATS_HISTOGRAM				controlAge;			// nsec, publish to read of the snapshot
+
+	OMX_BOOL					isValid;			// Released buffers go back to the camera
+} CONTEXT;
+
+/* Set by signal handler. Main loop stops the capture on it. */
+static volatile sig_atomic_t isInterrupted = 0;
+
+/* Set by SIGUSR1. Main loop triggers the pre-roll on it. */
+static volatile sig_atomic_t isTriggered = 0;
+
+void terminate(CONTEXT* pContext);
+
+/* Event Handler : OMX Event */
+OMX_ERRORTYPE onOMXevent (
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_PTR pAppData,
+		OMX_IN OMX_EVENTTYPE eEvent,
+		OMX_IN OMX_U32 nData1,
+		OMX_IN OMX_U32 nData2,
+		OMX_IN OMX_PTR pEventData) {
+
+	print_event(hComponent, eEvent, nData1, nData2);
+
+	switch(eEvent) {
+	case OMX_EventParamOrConfigChanged :
+		if(nData2 == OMX_IndexParamCameraDeviceNumber) {
+			((CONTEXT*)pAppData)->isCameraReady = OMX_TRUE;
+			print_log("Camera device is ready.");
+		}
+		break;
+	default :
+		break;
+	}
+	return OMX_ErrorNone;
+}
+
+/* Mean of luma sampled every MOTION_STEP pixel and line. */
+unsigned int lumaMean(CONFIG* pConfig, const OMX_U8* pY) {
+	unsigned long long	nSum	= 0;
+	unsigned int		nCount	= 0;
+
+	for(unsigned int y = 0; y < pConfig->nHeight; y += MOTION_STEP) {
+		const OMX_U8* pLine = pY + y * pConfig->nWidth;
+		for(unsigned int x = 0; x < pConfig->nWidth; x += MOTION_STEP, nCount++) {
+			nSum += pLine[x];
+		}
+	}
+	return nCount ? nSum / nCount : 0;
+}
+
+/* Callback : Camera-out buffer is filled. Every consumer gets it, and the snapshot too. */
+OMX_ERRORTYPE onFillCameraOut (
+		OMX_OUT OMX_HANDLETYPE hComponent,
+		OMX_OUT OMX_PTR pAppData,
+		OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer) {
+	CONTEXT*		pContext = (CONTEXT*)pAppData;
+	FANOUT_FRAME*	pFrame;
+	LATEST_META		meta;
+
+	__atomic_add_fetch(&pContext->nPublishing, 1, __ATOMIC_SEQ_CST);
+	fanout_publish(&pContext->fanout, pBuffer, &pFrame);
+	if(pFrame == NULL) {
+		__atomic_sub_fetch(&pContext->nPublishing, 1, __ATOMIC_SEQ_CST);
+		return OMX_ErrorNone;
+	}
+
+	meta.nSequence	= pFrame->nSequence;
+	meta.nTimeStamp	= OMX_TICKS_TO_S64(pBuffer->nTimeStamp);
+	meta.nPublished	= pFrame->nPublished;
+	meta.nWidth		= pContext->config.nWidth;
+	meta.nHeight	= pContext->config.nHeight;
+	meta.nStride	= pContext->config.nWidth;
+	meta.nLumaMean	= lumaMean(&pContext->config, pBuffer->pBuffer);
+	meta.pY			= pBuffer->pBuffer;
+	latest_publish(&pContext->latest, pFrame, &meta);
+	__atomic_sub_fetch(&pContext->nPublishing, 1, __ATOMIC_SEQ_CST);
+	return OMX_ErrorNone;
+}
+
+/* Callback : Render-in buffer is emptied */
+OMX_ERRORTYPE onEmptyRenderIn(
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_PTR pAppData,
+		OMX_IN OMX_BUFFERHEADERTYPE* pBuffer) {
+	OMXsonienBufferPut(((CONTEXT*)pAppData)->pManagerRender, pBuffer);
+	return OMX_ErrorNone;
+}
+
+/* Fan-out : Last reference of the frame is dropped. */
+void onFrameReleased(OMX_BUFFERHEADERTYPE* pBuffer, void* pData) {
+	CONTEXT* pContext = (CONTEXT*)pData;
+
+	if(pContext->isValid)	OMXsonienBufferSend(pContext->pManagerCamera, pBuffer);
+	else					OMXsonienBufferPut(pContext->pManagerCamera, pBuffer);
+}
+
+/* Snapshot : Frame is neither current nor pinned. */
+void onSnapshotReleased(void* pFrame, void* pData) {
+	fanout_release((FANOUT_FRAME*)pFrame);
+}
+
+/* Callback : Error detection callback of OMXsonien */
+void onOMXsonienError(OMX_ERRORTYPE err, OMX_PTR pAppData) {
+	printf("Error : 0x%08x\n", err);
+	terminate((CONTEXT*)pAppData);
+	exit(-1);
+}
+
+void onSignal(int signal) {
+	isInterrupted = 1;
+}
+
+void onTrigger(int signal) {
+	isTriggered = 1;
+}
+
+/*
+ * Next frame of the consumer. A consumer dropped for lagging is attached
+ * again and goes on from the live frame. NULL when fan-out is stopped.
+ * If pIsGap is not NULL, it tells whether frames were lost before this one.
+ * Consumers which keep state across frames use it to start over.
+ */
+FANOUT_FRAME* takeFrame(CONTEXT* pContext, FANOUT_CONSUMER* pConsumer, OMX_BOOL* pIsGap) {
+	FANOUT_FRAME* pFrame;
+
+	if(pIsGap) *pIsGap = OMX_FALSE;
+	while((pFrame = fanout_take(pConsumer)) == NULL) {
+		if(!fanout_attach(&pContext->fanout, pConsumer, pConsumer->pName, pContext->nLagMax)) {
+			return NULL;
+		}
+		print_log("FANOUT : %s lagged behind and is attached again.", pConsumer->pName);
+		if(pIsGap) *pIsGap = OMX_TRUE;
+	}
+	return pFrame;
+}
+
+/* Consumer : Copy the frame into a buffer of the render. Padding is not copied. */
+void* thread_display(void* data) {
+	CONTEXT*		pContext	= (CONTEXT*)data;
+	CONFIG*			pConfig		= &pContext->config;
+	unsigned int	nSizeY		= pConfig->nWidth * pConfig->nHeight;
+	FANOUT_FRAME*	pFrame;
+
+	pthread_setname_np(pthread_self(), "display");
+	cpu_thread_register("display");
+
+	while((pFrame = takeFrame(pContext, &pContext->display, NULL))) {
+		OMX_BUFFERHEADERTYPE* pBuffer = OMXsonienBufferGet(pContext->pManagerRender);
+		if(pBuffer) {
+			OMX_U8* pSrc = pFrame->pBuffer->pBuffer;
+			memcpy(pBuffer->pBuffer, pSrc, nSizeY);
+			memcpy(pBuffer->pBuffer + nSizeY, pSrc + pContext->nSizeY, nSizeY / 4);
+			memcpy(pBuffer->pBuffer + nSizeY * 5 / 4, pSrc + pContext->nSizeY * 5 / 4, nSizeY / 4);
+			pBuffer->nFilledLen	= nSizeY * 3 / 2;
+			pBuffer->nTimeStamp	= pFrame->pBuffer->nTimeStamp;
+			OMXsonienBufferSend(pContext->pManagerRender, pBuffer);
+			pContext->nDisplayed++;
+		}
+		else {
+			pContext->nDisplaySkipped++;
+		}
+		fanout_release(pFrame);
+	}
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+/* Consumer : Mean absolute difference of sampled luma against the last frame. */
+void* thread_motion(void* data) {
+	CONTEXT*		pContext	= (CONTEXT*)data;
+	CONFIG*			pConfig		= &pContext->config;
+	unsigned int	nColumns	= pConfig->nWidth / MOTION_STEP;
+	unsigned int	nLines		= pConfig->nHeight / MOTION_STEP;
+	OMX_U8*			pSamples	= calloc(nColumns * nLines, 1);
+	OMX_BOOL		isFirst		= OMX_TRUE;
+	OMX_BOOL		isMotion	= OMX_FALSE;
+	OMX_BOOL		isGap;
+	FANOUT_FRAME*	pFrame;
+
+	pthread_setname_np(pthread_self(), "motion");
+	cpu_thread_register("motion");
+
+	while((pFrame = takeFrame(pContext, &pContext->motion, &isGap))) {
+		// Samples are stale after frames are lost. Take them again before comparing.
+		if(isGap) isFirst = OMX_TRUE;
+
+		OMX_U8*				pY		= pFrame->pBuffer->pBuffer;
+		OMX_U8*				pSample	= pSamples;
+		unsigned long long	nSum	= 0;
+
+		for(unsigned int y = 0; y < nLines; y++) {
+			OMX_U8* pLine = pY + y * MOTION_STEP * pConfig->nWidth;
+			for(unsigned int x = 0; x < nColumns; x++, pSample++) {
+				OMX_U8 nValue = pLine[x * MOTION_STEP];
+				nSum += nValue > *pSample ? nValue - *pSample : *pSample - nValue;
+				*pSample = nValue;
+			}
+		}
+
+		OMX_BOOL isMotionNow = isFirst ? isMotion : nSum / (nColumns * nLines) >= MOTION_THRESHOLD;
+		if(isMotionNow != isMotion) {
+			print_log("MOTION : %s at frame %llu, score %llu", isMotionNow ? "Start" : "Stop",
+					pFrame->nSequence, nSum / (nColumns * nLines));
+			if(isMotionNow) pContext->nMotionEvents++;
+			if(isMotionNow && pContext->pPreroll) preroll_trigger(pContext->pPreroll, "motion");
+			isMotion = isMotionNow;
+		}
+		isFirst = OMX_FALSE;
+
+		if(pContext->nMotionDelay) usleep(pContext->nMotionDelay * 1000);
+		fanout_release(pFrame);
+	}
+	free(pSamples);
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+/* Consumer : Append the camera buffer to the record. */
+void* thread_recorder(void* data) {
+	CONTEXT*		pContext = (CONTEXT*)data;
+	FANOUT_FRAME*	pFrame;
+
+	pthread_setname_np(pthread_self(), "recorder");
+	cpu_thread_register("recorder");
+
+	while((pFrame = takeFrame(pContext, &pContext->recorder, NULL))) {
+		replay_record(pContext->pRecorder, pFrame->pBuffer);
+		fanout_release(pFrame);
+	}
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+/* Consumers release what they hold and stop. Buffers stay with the client. */
+void consumersStop(CONTEXT* pContext) {
+	pContext->isValid = OMX_FALSE;
+	fanout_stop(&pContext->fanout);
+	for(unsigned int i = 0; i < pContext->nThreads; i++) {
+		pthread_join(pContext->threads[i], NULL);
+	}
+	pContext->nThreads = 0;
+
+	// Frames are not published after fanout_stop(). Wait for the one on the way, then snapshot is free.
+	while(__atomic_load_n(&pContext->nPublishing, __ATOMIC_SEQ_CST) > 0) {
+		usleep(100);
+	}
+	latest_clear(&pContext->latest);
+}
+
+/*
+ * Control loop : Read the latest snapshot as often as it likes. It never
+ * waits for the capture path, and the capture path never waits for it.
+ */
+void* thread_control(void* data) {
+	CONTEXT*			pContext	= (CONTEXT*)data;
+	unsigned long long	nSequence	= ~0ULL;
+	unsigned int		nLuma		= 0;
+
+	pthread_setname_np(pthread_self(), "control");
+	cpu_thread_register("control");
+
+	while(pContext->isValid) {
+		const LATEST_META* pMeta = latest_acquire(&pContext->latest);
+		if(pMeta) {
+			if(pMeta->nSequence != nSequence) {
+				stats_histogram_add(&pContext->controlAge, stats_now() - pMeta->nPublished);
+				pContext->nControlFrames++;
+				nSequence	= pMeta->nSequence;
+				nLuma		= pMeta->nLumaMean;
+			}
+			latest_release(&pContext->latest, pMeta);
+		}
+		usleep(CONTROL_PERIOD * 1000);
+	}
+	print_log("CONTROL : %d frames seen, luma %d at last, age p50 %.1f us, p99 %.1f us",
+			pContext->nControlFrames, nLuma,
+			stats_histogram_percentile(&pContext->controlAge, 50) / 1000.0,
+			stats_histogram_percentile(&pContext->controlAge, 99) / 1000.0);
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+/* Consumer : Copy the frame into the shared memory ring. Readers never hold it back. */
+void* thread_exporter(void* data) {
+	CONTEXT*		pContext = (CONTEXT*)data;
+	FANOUT_FRAME*	pFrame;
+
+	pthread_setname_np(pthread_self(), "exporter");
+	cpu_thread_register("exporter");
+
+	while((pFrame = takeFrame(pContext, &pContext->exporter, NULL))) {
+		OMX_BUFFERHEADERTYPE* pBuffer = pFrame->pBuffer;
+		shmring_write(pContext->pExport, pBuffer->pBuffer + pBuffer->nOffset, pBuffer->nFilledLen, OMX_TICKS_TO_S64(pBuffer->nTimeStamp));
+		fanout_release(pFrame);
+	}
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+/* Consumer : Pack the frame for the YUV writer. Storage never holds the frame. */
+void* thread_yuv(void* data) {
+	CONTEXT*		pContext = (CONTEXT*)data;
+	FANOUT_FRAME*	pFrame;
+
+	pthread_setname_np(pthread_self(), "yuv");
+	cpu_thread_register("yuv");
+
+	while((pFrame = takeFrame(pContext, &pContext->yuv, NULL))) {
+		yuvrec_write(pContext->pYuv, pFrame->pBuffer);
+		fanout_release(pFrame);
+	}
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+/* Consumer : Keep the frame in the pre-roll ring. */
+void* thread_preroll(void* data) {
+	CONTEXT*		pContext = (CONTEXT*)data;
+	FANOUT_FRAME*	pFrame;
+
+	pthread_setname_np(pthread_self(), "preroll");
+	cpu_thread_register("preroll");
+
+	while((pFrame = takeFrame(pContext, &pContext->preroll, NULL))) {
+		preroll_write(pContext->pPreroll, pFrame->pBuffer);
+		fanout_release(pFrame);
+	}
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+/* Consumer : Write the frame to the Y4M file straight from the camera buffer. */
+void* thread_y4m(void* data) {
+	CONTEXT*		pContext = (CONTEXT*)data;
+	FANOUT_FRAME*	pFrame;
+
+	pthread_setname_np(pthread_self(), "y4m");
+	cpu_thread_register("y4m");
+
+	while((pFrame = takeFrame(pContext, &pContext->y4m, NULL))) {
+		y4m_write(pContext->pY4m, pFrame->pBuffer);
+		fanout_release(pFrame);
+	}
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+void terminate(CONTEXT* pContext) {
+	print_log("On terminating...");
+	metrics_stop();
+
+	consumersStop(pContext);
+
+	// Executing -> Idle -> Loaded with buffers freed -> Free, render first.
+	OMXsonienGraphDestroy(pContext->pGraph);
+	pContext->pGraph	= NULL;
+	pContext->pCamera	= NULL;
+
+	OMXsonienCallDump();
+	OMXsonienDestroy(pContext->pOMXsonien);
+	pContext->pOMXsonien = NULL;
+	OMX_Deinit();
+
+	replay_record_close(pContext->pRecorder);
+	pContext->pRecorder = NULL;
+	shmring_close(pContext->pExport);
+	pContext->pExport = NULL;
+	yuvrec_close(pContext->pYuv);
+	pContext->pYuv = NULL;
+	preroll_close(pContext->pPreroll);
+	pContext->pPreroll = NULL;
+	y4m_writer_close(pContext->pY4m);
+	pContext->pY4m = NULL;
+	fanout_destroy(&pContext->fanout);
+}
+
+/* Graph : Called before video format of the render is set. */
+OMX_ERRORTYPE configureRender(OMX_HANDLETYPE hComponent, OMX_PTR pAppData) {
+	// Configure rendering region
+	OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
+	OMX_INIT_STRUCTURE(displayRegion);
+	displayRegion.nPortIndex = 90;
+	config_display_region(&((CONTEXT*)pAppData)->config, &displayRegion);
+	displayRegion.set = OMX_DISPLAY_SET_NUM | OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_MODE | OMX_DISPLAY_SET_DEST_RECT;
+	displayRegion.mode = OMX_DISPLAY_MODE_FILL;
+	displayRegion.num = 0;
+	return OMX_SetConfig(hComponent, OMX_IndexConfigDisplayRegion, &displayRegion);
+}
+
+/*
+ * Camera #71 -> client -> consumers, one of which feeds Render #90. Render
+ * is not in the graph on headless.
+ */
+void componentLoad(CONTEXT* pContext, OMX_CALLBACKTYPE* pCallbackOMX) {
+	OMXsonien_VIDEOFORMAT format;
+
+	memset(&format, 0x00, sizeof(format));
+	format.eColorFormat		= OMX_COLOR_FormatYUV420PackedPlanar;
+	format.nFrameWidth		= pContext->config.nWidth;
+	format.nFrameHeight		= pContext->config.nHeight;
+	format.xFramerate		= pContext->config.nFramerate << 16;	// Fixed point. 1
+
+	pContext->pGraph = OMXsonienGraphCreateIn(pContext->pOMXsonien, pCallbackOMX, pContext);
+
+	// Set video format of #71 port. A buffer is a whole frame, so it is published as it is.
+	pContext->pNodeCamera = OMXsonienGraphAdd(pContext->pGraph, COMPONENT_CAMERA, OMXsonienConfigureCamera);
+	format.nSliceHeight		= (pContext->config.nHeight + 15) & ~15;
+	format.nBufferCount		= pContext->config.nCameraBuffers;
+	OMXsonienGraphFormat(pContext->pNodeCamera, 71, &format);
+	OMXsonienGraphClient(pContext->pGraph, pContext->pNodeCamera, 71, NULL, 0);
+
+	if(!pContext->isHeadless) {
+		// Set video format of #90 port.
+		pContext->pNodeRender = OMXsonienGraphAdd(pContext->pGraph, COMPONENT_RENDER, configureRender);
+		format.nSliceHeight		= pContext->config.nHeight;
+		format.nBufferCount		= pContext->config.nRenderBuffers;
+		OMXsonienGraphFormat(pContext->pNodeRender, 90, &format);
+		OMXsonienGraphClient(pContext->pGraph, NULL, 0, pContext->pNodeRender, 90);
+	}
+	OMXsonienGraphLoad(pContext->pGraph);
+
+	pContext->pCamera = pContext->pNodeCamera->hComponent;
+}
+
+void componentConfigure(CONTEXT* pContext) {
+	OMX_PARAM_PORTDEFINITIONTYPE portDef;
+
+	OMX_INIT_STRUCTURE(portDef);
+	portDef.nPortIndex = 71;
+	OMXsonienCall(OMX_GetParameter(pContext->pCamera, OMX_IndexParamPortDefinition, &portDef));
+	pContext->nSizeY = portDef.format.video.nFrameWidth * portDef.format.video.nSliceHeight;
+	if(portDef.format.video.nSliceHeight < pContext->config.nHeight) {
+		print_log("Camera takes slices of %d lines. A buffer must be a whole frame.", portDef.format.video.nSliceHeight);
+		terminate(pContext);
+		exit(-1);
+	}
+
+	// Record output of the camera as it is.
+	if(pContext->pRecordPath) {
+		if((pContext->pRecorder = replay_record_open(pContext->pRecordPath, &portDef)) == NULL) {
+			terminate(pContext);
+			exit(-1);
+		}
+	}
+
+	// Export frames as they are laid out on #71.
+	if(pContext->pExportName) {
+		OMX_VIDEO_PORTDEFINITIONTYPE* pVideo = &portDef.format.video;
+		if((pContext->pExport = shmring_create(pContext->pExportName, pVideo->nFrameWidth, pVideo->nFrameHeight,
+				pVideo->nStride, pVideo->nSliceHeight, portDef.nBufferSize, EXPORT_SLOTS)) == NULL) {
+			terminate(pContext);
+			exit(-1);
+		}
+	}
+
+	// Record frames without padding of #71.
+	if(pContext->pYuvPrefix) {
+		if((pContext->pYuv = yuvrec_open(pContext->pYuvPrefix, &portDef, pContext->config.nFramerate * YUV_SEGMENT)) == NULL) {
+			terminate(pContext);
+			exit(-1);
+		}
+	}
+
+	// Ring of the last frames before a trigger.
+	if(pContext->pPrerollPrefix) {
+		if((pContext->pPreroll = preroll_open(pContext->pPrerollPrefix, &portDef, pContext->config.nFramerate * PREROLL_SECONDS)) == NULL) {
+			terminate(pContext);
+			exit(-1);
+		}
+	}
+
+	// Y4M of the frames without padding of #71.
+	if(pContext->pY4mPath) {
+		if((pContext->pY4m = y4m_writer_open(pContext->pY4mPath, &portDef)) == NULL) {
+			terminate(pContext);
+			exit(-1);
+		}
+	}
+
+	// Wait up for camera being ready.
+	while(!pContext->isCameraReady) {
+		print_log("Waiting until camera device is ready.");
+		usleep(100 * 1000);
+	}
+	print_log("Camera is ready.");
+}
+
+void componentPrepare(CONTEXT* pContext) {
+	// Loaded -> Idle -> Executing. Buffers are allocated on the way to Idle.
+	OMXsonienGraphStart(pContext->pGraph);
+	pContext->pManagerCamera = OMXsonienGraphManager(pContext->pNodeCamera, 71);
+	pContext->pManagerRender = OMXsonienGraphManager(pContext->pNodeRender, 90);
+}
+
+/* Attach the consumer, if any, and start its thread. */
+void consumerStart(CONTEXT* pContext, FANOUT_CONSUMER* pConsumer, const char* pName, void* (*thread)(void*)) {
+	if(pConsumer && !fanout_attach(&pContext->fanout, pConsumer, pName, pContext->nLagMax)) {
+		print_log("FANOUT : Failed to attach %s. %d consumers at most.", pName, FANOUT_CONSUMERS);
+		terminate(pContext);
+		exit(-1);
+	}
+	if(pthread_create(&pContext->threads[pContext->nThreads], NULL, thread, pContext) != 0) {
+		print_log("FANOUT : Failed to start %s.", pName);
+		terminate(pContext);
+		exit(-1);
+	}
+	pContext->nThreads++;
+}
+
+int main(int argc, char** argv) {
+	/* Temporary variables */
+	OMX_ERRORTYPE	err;
+	int				opt;
+
+	/* Initialize application variables */
+	CONTEXT* pContext = calloc(1, sizeof(CONTEXT));
+	config_init(&pContext->config, 640, 480, 30);
+	pContext->config.nCameraBuffers	= CAMERA_BUFFERS;
+	pContext->nSeconds	= 5;
+	pContext->nLagMax	= 2;
+	pContext->isValid	= OMX_TRUE;
+
+	OMX_BOOL isValid = OMX_TRUE;
+	while((opt = getopt_long(argc, argv, CONFIG_SHORT_OPTIONS "s:L:d:o:x:y:p:w:H", config_options, NULL)) != -1) {
+		switch(opt) {
+		case 's' :
+			isValid = config_uint(optarg, &pContext->nSeconds) && pContext->nSeconds > 0;
+			break;
+		case 'L' :
+			isValid = config_uint(optarg, &pContext->nLagMax) && pContext->nLagMax > 0 && pContext->nLagMax <= FANOUT_QUEUE;
+			break;
+		case 'd' :
+			isValid = config_uint(optarg, &pContext->nMotionDelay);
+			break;
+		case 'o' :
+			pContext->pRecordPath	= optarg;
+			break;
+		case 'x' :
+			pContext->pExportName	= optarg;
+			break;
+		case 'y' :
+			pContext->pYuvPrefix	= optarg;
+			break;
+		case 'p' :
+			pContext->pPrerollPrefix	= optarg;
+			break;
+		case 'w' :
+			pContext->pY4mPath		= optarg;
+			break;
+		case 'H' :
+			pContext->isHeadless	= OMX_TRUE;
+			break;
+		default :
+			isValid = config_option(&pContext->config, opt, optarg);
+		}
+
+		if(!isValid) {
+			fprintf(stderr, "Usage : %s [options] [-s seconds] [-L frames] [-d msec] [-o record] [-x name] [-y prefix] [-p prefix] [-w y4m] [-H]\n", argv[0]);
+			config_usage(stderr);
+			exit(-1);
+		}
+	}
+	if(!config_validate(&pContext->config)) {
+		exit(-1);
+	}
+	if(pContext->nLagMax + 2 > pContext->config.nCameraBuffers) {
+		fprintf(stderr, "Lag must be less than camera buffers by two, or a slow consumer stalls capture.\n");
+		exit(-1);
+	}
+	config_print(&pContext->config);
+
+	// RPI initialize.
+	bcm_host_init();
+
+	// OMX initialize.
+	print_log("Initialize OMX");
+	if((err = OMX_Init()) != OMX_ErrorNone) {
+		print_omx_error(err, "FAIL");
+		OMX_Deinit();
+		exit(-1);
+	}
+
+	// OMXsonien helper initialize.
+	pContext->pOMXsonien = OMXsonienCreate();
+	OMXsonienSetErrorHandler(pContext->pOMXsonien, onOMXsonienError, pContext);
+	fanout_init(&pContext->fanout, onFrameReleased, pContext);
+	latest_init(&pContext->latest, onSnapshotReleased, pContext);
+
+	// For loading component, Callback shall provide.
+	OMX_CALLBACKTYPE callbackOMX;
+	callbackOMX.EventHandler	= onOMXevent;
+	callbackOMX.EmptyBufferDone	= onEmptyRenderIn;
+	callbackOMX.FillBufferDone	= onFillCameraOut;
+
+	componentLoad(pContext, &callbackOMX);
+	componentConfigure(pContext);
+	componentPrepare(pContext);
+
+	cpu_thread_register("main");
+	if(!pContext->isHeadless)	consumerStart(pContext, &pContext->display, "display", thread_display);
+	consumerStart(pContext, &pContext->motion, "motion", thread_motion);
+	if(pContext->pRecorder)		consumerStart(pContext, &pContext->recorder, "recorder", thread_recorder);
+	if(pContext->pExport)		consumerStart(pContext, &pContext->exporter, "exporter", thread_exporter);
+	if(pContext->pYuv)			consumerStart(pContext, &pContext->yuv, "yuv", thread_yuv);
+	if(pContext->pPreroll)		consumerStart(pContext, &pContext->preroll, "preroll", thread_preroll);
+	if(pContext->pY4m)			consumerStart(pContext, &pContext->y4m, "y4m", thread_y4m);
+	consumerStart(pContext, NULL, "control", thread_control);
+
+	// Serve metrics if OMX_METRICS names the socket path. One series per consumer.
+	FANOUT*	pFanout = &pContext->fanout;
+	char	name[128];
+	metrics_add_u32("omx_fanout_published_total", "Frames published to consumers.", MetricCounter, &pFanout->nPublished);
+	metrics_add_u32("omx_fanout_unconsumed_total", "Frames released at once, no consumer attached.", MetricCounter, &pFanout->nUnconsumed);
+	for(unsigned int i = 0; i < pFanout->nConsumers; i++) {
+		snprintf(name, sizeof(name), "omx_fanout_taken_total{consumer=\"%s\"}", pFanout->consumers[i]->pName);
+		metrics_add_u32(name, "Frames taken by the consumer.", MetricCounter, &pFanout->consumers[i]->nTaken);
+	}
+	for(unsigned int i = 0; i < pFanout->nConsumers; i++) {
+		snprintf(name, sizeof(name), "omx_fanout_dropped_total{consumer=\"%s\"}", pFanout->consumers[i]->pName);
+		metrics_add_u32(name, "Times the consumer was dropped for lagging.", MetricCounter, &pFanout->consumers[i]->nDropped);
+	}
+	for(unsigned int i = 0; i < pFanout->nConsumers; i++) {
+		snprintf(name, sizeof(name), "omx_fanout_frames_lost_total{consumer=\"%s\"}", pFanout->consumers[i]->pName);
+		metrics_add_u32(name, "Frames released from the queue of the consumer on drop.", MetricCounter, &pFanout->consumers[i]->nFramesLost);
+	}
+	for(unsigned int i = 0; i < pFanout->nConsumers; i++) {
+		snprintf(name, sizeof(name), "omx_fanout_lag_peak{consumer=\"%s\"}", pFanout->consumers[i]->pName);
+		metrics_add_u32(name, "Most frames queued to the consumer at once.", MetricGauge, &pFanout->consumers[i]->nLagPeak);
+	}
+	for(unsigned int i = 0; i < pFanout->nConsumers; i++) {
+		snprintf(name, sizeof(name), "omx_fanout_lag_seconds{consumer=\"%s\"}", pFanout->consumers[i]->pName);
+		metrics_add_histogram(name, "Publish to take of the consumer.", &pFanout->consumers[i]->lag, 1e-9);
+	}
+	metrics_add_u32("omx_motion_events_total", "Motion events detected.", MetricCounter, &pContext->nMotionEvents);
+	metrics_start(getenv("OMX_METRICS"));
+
+	// Since #71 is capturing port, needs capture signal like other handy capture devices
+	print_log("Capture start.");
+	OMX_CONFIG_PORTBOOLEANTYPE	portCapturing;
+	OMX_INIT_STRUCTURE(portCapturing);
+	portCapturing.nPortIndex = 71;
+	portCapturing.bEnabled = OMX_TRUE;
+	OMX_BUFFERHEADERTYPE* pBuffer;
+	while((pBuffer = OMXsonienBufferGet(pContext->pManagerCamera))) {
+		OMXsonienBufferSend(pContext->pManagerCamera, pBuffer);
+	}
+	OMX_SetConfig(pContext->pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+
+	// Set signal interrupt handler
+	signal(SIGINT, 	onSignal);
+	signal(SIGTERM, onSignal);
+	signal(SIGUSR1, onTrigger);
+
+	print_log("Capture for %d seconds.", pContext->nSeconds);
+	unsigned long long nBegin	= stats_now();
+	unsigned long long nEnd		= nBegin + pContext->nSeconds * 1000000000ULL;
+	while(!isInterrupted && stats_now() < nEnd) {
+		usleep(100 * 1000);
+		if(isTriggered) {
+			isTriggered = 0;
+			if(pContext->pPreroll) preroll_trigger(pContext->pPreroll, "SIGUSR1");
+		}
+	}
+	double nElapsed = (stats_now() - nBegin) / 1e9;
+	signal(SIGINT, 	SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGUSR1, SIG_DFL);
+
+	consumersStop(pContext);
+	portCapturing.bEnabled = OMX_FALSE;
+	OMX_SetConfig(pContext->pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	print_log("Capture stop.");
+
+	fanout_report(&pContext->fanout);
+	latest_report(&pContext->latest);
+	print_log("FANOUT : %.2f fps published, %d displayed, %d skipped by display, %d motion events",
+			pContext->fanout.nPublished / nElapsed, pContext->nDisplayed, pContext->nDisplaySkipped, pContext->nMotionEvents);
+	cpu_report_total(pContext->fanout.nPublished);
+	terminate(pContext);
+	free(pContext);
+}
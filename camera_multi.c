@@ -0,0 +1,514 @@
+/*
+ ============================================================================
+ Name        : camera_multi.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : This is implemented version of camera_render_fps.c for boards
+               with more than one camera, like compute module.
+               Each camera runs its own pipeline, Camera #71 -> client ->
+               Render #90, with its own graph, buffer managers and stats.
+               FillBufferDone of every camera is posted to the strand of its
+               pipeline on one dispatcher, and a pool of workers copies
+               slices. Slices of a pipeline are copied in order by one
+               worker at a time, and pipelines run in parallel.
+
+               Usage : camera_multi [options] [-N cameras] [-w workers] [-s seconds] [-H]
+               -N is number of cameras, numbered from device 0. Default 2.
+               -w is number of workers. Default is number of cameras.
+               -H runs headless. Each render is replaced by a null sink.
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <bcm_host.h>
+
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Component.h>
+#include <IL/OMX_Video.h>
+#include <IL/OMX_Broadcom.h>
+
+#include "common.h"
+#include "config.h"
+#include "OMXsonienGraph.h"
+#include "dispatch.h"
+#include "metrics.h"
+
+#define	COMPONENT_CAMERA	"OMX.broadcom.camera"
+#define COMPONENT_RENDER	"OMX.broadcom.video_render"
+
+#define MULTI_MAX			4		// Cameras of one process
+
+struct CONTEXT;
+
+/* One camera and everything of it */
+typedef struct PIPELINE {
+	struct CONTEXT*				pContext;			// Owner
+	unsigned int				nDevice;
+	CONFIG*						pConfig;			// Shared, read only
+	OMXsonien_INSTANCE*			pOMXsonien;			// Buffer managers and errors of this camera
+	OMX_BOOL					isHeadless;
+	OMX_HANDLETYPE				pCamera;
+	OMX_BOOL					isCameraReady;
+	OMXsonien_GRAPH*			pGraph;
+	OMXsonien_GRAPHNODE*		pNodeCamera;
+	OMXsonien_GRAPHNODE*		pNodeRender;		// NULL on headless
+	OMXsonien_BUFFERMANAGER*	pManagerCamera;
+	OMXsonien_BUFFERMANAGER*	pManagerRender;
+	DISPATCH_STRAND				strand;
+	OMX_BOOL					isValid;			// Camera buffers go back to the camera
+
+	// Owned by the worker running the strand.
+	unsigned int				nSliceHeight;
+	unsigned int				nSizeY, nSizeU, nSizeV;	// Of a slice
+	OMX_BUFFERHEADERTYPE*		pCurrentBuffer;		// Frame being filled
+	OMX_BUFFERHEADERTYPE		bufferNullSink;		// The only buffer of null sink
+	OMX_U8*						pY;
+	OMX_U8*						pU;
+	OMX_U8*						pV;
+	unsigned int				nRow;				// Rows of the frame filled
+	OMX_BOOL					isSkipping;			// Render had no buffer at first slice
+	unsigned long long			nFrameBegin;		// nsec, arrival of first slice
+
+	unsigned int				nFrames;
+	unsigned int				nSkipped;
+	STATS_HISTOGRAM				latency;			// nsec, first slice to OMX_EmptyThisBuffer
+} PIPELINE;
+
+/* Application variant */
+typedef struct CONTEXT {
+	CONFIG						config;
+	DISPATCHER*					pDispatcher;
+	PIPELINE					pipelines[MULTI_MAX];
+	unsigned int				nPipelines;
+	unsigned int				nWorkers;
+	unsigned int				nSeconds;
+	OMX_BOOL					isHeadless;
+	OMX_BOOL					isValid;
+} CONTEXT;
+
+/* Set by signal handler. Main loop stops the capture on it. */
+static volatile sig_atomic_t isInterrupted = 0;
+
+void terminate(CONTEXT* pContext);
+
+/* Event Handler : OMX Event */
+OMX_ERRORTYPE onOMXevent (
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_PTR pAppData,
+		OMX_IN OMX_EVENTTYPE eEvent,
+		OMX_IN OMX_U32 nData1,
+		OMX_IN OMX_U32 nData2,
+		OMX_IN OMX_PTR pEventData) {
+
+	print_event(hComponent, eEvent, nData1, nData2);
+
+	switch(eEvent) {
+	case OMX_EventParamOrConfigChanged :
+		if(nData2 == OMX_IndexParamCameraDeviceNumber) {
+			((PIPELINE*)pAppData)->isCameraReady = OMX_TRUE;
+			print_log("Camera %d device is ready.", ((PIPELINE*)pAppData)->nDevice);
+		}
+		break;
+	default :
+		break;
+	}
+	return OMX_ErrorNone;
+}
+
+/* Callback : Camera-out buffer is filled. Worker of the pipeline takes it. */
+OMX_ERRORTYPE onFillCameraOut (
+		OMX_OUT OMX_HANDLETYPE hComponent,
+		OMX_OUT OMX_PTR pAppData,
+		OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer) {
+	PIPELINE* pPipeline = (PIPELINE*)pAppData;
+
+	if(!dispatch_post(&pPipeline->strand, pBuffer)) {
+		OMXsonienBufferPut(pPipeline->pManagerCamera, pBuffer);
+	}
+	return OMX_ErrorNone;
+}
+
+/* Callback : Render-in buffer is emptied */
+OMX_ERRORTYPE onEmptyRenderIn(
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_PTR pAppData,
+		OMX_IN OMX_BUFFERHEADERTYPE* pBuffer) {
+	OMXsonienBufferPut(((PIPELINE*)pAppData)->pManagerRender, pBuffer);
+	return OMX_ErrorNone;
+}
+
+/* Callback : Error detection callback of OMXsonien */
+void onOMXsonienError(OMX_ERRORTYPE err, OMX_PTR pAppData) {
+	PIPELINE* pPipeline = (PIPELINE*)pAppData;
+
+	printf("Error : Camera %d : 0x%08x\n", pPipeline->nDevice, err);
+	terminate(pPipeline->pContext);
+	exit(-1);
+}
+
+void onSignal(int signal) {
+	isInterrupted = 1;
+}
+
+void terminate(CONTEXT* pContext) {
+	print_log("On terminating...");
+	metrics_stop();
+
+	// Slices already posted are copied, then no more.
+	if(pContext->pDispatcher) {
+		dispatch_stop(pContext->pDispatcher);
+	}
+
+	for(unsigned int i = 0; i < pContext->nPipelines; i++) {
+		PIPELINE* pPipeline = &pContext->pipelines[i];
+
+		// Frame being filled goes back, so no buffer is left with the client when freed.
+		if(pPipeline->pManagerRender && pPipeline->pCurrentBuffer) {
+			OMXsonienBufferPut(pPipeline->pManagerRender, pPipeline->pCurrentBuffer);
+		}
+		pPipeline->pCurrentBuffer = NULL;
+
+		// Executing -> Idle -> Loaded with buffers freed -> Free, render first.
+		OMXsonienGraphDestroy(pPipeline->pGraph);
+		pPipeline->pGraph	= NULL;
+		pPipeline->pCamera	= NULL;
+		if(pPipeline->bufferNullSink.pBuffer) free(pPipeline->bufferNullSink.pBuffer);
+		pPipeline->bufferNullSink.pBuffer = NULL;
+
+		OMXsonienDestroy(pPipeline->pOMXsonien);
+		pPipeline->pOMXsonien = NULL;
+	}
+	dispatch_destroy(pContext->pDispatcher);
+	pContext->pDispatcher = NULL;
+
+	OMXsonienCallDump();
+	OMX_Deinit();
+}
+
+/* Graph : Called before video format of the camera is set. */
+OMX_ERRORTYPE configureCamera(OMX_HANDLETYPE hComponent, OMX_PTR pAppData) {
+	return OMXsonienConfigureCameraDevice(hComponent, ((PIPELINE*)pAppData)->nDevice);
+}
+
+/* Graph : Called before video format of the render is set. Cameras are side by side. */
+OMX_ERRORTYPE configureRender(OMX_HANDLETYPE hComponent, OMX_PTR pAppData) {
+	PIPELINE* pPipeline = (PIPELINE*)pAppData;
+
+	// Configure rendering region
+	OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
+	OMX_INIT_STRUCTURE(displayRegion);
+	displayRegion.nPortIndex = 90;
+	config_display_region(pPipeline->pConfig, &displayRegion);
+	displayRegion.dest_rect.x_offset += pPipeline->nDevice * displayRegion.dest_rect.width;
+	displayRegion.fullscreen = OMX_FALSE;
+	displayRegion.set = OMX_DISPLAY_SET_NUM | OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_MODE | OMX_DISPLAY_SET_DEST_RECT;
+	displayRegion.mode = OMX_DISPLAY_MODE_FILL;
+	displayRegion.num = 0;
+	return OMX_SetConfig(hComponent, OMX_IndexConfigDisplayRegion, &displayRegion);
+}
+
+/*
+ * Worker : Copy a slice into the frame of the render, and hand the camera
+ * buffer back. Runs on one worker at a time per pipeline.
+ */
+void processSlice(void* pData, void* pItem) {
+	PIPELINE*				pPipeline	= (PIPELINE*)pData;
+	OMX_BUFFERHEADERTYPE*	pBuffer		= (OMX_BUFFERHEADERTYPE*)pItem;
+	CONFIG*					pConfig		= pPipeline->pConfig;
+
+	if(pPipeline->pCurrentBuffer == NULL && !pPipeline->isSkipping) {
+		pPipeline->pCurrentBuffer = pPipeline->isHeadless ? &pPipeline->bufferNullSink : OMXsonienBufferGet(pPipeline->pManagerRender);
+		if(pPipeline->pCurrentBuffer) {
+			pPipeline->pY			= pPipeline->pCurrentBuffer->pBuffer;
+			pPipeline->pU			= pPipeline->pY + pConfig->nWidth * pConfig->nHeight;
+			pPipeline->pV			= pPipeline->pY + pConfig->nWidth * pConfig->nHeight * 5 / 4;
+			pPipeline->nRow			= 0;
+			pPipeline->nFrameBegin	= stats_now();
+			pPipeline->pCurrentBuffer->nFilledLen = 0;
+		}
+		else {
+			// Render holds every buffer. Camera keeps running.
+			pPipeline->isSkipping = OMX_TRUE;
+		}
+	}
+
+	OMX_BUFFERHEADERTYPE* pCurrentBuffer = pPipeline->pCurrentBuffer;
+	if(pCurrentBuffer && pBuffer->nFilledLen && pPipeline->nRow < pConfig->nHeight) {
+		// Last slice is padded to multiple of 16 lines. Padding is not copied.
+		unsigned int nRows = pConfig->nHeight - pPipeline->nRow;
+		if(nRows > pPipeline->nSliceHeight) nRows = pPipeline->nSliceHeight;
+		unsigned int nSizeY	= pConfig->nWidth * nRows;
+		unsigned int nSizeC	= nSizeY / 4;
+
+		OMX_U8* pSrcY = pBuffer->pBuffer;
+		OMX_U8* pSrcU = pSrcY + pPipeline->nSizeY;
+		OMX_U8* pSrcV = pSrcU + pPipeline->nSizeU;
+		memcpy(pPipeline->pY, pSrcY, nSizeY);	pPipeline->pY += nSizeY;
+		memcpy(pPipeline->pU, pSrcU, nSizeC);	pPipeline->pU += nSizeC;
+		memcpy(pPipeline->pV, pSrcV, nSizeC);	pPipeline->pV += nSizeC;
+		pCurrentBuffer->nFilledLen += nSizeY + nSizeC * 2;
+		pPipeline->nRow += nRows;
+	}
+
+	if(pBuffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) {
+		if(pCurrentBuffer) {
+			pCurrentBuffer->nTimeStamp = pBuffer->nTimeStamp;
+			if(pPipeline->isHeadless)	pCurrentBuffer->nFilledLen = 0;
+			else						OMXsonienBufferSend(pPipeline->pManagerRender, pCurrentBuffer);
+			stats_histogram_add(&pPipeline->latency, stats_now() - pPipeline->nFrameBegin);
+			__atomic_add_fetch(&pPipeline->nFrames, 1, __ATOMIC_RELAXED);
+		}
+		else {
+			__atomic_add_fetch(&pPipeline->nSkipped, 1, __ATOMIC_RELAXED);
+		}
+		pPipeline->pCurrentBuffer	= NULL;
+		pPipeline->isSkipping		= OMX_FALSE;
+	}
+
+	// Same buffer goes back to be filled again.
+	if(pPipeline->isValid)	OMXsonienBufferSend(pPipeline->pManagerCamera, pBuffer);
+	else					OMXsonienBufferPut(pPipeline->pManagerCamera, pBuffer);
+}
+
+/*
+ * Camera #71 -> client -> Render #90 for each camera. Render is not in the
+ * graph on headless.
+ */
+void componentLoad(PIPELINE* pPipeline, OMX_CALLBACKTYPE* pCallbackOMX) {
+	OMXsonien_VIDEOFORMAT format;
+
+	memset(&format, 0x00, sizeof(format));
+	format.eColorFormat		= OMX_COLOR_FormatYUV420PackedPlanar;
+	format.nFrameWidth		= pPipeline->pConfig->nWidth;
+	format.nFrameHeight		= pPipeline->pConfig->nHeight;
+	format.xFramerate		= pPipeline->pConfig->nFramerate << 16;	// Fixed point. 1
+
+	pPipeline->pGraph = OMXsonienGraphCreateIn(pPipeline->pOMXsonien, pCallbackOMX, pPipeline);
+
+	// Set video format of #71 port.
+	pPipeline->pNodeCamera = OMXsonienGraphAdd(pPipeline->pGraph, COMPONENT_CAMERA, configureCamera);
+	format.nSliceHeight		= pPipeline->pConfig->nSliceHeight;
+	format.nBufferCount		= pPipeline->pConfig->nCameraBuffers;
+	OMXsonienGraphFormat(pPipeline->pNodeCamera, 71, &format);
+	OMXsonienGraphClient(pPipeline->pGraph, pPipeline->pNodeCamera, 71, NULL, 0);
+
+	if(!pPipeline->isHeadless) {
+		// Set video format of #90 port.
+		pPipeline->pNodeRender = OMXsonienGraphAdd(pPipeline->pGraph, COMPONENT_RENDER, configureRender);
+		format.nSliceHeight		= pPipeline->pConfig->nHeight;
+		format.nBufferCount		= pPipeline->pConfig->nRenderBuffers;
+		OMXsonienGraphFormat(pPipeline->pNodeRender, 90, &format);
+		OMXsonienGraphClient(pPipeline->pGraph, NULL, 0, pPipeline->pNodeRender, 90);
+	}
+	OMXsonienGraphLoad(pPipeline->pGraph);
+
+	pPipeline->pCamera = pPipeline->pNodeCamera->hComponent;
+}
+
+void componentConfigure(PIPELINE* pPipeline) {
+	OMX_PARAM_PORTDEFINITIONTYPE portDef;
+
+	OMX_INIT_STRUCTURE(portDef);
+	portDef.nPortIndex = 71;
+	OMXsonienCall(OMX_GetParameter(pPipeline->pCamera, OMX_IndexParamPortDefinition, &portDef));
+	pPipeline->nSliceHeight = portDef.format.video.nSliceHeight;
+	pPipeline->nSizeY = portDef.format.video.nFrameWidth * portDef.format.video.nSliceHeight;
+	pPipeline->nSizeU = pPipeline->nSizeY / 4;
+	pPipeline->nSizeV = pPipeline->nSizeY / 4;
+
+	// Wait up for camera being ready.
+	while(!pPipeline->isCameraReady) {
+		print_log("Waiting until camera %d device is ready.", pPipeline->nDevice);
+		usleep(100 * 1000);
+	}
+	print_log("Camera %d is ready.", pPipeline->nDevice);
+}
+
+void componentPrepare(PIPELINE* pPipeline) {
+	// Loaded -> Idle -> Executing. Buffers are allocated on the way to Idle.
+	OMXsonienGraphStart(pPipeline->pGraph);
+	pPipeline->pManagerCamera = OMXsonienGraphManager(pPipeline->pNodeCamera, 71);
+	pPipeline->pManagerRender = OMXsonienGraphManager(pPipeline->pNodeRender, 90);
+
+	// Allocate buffers to null sink
+	if(pPipeline->isHeadless) {
+		OMX_BUFFERHEADERTYPE* pBuffer = &pPipeline->bufferNullSink;
+		pBuffer->nAllocLen = pPipeline->pConfig->nWidth * pPipeline->pConfig->nHeight * 3 / 2;
+		if(posix_memalign((void**)&pBuffer->pBuffer, 64, pBuffer->nAllocLen) != 0) {
+			print_log("FAIL");
+			terminate(pPipeline->pContext);
+			exit(-1);
+		}
+		memset(pBuffer->pBuffer, 0x00, pBuffer->nAllocLen);
+	}
+}
+
+void reportPipelines(CONTEXT* pContext, double nElapsed) {
+	unsigned int nTotal = 0;
+
+	for(unsigned int i = 0; i < pContext->nPipelines; i++) {
+		PIPELINE* pPipeline = &pContext->pipelines[i];
+		print_log("MULTI : Camera %d : %d frames, %.2f fps, %d skipped, latency p50 %.1f us, p99 %.1f us",
+				pPipeline->nDevice, pPipeline->nFrames, pPipeline->nFrames / nElapsed, pPipeline->nSkipped,
+				stats_histogram_percentile(&pPipeline->latency, 50) / 1000.0,
+				stats_histogram_percentile(&pPipeline->latency, 99) / 1000.0);
+		nTotal += pPipeline->nFrames;
+	}
+	print_log("MULTI : %d cameras, %d workers, %.2f fps in total",
+			pContext->nPipelines, pContext->nWorkers, nTotal / nElapsed);
+}
+
+int main(int argc, char** argv) {
+	/* Temporary variables */
+	OMX_ERRORTYPE	err;
+	int				opt;
+
+	/* Initialize application variables. Every function reaches them through pContext or the pipeline. */
+	CONTEXT* pContext = calloc(1, sizeof(CONTEXT));
+	config_init(&pContext->config, 640, 480, 30);
+	pContext->nPipelines	= 2;
+	pContext->nSeconds	= 5;
+	pContext->isValid	= OMX_TRUE;
+
+	OMX_BOOL isValid = OMX_TRUE;
+	while((opt = getopt_long(argc, argv, CONFIG_SHORT_OPTIONS "N:w:s:H", config_options, NULL)) != -1) {
+		switch(opt) {
+		case 'N' :
+			isValid = config_uint(optarg, &pContext->nPipelines) && pContext->nPipelines > 0 && pContext->nPipelines <= MULTI_MAX;
+			break;
+		case 'w' :
+			isValid = config_uint(optarg, &pContext->nWorkers) && pContext->nWorkers > 0 && pContext->nWorkers <= DISPATCH_WORKERS;
+			break;
+		case 's' :
+			isValid = config_uint(optarg, &pContext->nSeconds) && pContext->nSeconds > 0;
+			break;
+		case 'H' :
+			pContext->isHeadless	= OMX_TRUE;
+			break;
+		default :
+			isValid = config_option(&pContext->config, opt, optarg);
+		}
+
+		if(!isValid) {
+			fprintf(stderr, "Usage : %s [options] [-N cameras] [-w workers] [-s seconds] [-H]\n", argv[0]);
+			config_usage(stderr);
+			exit(-1);
+		}
+	}
+	if(pContext->nWorkers == 0) {
+		pContext->nWorkers = pContext->nPipelines;
+	}
+	if(!config_validate(&pContext->config)) {
+		exit(-1);
+	}
+	config_print(&pContext->config);
+
+	// RPI initialize.
+	bcm_host_init();
+
+	// OMX initialize.
+	print_log("Initialize OMX");
+	if((err = OMX_Init()) != OMX_ErrorNone) {
+		print_omx_error(err, "FAIL");
+		OMX_Deinit();
+		exit(-1);
+	}
+
+	// Workers are shared by every pipeline.
+	if((pContext->pDispatcher = dispatch_create(pContext->nWorkers)) == NULL) {
+		terminate(pContext);
+		exit(-1);
+	}
+
+	// For loading component, Callback shall provide. pAppData tells the pipeline.
+	OMX_CALLBACKTYPE callbackOMX;
+	callbackOMX.EventHandler	= onOMXevent;
+	callbackOMX.EmptyBufferDone	= onEmptyRenderIn;
+	callbackOMX.FillBufferDone	= onFillCameraOut;
+
+	for(unsigned int i = 0; i < pContext->nPipelines; i++) {
+		PIPELINE* pPipeline = &pContext->pipelines[i];
+		pPipeline->pContext		= pContext;
+		pPipeline->nDevice		= i;
+		pPipeline->pConfig		= &pContext->config;
+		pPipeline->pOMXsonien	= OMXsonienCreate();
+		OMXsonienSetErrorHandler(pPipeline->pOMXsonien, onOMXsonienError, pPipeline);
+		pPipeline->isHeadless	= pContext->isHeadless;
+		pPipeline->isValid		= OMX_TRUE;
+		dispatch_strand_init(pContext->pDispatcher, &pPipeline->strand, processSlice, pPipeline);
+
+		componentLoad(pPipeline, &callbackOMX);
+		componentConfigure(pPipeline);
+		componentPrepare(pPipeline);
+	}
+
+	// Serve metrics if OMX_METRICS names the socket path. One series per camera.
+	char name[128];
+	for(unsigned int i = 0; i < pContext->nPipelines; i++) {
+		snprintf(name, sizeof(name), "omx_frames_captured_total{camera=\"%u\"}", i);
+		metrics_add_u32(name, "Frames sent to the render.", MetricCounter, &pContext->pipelines[i].nFrames);
+	}
+	for(unsigned int i = 0; i < pContext->nPipelines; i++) {
+		snprintf(name, sizeof(name), "omx_frames_skipped_total{camera=\"%u\"}", i);
+		metrics_add_u32(name, "Frames skipped for no render buffer.", MetricCounter, &pContext->pipelines[i].nSkipped);
+	}
+	for(unsigned int i = 0; i < pContext->nPipelines; i++) {
+		if(pContext->pipelines[i].pManagerRender == NULL) continue;
+		snprintf(name, sizeof(name), "omx_render_buffer_remain{camera=\"%u\"}", i);
+		metrics_add_u32(name, "Render buffers owned by the client (nBufferRemain).", MetricGauge, &pContext->pipelines[i].pManagerRender->nBufferRemain);
+	}
+	for(unsigned int i = 0; i < pContext->nPipelines; i++) {
+		snprintf(name, sizeof(name), "omx_frame_latency_seconds{camera=\"%u\"}", i);
+		metrics_add_histogram(name, "First slice arrival to OMX_EmptyThisBuffer.", &pContext->pipelines[i].latency, 1e-9);
+	}
+	metrics_start(getenv("OMX_METRICS"));
+
+	// Since #71 is capturing port, needs capture signal like other handy capture devices
+	print_log("Capture start.");
+	OMX_CONFIG_PORTBOOLEANTYPE	portCapturing;
+	OMX_INIT_STRUCTURE(portCapturing);
+	portCapturing.nPortIndex = 71;
+	portCapturing.bEnabled = OMX_TRUE;
+	for(unsigned int i = 0; i < pContext->nPipelines; i++) {
+		PIPELINE* pPipeline = &pContext->pipelines[i];
+		OMX_BUFFERHEADERTYPE* pBuffer;
+		while((pBuffer = OMXsonienBufferGet(pPipeline->pManagerCamera))) {
+			OMXsonienBufferSend(pPipeline->pManagerCamera, pBuffer);
+		}
+		OMX_SetConfig(pPipeline->pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	}
+
+	// Set signal interrupt handler
+	signal(SIGINT, 	onSignal);
+	signal(SIGTERM, onSignal);
+
+	cpu_thread_register("main");
+
+	print_log("Capture for %d seconds.", pContext->nSeconds);
+	unsigned long long nBegin	= stats_now();
+	unsigned long long nEnd		= nBegin + pContext->nSeconds * 1000000000ULL;
+	while(pContext->isValid && !isInterrupted && stats_now() < nEnd) {
+		usleep(100 * 1000);
+	}
+	double nElapsed = (stats_now() - nBegin) / 1e9;
+	signal(SIGINT, 	SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	portCapturing.bEnabled = OMX_FALSE;
+	for(unsigned int i = 0; i < pContext->nPipelines; i++) {
+		pContext->pipelines[i].isValid = OMX_FALSE;
+		OMX_SetConfig(pContext->pipelines[i].pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	}
+	print_log("Capture stop.");
+
+	reportPipelines(pContext, nElapsed);
+	cpu_report_total(0);
+	terminate(pContext);
+	free(pContext);
+}
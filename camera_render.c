@@ -21,7 +21,8 @@
 #include <IL/OMX_Broadcom.h>
 
 #include "common.h"
-#include "OMXsonien.h"
+#include "config.h"
+#include "OMXsonienGraph.h"
 
 #define	COMPONENT_CAMERA	"OMX.broadcom.camera"
 #define COMPONENT_RENDER	"OMX.broadcom.video_render"
@@ -31,16 +32,19 @@ typedef struct {
 	OMX_HANDLETYPE				pCamera;
 	OMX_HANDLETYPE				pRender;
 	OMX_BOOL					isCameraReady;
+	OMXsonien_GRAPH*			pGraph;
+	OMXsonien_GRAPHNODE*		pNodeCamera;
+	OMXsonien_GRAPHNODE*		pNodeRender;
 
-	unsigned int				nWidth;
-	unsigned int				nHeight;
-	unsigned int				nFramerate;
+	CONFIG						config;
 
 	OMX_BUFFERHEADERTYPE*		pBufferCameraOut;
 	OMX_U8*						pSrcY;
 	OMX_U8*						pSrcU;
 	OMX_U8*						pSrcV;
 	unsigned int				nSizeY, nSizeU, nSizeV;
+	unsigned int				nSliceHeight;		// Of #71. Last slice may be padded beyond the frame.
+	OMXsonien_BUFFERMANAGER*	pManagerCamera;
 	OMXsonien_BUFFERMANAGER*	pManagerRender;
 	OMX_BOOL					isFilled;
 } CONTEXT;
@@ -75,7 +79,13 @@ OMX_ERRORTYPE onFillCameraOut (
 		OMX_OUT OMX_HANDLETYPE hComponent,
 		OMX_OUT OMX_PTR pAppData,
 		OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer) {
-	mContext.isFilled = OMX_TRUE;
+	// Only one buffer is with the camera at once. Client reads it until sending next one.
+	OMXsonienBufferPut(mContext.pManagerCamera, pBuffer);
+	mContext.pBufferCameraOut	= pBuffer;
+	mContext.pSrcY				= pBuffer->pBuffer;
+	mContext.pSrcU				= mContext.pSrcY + mContext.nSizeY;
+	mContext.pSrcV				= mContext.pSrcU + mContext.nSizeU;
+	mContext.isFilled			= OMX_TRUE;
 	return OMX_ErrorNone;
 }
 
@@ -100,38 +110,11 @@ void onOMXsonienError(OMX_ERRORTYPE err) {
 void terminate() {
 	print_log("On terminating...");
 
-	OMX_STATETYPE state;
-	OMX_BOOL bWaitForCamera, bWaitForRender;
-
-	// Execute -> Idle
-	bWaitForCamera = bWaitForRender = OMX_FALSE;
-	if(isState(mContext.pCamera, OMX_StateExecuting)) {
-		OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateIdle, NULL);
-		bWaitForCamera = OMX_TRUE;
-	}
-	if(isState(mContext.pRender, OMX_StateExecuting)) {
-		OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateIdle, NULL);
-		bWaitForRender = OMX_TRUE;
-	}
-	if(bWaitForCamera) wait_for_state_change(OMX_StateIdle, mContext.pCamera, NULL);
-	if(bWaitForRender) wait_for_state_change(OMX_StateIdle, mContext.pRender, NULL);
-
-	// Idle -> Loaded
-	bWaitForCamera = bWaitForRender = OMX_FALSE;
-	if(isState(mContext.pCamera, OMX_StateIdle)) {
-		OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateLoaded, NULL);
-		bWaitForCamera = OMX_TRUE;
-	}
-	if(isState(mContext.pRender, OMX_StateIdle)) {
-		OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateLoaded, NULL);
-		bWaitForRender = OMX_TRUE;
-	}
-	if(bWaitForCamera) wait_for_state_change(OMX_StateLoaded, mContext.pCamera, NULL);
-	if(bWaitForRender) wait_for_state_change(OMX_StateLoaded, mContext.pRender, NULL);
-
-	// Loaded -> Free
-	if(isState(mContext.pCamera, OMX_StateLoaded)) OMX_FreeHandle(mContext.pCamera);
-	if(isState(mContext.pRender, OMX_StateLoaded)) OMX_FreeHandle(mContext.pRender);
+	// Executing -> Idle -> Loaded with buffers freed -> Free, render first.
+	OMXsonienGraphDestroy(mContext.pGraph);
+	mContext.pGraph		= NULL;
+	mContext.pCamera	= NULL;
+	mContext.pRender	= NULL;
 
 	OMXsonienDeinit();
 	OMX_Deinit();
@@ -140,101 +123,66 @@ void terminate() {
 	getchar();
 }
 
+/* Graph : Called before video format of the render is set. */
+OMX_ERRORTYPE configureRender(OMX_HANDLETYPE hComponent, OMX_PTR pAppData) {
+	// Configure rendering region
+	OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
+	OMX_INIT_STRUCTURE(displayRegion);
+	displayRegion.nPortIndex = 90;
+	config_display_region(&((CONTEXT*)pAppData)->config, &displayRegion);
+	displayRegion.set = OMX_DISPLAY_SET_NUM | OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_MODE | OMX_DISPLAY_SET_DEST_RECT;
+	displayRegion.mode = OMX_DISPLAY_MODE_FILL;
+	displayRegion.num = 0;
+	return OMX_SetConfig(hComponent, OMX_IndexConfigDisplayRegion, &displayRegion);
+}
+
+/*
+ * Camera #71 -> client -> Render #90. Client copies camera slices into
+ * render frames.
+ */
 void componentLoad(OMX_CALLBACKTYPE* pCallbackOMX) {
-	OMX_ERRORTYPE err;
+	OMXsonien_VIDEOFORMAT format;
+
+	mContext.pGraph = OMXsonienGraphCreate(pCallbackOMX, &mContext);
+	mContext.pNodeCamera = OMXsonienGraphAdd(mContext.pGraph, COMPONENT_CAMERA, OMXsonienConfigureCamera);
+	mContext.pNodeRender = OMXsonienGraphAdd(mContext.pGraph, COMPONENT_RENDER, configureRender);
+
+	// Set video format of #71 port.
+	memset(&format, 0x00, sizeof(format));
+	format.eColorFormat		= OMX_COLOR_FormatYUV420PackedPlanar;
+	format.nFrameWidth		= mContext.config.nWidth;
+	format.nFrameHeight		= mContext.config.nHeight;
+	format.xFramerate		= mContext.config.nFramerate << 16;	// Fixed point. 1
+	format.nSliceHeight		= mContext.config.nSliceHeight;
+	OMXsonienGraphFormat(mContext.pNodeCamera, 71, &format);
+
+	// Set video format of #90 port.
+	format.nSliceHeight		= mContext.config.nHeight;
+	format.nBufferCount		= mContext.config.nRenderBuffers;
+	OMXsonienGraphFormat(mContext.pNodeRender, 90, &format);
 
-	// Loading component
-	print_log("Load %s", COMPONENT_CAMERA);
-	OMXsonienCheckError(OMX_GetHandle(&mContext.pCamera, COMPONENT_CAMERA, &mContext, pCallbackOMX));
-	print_log("Handler address : 0x%08x", mContext.pCamera);
+	OMXsonienGraphClient(mContext.pGraph, mContext.pNodeCamera, 71, NULL, 0);
+	OMXsonienGraphClient(mContext.pGraph, NULL, 0, mContext.pNodeRender, 90);
+	OMXsonienGraphLoad(mContext.pGraph);
 
-	print_log("Load %s", COMPONENT_RENDER);
-	OMXsonienCheckError(OMX_GetHandle(&mContext.pRender, COMPONENT_RENDER, &mContext, pCallbackOMX));
-	print_log("Handler address : 0x%08x", mContext.pRender);
+	mContext.pCamera = mContext.pNodeCamera->hComponent;
+	mContext.pRender = mContext.pNodeRender->hComponent;
 }
 
 void componentConfigure() {
-	OMX_ERRORTYPE err;
 	OMX_PARAM_PORTDEFINITIONTYPE portDef;
 	OMX_VIDEO_PORTDEFINITIONTYPE* formatVideo;
 
-	// Disable any unused ports
-	OMX_SendCommand(mContext.pCamera, OMX_CommandPortDisable, 70, NULL);
-	OMX_SendCommand(mContext.pCamera, OMX_CommandPortDisable, 72, NULL);
-	OMX_SendCommand(mContext.pCamera, OMX_CommandPortDisable, 73, NULL);
-
-	// Configure OMX_IndexParamCameraDeviceNumber callback enable to ensure whether camera is initialized properly.
-	print_log("Configure DeviceNumber callback enable.");
-	OMX_CONFIG_REQUESTCALLBACKTYPE configCameraCallback;
-	OMX_INIT_STRUCTURE(configCameraCallback);
-	configCameraCallback.nPortIndex	= OMX_ALL;	// Must Be OMX_ALL
-	configCameraCallback.nIndex 	= OMX_IndexParamCameraDeviceNumber;
-	configCameraCallback.bEnable 	= OMX_TRUE;
-	OMXsonienCheckError(OMX_SetConfig(mContext.pCamera, OMX_IndexConfigRequestCallback, &configCameraCallback));
-
-	// OMX CameraDeviceNumber set -> will trigger Camera Ready callback
-	print_log("Set CameraDeviceNumber parameter.");
-	OMX_PARAM_U32TYPE deviceNumber;
-	OMX_INIT_STRUCTURE(deviceNumber);
-	deviceNumber.nPortIndex = OMX_ALL;
-	deviceNumber.nU32 = 0;	// Mostly zero
-	OMXsonienCheckError(OMX_SetParameter(mContext.pCamera, OMX_IndexParamCameraDeviceNumber, &deviceNumber));
-
-	// Set video format of #71 port.
-	print_log("Set video format of the camera : Using #71.");
 	OMX_INIT_STRUCTURE(portDef);
 	portDef.nPortIndex = 71;
-
-	print_log("Get non-initialized definition of #71.");
-	OMX_GetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef);
-
-	print_log("Set up parameters of video format of #71.");
-	formatVideo = &portDef.format.video;
-	formatVideo->eColorFormat 	= OMX_COLOR_FormatYUV420PackedPlanar;
-	formatVideo->nFrameWidth	= mContext.nWidth;
-	formatVideo->nFrameHeight	= mContext.nHeight;
-	formatVideo->xFramerate		= mContext.nFramerate << 16;	// Fixed point. 1
-	formatVideo->nStride		= formatVideo->nFrameWidth;		// Stride 0 -> Raise segment fault.
-	OMXsonienCheckError(OMX_SetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef));
-
-	OMX_GetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef);
+	OMXsonienCall(OMX_GetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef));
 	formatVideo = &portDef.format.video;
+	mContext.nSliceHeight	= formatVideo->nSliceHeight;
 	mContext.nSizeY = formatVideo->nFrameWidth * formatVideo->nSliceHeight;
 	mContext.nSizeU	= mContext.nSizeY / 4;
 	mContext.nSizeV	= mContext.nSizeY / 4;
 	print_log("%d %d %d", mContext.nSizeY, mContext.nSizeU, mContext.nSizeV);
 
-	// Set video format of #90 port.
-	print_log("Set video format of the render : Using #90.");
-	OMX_INIT_STRUCTURE(portDef);
-	portDef.nPortIndex = 90;
-
-	print_log("Get default definition of #90.");
-	OMX_GetParameter(mContext.pRender, OMX_IndexParamPortDefinition, &portDef);
-
-	print_log("Set up parameters of video format of #90.");
-	formatVideo = &portDef.format.video;
-	formatVideo->eColorFormat 		= OMX_COLOR_FormatYUV420PackedPlanar;
-	formatVideo->eCompressionFormat	= OMX_VIDEO_CodingUnused;
-	formatVideo->nFrameWidth		= mContext.nWidth;
-	formatVideo->nFrameHeight		= mContext.nHeight;
-	formatVideo->nStride			= mContext.nWidth;
-	formatVideo->nSliceHeight		= mContext.nHeight;
-	formatVideo->xFramerate			= mContext.nFramerate << 16;
-	OMXsonienCheckError(OMX_SetParameter(mContext.pRender, OMX_IndexParamPortDefinition, &portDef));
-
-	// Configure rendering region
-	OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
-	OMX_INIT_STRUCTURE(displayRegion);
-	displayRegion.nPortIndex = 90;
-	displayRegion.dest_rect.width 	= mContext.nWidth;
-	displayRegion.dest_rect.height 	= mContext.nHeight;
-	displayRegion.set = OMX_DISPLAY_SET_NUM | OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_MODE | OMX_DISPLAY_SET_DEST_RECT;
-	displayRegion.mode = OMX_DISPLAY_MODE_FILL;
-	displayRegion.fullscreen = OMX_FALSE;
-	displayRegion.num = 0;
-	OMXsonienCheckError(OMX_SetConfig(mContext.pRender, OMX_IndexConfigDisplayRegion, &displayRegion));
-
 	// Wait up for camera being ready.
 	while(!mContext.isCameraReady) {
 		print_log("Waiting until camera device is ready.");
@@ -244,57 +192,26 @@ void componentConfigure() {
 }
 
 void componentPrepare() {
-	OMX_ERRORTYPE err;
-	OMX_PARAM_PORTDEFINITIONTYPE portDef;
-
-	// Request state of components to be IDLE.
-	// The command will turn the component into waiting mode.
-	// After allocating buffer to all enabled ports than the component will be IDLE.
-	print_log("STATE : CAMERA - IDLE request");
-	OMXsonienCheckError(OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateIdle, NULL));
-
-	print_log("STATE : RENDER - IDLE request");
-	OMXsonienCheckError(OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateIdle, NULL));
-
-	// Allocate buffers to render
-	print_log("Allocate buffer to renderer #90 for input.");
-	OMX_INIT_STRUCTURE(portDef);
-	portDef.nPortIndex = 90;
-	OMX_GetParameter(mContext.pRender, OMX_IndexParamPortDefinition, &portDef);
-	print_log("Size of predefined buffer : %d * %d", portDef.nBufferSize, portDef.nBufferCountActual);
-	mContext.pManagerRender = OMXsonienAllocateBuffer(mContext.pRender, 90, &mContext, 0, 0);
+	// Loaded -> Idle -> Executing. Buffers are allocated on the way to Idle.
+	OMXsonienGraphStart(mContext.pGraph);
 
-	// Allocate buffer to camera
-	OMX_INIT_STRUCTURE(portDef);
-	portDef.nPortIndex = 71;
-	OMX_GetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef);
-	print_log("Size of predefined buffer : %d * %d", portDef.nBufferSize, portDef.nBufferCountActual);
-	OMXsonienCheckError(OMX_AllocateBuffer(mContext.pCamera, &mContext.pBufferCameraOut, 71, &mContext, portDef.nBufferSize));
-
-	mContext.pSrcY 	= mContext.pBufferCameraOut->pBuffer;
-	mContext.pSrcU	= mContext.pSrcY + mContext.nSizeY;
-	mContext.pSrcV	= mContext.pSrcU + mContext.nSizeU;
-	print_log("0x%08x 0x%08x 0x%08x", mContext.pSrcY, mContext.pSrcU, mContext.pSrcV);
-
-	// Wait up for component being idle.
-	if(!wait_for_state_change(OMX_StateIdle, mContext.pRender, mContext.pCamera, NULL)) {
-		print_log("FAIL");
-		terminate();
-		exit(-1);
-	}
-	print_log("STATE : IDLE OK!");
+	mContext.pManagerCamera = OMXsonienGraphManager(mContext.pNodeCamera, 71);
+	mContext.pManagerRender = OMXsonienGraphManager(mContext.pNodeRender, 90);
+	print_log("Buffers : camera %d, render %d", mContext.pManagerCamera->nBufferCount, mContext.pManagerRender->nBufferCount);
 }
 
-int main(void) {
+int main(int argc, char** argv) {
 	/* Temporary variables */
 	OMX_ERRORTYPE	err;
 	OMX_PARAM_PORTDEFINITIONTYPE	portDef;
 
 	/* Initialize application variables */
 	memset(&mContext, 0, (size_t)sizeof(mContext));
-	mContext.nWidth 	= 640;
-	mContext.nHeight 	= 480;
-	mContext.nFramerate	= 25;
+	config_init(&mContext.config, 640, 480, 25);
+	if(!config_parse(&mContext.config, argc, argv)) {
+		exit(-1);
+	}
+	config_print(&mContext.config);
 
 	// RPI initialize.
 	bcm_host_init();
@@ -321,20 +238,6 @@ int main(void) {
 	componentConfigure();
 	componentPrepare();
 
-	// Request state of component to be EXECUTE.
-	print_log("STATE : CAMERA - EXECUTING request");
-	OMXsonienCheckError(OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateExecuting, NULL));
-
-	print_log("STATE : RENDER - EXECUTING request");
-	OMXsonienCheckError(OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateExecuting, NULL));
-
-	if(!wait_for_state_change(OMX_StateExecuting, mContext.pCamera, mContext.pRender, NULL)) {
-		print_log("FAIL");
-		terminate();
-		exit(-1);
-	}
-	print_log("STATE : EXECUTING OK!");
-
 	// Since #71 is capturing port, needs capture signal like other handy capture devices
 	print_log("Capture start.");
 	OMX_CONFIG_PORTBOOLEANTYPE	portCapturing;
@@ -342,17 +245,20 @@ int main(void) {
 	portCapturing.nPortIndex = 71;
 	portCapturing.bEnabled = OMX_TRUE;
 	OMX_SetConfig(mContext.pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	cpu_thread_register("main");
+	config_apply_thread(&mContext.config);
 
 	OMX_U8*			pY = NULL;
 	OMX_U8*			pU = NULL;
 	OMX_U8*			pV = NULL;
-	unsigned int	nOffsetU 	= mContext.nWidth * mContext.nHeight;
+	unsigned int	nOffsetU 	= mContext.config.nWidth * mContext.config.nHeight;
 	unsigned int 	nOffsetV 	= nOffsetU * 5 / 4;
-	unsigned int 	nFrameMax	= mContext.nFramerate * 5;
+	unsigned int 	nFrameMax	= mContext.config.nFramerate * 5;
 	unsigned int	nFrames		= 0;
+	unsigned int	nRow		= 0;		// Rows of the frame copied
 
 	print_log("Capture for %d frames.", nFrameMax);
-	OMX_FillThisBuffer(mContext.pCamera, mContext.pBufferCameraOut);
+	OMXsonienBufferSend(mContext.pManagerCamera, OMXsonienBufferGet(mContext.pManagerCamera));
 	OMX_BUFFERHEADERTYPE* pCurrentBuffer = OMXsonienBufferGet(mContext.pManagerRender);
 
 	while(nFrames < nFrameMax) {
@@ -361,29 +267,45 @@ int main(void) {
 				pY = pCurrentBuffer->pBuffer;
 				pU = pY + nOffsetU;
 				pV = pY + nOffsetV;
+				nRow = 0;
 			}
 
-			memcpy(pY, mContext.pSrcY, mContext.nSizeY);	pY += mContext.nSizeY;
-			memcpy(pU, mContext.pSrcU, mContext.nSizeU);	pU += mContext.nSizeU;
-			memcpy(pV, mContext.pSrcV, mContext.nSizeV);	pV += mContext.nSizeV;
-			pCurrentBuffer->nFilledLen += mContext.pBufferCameraOut->nFilledLen;
+			if(mContext.pBufferCameraOut->nFilledLen && nRow < mContext.config.nHeight) {
+				// Last slice is padded to multiple of 16 lines. Padding is not copied.
+				unsigned int nRows = mContext.config.nHeight - nRow;
+				if(nRows > mContext.nSliceHeight) nRows = mContext.nSliceHeight;
+				unsigned int nSizeY	= mContext.config.nWidth * nRows;
+				unsigned int nSizeC	= nSizeY / 4;
+
+				memcpy(pY, mContext.pSrcY, nSizeY);	pY += nSizeY;
+				memcpy(pU, mContext.pSrcU, nSizeC);	pU += nSizeC;
+				memcpy(pV, mContext.pSrcV, nSizeC);	pV += nSizeC;
+				pCurrentBuffer->nFilledLen += nSizeY + nSizeC * 2;
+				nRow += nRows;
+			}
 
 			if(mContext.pBufferCameraOut->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) {
 				print_log("BUFFER 0x%08x filled", pCurrentBuffer);
-				OMX_EmptyThisBuffer(mContext.pRender, pCurrentBuffer);
+				OMXsonienBufferSend(mContext.pManagerRender, pCurrentBuffer);
 				nFrames++;
 				pCurrentBuffer = OMXsonienBufferGet(mContext.pManagerRender);
 			}
 			mContext.isFilled = OMX_FALSE;
-			OMX_FillThisBuffer(mContext.pCamera, mContext.pBufferCameraOut);
+			OMXsonienBufferSend(mContext.pManagerCamera, OMXsonienBufferGet(mContext.pManagerCamera));
 		}
 
 		usleep(1);
 	}
 
+	// Frame being filled goes back, so no buffer is left with the client when freed.
+	if(pCurrentBuffer) {
+		OMXsonienBufferPut(mContext.pManagerRender, pCurrentBuffer);
+	}
+
 	portCapturing.bEnabled = OMX_FALSE;
 	OMX_SetConfig(mContext.pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
 	print_log("Capture stop.");
+	cpu_report_total(nFrames);
 
 	terminate();
 }
@@ -7,12 +7,48 @@
  Description : This is implemented version of camera_render.c.
                This program support counting FPS so user may use this program
                for measuring performance limit of non-tunneling camera rendering.
+
+               Usage : camera_render_fps [-r WxH] [-f framerate] [-c render buffers] [-n frames | -b frames]
+               -n stops after the number of frames and reports sustained FPS
+               and latency. -b does the same headless. The render is replaced
+               by a null sink which takes a frame at once.
+
+               -P chooses what happens when the render holds every buffer.
+               block waits for the render, so the camera drops frames on its
+               own. drop-oldest keeps up to two complete frames pending and
+               drops the oldest one. latest keeps one pending frame and
+               overwrites it with the newest one. Default is block.
+
+               -p paces frames to the render at the display rate by nTimeStamp
+               of the camera, after the playout delay in msec. 0 fps is the
+               camera framerate and 0 delay is one display interval. Frames
+               which would be late are skipped. Up to four frames wait for
+               their slot with any policy, so drop-oldest and latest keep
+               four pending instead of two and one, as the playout delay
+               holds that many. Render takes enough buffers for them, the
+               frames it holds and the one being filled. Not for headless.
+
+               -A lowers framerate of the camera by OMX_IndexConfigVideoFramerate
+               while copy time, queue depth or drops show overload, down to
+               the given minimum, and raises it back up to -f with headroom.
+
+               -o records camera output to the file. -i replays the file
+               instead of the camera at original speed, or at maximum speed
+               with -m, so runs can be compared on identical input. A Y4M
+               clip, such as one of camera_fanout -w, is replayed as well.
+
+               Sweep : camera_render_fps -S result.csv|result.json [-R WxH,...] [-F min-max] [-C count,...] [-n frames] [-H]
+               Finds the highest framerate without a drop for each resolution
+               and render buffer count. -H runs trials headless.
  ============================================================================
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <unistd.h>
 #include <bcm_host.h>
 
 #include <IL/OMX_Core.h>
@@ -21,34 +57,94 @@
 #include <IL/OMX_Broadcom.h>
 
 #include "common.h"
-#include "OMXsonien.h"
+#include "config.h"
+#include "OMXsonienGraph.h"
+#include "trace.h"
+#include "metrics.h"
+#include "sweep.h"
+#include "replay.h"
+#include "pacer.h"
+#include "adapt.h"
 
 #define	COMPONENT_CAMERA	"OMX.broadcom.camera"
 #define COMPONENT_RENDER	"OMX.broadcom.video_render"
 
+#define PENDING_MAX			4	// Complete frames waiting for the render
+#define PENDING_DROP		2	// Pending frames of drop-oldest
+#define RENDER_DEPTH		2	// Frames the render may hold. One on screen, one waiting for vsync.
+
+/* Back-pressure policy when the render holds every buffer of #90 */
+typedef enum {
+	PolicyBlock		= 0x00,		// Wait for the render. Camera drops frames while waiting.
+	PolicyDropOldest,			// Keep PENDING_DROP frames pending and drop the oldest one.
+	PolicyLatest				// Keep one frame pending and overwrite it with the newest one.
+} POLICY;
+
+typedef struct {
+	OMX_BUFFERHEADERTYPE*		pBuffer;
+	unsigned long long			nFrameBegin;		// nsec, arrival of first slice
+	unsigned long long			nSlot;				// nsec, release time when paced
+} PENDING;
+
 /* Application variant */
 typedef struct {
 	OMX_HANDLETYPE				pCamera;
 	OMX_HANDLETYPE				pRender;
 	OMX_BOOL					isCameraReady;
+	OMXsonien_INSTANCE*			pOMXsonien;
+	OMXsonien_GRAPH*			pGraph;
+	OMXsonien_GRAPHNODE*		pNodeCamera;		// NULL on replay
+	OMXsonien_GRAPHNODE*		pNodeRender;		// NULL on headless
 
-	unsigned int				nWidth;
-	unsigned int				nHeight;
-	unsigned int				nFramerate;
+	CONFIG						config;
 
 	OMX_BUFFERHEADERTYPE*		pBufferCameraOut;
 	OMX_U8*						pSrcY;
 	OMX_U8*						pSrcU;
 	OMX_U8*						pSrcV;
 	unsigned int				nSizeY, nSizeU, nSizeV;
+	unsigned int				nSliceHeight;		// Of #71. Last slice may be padded beyond the frame.
+	OMXsonien_BUFFERMANAGER*	pManagerCamera;
 	OMXsonien_BUFFERMANAGER*	pManagerRender;
 	OMX_BOOL					isFilled;
 
+	OMX_BOOL					isHeadless;			// Null sink instead of the render
+	unsigned int				nFrameLimit;		// Stop after this number of frames. 0 : Never
+	OMX_BUFFERHEADERTYPE		bufferNullSink;		// The only buffer of null sink
+	unsigned long long			nTimeFirstFrame;	// nsec
+	unsigned long long			nTimeLastFrame;
+
+	POLICY						ePolicy;
+	unsigned int				nPendingMax;		// Of the policy, or PENDING_MAX with any policy when paced
+	PENDING						pending[PENDING_MAX];	// Oldest first. Client owns them.
+	unsigned int				nPending;
+	unsigned int				nRenderHeld;		// Frames sent to the render and not emptied yet
+	OMX_BOOL					isPaced;
+	PACER						pacer;
+	OMX_BOOL					isAdaptive;
+	ADAPT						adapt;
+	unsigned int				nFramerate;			// Current framerate of the camera
+	unsigned int				nLostAdapted;		// Drops and discards already reported to the controller
+
+	REPLAY*						pReplay;			// Replaces the camera if not NULL
+	REPLAY_RECORDER*			pRecorder;
+	const char*					pRecordPath;
+
 	OMX_BOOL					isValid;
 	pthread_t					thread_fps;
 	unsigned int				nFrameCaptured;
+	unsigned int				nFrameDropped;
+	unsigned int				nFrameDiscarded;	// Frames dropped by back-pressure policy
+	unsigned int				nFPS;
+	OMX_S64						nTimestampLast;		// usec, nTimeStamp of last frame
+	unsigned long long			nFrameBegin;		// nsec, arrival of first slice
+	STATS_HISTOGRAM				latency;			// nsec, first slice to OMX_EmptyThisBuffer
 } CONTEXT;
-CONTEXT mContext;
+
+/* Set by signal handler. Main loop stops the pipeline on it. */
+static volatile sig_atomic_t isInterrupted = 0;
+
+void terminate(CONTEXT* pContext);
 
 /* Event Handler : OMX Event */
 OMX_ERRORTYPE onOMXevent (
@@ -59,6 +155,7 @@ OMX_ERRORTYPE onOMXevent (
 		OMX_IN OMX_U32 nData2,
 		OMX_IN OMX_PTR pEventData) {
 
+	TRACE_INSTANT("onOMXevent");
 	print_event(hComponent, eEvent, nData1, nData2);
 
 	switch(eEvent) {
@@ -79,7 +176,18 @@ OMX_ERRORTYPE onFillCameraOut (
 		OMX_OUT OMX_HANDLETYPE hComponent,
 		OMX_OUT OMX_PTR pAppData,
 		OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer) {
-	mContext.isFilled = OMX_TRUE;
+	CONTEXT* pContext = (CONTEXT*)pAppData;
+
+	TRACE_INSTANT("onFillCameraOut");
+	// Only one buffer is with the camera or the replay at once. Client reads it until filling next one.
+	if(pContext->pManagerCamera) {
+		OMXsonienBufferPut(pContext->pManagerCamera, pBuffer);
+	}
+	pContext->pBufferCameraOut	= pBuffer;
+	pContext->pSrcY				= pBuffer->pBuffer;
+	pContext->pSrcU				= pContext->pSrcY + pContext->nSizeY;
+	pContext->pSrcV				= pContext->pSrcU + pContext->nSizeU;
+	pContext->isFilled			= OMX_TRUE;
 	return OMX_ErrorNone;
 }
 
@@ -88,239 +196,596 @@ OMX_ERRORTYPE onEmptyRenderIn(
 		OMX_IN OMX_HANDLETYPE hComponent,
 		OMX_IN OMX_PTR pAppData,
 		OMX_IN OMX_BUFFERHEADERTYPE* pBuffer) {
+	CONTEXT* pContext = (CONTEXT*)pAppData;
 
-	OMXsonienBufferPut(mContext.pManagerRender, pBuffer);
+	TRACE_BEGIN("onEmptyRenderIn");
+	OMXsonienBufferPut(pContext->pManagerRender, pBuffer);
+	__atomic_sub_fetch(&pContext->nRenderHeld, 1, __ATOMIC_RELAXED);
+	TRACE_END("onEmptyRenderIn");
 	return OMX_ErrorNone;
 }
 
 /* Callback : Error detection callback of OMXsonien */
-void onOMXsonienError(OMX_ERRORTYPE err) {
+void onOMXsonienError(OMX_ERRORTYPE err, OMX_PTR pAppData) {
 	printf("Error : 0x%08x\n", err);
-	terminate();
+	terminate((CONTEXT*)pAppData);
 	exit(-1);
 }
 
+/* Count frames skipped by the camera from the gap between timestamps. */
+void countDroppedFrames(CONTEXT* pContext, OMX_BUFFERHEADERTYPE* pBuffer) {
+	OMX_S64 nTimestamp	= OMX_TICKS_TO_S64(pBuffer->nTimeStamp);
+	OMX_S64 nInterval	= 1000000 / pContext->nFramerate;
+
+	if(pContext->nTimestampLast > 0 && nTimestamp > pContext->nTimestampLast) {
+		OMX_S64 nGap = nTimestamp - pContext->nTimestampLast;
+		if(nGap > nInterval * 3 / 2) {
+			__atomic_add_fetch(&pContext->nFrameDropped, (nGap + nInterval / 2) / nInterval - 1, __ATOMIC_RELAXED);
+		}
+	}
+	pContext->nTimestampLast = nTimestamp;
+}
+
 void onSignal(int signal) {
-	mContext.isValid = OMX_FALSE;
+	isInterrupted = 1;
 }
 
 void* thread_fps_counter(void* data) {
+	CONTEXT* pContext = (CONTEXT*)data;
 	unsigned int nFrameTracked = 0;
 
-	while(mContext.isValid) {
+	pthread_setname_np(pthread_self(), "fps_counter");
+	cpu_thread_register("fps_counter");
+
+	while(pContext->isValid) {
 		usleep(1000 * 1000);
 
-		int nFrameNow = mContext.nFrameCaptured;
+		int nFrameNow = pContext->nFrameCaptured;
+		pContext->nFPS = nFrameNow - nFrameTracked;
+		TRACE_COUNTER("FPS", nFrameNow - nFrameTracked);
 		printf("FPS : %d\n", nFrameNow - nFrameTracked);
+		cpu_report(nFrameNow - nFrameTracked);
 		nFrameTracked = nFrameNow;
 	}
+	cpu_thread_finish();
 
 	pthread_exit(NULL);
 }
 
-void terminate() {
+void terminate(CONTEXT* pContext) {
 	print_log("On terminating...");
 
-	if(mContext.thread_fps) {
-		pthread_join(mContext.thread_fps, NULL);
+	if(pContext->thread_fps) {
+		pthread_join(pContext->thread_fps, NULL);
 	}
+	metrics_stop();
+	cpu_report_total(pContext->nFrameCaptured);
+
+	// Executing -> Idle -> Loaded with buffers freed -> Free, render first.
+	OMXsonienGraphDestroy(pContext->pGraph);
+	pContext->pGraph		= NULL;
+	pContext->pCamera	= NULL;
+	pContext->pRender	= NULL;
+
+	OMXsonienCallDump();
+	OMXsonienDestroy(pContext->pOMXsonien);
+	pContext->pOMXsonien = NULL;
+	OMX_Deinit();
+
+	if(pContext->bufferNullSink.pBuffer) free(pContext->bufferNullSink.pBuffer);
+	replay_close(pContext->pReplay);
+	replay_record_close(pContext->pRecorder);
+
+	if(pContext->isHeadless) return;
+	print_log("Press enter to terminate.");
+	getchar();
+}
 
-	OMX_STATETYPE state;
-	OMX_BOOL bWaitForCamera, bWaitForRender;
+/* Graph : Called before video format of the render is set. */
+OMX_ERRORTYPE configureRender(OMX_HANDLETYPE hComponent, OMX_PTR pAppData) {
+	// Configure rendering region
+	OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
+	OMX_INIT_STRUCTURE(displayRegion);
+	displayRegion.nPortIndex = 90;
+	config_display_region(&((CONTEXT*)pAppData)->config, &displayRegion);
+	displayRegion.set = OMX_DISPLAY_SET_NUM | OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_MODE | OMX_DISPLAY_SET_DEST_RECT;
+	displayRegion.mode = OMX_DISPLAY_MODE_FILL;
+	displayRegion.num = 0;
+	return OMX_SetConfig(hComponent, OMX_IndexConfigDisplayRegion, &displayRegion);
+}
 
-	// Execute -> Idle
-	bWaitForCamera = bWaitForRender = OMX_FALSE;
-	if(isState(mContext.pCamera, OMX_StateExecuting)) {
-		OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateIdle, NULL);
-		bWaitForCamera = OMX_TRUE;
+/*
+ * Camera #71 -> client -> Render #90. Camera is not in the graph on replay
+ * and render is not in the graph on headless.
+ */
+void componentLoad(CONTEXT* pContext, OMX_CALLBACKTYPE* pCallbackOMX) {
+	OMX_PARAM_PORTDEFINITIONTYPE portDef;
+	OMXsonien_VIDEOFORMAT format;
+
+	if(pContext->pReplay) {
+		// Camera is replaced by the record. Take its layout.
+		print_log("Replay : %s is replaced by the record.", COMPONENT_CAMERA);
+		OMX_INIT_STRUCTURE(portDef);
+		portDef.nPortIndex = 71;
+		replay_port_definition(pContext->pReplay, &portDef);
+		pContext->config.nWidth		= portDef.format.video.nFrameWidth;
+		pContext->config.nHeight		= portDef.format.video.nFrameHeight;
+		pContext->config.nFramerate	= portDef.format.video.xFramerate >> 16 ? portDef.format.video.xFramerate >> 16 : 1;
+		pContext->isCameraReady	= OMX_TRUE;
 	}
-	if(isState(mContext.pRender, OMX_StateExecuting)) {
-		OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateIdle, NULL);
-		bWaitForRender = OMX_TRUE;
+	if(pContext->isHeadless) {
+		print_log("Headless : %s is replaced by null sink.", COMPONENT_RENDER);
 	}
-	if(bWaitForCamera) wait_for_state_change(OMX_StateIdle, mContext.pCamera, NULL);
-	if(bWaitForRender) wait_for_state_change(OMX_StateIdle, mContext.pRender, NULL);
 
-	// Idle -> Loaded
-	bWaitForCamera = bWaitForRender = OMX_FALSE;
-	if(isState(mContext.pCamera, OMX_StateIdle)) {
-		OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateLoaded, NULL);
-		bWaitForCamera = OMX_TRUE;
+	memset(&format, 0x00, sizeof(format));
+	format.eColorFormat		= OMX_COLOR_FormatYUV420PackedPlanar;
+	format.nFrameWidth		= pContext->config.nWidth;
+	format.nFrameHeight		= pContext->config.nHeight;
+	format.xFramerate		= pContext->config.nFramerate << 16;	// Fixed point. 1
+
+	pContext->pGraph = OMXsonienGraphCreateIn(pContext->pOMXsonien, pCallbackOMX, pContext);
+	if(!pContext->pReplay) {
+		// Set video format of #71 port.
+		pContext->pNodeCamera = OMXsonienGraphAdd(pContext->pGraph, COMPONENT_CAMERA, OMXsonienConfigureCamera);
+		format.nSliceHeight		= pContext->config.nSliceHeight;
+		OMXsonienGraphFormat(pContext->pNodeCamera, 71, &format);
+		OMXsonienGraphClient(pContext->pGraph, pContext->pNodeCamera, 71, NULL, 0);
 	}
-	if(isState(mContext.pRender, OMX_StateIdle)) {
-		OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateLoaded, NULL);
-		bWaitForRender = OMX_TRUE;
+	if(!pContext->isHeadless) {
+		// Set video format of #90 port.
+		pContext->pNodeRender = OMXsonienGraphAdd(pContext->pGraph, COMPONENT_RENDER, configureRender);
+		format.nSliceHeight		= pContext->config.nHeight;
+		format.nBufferCount		= pContext->config.nRenderBuffers;
+		OMXsonienGraphFormat(pContext->pNodeRender, 90, &format);
+		OMXsonienGraphClient(pContext->pGraph, NULL, 0, pContext->pNodeRender, 90);
 	}
-	if(bWaitForCamera) wait_for_state_change(OMX_StateLoaded, mContext.pCamera, NULL);
-	if(bWaitForRender) wait_for_state_change(OMX_StateLoaded, mContext.pRender, NULL);
+	OMXsonienGraphLoad(pContext->pGraph);
 
-	// Loaded -> Free
-	if(isState(mContext.pCamera, OMX_StateLoaded)) OMX_FreeHandle(mContext.pCamera);
-	if(isState(mContext.pRender, OMX_StateLoaded)) OMX_FreeHandle(mContext.pRender);
+	if(pContext->pNodeCamera) pContext->pCamera = pContext->pNodeCamera->hComponent;
+	if(pContext->pNodeRender) pContext->pRender = pContext->pNodeRender->hComponent;
+}
 
-	OMXsonienDeinit();
-	OMX_Deinit();
+void componentConfigure(CONTEXT* pContext) {
+	OMX_PARAM_PORTDEFINITIONTYPE portDef;
+	OMX_VIDEO_PORTDEFINITIONTYPE* formatVideo;
 
-	print_log("Press enter to terminate.");
-	getchar();
+	OMX_INIT_STRUCTURE(portDef);
+	portDef.nPortIndex = 71;
+	if(pContext->pReplay) {
+		replay_port_definition(pContext->pReplay, &portDef);
+	}
+	else {
+		OMXsonienCall(OMX_GetParameter(pContext->pCamera, OMX_IndexParamPortDefinition, &portDef));
+	}
+	formatVideo = &portDef.format.video;
+	pContext->nSliceHeight	= formatVideo->nSliceHeight;
+	pContext->nSizeY = formatVideo->nFrameWidth * formatVideo->nSliceHeight;
+	pContext->nSizeU	= pContext->nSizeY / 4;
+	pContext->nSizeV	= pContext->nSizeY / 4;
+	print_log("%d %d %d", pContext->nSizeY, pContext->nSizeU, pContext->nSizeV);
+
+	// Record output of the camera as it is.
+	if(pContext->pRecordPath) {
+		if((pContext->pRecorder = replay_record_open(pContext->pRecordPath, &portDef)) == NULL) {
+			terminate(pContext);
+			exit(-1);
+		}
+	}
+
+	// Wait up for camera being ready.
+	while(!pContext->isCameraReady) {
+		print_log("Waiting until camera device is ready.");
+		usleep(100 * 1000);
+	}
+	print_log("Camera is ready.");
 }
 
-void componentLoad(OMX_CALLBACKTYPE* pCallbackOMX) {
-	OMX_ERRORTYPE err;
+void componentPrepare(CONTEXT* pContext) {
+	// Loaded -> Idle -> Executing. Buffers are allocated on the way to Idle.
+	OMXsonienGraphStart(pContext->pGraph);
+	pContext->pManagerCamera = OMXsonienGraphManager(pContext->pNodeCamera, 71);
+	pContext->pManagerRender = OMXsonienGraphManager(pContext->pNodeRender, 90);
+
+	// Allocate buffers to null sink
+	if(pContext->isHeadless) {
+		print_log("Allocate a frame to null sink.");
+		OMX_BUFFERHEADERTYPE* pBuffer = &pContext->bufferNullSink;
+		pBuffer->nAllocLen = pContext->config.nWidth * pContext->config.nHeight * 3 / 2;
+		if(posix_memalign((void**)&pBuffer->pBuffer, 64, pBuffer->nAllocLen) != 0) {
+			print_log("FAIL");
+			terminate(pContext);
+			exit(-1);
+		}
+		memset(pBuffer->pBuffer, 0x00, pBuffer->nAllocLen);
+	}
+
+	// Allocate buffer to replay
+	if(pContext->pReplay) {
+		print_log("Allocate buffer to replay.");
+		if((pContext->pBufferCameraOut = replay_allocate_buffer(pContext->pReplay, pContext)) == NULL) {
+			print_log("FAIL");
+			terminate(pContext);
+			exit(-1);
+		}
+	}
+}
 
-	// Loading component
-	print_log("Load %s", COMPONENT_CAMERA);
-	OMXsonienCheckError(OMX_GetHandle(&mContext.pCamera, COMPONENT_CAMERA, &mContext, pCallbackOMX));
-	print_log("Handler address : 0x%08x", mContext.pCamera);
+/*
+ * Hand a complete frame to the render. Null sink of headless mode takes the
+ * frame at once.
+ */
+void renderFrame(CONTEXT* pContext, OMX_BUFFERHEADERTYPE* pBuffer, unsigned long long nFrameBegin) {
+	if(pContext->isHeadless) {
+		pBuffer->nFilledLen = 0;
+	}
+	else {
+		__atomic_add_fetch(&pContext->nRenderHeld, 1, __ATOMIC_RELAXED);
+		OMXsonienBufferSend(pContext->pManagerRender, pBuffer);
+	}
 
-	print_log("Load %s", COMPONENT_RENDER);
-	OMXsonienCheckError(OMX_GetHandle(&mContext.pRender, COMPONENT_RENDER, &mContext, pCallbackOMX));
-	print_log("Handler address : 0x%08x", mContext.pRender);
+	pContext->nTimeLastFrame = stats_now();
+	stats_histogram_add(&pContext->latency, pContext->nTimeLastFrame - nFrameBegin);
+	if(__atomic_add_fetch(&pContext->nFrameCaptured, 1, __ATOMIC_RELAXED) == 1) {
+		pContext->nTimeFirstFrame = pContext->nTimeLastFrame;
+	}
+	if(pContext->nFrameLimit && pContext->nFrameCaptured >= pContext->nFrameLimit) {
+		pContext->isValid = OMX_FALSE;
+	}
 }
 
-void componentConfigure() {
-	OMX_ERRORTYPE err;
-	OMX_PARAM_PORTDEFINITIONTYPE portDef;
-	OMX_VIDEO_PORTDEFINITIONTYPE* formatVideo;
+/* Take the oldest pending frame out. */
+PENDING pendingPop(CONTEXT* pContext) {
+	PENDING pending = pContext->pending[0];
 
-	// Disable any unused ports
-	OMX_SendCommand(mContext.pCamera, OMX_CommandPortDisable, 70, NULL);
-	OMX_SendCommand(mContext.pCamera, OMX_CommandPortDisable, 72, NULL);
-	OMX_SendCommand(mContext.pCamera, OMX_CommandPortDisable, 73, NULL);
-
-	// Configure OMX_IndexParamCameraDeviceNumber callback enable to ensure whether camera is initialized properly.
-	print_log("Configure DeviceNumber callback enable.");
-	OMX_CONFIG_REQUESTCALLBACKTYPE configCameraCallback;
-	OMX_INIT_STRUCTURE(configCameraCallback);
-	configCameraCallback.nPortIndex	= OMX_ALL;	// Must Be OMX_ALL
-	configCameraCallback.nIndex 	= OMX_IndexParamCameraDeviceNumber;
-	configCameraCallback.bEnable 	= OMX_TRUE;
-	OMXsonienCheckError(OMX_SetConfig(mContext.pCamera, OMX_IndexConfigRequestCallback, &configCameraCallback));
-
-	// OMX CameraDeviceNumber set -> will trigger Camera Ready callback
-	print_log("Set CameraDeviceNumber parameter.");
-	OMX_PARAM_U32TYPE deviceNumber;
-	OMX_INIT_STRUCTURE(deviceNumber);
-	deviceNumber.nPortIndex = OMX_ALL;
-	deviceNumber.nU32 = 0;	// Mostly zero
-	OMXsonienCheckError(OMX_SetParameter(mContext.pCamera, OMX_IndexParamCameraDeviceNumber, &deviceNumber));
-
-	// Set video format of #71 port.
-	print_log("Set video format of the camera : Using #71.");
-	OMX_INIT_STRUCTURE(portDef);
-	portDef.nPortIndex = 71;
+	pContext->nPending--;
+	memmove(&pContext->pending[0], &pContext->pending[1], pContext->nPending * sizeof(PENDING));
+	return pending;
+}
 
-	print_log("Get non-initialized definition of #71.");
-	OMX_GetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef);
+/* Hand the pending frame to the render. */
+void pendingRender(CONTEXT* pContext, PENDING pending) {
+	renderFrame(pContext, pending.pBuffer, pending.nFrameBegin);
+	if(pContext->isPaced) {
+		pacer_release(&pContext->pacer, pending.nSlot, stats_now());
+	}
+}
 
-	print_log("Set up parameters of video format of #71.");
-	formatVideo = &portDef.format.video;
-	formatVideo->eColorFormat 	= OMX_COLOR_FormatYUV420PackedPlanar;
-	formatVideo->nFrameWidth	= mContext.nWidth;
-	formatVideo->nFrameHeight	= mContext.nHeight;
-	formatVideo->xFramerate		= mContext.nFramerate << 16;	// Fixed point. 1
-	formatVideo->nStride		= formatVideo->nFrameWidth;		// Stride 0 -> Raise segment fault.
-	OMXsonienCheckError(OMX_SetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef));
-
-	OMX_GetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef);
-	formatVideo = &portDef.format.video;
-	mContext.nSizeY = formatVideo->nFrameWidth * formatVideo->nSliceHeight;
-	mContext.nSizeU	= mContext.nSizeY / 4;
-	mContext.nSizeV	= mContext.nSizeY / 4;
-	print_log("%d %d %d", mContext.nSizeY, mContext.nSizeU, mContext.nSizeV);
+/*
+ * Send pending frames which are due while the render has room for them.
+ * Block lets the render queue them up.
+ */
+void pendingFlush(CONTEXT* pContext) {
+	while(pContext->nPending > 0) {
+		if(pContext->isPaced) {
+			unsigned long long nNow = stats_now();
+			if(nNow < pContext->pending[0].nSlot) {
+				break;
+			}
+			if(pacer_is_late(&pContext->pacer, pContext->pending[0].nSlot, nNow)) {
+				OMXsonienBufferPut(pContext->pManagerRender, pendingPop(pContext).pBuffer);
+				continue;
+			}
+		}
+		if(pContext->ePolicy != PolicyBlock && __atomic_load_n(&pContext->nRenderHeld, __ATOMIC_RELAXED) >= RENDER_DEPTH) {
+			break;
+		}
+		pendingRender(pContext, pendingPop(pContext));
+	}
+}
 
-	// Set video format of #90 port.
-	print_log("Set video format of the render : Using #90.");
-	OMX_INIT_STRUCTURE(portDef);
-	portDef.nPortIndex = 90;
+/*
+ * Frame is complete. Block sends it at once and the render queues it.
+ * Others keep it pending until the render has room, so it never holds
+ * more than RENDER_DEPTH frames and latency stays bounded. Paced frames
+ * are pending until their slot with any policy.
+ */
+void completeFrame(CONTEXT* pContext, OMX_BUFFERHEADERTYPE* pBuffer, unsigned long long nFrameBegin) {
+	unsigned long long nSlot = 0;
 
-	print_log("Get default definition of #90.");
-	OMX_GetParameter(mContext.pRender, OMX_IndexParamPortDefinition, &portDef);
+	if(pContext->isHeadless || (pContext->ePolicy == PolicyBlock && !pContext->isPaced)) {
+		renderFrame(pContext, pBuffer, nFrameBegin);
+		return;
+	}
 
-	print_log("Set up parameters of video format of #90.");
-	formatVideo = &portDef.format.video;
-	formatVideo->eColorFormat 		= OMX_COLOR_FormatYUV420PackedPlanar;
-	formatVideo->eCompressionFormat	= OMX_VIDEO_CodingUnused;
-	formatVideo->nFrameWidth		= mContext.nWidth;
-	formatVideo->nFrameHeight		= mContext.nHeight;
-	formatVideo->nStride			= mContext.nWidth;
-	formatVideo->nSliceHeight		= mContext.nHeight;
-	formatVideo->xFramerate			= mContext.nFramerate << 16;
-	OMXsonienCheckError(OMX_SetParameter(mContext.pRender, OMX_IndexParamPortDefinition, &portDef));
+	if(pContext->isPaced) {
+		if((nSlot = pacer_schedule(&pContext->pacer, OMX_TICKS_TO_S64(pBuffer->nTimeStamp), stats_now())) == 0) {
+			OMXsonienBufferPut(pContext->pManagerRender, pBuffer);
+			return;
+		}
+	}
 
-	// Configure rendering region
-	OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
-	OMX_INIT_STRUCTURE(displayRegion);
-	displayRegion.nPortIndex = 90;
-	displayRegion.dest_rect.width 	= mContext.nWidth;
-	displayRegion.dest_rect.height 	= mContext.nHeight;
-	displayRegion.set = OMX_DISPLAY_SET_NUM | OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_MODE | OMX_DISPLAY_SET_DEST_RECT;
-	displayRegion.mode = OMX_DISPLAY_MODE_FILL;
-	displayRegion.fullscreen = OMX_FALSE;
-	displayRegion.num = 0;
-	OMXsonienCheckError(OMX_SetConfig(mContext.pRender, OMX_IndexConfigDisplayRegion, &displayRegion));
+	if(pContext->nPending == pContext->nPendingMax) {
+		if(pContext->ePolicy == PolicyBlock) {
+			pendingRender(pContext, pendingPop(pContext));
+		}
+		else {
+			OMXsonienBufferPut(pContext->pManagerRender, pendingPop(pContext).pBuffer);
+			__atomic_add_fetch(&pContext->nFrameDiscarded, 1, __ATOMIC_RELAXED);
+		}
+	}
+	pContext->pending[pContext->nPending].pBuffer		= pBuffer;
+	pContext->pending[pContext->nPending].nFrameBegin	= nFrameBegin;
+	pContext->pending[pContext->nPending].nSlot		= nSlot;
+	pContext->nPending++;
+	pendingFlush(pContext);
+}
 
-	// Wait up for camera being ready.
-	while(!mContext.isCameraReady) {
-		print_log("Waiting until camera device is ready.");
-		usleep(100 * 1000);
+/*
+ * Get a buffer to fill the next frame in. NULL means the frame is skipped.
+ */
+OMX_BUFFERHEADERTYPE* nextFrame(CONTEXT* pContext) {
+	OMX_BUFFERHEADERTYPE* pBuffer;
+
+	if(pContext->isHeadless) {
+		return &pContext->bufferNullSink;
+	}
+	if((pBuffer = OMXsonienBufferGet(pContext->pManagerRender))) {
+		return pBuffer;
+	}
+
+	switch(pContext->ePolicy) {
+	case PolicyBlock :
+		// Camera buffer is not given back while waiting. Paced frames still go out.
+		TRACE_BEGIN("block");
+		while(pContext->isValid && !isInterrupted && pContext->pManagerRender->nBufferRemain == 0) {
+			pendingFlush(pContext);
+			usleep(100);
+		}
+		TRACE_END("block");
+		return pContext->isValid && !isInterrupted ? OMXsonienBufferGet(pContext->pManagerRender) : NULL;
+	default :
+		// Overwrite the oldest pending frame. Frames with the render are out of reach.
+		if(pContext->nPending == 0) {
+			return NULL;
+		}
+		pBuffer = pendingPop(pContext).pBuffer;
+		pBuffer->nFilledLen = 0;
+		__atomic_add_fetch(&pContext->nFrameDiscarded, 1, __ATOMIC_RELAXED);
+		return pBuffer;
 	}
-	print_log("Camera is ready.");
 }
 
-void componentPrepare() {
-	OMX_ERRORTYPE err;
-	OMX_PARAM_PORTDEFINITIONTYPE portDef;
+/*
+ * Report the frame to the controller and change framerate of the camera if
+ * it says so. Frames which are pending for their slot are not a backlog.
+ */
+void adaptFramerate(CONTEXT* pContext, unsigned long long nBusy) {
+	unsigned int nLostNow	= pContext->nFrameDropped + pContext->nFrameDiscarded;
+	unsigned int nDepth		= __atomic_load_n(&pContext->nRenderHeld, __ATOMIC_RELAXED);
+	unsigned int nFramerate;
 
-	// Request state of components to be IDLE.
-	// The command will turn the component into waiting mode.
-	// After allocating buffer to all enabled ports than the component will be IDLE.
-	print_log("STATE : CAMERA - IDLE request");
-	OMXsonienCheckError(OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateIdle, NULL));
+	if(!pContext->isPaced) nDepth += pContext->nPending;
+	adapt_frame(&pContext->adapt, nBusy, nDepth, nLostNow - pContext->nLostAdapted);
+	pContext->nLostAdapted = nLostNow;
 
-	print_log("STATE : RENDER - IDLE request");
-	OMXsonienCheckError(OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateIdle, NULL));
+	if((nFramerate = adapt_update(&pContext->adapt, stats_now())) == 0) {
+		return;
+	}
 
-	// Allocate buffers to render
-	print_log("Allocate buffer to renderer #90 for input.");
-	OMX_INIT_STRUCTURE(portDef);
-	portDef.nPortIndex = 90;
-	OMX_GetParameter(mContext.pRender, OMX_IndexParamPortDefinition, &portDef);
-	print_log("Size of predefined buffer : %d * %d", portDef.nBufferSize, portDef.nBufferCountActual);
-	mContext.pManagerRender = OMXsonienAllocateBuffer(mContext.pRender, 90, &mContext, 0, 0);
+	OMX_CONFIG_FRAMERATETYPE framerate;
+	OMX_INIT_STRUCTURE(framerate);
+	framerate.nPortIndex		= 71;
+	framerate.xEncodeFramerate	= nFramerate << 16;	// Fixed point. 1
+	if(OMX_SetConfig(pContext->pCamera, OMX_IndexConfigVideoFramerate, &framerate) != OMX_ErrorNone) {
+		print_log("ADAPT : Camera refused %d fps. Adaptation stops.", nFramerate);
+		pContext->isAdaptive = OMX_FALSE;
+		return;
+	}
+	pContext->nFramerate = nFramerate;
+}
 
-	// Allocate buffer to camera
-	OMX_INIT_STRUCTURE(portDef);
-	portDef.nPortIndex = 71;
-	OMX_GetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef);
-	print_log("Size of predefined buffer : %d * %d", portDef.nBufferSize, portDef.nBufferCountActual);
-	OMXsonienCheckError(OMX_AllocateBuffer(mContext.pCamera, &mContext.pBufferCameraOut, 71, &mContext, portDef.nBufferSize));
-
-	mContext.pSrcY 	= mContext.pBufferCameraOut->pBuffer;
-	mContext.pSrcU	= mContext.pSrcY + mContext.nSizeY;
-	mContext.pSrcV	= mContext.pSrcU + mContext.nSizeU;
-	print_log("0x%08x 0x%08x 0x%08x", mContext.pSrcY, mContext.pSrcU, mContext.pSrcV);
-
-	// Wait up for component being idle.
-	if(!wait_for_state_change(OMX_StateIdle, mContext.pRender, mContext.pCamera, NULL)) {
-		print_log("FAIL");
-		terminate();
-		exit(-1);
+/*
+ * Hand the camera buffer to be filled. onFillCameraOut is called either way.
+ */
+OMX_ERRORTYPE fillCameraOut(CONTEXT* pContext) {
+	if(pContext->pReplay) {
+		return replay_fill(pContext->pReplay, pContext->pBufferCameraOut);
+	}
+
+	return OMXsonienBufferSend(pContext->pManagerCamera, OMXsonienBufferGet(pContext->pManagerCamera));
+}
+
+void reportBenchmark(CONTEXT* pContext) {
+	unsigned int	nFrames		= pContext->nFrameCaptured;
+	double			nElapsed	= (pContext->nTimeLastFrame - pContext->nTimeFirstFrame) / 1e9;
+
+	if(nFrames < 2 || nElapsed <= 0) {
+		print_log("BENCHMARK : Not enough frames.");
+		return;
 	}
-	print_log("STATE : IDLE OK!");
+
+	// Interval is measured between first and last frame, so one frame less.
+	print_log("BENCHMARK : %dx%d @ %d fps requested, %d frames in %.3f s",
+			pContext->config.nWidth, pContext->config.nHeight, pContext->config.nFramerate, nFrames, nElapsed);
+	print_log("BENCHMARK : Sustained %.2f fps, %d frames dropped by camera, %d discarded by back-pressure",
+			(nFrames - 1) / nElapsed, pContext->nFrameDropped, pContext->nFrameDiscarded);
+	print_log("BENCHMARK : Latency p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us",
+			stats_histogram_percentile(&pContext->latency, 50) / 1000.0,
+			stats_histogram_percentile(&pContext->latency, 90) / 1000.0,
+			stats_histogram_percentile(&pContext->latency, 99) / 1000.0,
+			pContext->latency.nMax / 1000.0);
+
+	SWEEP_RESULT result;
+	result.nWidth		= pContext->config.nWidth;
+	result.nHeight		= pContext->config.nHeight;
+	result.nFramerate	= pContext->config.nFramerate;
+	result.nBuffers		= pContext->config.nRenderBuffers;
+	result.nFrames		= nFrames;
+	result.nDropped		= pContext->nFrameDropped + pContext->nFrameDiscarded;
+	result.nFPS			= (nFrames - 1) / nElapsed;
+	result.nLatencyP99	= stats_histogram_percentile(&pContext->latency, 99);
+	sweep_report(&result);
+}
+
+/*
+ * Trials of sweep run with the options of this run. Sweep sets resolution,
+ * framerate and render buffers of each trial by itself.
+ */
+OMX_BOOL sweepArgs(CONTEXT* pContext, SWEEP* pSweep, const char* pPolicy, const char* pPace, const char* pAdapt) {
+	CONFIG* pConfig = &pContext->config;
+	int isValid = 1;
+
+	if(pConfig->nCameraBuffers)	isValid &= sweep_add_arg(pSweep, "--camera-buffers=%u", pConfig->nCameraBuffers);
+	if(pConfig->nSliceHeight)	isValid &= sweep_add_arg(pSweep, "--slice-height=%u", pConfig->nSliceHeight);
+	if(pConfig->nDisplayWidth || pConfig->nDisplayHeight || pConfig->nDisplayX || pConfig->nDisplayY) {
+		isValid &= sweep_add_arg(pSweep, "--display=%d,%d,%ux%u", pConfig->nDisplayX, pConfig->nDisplayY,
+				pConfig->nDisplayWidth, pConfig->nDisplayHeight);
+	}
+	if(pConfig->isFullscreen)		isValid &= sweep_add_arg(pSweep, "--fullscreen=%d", pConfig->isFullscreen);
+	if(pConfig->nThreadPriority)	isValid &= sweep_add_arg(pSweep, "--priority=%d", pConfig->nThreadPriority);
+	if(pConfig->nThreadCPU >= 0)	isValid &= sweep_add_arg(pSweep, "--cpu=%d", pConfig->nThreadCPU);
+	if(pPolicy)	isValid &= sweep_add_arg(pSweep, "-P%s", pPolicy);
+	if(pPace)	isValid &= sweep_add_arg(pSweep, "-p%s", pPace);
+	if(pAdapt)	isValid &= sweep_add_arg(pSweep, "-A%s", pAdapt);
+
+	if(!isValid) print_log("SWEEP : Options are too long to give to the trials.");
+	return isValid ? OMX_TRUE : OMX_FALSE;
 }
 
-int main(void) {
+int main(int argc, char** argv) {
 	/* Temporary variables */
 	OMX_ERRORTYPE	err;
 	OMX_PARAM_PORTDEFINITIONTYPE	portDef;
+	int				opt;
+	SWEEP			sweep;
+
+	/* Initialize application variables. Every function reaches them through pContext. */
+	CONTEXT* pContext = calloc(1, sizeof(CONTEXT));
+	config_init(&pContext->config, 640, 480, 25);
+	pContext->isValid	= OMX_TRUE;
+	pContext->ePolicy	= PolicyBlock;
+
+	memset(&sweep, 0, sizeof(sweep));
+	sweep.nResolutions		= 1;
+	sweep.nBuffers			= 1;
+	sweep.nFramerateMin		= 1;
+	sweep.nFramerateMax		= 90;
+	sweep.nFrames			= 300;
+
+	OMX_BOOL isSweep	= OMX_FALSE;
+	OMX_BOOL isSweepResolutions	= OMX_FALSE;
+	OMX_BOOL isSweepBuffers		= OMX_FALSE;
+	const char* pSweepPolicy	= NULL;
+	const char* pSweepPace		= NULL;
+	const char* pSweepAdapt		= NULL;
+	OMX_BOOL isValid	= OMX_TRUE;
+	const char* pReplayPath		= NULL;
+	OMX_BOOL isReplayRealtime	= OMX_TRUE;
+	unsigned int nPaceFramerate	= 0;
+	unsigned int nPaceDelay		= 0;
+	unsigned int nAdaptFramerateMin	= 0;
+	while((opt = getopt_long(argc, argv, CONFIG_SHORT_OPTIONS "n:b:S:R:F:C:Ho:i:mP:p:A:", config_options, NULL)) != -1) {
+		switch(opt) {
+		case 'n' :
+			isValid = config_uint(optarg, &pContext->nFrameLimit);
+			sweep.nFrames			= pContext->nFrameLimit;
+			break;
+		case 'b' :
+			pContext->isHeadless		= OMX_TRUE;
+			isValid = config_uint(optarg, &pContext->nFrameLimit);
+			break;
+		case 'S' :
+			isSweep					= OMX_TRUE;
+			sweep.pOutput			= optarg;
+			break;
+		case 'R' :
+			isValid = sweep_parse_resolutions(&sweep, optarg);
+			isSweepResolutions		= OMX_TRUE;
+			break;
+		case 'F' :
+			isValid = sscanf(optarg, "%u-%u", &sweep.nFramerateMin, &sweep.nFramerateMax) == 2
+					&& sweep.nFramerateMin > 0 && sweep.nFramerateMin <= sweep.nFramerateMax;
+			break;
+		case 'C' :
+			isValid = sweep_parse_buffers(&sweep, optarg);
+			isSweepBuffers			= OMX_TRUE;
+			break;
+		case 'H' :
+			sweep.isHeadless		= OMX_TRUE;
+			break;
+		case 'o' :
+			pContext->pRecordPath	= optarg;
+			break;
+		case 'i' :
+			pReplayPath				= optarg;
+			break;
+		case 'm' :
+			isReplayRealtime		= OMX_FALSE;
+			break;
+		case 'P' :
+			if(strcmp(optarg, "block") == 0)			pContext->ePolicy = PolicyBlock;
+			else if(strcmp(optarg, "drop-oldest") == 0)	pContext->ePolicy = PolicyDropOldest;
+			else if(strcmp(optarg, "latest") == 0)		pContext->ePolicy = PolicyLatest;
+			else isValid = OMX_FALSE;
+			pSweepPolicy			= optarg;
+			break;
+		case 'p' :
+			nPaceDelay = 0;
+			isValid = sscanf(optarg, "%u,%u", &nPaceFramerate, &nPaceDelay) >= 1;
+			pContext->isPaced		= OMX_TRUE;
+			pSweepPace				= optarg;
+			break;
+		case 'A' :
+			isValid = config_uint(optarg, &nAdaptFramerateMin) && nAdaptFramerateMin > 0;
+			pContext->isAdaptive		= OMX_TRUE;
+			pSweepAdapt				= optarg;
+			break;
+		default :
+			isValid = config_option(&pContext->config, opt, optarg);
+		}
 
-	/* Initialize application variables */
-	memset(&mContext, 0, (size_t)sizeof(mContext));
-	mContext.nWidth 	= 640;
-	mContext.nHeight 	= 480;
-	mContext.nFramerate	= 25;
-	mContext.isValid	= OMX_TRUE;
+		if(!isValid) {
+			fprintf(stderr, "Usage : %s [options] [-n frames | -b frames] [-o record | -i record [-m]] [-P block|drop-oldest|latest] [-p fps[,delay]] [-A min fps]\n", argv[0]);
+			fprintf(stderr, "        %s -S result.csv|result.json [-R WxH,...] [-F min-max] [-C count,...] [-n frames] [-H]\n", argv[0]);
+			config_usage(stderr);
+			exit(-1);
+		}
+	}
+	if(isSweep) {
+		// Without lists of their own, trials take resolution and render buffers of the options.
+		if(!isSweepResolutions) {
+			sweep.resolutions[0][0]	= pContext->config.nWidth;
+			sweep.resolutions[0][1]	= pContext->config.nHeight;
+		}
+		if(!isSweepBuffers) sweep.buffers[0] = pContext->config.nRenderBuffers;
+		if(sweep.isHeadless && pContext->isPaced) {
+			fprintf(stderr, "Pacing needs the render.\n");
+			exit(-1);
+		}
+		if(!config_validate(&pContext->config) || !sweepArgs(pContext, &sweep, pSweepPolicy, pSweepPace, pSweepAdapt)) {
+			exit(-1);
+		}
+		exit(sweep_run(&sweep, "/proc/self/exe") == 0 ? 0 : -1);
+	}
+	if(pContext->isHeadless && pContext->nFrameLimit == 0) {
+		fprintf(stderr, "Number of frames must not be zero.\n");
+		exit(-1);
+	}
+	if(pContext->isHeadless && pContext->isPaced) {
+		fprintf(stderr, "Pacing needs the render.\n");
+		exit(-1);
+	}
+	// Paced frames wait for their slot, so playout delay takes room.
+	pContext->nPendingMax = pContext->ePolicy == PolicyLatest ? 1 : PENDING_DROP;
+	if(pContext->isPaced) {
+		pContext->nPendingMax = PENDING_MAX;
+		// Otherwise frames with a slot are taken back for the next one.
+		if(pContext->config.nRenderBuffers < RENDER_DEPTH + PENDING_MAX + 1) {
+			pContext->config.nRenderBuffers = RENDER_DEPTH + PENDING_MAX + 1;
+			print_log("PACE : %d render buffers for frames waiting for their slot.", pContext->config.nRenderBuffers);
+		}
+	}
+	if(!config_validate(&pContext->config)) {
+		exit(-1);
+	}
+	config_print(&pContext->config);
+
+	// Replay takes the place of the camera.
+	if(pReplayPath) {
+		if((pContext->pReplay = replay_open(pReplayPath, isReplayRealtime)) == NULL) {
+			exit(-1);
+		}
+	}
 
 	// RPI initialize.
 	bcm_host_init();
@@ -333,9 +798,9 @@ int main(void) {
 		exit(-1);
 	}
 
-	// OMXsonien helper initialize
-	OMXsonienInit();
-	OMXsonienSetErrorCallback(onOMXsonienError);
+	// OMXsonien helper initialize. Buffer managers and errors stay with this pipeline.
+	pContext->pOMXsonien = OMXsonienCreate();
+	OMXsonienSetErrorHandler(pContext->pOMXsonien, onOMXsonienError, pContext);
 
 	// For loading component, Callback shall provide.
 	OMX_CALLBACKTYPE callbackOMX;
@@ -343,23 +808,22 @@ int main(void) {
 	callbackOMX.EmptyBufferDone	= onEmptyRenderIn;
 	callbackOMX.FillBufferDone	= onFillCameraOut;
 
-	componentLoad(&callbackOMX);
-	componentConfigure();
-	componentPrepare();
-
-	// Request state of component to be EXECUTE.
-	print_log("STATE : CAMERA - EXECUTING request");
-	OMXsonienCheckError(OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateExecuting, NULL));
+	componentLoad(pContext, &callbackOMX);
+	componentConfigure(pContext);
+	componentPrepare(pContext);
 
-	print_log("STATE : RENDER - EXECUTING request");
-	OMXsonienCheckError(OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateExecuting, NULL));
-
-	if(!wait_for_state_change(OMX_StateExecuting, mContext.pCamera, mContext.pRender, NULL)) {
-		print_log("FAIL");
-		terminate();
-		exit(-1);
+	// Framerate of replay is known after loading.
+	if(pContext->isPaced) {
+		pacer_init(&pContext->pacer, nPaceFramerate ? nPaceFramerate : pContext->config.nFramerate, nPaceDelay * 1000000ULL);
+	}
+	pContext->nFramerate = pContext->config.nFramerate;
+	if(pContext->isAdaptive && pContext->pReplay) {
+		print_log("ADAPT : Replay runs at recorded framerate. Adaptation is off.");
+		pContext->isAdaptive = OMX_FALSE;
+	}
+	if(pContext->isAdaptive) {
+		adapt_init(&pContext->adapt, pContext->config.nFramerate, nAdaptFramerateMin);
 	}
-	print_log("STATE : EXECUTING OK!");
 
 	// Since #71 is capturing port, needs capture signal like other handy capture devices
 	print_log("Capture start.");
@@ -367,45 +831,121 @@ int main(void) {
 	OMX_INIT_STRUCTURE(portCapturing);
 	portCapturing.nPortIndex = 71;
 	portCapturing.bEnabled = OMX_TRUE;
-	OMX_SetConfig(mContext.pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	if(pContext->pReplay) {
+		replay_start(pContext->pReplay, onFillCameraOut, pContext);
+	}
+	else {
+		OMX_SetConfig(pContext->pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	}
 
 	// Set signal interrupt handler
 	signal(SIGINT, 	onSignal);
 	signal(SIGTSTP, onSignal);
 	signal(SIGTERM, onSignal);
 
+	// Account CPU time of copy loop and FPS counter
+	cpu_thread_register("main");
+	config_apply_thread(&pContext->config);
+
 	// Create FPS counter thread
-	pthread_create(&mContext.thread_fps, NULL, thread_fps_counter, NULL);
+	pthread_create(&pContext->thread_fps, NULL, thread_fps_counter, pContext);
+
+	// Serve metrics if OMX_METRICS names the socket path.
+	metrics_add_u32("omx_fps", "Frames rendered during the last second.", MetricGauge, &pContext->nFPS);
+	metrics_add_u32("omx_camera_framerate", "Framerate of the camera, lowered by -A under overload.", MetricGauge, &pContext->nFramerate);
+	metrics_add_u32("omx_frames_captured_total", "Frames sent to the render.", MetricCounter, &pContext->nFrameCaptured);
+	metrics_add_u32("omx_frames_dropped_total", "Frames the camera skipped, detected by nTimeStamp gap.", MetricCounter, &pContext->nFrameDropped);
+	metrics_add_u32("omx_frames_discarded_total", "Frames dropped by back-pressure policy.", MetricCounter, &pContext->nFrameDiscarded);
+	if(pContext->pManagerRender) {
+		metrics_add_u32("omx_render_buffer_remain", "Render buffers owned by the client (nBufferRemain).", MetricGauge, &pContext->pManagerRender->nBufferRemain);
+	}
+	metrics_add_histogram("omx_frame_latency_seconds", "First slice arrival to OMX_EmptyThisBuffer.", &pContext->latency, 1e-9);
+	if(pContext->isPaced) {
+		metrics_add_histogram("omx_pacing_error_seconds", "OMX_EmptyThisBuffer behind the slot of the frame.", &pContext->pacer.error, 1e-9);
+		metrics_add_histogram("omx_pacing_jitter_seconds", "Deviation of interval between frames from the display interval.", &pContext->pacer.jitter, 1e-9);
+	}
+	metrics_start(getenv("OMX_METRICS"));
 
 	OMX_U8*			pY = NULL;
 	OMX_U8*			pU = NULL;
 	OMX_U8*			pV = NULL;
-	unsigned int	nOffsetU 	= mContext.nWidth * mContext.nHeight;
+	unsigned int	nOffsetU 	= pContext->config.nWidth * pContext->config.nHeight;
 	unsigned int 	nOffsetV 	= nOffsetU * 5 / 4;
+	unsigned int	nRow		= 0;		// Rows of the frame copied
+
+	fillCameraOut(pContext);
+	OMX_BUFFERHEADERTYPE* pCurrentBuffer = NULL;
+	OMX_BOOL isSkipping = OMX_FALSE;
+	unsigned long long nFrameBusy = 0;		// nsec, copy time of the frame
 
-	OMX_FillThisBuffer(mContext.pCamera, mContext.pBufferCameraOut);
-	OMX_BUFFERHEADERTYPE* pCurrentBuffer = OMXsonienBufferGet(mContext.pManagerRender);
+	while(pContext->isValid) {
+		if(isInterrupted) {
+			pContext->isValid = OMX_FALSE;
+			break;
+		}
 
-	while(mContext.isValid) {
-		if(mContext.isFilled) {
-			if(pCurrentBuffer->nFilledLen == 0) {
-				pY = pCurrentBuffer->pBuffer;
-				pU = pY + nOffsetU;
-				pV = pY + nOffsetV;
+		// Render may have emptied a buffer since.
+		pendingFlush(pContext);
+
+		if(pContext->isFilled) {
+			replay_record(pContext->pRecorder, pContext->pBufferCameraOut);
+			if(pCurrentBuffer == NULL && !isSkipping) {
+				if((pCurrentBuffer = nextFrame(pContext)) == NULL) {
+					isSkipping = OMX_TRUE;
+				}
+				else {
+					pY = pCurrentBuffer->pBuffer;
+					pU = pY + nOffsetU;
+					pV = pY + nOffsetV;
+					nRow = 0;
+					pContext->nFrameBegin = stats_now();
+				}
 			}
 
-			memcpy(pY, mContext.pSrcY, mContext.nSizeY);	pY += mContext.nSizeY;
-			memcpy(pU, mContext.pSrcU, mContext.nSizeU);	pU += mContext.nSizeU;
-			memcpy(pV, mContext.pSrcV, mContext.nSizeV);	pV += mContext.nSizeV;
-			pCurrentBuffer->nFilledLen += mContext.pBufferCameraOut->nFilledLen;
+			if(pCurrentBuffer && pContext->pBufferCameraOut->nFilledLen && nRow < pContext->config.nHeight) {
+				// Last slice is padded to multiple of 16 lines. Padding is not copied.
+				unsigned int nRows = pContext->config.nHeight - nRow;
+				if(nRows > pContext->nSliceHeight) nRows = pContext->nSliceHeight;
+				unsigned int nSizeY	= pContext->config.nWidth * nRows;
+				unsigned int nSizeC	= nSizeY / 4;
+
+				// V plane comes last, so it is the one to reach the end of the buffer.
+				if(pV + nSizeC > pCurrentBuffer->pBuffer + pCurrentBuffer->nAllocLen) {
+					print_log("Frame does not fit in %d bytes of the buffer.", pCurrentBuffer->nAllocLen);
+					pContext->isValid = OMX_FALSE;
+					break;
+				}
+				unsigned long long nCopyBegin = stats_now();
+				TRACE_BEGIN("copy");
+				memcpy(pY, pContext->pSrcY, nSizeY);	pY += nSizeY;
+				memcpy(pU, pContext->pSrcU, nSizeC);	pU += nSizeC;
+				memcpy(pV, pContext->pSrcV, nSizeC);	pV += nSizeC;
+				TRACE_END("copy");
+				nFrameBusy += stats_now() - nCopyBegin;
+				pCurrentBuffer->nFilledLen += nSizeY + nSizeC * 2;
+				nRow += nRows;
+			}
 
-			if(mContext.pBufferCameraOut->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) {
-				OMX_EmptyThisBuffer(mContext.pRender, pCurrentBuffer);
-				mContext.nFrameCaptured++;
-				pCurrentBuffer = OMXsonienBufferGet(mContext.pManagerRender);
+			if(pContext->pBufferCameraOut->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) {
+				countDroppedFrames(pContext, pContext->pBufferCameraOut);
+				if(pCurrentBuffer) {
+					pCurrentBuffer->nTimeStamp = pContext->pBufferCameraOut->nTimeStamp;
+					completeFrame(pContext, pCurrentBuffer, pContext->nFrameBegin);
+				}
+				else {
+					// Render holds every buffer. Camera keeps running.
+					__atomic_add_fetch(&pContext->nFrameDiscarded, 1, __ATOMIC_RELAXED);
+				}
+				pCurrentBuffer	= NULL;
+				isSkipping		= OMX_FALSE;
+				if(pContext->isAdaptive) adaptFramerate(pContext, nFrameBusy);
+				nFrameBusy		= 0;
 			}
-			mContext.isFilled = OMX_FALSE;
-			OMX_FillThisBuffer(mContext.pCamera, mContext.pBufferCameraOut);
+			pContext->isFilled = OMX_FALSE;
+			fillCameraOut(pContext);
+		}
+		else if(pContext->pReplay && replay_is_end(pContext->pReplay)) {
+			pContext->isValid = OMX_FALSE;
 		}
 
 		usleep(1);
@@ -414,9 +954,26 @@ int main(void) {
 	signal(SIGTSTP, SIG_DFL);
 	signal(SIGTERM, SIG_DFL);
 
+	// Frame being filled goes back, so no buffer is left with the client when freed.
+	if(pContext->pManagerRender && pCurrentBuffer) {
+		OMXsonienBufferPut(pContext->pManagerRender, pCurrentBuffer);
+	}
+	while(pContext->nPending > 0) {
+		OMXsonienBufferPut(pContext->pManagerRender, pendingPop(pContext).pBuffer);
+	}
+
 	portCapturing.bEnabled = OMX_FALSE;
-	OMX_SetConfig(mContext.pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	if(pContext->pCamera) {
+		OMX_SetConfig(pContext->pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	}
 	print_log("Capture stop.");
 
-	terminate();
+	if(pContext->nFrameLimit) reportBenchmark(pContext);
+	if(pContext->isPaced) pacer_report(&pContext->pacer);
+	if(pContext->isAdaptive) {
+		print_log("ADAPT : %d changes, %d fps at last, between %d and %d fps",
+				pContext->adapt.nChanges, pContext->nFramerate, pContext->adapt.nFramerateMin, pContext->adapt.nFramerateMax);
+	}
+	terminate(pContext);
+	free(pContext);
 }
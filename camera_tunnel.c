@@ -19,6 +19,8 @@
 #include <IL/OMX_Broadcom.h>
 
 #include "common.h"
+#include "config.h"
+#include "OMXsonienGraph.h"
 
 #define	COMPONENT_CAMERA	"OMX.broadcom.camera"
 #define COMPONENT_RENDER	"OMX.broadcom.video_render"
@@ -28,10 +30,9 @@ typedef struct {
 	OMX_HANDLETYPE			pCamera;
 	OMX_HANDLETYPE			pRender;
 	OMX_BOOL				isCameraReady;
+	OMXsonien_GRAPH*		pGraph;
 
-	unsigned int			nWidth;
-	unsigned int			nHeight;
-	unsigned int			nFramerate;
+	CONFIG					config;
 } CONTEXT;
 CONTEXT mContext;
 
@@ -59,164 +60,75 @@ OMX_ERRORTYPE onOMXevent (
 	return OMX_ErrorNone;
 }
 
+/* Callback : Error detection callback of OMXsonien */
+void onOMXsonienError(OMX_ERRORTYPE err) {
+	printf("Error : 0x%08x\n", err);
+	terminate();
+	exit(-1);
+}
+
 void terminate() {
 	print_log("On terminating...");
 
-	OMX_STATETYPE state;
-	OMX_BOOL bWaitForCamera, bWaitForRender;
-
-	// Execute -> Idle
-	bWaitForCamera = bWaitForRender = OMX_FALSE;
-	if(isState(mContext.pCamera, OMX_StateExecuting)) {
-		OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateIdle, NULL);
-		bWaitForCamera = OMX_TRUE;
-	}
-	if(isState(mContext.pRender, OMX_StateExecuting)) {
-		OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateIdle, NULL);
-		bWaitForRender = OMX_TRUE;
-	}
-	if(bWaitForCamera) wait_for_state_change(OMX_StateIdle, mContext.pCamera, NULL);
-	if(bWaitForRender) wait_for_state_change(OMX_StateIdle, mContext.pRender, NULL);
-
-	// Idle -> Loaded
-	bWaitForCamera = bWaitForRender = OMX_FALSE;
-	if(isState(mContext.pCamera, OMX_StateIdle)) {
-		OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateLoaded, NULL);
-		bWaitForCamera = OMX_TRUE;
-	}
-	if(isState(mContext.pRender, OMX_StateIdle)) {
-		OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateLoaded, NULL);
-		bWaitForRender = OMX_TRUE;
-	}
-	if(bWaitForCamera) wait_for_state_change(OMX_StateLoaded, mContext.pCamera, NULL);
-	if(bWaitForRender) wait_for_state_change(OMX_StateLoaded, mContext.pRender, NULL);
-
-	// Loaded -> Free
-	if(isState(mContext.pCamera, OMX_StateLoaded)) OMX_FreeHandle(mContext.pCamera);
-	if(isState(mContext.pRender, OMX_StateLoaded)) OMX_FreeHandle(mContext.pRender);
+	// Executing -> Idle -> Loaded -> Free, render first.
+	OMXsonienGraphDestroy(mContext.pGraph);
+	mContext.pGraph		= NULL;
+	mContext.pCamera	= NULL;
+	mContext.pRender	= NULL;
 
+	OMXsonienDeinit();
 	OMX_Deinit();
 
 	print_log("Press enter to terminate.");
 	getchar();
 }
 
-void componentLoad(OMX_CALLBACKTYPE* pCallbackOMX) {
-	OMX_ERRORTYPE err;
-
-	// Loading component
-	print_log("Load %s", COMPONENT_CAMERA);
-	if((err = OMX_GetHandle(&mContext.pCamera, COMPONENT_CAMERA, &mContext, pCallbackOMX)) != OMX_ErrorNone ) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
-	print_log("Handler address : 0x%08x", mContext.pCamera);
-
-	print_log("Load %s", COMPONENT_RENDER);
-	if((err = OMX_GetHandle(&mContext.pRender, COMPONENT_RENDER, &mContext, pCallbackOMX)) != OMX_ErrorNone ) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
-	print_log("Handler address : 0x%08x", mContext.pRender);
+/* Graph : Called before video format of the render is set. */
+OMX_ERRORTYPE configureRender(OMX_HANDLETYPE hComponent, OMX_PTR pAppData) {
+	// Configure rendering region
+	OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
+	OMX_INIT_STRUCTURE(displayRegion);
+	displayRegion.nPortIndex = 90;
+	config_display_region(&((CONTEXT*)pAppData)->config, &displayRegion);
+	displayRegion.set = OMX_DISPLAY_SET_NUM | OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_MODE | OMX_DISPLAY_SET_DEST_RECT;
+	displayRegion.mode = OMX_DISPLAY_MODE_FILL;
+	displayRegion.num = 0;
+	return OMX_SetConfig(hComponent, OMX_IndexConfigDisplayRegion, &displayRegion);
 }
 
-void componentConfigure() {
-	OMX_ERRORTYPE err;
-	OMX_PARAM_PORTDEFINITIONTYPE portDef;
-	OMX_VIDEO_PORTDEFINITIONTYPE* formatVideo;
-
-	// Disable any unused ports
-	OMX_SendCommand(mContext.pCamera, OMX_CommandPortDisable, 70, NULL);
-	OMX_SendCommand(mContext.pCamera, OMX_CommandPortDisable, 72, NULL);
-	OMX_SendCommand(mContext.pCamera, OMX_CommandPortDisable, 73, NULL);
-
-	// Configure OMX_IndexParamCameraDeviceNumber callback enable to ensure whether camera is initialized properly.
-	print_log("Configure DeviceNumber callback enable.");
-	OMX_CONFIG_REQUESTCALLBACKTYPE configCameraCallback;
-	OMX_INIT_STRUCTURE(configCameraCallback);
-	configCameraCallback.nPortIndex	= OMX_ALL;	// Must Be OMX_ALL
-	configCameraCallback.nIndex 	= OMX_IndexParamCameraDeviceNumber;
-	configCameraCallback.bEnable 	= OMX_TRUE;
-	if((err = OMX_SetConfig(mContext.pCamera, OMX_IndexConfigRequestCallback, &configCameraCallback)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
+/*
+ * Camera #71 -> Render #90 in tunnel. Graph disables the other ports of the camera.
+ */
+void componentLoad(OMX_CALLBACKTYPE* pCallbackOMX) {
+	OMXsonien_VIDEOFORMAT format;
 
-	// OMX CameraDeviceNumber set -> will trigger Camera Ready callback
-	print_log("Set CameraDeviceNumber parameter.");
-	OMX_PARAM_U32TYPE deviceNumber;
-	OMX_INIT_STRUCTURE(deviceNumber);
-	deviceNumber.nPortIndex = OMX_ALL;
-	deviceNumber.nU32 = 0;	// Mostly zero
-	if((err = OMX_SetParameter(mContext.pCamera, OMX_IndexParamCameraDeviceNumber, &deviceNumber)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
+	mContext.pGraph = OMXsonienGraphCreate(pCallbackOMX, &mContext);
+	OMXsonien_GRAPHNODE* pNodeCamera = OMXsonienGraphAdd(mContext.pGraph, COMPONENT_CAMERA, OMXsonienConfigureCamera);
+	OMXsonien_GRAPHNODE* pNodeRender = OMXsonienGraphAdd(mContext.pGraph, COMPONENT_RENDER, configureRender);
 
 	// Set video format of #71 port.
-	print_log("Set video format of the camera : Using #71.");
-	OMX_INIT_STRUCTURE(portDef);
-	portDef.nPortIndex = 71;
-
-	print_log("Get non-initialized definition of #71.");
-	OMX_GetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef);
-
-	print_log("Set up parameters of video format of #71.");
-	formatVideo = &portDef.format.video;
-	formatVideo->eColorFormat 	= OMX_COLOR_FormatYUV420PackedPlanar;
-	formatVideo->nFrameWidth	= mContext.nWidth;
-	formatVideo->nFrameHeight	= mContext.nHeight;
-	formatVideo->xFramerate		= mContext.nFramerate << 16;	// Fixed point. 1
-	formatVideo->nStride		= formatVideo->nFrameWidth;		// Stride 0 -> Raise segment fault.
-	if((err = OMX_SetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
-	OMX_GetParameter(mContext.pCamera, OMX_IndexParamPortDefinition, &portDef);
+	memset(&format, 0x00, sizeof(format));
+	format.eColorFormat		= OMX_COLOR_FormatYUV420PackedPlanar;
+	format.nFrameWidth		= mContext.config.nWidth;
+	format.nFrameHeight		= mContext.config.nHeight;
+	format.xFramerate		= mContext.config.nFramerate << 16;	// Fixed point. 1
+	format.nSliceHeight		= mContext.config.nSliceHeight;
+	format.nBufferCount		= mContext.config.nCameraBuffers;
+	OMXsonienGraphFormat(pNodeCamera, 71, &format);
 
 	// Set video format of #90 port.
-	print_log("Set video format of the render : Using #90.");
-	OMX_INIT_STRUCTURE(portDef);
-	portDef.nPortIndex = 90;
-
-	print_log("Get default definition of #90.");
-	OMX_GetParameter(mContext.pRender, OMX_IndexParamPortDefinition, &portDef);
-
-	print_log("Set up parameters of video format of #90.");
-	formatVideo = &portDef.format.video;
-	formatVideo->eColorFormat 		= OMX_COLOR_FormatYUV420PackedPlanar;
-	formatVideo->nFrameWidth		= mContext.nWidth;
-	formatVideo->nFrameHeight		= mContext.nHeight;
-	formatVideo->nStride			= mContext.nWidth;
-	formatVideo->nSliceHeight		= mContext.nHeight;
-	formatVideo->xFramerate			= mContext.nFramerate << 16;
-	if((err = OMX_SetParameter(mContext.pRender, OMX_IndexParamPortDefinition, &portDef)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
+	format.nSliceHeight		= mContext.config.nHeight;
+	format.nBufferCount		= mContext.config.nRenderBuffers;
+	OMXsonienGraphFormat(pNodeRender, 90, &format);
 
-	// Configure rendering region
-	OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
-	OMX_INIT_STRUCTURE(displayRegion);
-	displayRegion.nPortIndex = 90;
-	displayRegion.dest_rect.width 	= mContext.nWidth;
-	displayRegion.dest_rect.height 	= mContext.nHeight;
-	displayRegion.set = OMX_DISPLAY_SET_NUM | OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_MODE | OMX_DISPLAY_SET_DEST_RECT;
-	displayRegion.mode = OMX_DISPLAY_MODE_FILL;
-	displayRegion.fullscreen = OMX_FALSE;
-	displayRegion.num = 0;
-	if((err = OMX_SetConfig(mContext.pRender, OMX_IndexConfigDisplayRegion, &displayRegion)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
+	OMXsonienGraphTunnel(mContext.pGraph, pNodeCamera, 71, pNodeRender, 90);
+	OMXsonienGraphLoad(mContext.pGraph);
+
+	mContext.pCamera = pNodeCamera->hComponent;
+	mContext.pRender = pNodeRender->hComponent;
+}
 
+void componentConfigure() {
 	// Wait up for camera being ready.
 	while(!mContext.isCameraReady) {
 		print_log("Waiting until camera device is ready.");
@@ -225,49 +137,18 @@ void componentConfigure() {
 	print_log("Camera is ready.");
 }
 
-void componentTunnel() {
-	OMX_ERRORTYPE err;
-	OMX_PARAM_PORTDEFINITIONTYPE portDef;
-
-	print_log("SETUP Tunnel.");
-	if((err = OMX_SetupTunnel(mContext.pCamera, 71, mContext.pRender, 90)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
-
-	print_log("STATE : CAMERA - IDLE request");
-	if((err = OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateIdle, NULL)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
-
-	print_log("STATE : RENDER - IDLE request");
-	if((err = OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateIdle, NULL)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
-
-	if(!wait_for_state_change(OMX_StateIdle, mContext.pCamera, mContext.pRender, NULL)) {
-		print_log("FAIL");
-		terminate();
-		exit(-1);
-	}
-	print_log("STATE : IDLE OK!");
-}
-
-int main(void) {
+int main(int argc, char** argv) {
 	/* Temporary variables */
 	OMX_ERRORTYPE	err;
 	OMX_PARAM_PORTDEFINITIONTYPE	portDef;
 
 	/* Initialize application variables */
 	memset(&mContext, 0, (size_t)sizeof(mContext));
-	mContext.nWidth 	= 1280;
-	mContext.nHeight 	= 960;
-	mContext.nFramerate	= 30;
+	config_init(&mContext.config, 1280, 960, 30);
+	if(!config_parse(&mContext.config, argc, argv)) {
+		exit(-1);
+	}
+	config_print(&mContext.config);
 
 	// RPI initialize.
 	bcm_host_init();
@@ -280,6 +161,10 @@ int main(void) {
 		exit(-1);
 	}
 
+	// OMXsonien helper initialize
+	OMXsonienInit();
+	OMXsonienSetErrorCallback(onOMXsonienError);
+
 	// For loading component, Callback shall provide.
 	OMX_CALLBACKTYPE callbackOMX;
 	callbackOMX.EventHandler	= onOMXevent;
@@ -288,29 +173,9 @@ int main(void) {
 
 	componentLoad(&callbackOMX);
 	componentConfigure();
-	componentTunnel();
 
-	// Request state of component to be EXECUTE.
-	print_log("STATE : CAMERA - EXECUTING request");
-	if((err = OMX_SendCommand(mContext.pCamera, OMX_CommandStateSet, OMX_StateExecuting, NULL)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
-
-	print_log("STATE : RENDER - EXECUTING request");
-	if((err = OMX_SendCommand(mContext.pRender, OMX_CommandStateSet, OMX_StateExecuting, NULL)) != OMX_ErrorNone) {
-		print_omx_error(err, "FAIL");
-		terminate();
-		exit(-1);
-	}
-
-	if(!wait_for_state_change(OMX_StateExecuting, mContext.pCamera, mContext.pRender, NULL)) {
-		print_log("FAIL");
-		terminate();
-		exit(-1);
-	}
-	print_log("STATE : EXECUTING OK!");
+	// Loaded -> Idle -> Executing, every component together.
+	OMXsonienGraphStart(mContext.pGraph);
 
 	// Since #71 is capturing port, needs capture signal like other handy capture devices
 	print_log("Capture start.");
@@ -319,6 +184,8 @@ int main(void) {
 	portCapturing.nPortIndex = 71;
 	portCapturing.bEnabled = OMX_TRUE;
 	OMX_SetConfig(mContext.pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	cpu_thread_register("main");
+	config_apply_thread(&mContext.config);
 
 	print_log("Capture for 5 second.");
 	usleep(5 * 1000 * 1000);
@@ -326,6 +193,7 @@ int main(void) {
 	portCapturing.bEnabled = OMX_FALSE;
 	OMX_SetConfig(mContext.pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
 	print_log("Capture stop.");
+	cpu_report_total(0);
 
 	terminate();
 }
@@ -0,0 +1,344 @@
+/*
+ ============================================================================
+ Name        : camera_tunnel_tap.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : This is tutorial of OpenMAX to display in tunnel and analyze
+               frames at the same time.
+               Camera #71 tunnels to video_splitter #250, and #251 tunnels to
+               the render, so display runs at full rate without the client.
+               #252 is delivered to the client, which hands a buffer only at
+               the tap rate. Splitter skips an output without a buffer, so
+               frames between taps cost nothing.
+
+               Usage : camera_tunnel_tap [options] [-t tap fps] [-s seconds]
+               -t 0 never taps.
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <bcm_host.h>
+
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Component.h>
+#include <IL/OMX_Video.h>
+#include <IL/OMX_Broadcom.h>
+
+#include "common.h"
+#include "config.h"
+#include "OMXsonienGraph.h"
+
+#define	COMPONENT_CAMERA	"OMX.broadcom.camera"
+#define COMPONENT_SPLITTER	"OMX.broadcom.video_splitter"
+#define COMPONENT_RENDER	"OMX.broadcom.video_render"
+
+/* Application variant */
+typedef struct {
+	OMX_HANDLETYPE				pCamera;
+	OMX_BOOL					isCameraReady;
+	OMXsonien_GRAPH*			pGraph;
+	OMXsonien_GRAPHNODE*		pNodeSplitter;
+
+	CONFIG						config;
+
+	unsigned int				nTapRate;			// fps. 0 : Never
+	unsigned int				nSeconds;
+	OMXsonien_BUFFERMANAGER*	pManagerTap;
+	OMX_VIDEO_PORTDEFINITIONTYPE	formatTap;
+	OMX_BUFFERHEADERTYPE*		pTapped;			// Filled by #252, not analyzed yet
+
+	OMX_BOOL					isValid;
+	unsigned int				nTapped;
+	unsigned int				nTapSkipped;		// Tap was due but the last frame was not analyzed
+	unsigned long long			nTimeAnalysis;		// nsec, sum
+} CONTEXT;
+CONTEXT mContext;
+
+void terminate();
+
+/* Event Handler : OMX Event */
+OMX_ERRORTYPE onOMXevent (
+		OMX_IN OMX_HANDLETYPE hComponent,
+		OMX_IN OMX_PTR pAppData,
+		OMX_IN OMX_EVENTTYPE eEvent,
+		OMX_IN OMX_U32 nData1,
+		OMX_IN OMX_U32 nData2,
+		OMX_IN OMX_PTR pEventData) {
+
+	print_event(hComponent, eEvent, nData1, nData2);
+
+	switch(eEvent) {
+	case OMX_EventParamOrConfigChanged :
+		if(nData2 == OMX_IndexParamCameraDeviceNumber) {
+			((CONTEXT*)pAppData)->isCameraReady = OMX_TRUE;
+			print_log("Camera device is ready.");
+		}
+		break;
+	default :
+		break;
+	}
+	return OMX_ErrorNone;
+}
+
+/* Callback : Splitter #252 buffer is filled */
+OMX_ERRORTYPE onFillTap (
+		OMX_OUT OMX_HANDLETYPE hComponent,
+		OMX_OUT OMX_PTR pAppData,
+		OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer) {
+	// Client owns the frame until analyzed. Flushed one goes back at once.
+	if(pBuffer->nFilledLen && mContext.isValid) {
+		// Newer frame wins. The one not analyzed yet goes back.
+		OMX_BUFFERHEADERTYPE* pStale = __atomic_exchange_n(&mContext.pTapped, pBuffer, __ATOMIC_ACQ_REL);
+		if(pStale) {
+			OMXsonienBufferPut(mContext.pManagerTap, pStale);
+			__atomic_add_fetch(&mContext.nTapSkipped, 1, __ATOMIC_RELAXED);
+		}
+	}
+	else {
+		OMXsonienBufferPut(mContext.pManagerTap, pBuffer);
+	}
+	return OMX_ErrorNone;
+}
+
+/* Callback : Error detection callback of OMXsonien */
+void onOMXsonienError(OMX_ERRORTYPE err) {
+	printf("Error : 0x%08x\n", err);
+	terminate();
+	exit(-1);
+}
+
+void onSignal(int signal) {
+	mContext.isValid = OMX_FALSE;
+}
+
+void terminate() {
+	print_log("On terminating...");
+
+	// Executing -> Idle -> Loaded with buffers freed -> Free, render first.
+	OMXsonienGraphDestroy(mContext.pGraph);
+	mContext.pGraph		= NULL;
+	mContext.pCamera	= NULL;
+
+	OMXsonienDeinit();
+	OMX_Deinit();
+}
+
+/* Graph : Called before video format of the render is set. */
+OMX_ERRORTYPE configureRender(OMX_HANDLETYPE hComponent, OMX_PTR pAppData) {
+	// Configure rendering region
+	OMX_CONFIG_DISPLAYREGIONTYPE displayRegion;
+	OMX_INIT_STRUCTURE(displayRegion);
+	displayRegion.nPortIndex = 90;
+	config_display_region(&((CONTEXT*)pAppData)->config, &displayRegion);
+	displayRegion.set = OMX_DISPLAY_SET_NUM | OMX_DISPLAY_SET_FULLSCREEN | OMX_DISPLAY_SET_MODE | OMX_DISPLAY_SET_DEST_RECT;
+	displayRegion.mode = OMX_DISPLAY_MODE_FILL;
+	displayRegion.num = 0;
+	return OMX_SetConfig(hComponent, OMX_IndexConfigDisplayRegion, &displayRegion);
+}
+
+/*
+ * Camera #71 -> Splitter #250, Splitter #251 -> Render #90 in tunnel.
+ * Splitter #252 -> client.
+ */
+void componentLoad(OMX_CALLBACKTYPE* pCallbackOMX) {
+	OMXsonien_VIDEOFORMAT format;
+
+	mContext.pGraph = OMXsonienGraphCreate(pCallbackOMX, &mContext);
+	OMXsonien_GRAPHNODE* pNodeCamera	= OMXsonienGraphAdd(mContext.pGraph, COMPONENT_CAMERA, OMXsonienConfigureCamera);
+	mContext.pNodeSplitter				= OMXsonienGraphAdd(mContext.pGraph, COMPONENT_SPLITTER, NULL);
+	OMXsonien_GRAPHNODE* pNodeRender	= OMXsonienGraphAdd(mContext.pGraph, COMPONENT_RENDER, configureRender);
+
+	memset(&format, 0x00, sizeof(format));
+	format.eColorFormat		= OMX_COLOR_FormatYUV420PackedPlanar;
+	format.nFrameWidth		= mContext.config.nWidth;
+	format.nFrameHeight		= mContext.config.nHeight;
+	format.xFramerate		= mContext.config.nFramerate << 16;	// Fixed point. 1
+	format.nSliceHeight		= mContext.config.nSliceHeight;
+	format.nBufferCount		= mContext.config.nCameraBuffers;
+	OMXsonienGraphFormat(pNodeCamera, 71, &format);
+
+	// Splitter and render take whole frames.
+	format.nSliceHeight		= mContext.config.nHeight;
+	format.nBufferCount		= 0;
+	OMXsonienGraphFormat(mContext.pNodeSplitter, 250, &format);
+	OMXsonienGraphFormat(mContext.pNodeSplitter, 251, &format);
+	OMXsonienGraphFormat(mContext.pNodeSplitter, 252, &format);
+	format.nBufferCount		= mContext.config.nRenderBuffers;
+	OMXsonienGraphFormat(pNodeRender, 90, &format);
+
+	OMXsonienGraphTunnel(mContext.pGraph, pNodeCamera, 71, mContext.pNodeSplitter, 250);
+	OMXsonienGraphTunnel(mContext.pGraph, mContext.pNodeSplitter, 251, pNodeRender, 90);
+	OMXsonienGraphClient(mContext.pGraph, mContext.pNodeSplitter, 252, NULL, 0);
+	OMXsonienGraphLoad(mContext.pGraph);
+
+	mContext.pCamera = pNodeCamera->hComponent;
+}
+
+void componentConfigure() {
+	// Wait up for camera being ready.
+	while(!mContext.isCameraReady) {
+		print_log("Waiting until camera device is ready.");
+		usleep(100 * 1000);
+	}
+	print_log("Camera is ready.");
+}
+
+/*
+ * Analysis of a tapped frame : Mean of luma.
+ */
+void analyzeFrame(OMX_BUFFERHEADERTYPE* pBuffer) {
+	OMX_VIDEO_PORTDEFINITIONTYPE* formatVideo = &mContext.formatTap;
+	unsigned long long nBegin = stats_now();
+
+	unsigned long long nSum = 0;
+	for(OMX_U32 row = 0; row < formatVideo->nFrameHeight; row++) {
+		OMX_U8* pY = pBuffer->pBuffer + pBuffer->nOffset + row * formatVideo->nStride;
+		for(OMX_U32 col = 0; col < formatVideo->nFrameWidth; col++) {
+			nSum += pY[col];
+		}
+	}
+
+	unsigned long long nElapsed = stats_now() - nBegin;
+	mContext.nTimeAnalysis += nElapsed;
+	mContext.nTapped++;
+	print_log("TAP : %lld us, mean luma %.1f in %.1f us",
+			(long long)OMX_TICKS_TO_S64(pBuffer->nTimeStamp),
+			(double)nSum / (formatVideo->nFrameWidth * formatVideo->nFrameHeight), nElapsed / 1000.0);
+}
+
+int main(int argc, char** argv) {
+	/* Temporary variables */
+	OMX_ERRORTYPE	err;
+	int				opt;
+
+	/* Initialize application variables */
+	memset(&mContext, 0, (size_t)sizeof(mContext));
+	config_init(&mContext.config, 1280, 720, 30);
+	mContext.nTapRate	= 1;
+	mContext.nSeconds	= 5;
+	mContext.isValid	= OMX_TRUE;
+
+	OMX_BOOL isValid = OMX_TRUE;
+	while((opt = getopt_long(argc, argv, CONFIG_SHORT_OPTIONS "t:s:", config_options, NULL)) != -1) {
+		switch(opt) {
+		case 't' :
+			isValid = config_uint(optarg, &mContext.nTapRate);
+			break;
+		case 's' :
+			isValid = config_uint(optarg, &mContext.nSeconds) && mContext.nSeconds > 0;
+			break;
+		default :
+			isValid = config_option(&mContext.config, opt, optarg);
+		}
+
+		if(!isValid) {
+			fprintf(stderr, "Usage : %s [options] [-t tap fps] [-s seconds]\n", argv[0]);
+			config_usage(stderr);
+			exit(-1);
+		}
+	}
+	if(!config_validate(&mContext.config)) {
+		exit(-1);
+	}
+	config_print(&mContext.config);
+
+	// RPI initialize.
+	bcm_host_init();
+
+	// OMX initialize.
+	print_log("Initialize OMX");
+	if((err = OMX_Init()) != OMX_ErrorNone) {
+		print_omx_error(err, "FAIL");
+		OMX_Deinit();
+		exit(-1);
+	}
+
+	// OMXsonien helper initialize
+	OMXsonienInit();
+	OMXsonienSetErrorCallback(onOMXsonienError);
+
+	// For loading component, Callback shall provide.
+	OMX_CALLBACKTYPE callbackOMX;
+	callbackOMX.EventHandler	= onOMXevent;
+	callbackOMX.EmptyBufferDone	= NULL;
+	callbackOMX.FillBufferDone	= onFillTap;
+
+	componentLoad(&callbackOMX);
+	componentConfigure();
+
+	// Loaded -> Idle -> Executing, every component together.
+	OMXsonienGraphStart(mContext.pGraph);
+	mContext.pManagerTap = OMXsonienGraphManager(mContext.pNodeSplitter, 252);
+
+	OMX_PARAM_PORTDEFINITIONTYPE portDef;
+	OMX_INIT_STRUCTURE(portDef);
+	portDef.nPortIndex = 252;
+	OMXsonienCall(OMX_GetParameter(mContext.pNodeSplitter->hComponent, OMX_IndexParamPortDefinition, &portDef));
+	mContext.formatTap = portDef.format.video;
+
+	// Since #71 is capturing port, needs capture signal like other handy capture devices
+	print_log("Capture start.");
+	OMX_CONFIG_PORTBOOLEANTYPE	portCapturing;
+	OMX_INIT_STRUCTURE(portCapturing);
+	portCapturing.nPortIndex = 71;
+	portCapturing.bEnabled = OMX_TRUE;
+	OMX_SetConfig(mContext.pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+
+	// Set signal interrupt handler
+	signal(SIGINT, 	onSignal);
+	signal(SIGTERM, onSignal);
+
+	cpu_thread_register("main");
+	config_apply_thread(&mContext.config);
+
+	print_log("Capture for %d seconds, tap at %d fps.", mContext.nSeconds, mContext.nTapRate);
+	unsigned long long nNow		= stats_now();
+	unsigned long long nEnd		= nNow + mContext.nSeconds * 1000000000ULL;
+	unsigned long long nPeriod	= mContext.nTapRate ? 1000000000ULL / mContext.nTapRate : 0;
+	unsigned long long nNextTap	= nNow;
+
+	while(mContext.isValid && (nNow = stats_now()) < nEnd) {
+		OMX_BUFFERHEADERTYPE* pTapped = __atomic_exchange_n(&mContext.pTapped, NULL, __ATOMIC_ACQUIRE);
+		if(pTapped) {
+			analyzeFrame(pTapped);
+			OMXsonienBufferPut(mContext.pManagerTap, pTapped);
+		}
+
+		// Hand a buffer to #252 only when a tap is due.
+		if(nPeriod && nNow >= nNextTap) {
+			OMX_BUFFERHEADERTYPE* pBuffer = OMXsonienBufferGet(mContext.pManagerTap);
+			if(pBuffer) {
+				OMXsonienBufferSend(mContext.pManagerTap, pBuffer);
+			}
+			else {
+				__atomic_add_fetch(&mContext.nTapSkipped, 1, __ATOMIC_RELAXED);
+			}
+			nNextTap += nPeriod;
+			if(nNextTap < nNow) nNextTap = nNow + nPeriod;
+		}
+
+		usleep(1000);
+	}
+	signal(SIGINT, 	SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	// Frames from now on go back without analysis.
+	mContext.isValid = OMX_FALSE;
+	OMX_BUFFERHEADERTYPE* pTapped = __atomic_exchange_n(&mContext.pTapped, NULL, __ATOMIC_ACQUIRE);
+	if(pTapped) {
+		OMXsonienBufferPut(mContext.pManagerTap, pTapped);
+	}
+
+	portCapturing.bEnabled = OMX_FALSE;
+	OMX_SetConfig(mContext.pCamera, OMX_IndexConfigPortCapturing, &portCapturing);
+	print_log("Capture stop.");
+	print_log("TAP : %d frames analyzed, %.1f us each, %d taps skipped",
+			mContext.nTapped, mContext.nTapped ? mContext.nTimeAnalysis / 1000.0 / mContext.nTapped : 0.0, mContext.nTapSkipped);
+	cpu_report_total(mContext.nTapped);
+
+	terminate();
+}
@@ -8,13 +8,20 @@
  ============================================================================
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 
 #include "common.h"
+#include "trace.h"
 
 void print_log(const char* message, ...) {
 	char str[1024] = "";
@@ -126,6 +133,7 @@ OMX_BOOL block_until_state_change(OMX_STATETYPE state_tobe, OMX_HANDLETYPE* ppHa
 	OMX_BOOL		isValid	= OMX_TRUE;
 
 	OMX_HANDLETYPE pHandler	= NULL;
+	TRACE_BEGIN("block_until_state_change");
 	while((pHandler = *ppHandler++)) {
 		int timeout_counter = 0;
 		isValid = OMX_FALSE;
@@ -140,6 +148,7 @@ OMX_BOOL block_until_state_change(OMX_STATETYPE state_tobe, OMX_HANDLETYPE* ppHa
 
 		if(!isValid) break;
 	}
+	TRACE_END("block_until_state_change");
 
 	return isValid;
 }
@@ -155,6 +164,7 @@ OMX_BOOL wait_for_state_change(OMX_STATETYPE state_tobe, ...) {
 	OMX_STATETYPE	state_current;
 	OMX_HANDLETYPE	pHandler = NULL;
 	OMX_BOOL		isValid	= OMX_TRUE;
+	TRACE_BEGIN("wait_for_state_change");
 	while((pHandler = va_arg(ap, OMX_HANDLETYPE))) {
 		print_log("Waiting for 0x%08x", pHandler);
 		int timeout_counter = 0;
@@ -170,7 +180,161 @@ OMX_BOOL wait_for_state_change(OMX_STATETYPE state_tobe, ...) {
 
 		if(!isValid) break;
 	}
+	TRACE_END("wait_for_state_change");
 	va_end(ap);
 
 	return isValid;
 }
+
+/* CPU accounting */
+#define CPU_THREADS_MAX	16
+
+typedef struct {
+	unsigned long long	nTime;			// nsec
+	unsigned long		nVoluntary;		// context switches
+	unsigned long		nInvoluntary;
+	unsigned long long	nWall;			// nsec
+} CPU_SAMPLE;
+
+typedef struct {
+	char				name[16];
+	pid_t				tid;
+	CPU_SAMPLE			first;
+	CPU_SAMPLE			last;
+} CPU_THREAD;
+
+static CPU_THREAD		cpuThreads[CPU_THREADS_MAX];
+static int				nCPUThreads		= 0;
+static CPU_SAMPLE		cpuProcessFirst;
+static CPU_SAMPLE		cpuProcessLast;
+static pthread_mutex_t	mutexCPU		= PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long cpu_clock(clockid_t clock) {
+	struct timespec ts;
+	if(clock_gettime(clock, &ts) != 0) return 0;
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Sample a thread. Keep previous values of a thread which already exited.
+ */
+static void cpu_sample_thread(CPU_THREAD* pThread, CPU_SAMPLE* pSample) {
+	char		path[64];
+	char		line[128];
+
+	*pSample		= pThread->last;
+	pSample->nWall	= cpu_clock(CLOCK_MONOTONIC);
+
+	// Calling thread reads its own clock. Others are read from procfs by tid,
+	// since pthread_t of a joined thread is not valid any more.
+	if(pThread->tid == syscall(SYS_gettid)) {
+		pSample->nTime = cpu_clock(CLOCK_THREAD_CPUTIME_ID);
+	}
+	else {
+		snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", pThread->tid);
+		FILE* fp = fopen(path, "r");
+		if(fp == NULL) return;
+		fscanf(fp, "%llu", &pSample->nTime);
+		fclose(fp);
+	}
+
+	snprintf(path, sizeof(path), "/proc/self/task/%d/status", pThread->tid);
+	FILE* fp = fopen(path, "r");
+	if(fp == NULL) return;
+	while(fgets(line, sizeof(line), fp)) {
+		sscanf(line, "voluntary_ctxt_switches: %lu", &pSample->nVoluntary);
+		sscanf(line, "nonvoluntary_ctxt_switches: %lu", &pSample->nInvoluntary);
+	}
+	fclose(fp);
+}
+
+static void cpu_sample_process(CPU_SAMPLE* pSample) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	pSample->nTime			= cpu_clock(CLOCK_PROCESS_CPUTIME_ID);
+	pSample->nVoluntary		= usage.ru_nvcsw;
+	pSample->nInvoluntary	= usage.ru_nivcsw;
+	pSample->nWall			= cpu_clock(CLOCK_MONOTONIC);
+}
+
+void cpu_thread_register(const char* name) {
+	pthread_mutex_lock(&mutexCPU);
+	if(nCPUThreads == 0) {
+		cpu_sample_process(&cpuProcessFirst);
+		cpuProcessLast = cpuProcessFirst;
+	}
+
+	if(nCPUThreads < CPU_THREADS_MAX) {
+		CPU_THREAD* pThread = &cpuThreads[nCPUThreads++];
+		memset(pThread, 0x00, sizeof(CPU_THREAD));
+		snprintf(pThread->name, sizeof(pThread->name), "%s", name);
+		pThread->tid	= syscall(SYS_gettid);
+		cpu_sample_thread(pThread, &pThread->first);
+		pThread->last	= pThread->first;
+	}
+	pthread_mutex_unlock(&mutexCPU);
+}
+
+void cpu_thread_finish() {
+	pid_t tid = syscall(SYS_gettid);
+
+	pthread_mutex_lock(&mutexCPU);
+	for(int i = 0; i < nCPUThreads; i++) {
+		if(cpuThreads[i].tid == tid) {
+			CPU_SAMPLE sample;
+			cpu_sample_thread(&cpuThreads[i], &sample);
+			cpuThreads[i].last = sample;
+		}
+	}
+	pthread_mutex_unlock(&mutexCPU);
+}
+
+static void cpu_print(const char* name, CPU_SAMPLE* pFrom, CPU_SAMPLE* pTo, unsigned int nFrames) {
+	unsigned long long	nTime	= pTo->nTime - pFrom->nTime;
+	unsigned long long	nWall	= pTo->nWall - pFrom->nWall;
+	char				perFrame[32] = "";
+
+	if(nFrames) {
+		snprintf(perFrame, sizeof(perFrame), ", %llu us/frame", nTime / 1000 / nFrames);
+	}
+	print_log("CPU : %-12s %9.1f ms (%5.1f%%%s) ctxsw %lu/%lu",
+			name,
+			nTime / 1000000.0,
+			nWall ? nTime * 100.0 / nWall : 0.0,
+			perFrame,
+			pTo->nVoluntary - pFrom->nVoluntary,
+			pTo->nInvoluntary - pFrom->nInvoluntary);
+}
+
+void cpu_report(unsigned int nFrames) {
+	CPU_SAMPLE sample;
+
+	pthread_mutex_lock(&mutexCPU);
+	for(int i = 0; i < nCPUThreads; i++) {
+		cpu_sample_thread(&cpuThreads[i], &sample);
+		cpu_print(cpuThreads[i].name, &cpuThreads[i].last, &sample, nFrames);
+		cpuThreads[i].last = sample;
+	}
+
+	cpu_sample_process(&sample);
+	cpu_print("process", &cpuProcessLast, &sample, nFrames);
+	cpuProcessLast = sample;
+	pthread_mutex_unlock(&mutexCPU);
+}
+
+void cpu_report_total(unsigned int nFrames) {
+	CPU_SAMPLE sample;
+
+	pthread_mutex_lock(&mutexCPU);
+	for(int i = 0; i < nCPUThreads; i++) {
+		cpu_sample_thread(&cpuThreads[i], &sample);
+		cpu_print(cpuThreads[i].name, &cpuThreads[i].first, &sample, nFrames);
+		cpuThreads[i].last = sample;
+	}
+
+	cpu_sample_process(&sample);
+	cpu_print("process", &cpuProcessFirst, &sample, nFrames);
+	cpuProcessLast = sample;
+	pthread_mutex_unlock(&mutexCPU);
+}
@@ -23,6 +23,18 @@
     (a).nVersion.s.nRevision = OMX_VERSION_REVISION; \
     (a).nVersion.s.nStep = OMX_VERSION_STEP
 
+/*
+ * Conversion between OMX_TICKS and 64bit integer in usec.
+ * OMX_TICKS is a structure of two 32bit integers when OMX_SKIP64BIT.
+ */
+#ifdef OMX_SKIP64BIT
+#define OMX_TICKS_TO_S64(t)		((OMX_S64)(((OMX_U64)(t).nHighPart << 32) | (t).nLowPart))
+#define OMX_S64_TO_TICKS(t, v)	do { (t).nLowPart = (OMX_U32)(v); (t).nHighPart = (OMX_U32)((OMX_U64)(v) >> 32); } while(0)
+#else
+#define OMX_TICKS_TO_S64(t)		((OMX_S64)(t))
+#define OMX_S64_TO_TICKS(t, v)	do { (t) = (v); } while(0)
+#endif
+
 
 /*
  * Print log message to console.
@@ -56,4 +68,25 @@ OMX_BOOL wait_for_state_change (OMX_STATETYPE state_tobe, ...);
  */
 OMX_BOOL isState(OMX_HANDLETYPE* hComponent, OMX_STATETYPE state);
 
+/*
+ * Register calling thread for CPU accounting. Up to 16 threads.
+ */
+void cpu_thread_register(const char* name);
+
+/*
+ * Take the last sample of calling thread. Call it just before thread exits.
+ */
+void cpu_thread_finish();
+
+/*
+ * Print CPU time and context switches of each registered thread and of the
+ * process since last call, with CPU time per frame when nFrames is not zero.
+ */
+void cpu_report(unsigned int nFrames);
+
+/*
+ * Same as cpu_report() but since each thread was registered.
+ */
+void cpu_report_total(unsigned int nFrames);
+
 #endif /* RPI_OMX_TUTORIAL_SRC_COMMON_H_ */
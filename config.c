@@ -0,0 +1,253 @@
+/*
+ ============================================================================
+ Name        : config.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Runtime configuration for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "config.h"
+#include "common.h"
+
+enum {
+	CONFIG_CAMERA_BUFFERS = 0x100,
+	CONFIG_SLICE_HEIGHT,
+	CONFIG_DISPLAY,
+	CONFIG_FULLSCREEN,
+	CONFIG_PRIORITY,
+	CONFIG_CPU,
+	CONFIG_FILE
+};
+
+const struct option config_options[] = {
+	{ "resolution",		required_argument,	NULL,	'r' },
+	{ "framerate",		required_argument,	NULL,	'f' },
+	{ "render-buffers",	required_argument,	NULL,	'c' },
+	{ "camera-buffers",	required_argument,	NULL,	CONFIG_CAMERA_BUFFERS },
+	{ "slice-height",	required_argument,	NULL,	CONFIG_SLICE_HEIGHT },
+	{ "display",		required_argument,	NULL,	CONFIG_DISPLAY },
+	{ "fullscreen",		optional_argument,	NULL,	CONFIG_FULLSCREEN },
+	{ "priority",		required_argument,	NULL,	CONFIG_PRIORITY },
+	{ "cpu",			required_argument,	NULL,	CONFIG_CPU },
+	{ "config",			required_argument,	NULL,	CONFIG_FILE },
+	{ NULL,				0,					NULL,	0 }
+};
+
+/*
+ * Whole string must be a decimal number.
+ */
+int config_int(const char* pValue, int* pResult) {
+	char* pEnd;
+
+	if(pValue == NULL || *pValue == '\0') return 0;
+	errno = 0;
+	long n = strtol(pValue, &pEnd, 10);
+	if(*pEnd != '\0' || errno == ERANGE || n < INT_MIN || n > INT_MAX) return 0;
+	*pResult = (int)n;
+
+	return 1;
+}
+
+int config_uint(const char* pValue, unsigned int* pResult) {
+	int n;
+
+	if(!config_int(pValue, &n) || n < 0) return 0;
+	*pResult = n;
+
+	return 1;
+}
+
+int config_size(const char* pValue, unsigned int* pWidth, unsigned int* pHeight) {
+	char		width[16];
+	const char*	pX;
+
+	if(pValue == NULL || (pX = strchr(pValue, 'x')) == NULL || pX - pValue >= sizeof(width)) return 0;
+	memcpy(width, pValue, pX - pValue);
+	width[pX - pValue] = '\0';
+
+	return config_uint(width, pWidth) && config_uint(pX + 1, pHeight);
+}
+
+void config_init(CONFIG* pConfig, unsigned int nWidth, unsigned int nHeight, unsigned int nFramerate) {
+	memset(pConfig, 0, sizeof(CONFIG));
+	pConfig->nWidth		= nWidth;
+	pConfig->nHeight	= nHeight;
+	pConfig->nFramerate	= nFramerate;
+	pConfig->nThreadCPU	= -1;
+}
+
+int config_option(CONFIG* pConfig, int opt, const char* pValue) {
+	int nEnd = 0;		// Of what sscanf() took. The rest is parsed on.
+
+	switch(opt) {
+	case 'r' :
+		return config_size(pValue, &pConfig->nWidth, &pConfig->nHeight) && pConfig->nWidth > 0 && pConfig->nHeight > 0;
+	case 'f' :
+		return config_uint(pValue, &pConfig->nFramerate) && pConfig->nFramerate > 0;
+	case 'c' :
+		return config_uint(pValue, &pConfig->nRenderBuffers);
+	case CONFIG_CAMERA_BUFFERS :
+		return config_uint(pValue, &pConfig->nCameraBuffers);
+	case CONFIG_SLICE_HEIGHT :
+		// Camera emits slices of multiple of 16 lines.
+		return config_uint(pValue, &pConfig->nSliceHeight) && pConfig->nSliceHeight % 16 == 0;
+	case CONFIG_DISPLAY :
+		return sscanf(pValue, "%d,%d,%n", &pConfig->nDisplayX, &pConfig->nDisplayY, &nEnd) == 2 && nEnd > 0
+				&& config_size(pValue + nEnd, &pConfig->nDisplayWidth, &pConfig->nDisplayHeight);
+	case CONFIG_FULLSCREEN :
+		if(pValue == NULL) {
+			pConfig->isFullscreen = 1;
+			return 1;
+		}
+		return config_int(pValue, &pConfig->isFullscreen);
+	case CONFIG_PRIORITY :
+		return config_int(pValue, &pConfig->nThreadPriority)
+				&& pConfig->nThreadPriority >= 0 && pConfig->nThreadPriority <= sched_get_priority_max(SCHED_FIFO);
+	case CONFIG_CPU :
+		return config_int(pValue, &pConfig->nThreadCPU) && pConfig->nThreadCPU >= -1 && pConfig->nThreadCPU < CPU_SETSIZE;
+	case CONFIG_FILE :
+		return config_load(pConfig, pValue);
+	default :
+		return 0;
+	}
+}
+
+int config_load(CONFIG* pConfig, const char* path) {
+	char line[256];
+	int nLine = 0;
+	int isValid = 1;
+
+	FILE* fp = fopen(path, "r");
+	if(fp == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	while(isValid && fgets(line, sizeof(line), fp)) {
+		nLine++;
+
+		char* pComment = strchr(line, '#');
+		if(pComment) *pComment = '\0';
+
+		char* pKey = line;
+		while(isspace((unsigned char)*pKey)) pKey++;
+		if(*pKey == '\0') continue;
+
+		char* pValue = strchr(pKey, '=');
+		if(pValue == NULL) {
+			isValid = 0;
+			break;
+		}
+
+		// Trim both of key and value.
+		char* pEnd = pValue;
+		*pValue++ = '\0';
+		while(pEnd > pKey && isspace((unsigned char)pEnd[-1])) *--pEnd = '\0';
+		while(isspace((unsigned char)*pValue)) pValue++;
+		pEnd = pValue + strlen(pValue);
+		while(pEnd > pValue && isspace((unsigned char)pEnd[-1])) *--pEnd = '\0';
+
+		const struct option* pOption;
+		for(pOption = config_options; pOption->name; pOption++) {
+			if(strcmp(pOption->name, pKey) == 0) break;
+		}
+		// Config file shall not include another one.
+		isValid = pOption->name && pOption->val != CONFIG_FILE && config_option(pConfig, pOption->val, pValue);
+	}
+	fclose(fp);
+
+	if(!isValid) {
+		fprintf(stderr, "%s:%d : Invalid configuration.\n", path, nLine);
+	}
+
+	return isValid;
+}
+
+void config_usage(FILE* fp) {
+	fprintf(fp,
+			"  -r, --resolution WxH\n"
+			"  -f, --framerate fps\n"
+			"  -c, --render-buffers count     Buffers of render #90. 0 : Port default\n"
+			"      --camera-buffers count     Buffers of camera #71. 0 : Port default\n"
+			"      --slice-height lines       Slice of camera #71, multiple of 16. 0 : Port default\n"
+			"      --display x,y,WxH          Display region. Frame size at 0,0 by default\n"
+			"      --fullscreen[=0|1]\n"
+			"      --priority 1-99            SCHED_FIFO priority of the main loop\n"
+			"      --cpu n                    CPU the main loop runs on\n"
+			"      --config file              Lines of \"key = value\", key is a long option\n");
+}
+
+int config_validate(CONFIG* pConfig) {
+	// Chroma planes of 4:2:0 are half in both ways. Copy loops leave out padding of the last slice.
+	if((pConfig->nWidth | pConfig->nHeight) & 1) {
+		fprintf(stderr, "Frame %dx%d is not for 4:2:0. Width and height must be even.\n", pConfig->nWidth, pConfig->nHeight);
+		return 0;
+	}
+
+	return 1;
+}
+
+int config_parse(CONFIG* pConfig, int argc, char** argv) {
+	int opt;
+
+	while((opt = getopt_long(argc, argv, CONFIG_SHORT_OPTIONS, config_options, NULL)) != -1) {
+		if(!config_option(pConfig, opt, optarg)) {
+			fprintf(stderr, "Usage : %s [options]\n", argv[0]);
+			config_usage(stderr);
+			return 0;
+		}
+	}
+
+	return config_validate(pConfig);
+}
+
+void config_print(CONFIG* pConfig) {
+	print_log("CONFIG : %dx%d @ %d fps, camera buffers %d, render buffers %d, slice %d",
+			pConfig->nWidth, pConfig->nHeight, pConfig->nFramerate,
+			pConfig->nCameraBuffers, pConfig->nRenderBuffers, pConfig->nSliceHeight);
+	print_log("CONFIG : display %d,%d,%dx%d%s, priority %d, cpu %d",
+			pConfig->nDisplayX, pConfig->nDisplayY, pConfig->nDisplayWidth, pConfig->nDisplayHeight,
+			pConfig->isFullscreen ? " fullscreen" : "", pConfig->nThreadPriority, pConfig->nThreadCPU);
+}
+
+void config_display_region(CONFIG* pConfig, OMX_CONFIG_DISPLAYREGIONTYPE* pRegion) {
+	pRegion->dest_rect.x_offset	= pConfig->nDisplayX;
+	pRegion->dest_rect.y_offset	= pConfig->nDisplayY;
+	pRegion->dest_rect.width	= pConfig->nDisplayWidth ? pConfig->nDisplayWidth : pConfig->nWidth;
+	pRegion->dest_rect.height	= pConfig->nDisplayHeight ? pConfig->nDisplayHeight : pConfig->nHeight;
+	pRegion->fullscreen			= pConfig->isFullscreen ? OMX_TRUE : OMX_FALSE;
+}
+
+void config_apply_thread(CONFIG* pConfig) {
+	int err;
+
+	if(pConfig->nThreadCPU >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(pConfig->nThreadCPU, &cpus);
+		if((err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) != 0) {
+			print_log("CONFIG : Failed to run on CPU %d. %s", pConfig->nThreadCPU, strerror(err));
+		}
+	}
+
+	if(pConfig->nThreadPriority > 0) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = pConfig->nThreadPriority;
+		if((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0) {
+			print_log("CONFIG : Failed to set SCHED_FIFO %d. %s", pConfig->nThreadPriority, strerror(err));
+		}
+	}
+}
@@ -0,0 +1,112 @@
+/*
+ ============================================================================
+ Name        : config.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Runtime configuration for rpi-omx-tutorial.
+               Every program takes the same options for resolution, framerate,
+               buffer counts, slice height, display region and the main loop
+               thread, from the command line or from a config file.
+
+               Config file has "key = value" per line, where key is the long
+               option without dashes. '#' starts a comment. Options after
+               --config override the file.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_CONFIG_H_
+#define RPI_OMX_TUTORIAL_SRC_CONFIG_H_
+
+#include <stdio.h>
+#include <getopt.h>
+
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Broadcom.h>
+
+/*
+ * Short options of config. Programs append their own after this.
+ */
+#define CONFIG_SHORT_OPTIONS	"r:f:c:"
+
+typedef struct CONFIG {
+	unsigned int		nWidth;
+	unsigned int		nHeight;
+	unsigned int		nFramerate;
+	unsigned int		nCameraBuffers;		// Port #71. 0 : Port default. Copy loops hold one buffer and ignore it
+	unsigned int		nRenderBuffers;		// Port #90. 0 : Port default
+	unsigned int		nSliceHeight;		// Port #71. 0 : Port default
+
+	int					isFullscreen;
+	int					nDisplayX;
+	int					nDisplayY;
+	unsigned int		nDisplayWidth;		// 0 : Frame width
+	unsigned int		nDisplayHeight;		// 0 : Frame height
+
+	int					nThreadPriority;	// SCHED_FIFO priority of the main loop. 0 : SCHED_OTHER
+	int					nThreadCPU;			// CPU the main loop runs on. -1 : Any
+} CONFIG;
+
+/*
+ * Long options of config, terminated by zeros, for getopt_long().
+ */
+extern const struct option config_options[];
+
+/*
+ * Parse a whole string as decimal number. Returns 0 on anything else,
+ * including trailing characters or out of range. config_uint() also
+ * rejects negatives.
+ */
+int config_int(const char* pValue, int* pResult);
+int config_uint(const char* pValue, unsigned int* pResult);
+
+/*
+ * Parse "WxH" with config_uint() for each. Returns 0 on error.
+ */
+int config_size(const char* pValue, unsigned int* pWidth, unsigned int* pHeight);
+
+/*
+ * Set the defaults of the program. Everything else is port default.
+ */
+void config_init(CONFIG* pConfig, unsigned int nWidth, unsigned int nHeight, unsigned int nFramerate);
+
+/*
+ * Apply an option returned by getopt_long() with config_options.
+ * Returns 0 if the option is unknown or the value is invalid.
+ */
+int config_option(CONFIG* pConfig, int opt, const char* pValue);
+
+/*
+ * Apply every line of a config file. Returns 0 on error.
+ */
+int config_load(CONFIG* pConfig, const char* path);
+
+/*
+ * Check options against each other, after every option is applied.
+ * Prints the reason and returns 0 on error.
+ */
+int config_validate(CONFIG* pConfig);
+
+/*
+ * Parse the command line of a program which has no option of its own.
+ * Prints usage and returns 0 on error.
+ */
+int config_parse(CONFIG* pConfig, int argc, char** argv);
+
+/*
+ * Print options of config for usage of the program.
+ */
+void config_usage(FILE* fp);
+
+void config_print(CONFIG* pConfig);
+
+/*
+ * Set dest_rect and fullscreen of the region. Caller still decides set, mode and num.
+ */
+void config_display_region(CONFIG* pConfig, OMX_CONFIG_DISPLAYREGIONTYPE* pRegion);
+
+/*
+ * Apply priority and CPU affinity to calling thread. Failure is logged and ignored.
+ */
+void config_apply_thread(CONFIG* pConfig);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_CONFIG_H_ */
@@ -0,0 +1,147 @@
+/*
+ ============================================================================
+ Name        : dispatch.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Dispatcher and worker pool for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "trace.h"
+#include "dispatch.h"
+
+/* Must be called with mutex locked. */
+static void dispatch_ready(DISPATCHER* pDispatcher, DISPATCH_STRAND* pStrand) {
+	pStrand->pNext = NULL;
+	if(pDispatcher->pReadyTail)	pDispatcher->pReadyTail->pNext = pStrand;
+	else						pDispatcher->pReadyHead = pStrand;
+	pDispatcher->pReadyTail = pStrand;
+	pthread_cond_signal(&pDispatcher->cond);
+}
+
+static void* dispatch_worker(void* data) {
+	DISPATCHER*	pDispatcher = (DISPATCHER*)data;
+	void*		items[DISPATCH_QUEUE];
+
+	pthread_setname_np(pthread_self(), "dispatch");
+	cpu_thread_register("dispatch");
+
+	pthread_mutex_lock(&pDispatcher->mutex);
+	while(1) {
+		while(pDispatcher->isRunning && pDispatcher->pReadyHead == NULL) {
+			pthread_cond_wait(&pDispatcher->cond, &pDispatcher->mutex);
+		}
+		DISPATCH_STRAND* pStrand = pDispatcher->pReadyHead;
+		if(pStrand == NULL) break;		// Stopped and drained
+
+		pDispatcher->pReadyHead = pStrand->pNext;
+		if(pDispatcher->pReadyHead == NULL) pDispatcher->pReadyTail = NULL;
+
+		// Take every item at once, so posting goes on while they run.
+		unsigned int nItems = 0;
+		while(pStrand->nHead != pStrand->nTail) {
+			items[nItems++] = pStrand->items[pStrand->nHead++ % DISPATCH_QUEUE];
+		}
+		pthread_mutex_unlock(&pDispatcher->mutex);
+
+		TRACE_BEGIN("dispatch");
+		for(unsigned int i = 0; i < nItems; i++) {
+			pStrand->handler(pStrand->pData, items[i]);
+		}
+		TRACE_END("dispatch");
+
+		pthread_mutex_lock(&pDispatcher->mutex);
+		pStrand->nRun += nItems;
+		if(pStrand->nHead != pStrand->nTail)	dispatch_ready(pDispatcher, pStrand);
+		else									pStrand->isScheduled = 0;
+	}
+	pthread_mutex_unlock(&pDispatcher->mutex);
+
+	cpu_thread_finish();
+	return NULL;
+}
+
+DISPATCHER* dispatch_create(unsigned int nThreads) {
+	DISPATCHER* pDispatcher = malloc(sizeof(DISPATCHER));
+	if(pDispatcher == NULL) return NULL;
+
+	memset(pDispatcher, 0x00, sizeof(DISPATCHER));
+	pthread_mutex_init(&pDispatcher->mutex, NULL);
+	pthread_cond_init(&pDispatcher->cond, NULL);
+	pDispatcher->isRunning = 1;
+
+	if(nThreads < 1) nThreads = 1;
+	if(nThreads > DISPATCH_WORKERS) nThreads = DISPATCH_WORKERS;
+	for(unsigned int i = 0; i < nThreads; i++) {
+		if(pthread_create(&pDispatcher->threads[i], NULL, dispatch_worker, pDispatcher) != 0) {
+			print_log("DISPATCH : Failed to start worker %d.", i);
+			break;
+		}
+		pDispatcher->nThreads++;
+	}
+	if(pDispatcher->nThreads == 0) {
+		dispatch_destroy(pDispatcher);
+		return NULL;
+	}
+
+	print_log("DISPATCH : %d workers", pDispatcher->nThreads);
+	return pDispatcher;
+}
+
+void dispatch_strand_init(DISPATCHER* pDispatcher, DISPATCH_STRAND* pStrand, DISPATCH_HANDLER handler, void* pData) {
+	memset(pStrand, 0x00, sizeof(DISPATCH_STRAND));
+	pStrand->pDispatcher	= pDispatcher;
+	pStrand->handler		= handler;
+	pStrand->pData			= pData;
+}
+
+int dispatch_post(DISPATCH_STRAND* pStrand, void* pItem) {
+	DISPATCHER* pDispatcher = pStrand->pDispatcher;
+
+	pthread_mutex_lock(&pDispatcher->mutex);
+	if(!pDispatcher->isRunning || pStrand->nTail - pStrand->nHead >= DISPATCH_QUEUE) {
+		pStrand->nRejected++;
+		pthread_mutex_unlock(&pDispatcher->mutex);
+		return 0;
+	}
+
+	pStrand->items[pStrand->nTail++ % DISPATCH_QUEUE] = pItem;
+	if(!pStrand->isScheduled) {
+		pStrand->isScheduled = 1;
+		dispatch_ready(pDispatcher, pStrand);
+	}
+	pthread_mutex_unlock(&pDispatcher->mutex);
+
+	return 1;
+}
+
+void dispatch_stop(DISPATCHER* pDispatcher) {
+	pthread_mutex_lock(&pDispatcher->mutex);
+	if(!pDispatcher->isRunning) {
+		pthread_mutex_unlock(&pDispatcher->mutex);
+		return;
+	}
+	pDispatcher->isRunning = 0;
+	pthread_cond_broadcast(&pDispatcher->cond);
+	pthread_mutex_unlock(&pDispatcher->mutex);
+
+	for(unsigned int i = 0; i < pDispatcher->nThreads; i++) {
+		pthread_join(pDispatcher->threads[i], NULL);
+	}
+}
+
+void dispatch_destroy(DISPATCHER* pDispatcher) {
+	if(pDispatcher == NULL) return;
+
+	dispatch_stop(pDispatcher);
+	pthread_cond_destroy(&pDispatcher->cond);
+	pthread_mutex_destroy(&pDispatcher->mutex);
+	free(pDispatcher);
+}
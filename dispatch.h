@@ -0,0 +1,74 @@
+/*
+ ============================================================================
+ Name        : dispatch.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Dispatcher and worker pool for rpi-omx-tutorial.
+               Work is posted to a strand, usually one per pipeline. Items
+               of a strand run in order and never on two workers at once,
+               so handler needs no lock for its own state. Strands with
+               items wait in one ready list and any idle worker takes the
+               oldest one, so N pipelines share M workers.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_DISPATCH_H_
+#define RPI_OMX_TUTORIAL_SRC_DISPATCH_H_
+
+#include <pthread.h>
+
+#define DISPATCH_QUEUE		16		// Items a strand holds. Power of two.
+#define DISPATCH_WORKERS	8		// Max number of workers
+
+typedef void (*DISPATCH_HANDLER)(void* pData, void* pItem);
+
+struct DISPATCHER;
+
+typedef struct DISPATCH_STRAND {
+	struct DISPATCHER*		pDispatcher;
+	DISPATCH_HANDLER		handler;
+	void*					pData;
+	void*					items[DISPATCH_QUEUE];
+	unsigned int			nHead;				// Next item to run
+	unsigned int			nTail;				// Next item to post
+	int						isScheduled;		// In the ready list or on a worker
+	unsigned int			nRun;				// Items run
+	unsigned int			nRejected;			// Posted while full or stopped
+	struct DISPATCH_STRAND*	pNext;				// Ready list
+} DISPATCH_STRAND;
+
+typedef struct DISPATCHER {
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	DISPATCH_STRAND*		pReadyHead;
+	DISPATCH_STRAND*		pReadyTail;
+	pthread_t				threads[DISPATCH_WORKERS];
+	unsigned int			nThreads;
+	int						isRunning;
+} DISPATCHER;
+
+/*
+ * Start nThreads workers. NULL on failure.
+ */
+DISPATCHER* dispatch_create(unsigned int nThreads);
+
+void dispatch_strand_init(DISPATCHER* pDispatcher, DISPATCH_STRAND* pStrand, DISPATCH_HANDLER handler, void* pData);
+
+/*
+ * Post an item to the strand. Safe from any thread, including OMX callbacks.
+ * Returns 0 if the strand is full or the dispatcher is stopped, then the
+ * item is not run and still belongs to the caller.
+ */
+int dispatch_post(DISPATCH_STRAND* pStrand, void* pItem);
+
+/*
+ * Run what is posted already, then join workers. Posts fail after this.
+ */
+void dispatch_stop(DISPATCHER* pDispatcher);
+
+/*
+ * Stop if running and free. NULL is ignored.
+ */
+void dispatch_destroy(DISPATCHER* pDispatcher);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_DISPATCH_H_ */
@@ -0,0 +1,125 @@
+/*
+ ============================================================================
+ Name        : export_reader.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Reader of frames exported by camera_fanout -x, in another
+               process. Frames are read in place from shared memory and
+               the mean luma of each is checked, as analytics would.
+               Frames which the writer overwrote before or while they were
+               read are counted, and capture is never slowed down by this.
+
+               Usage : export_reader name [-s seconds] [-d msec]
+               -d makes each frame slower by the delay, to see skipping.
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "common.h"
+#include "stats.h"
+#include "shmring.h"
+#include "config.h"
+
+#define READ_TIMEOUT		1000	// msec
+
+/* Set by signal handler. Main loop stops on it. */
+static volatile sig_atomic_t isInterrupted = 0;
+
+void onSignal(int signal) {
+	isInterrupted = 1;
+}
+
+int main(int argc, char** argv) {
+	unsigned int	nSeconds	= 0;
+	unsigned int	nDelay		= 0;
+	int				opt;
+
+	OMX_BOOL isValid = OMX_TRUE;
+	while(isValid && (opt = getopt(argc, argv, "s:d:")) != -1) {
+		switch(opt) {
+		case 's' :
+			isValid = config_uint(optarg, &nSeconds);
+			break;
+		case 'd' :
+			isValid = config_uint(optarg, &nDelay);
+			break;
+		default :
+			isValid = OMX_FALSE;
+		}
+	}
+	if(!isValid || optind != argc - 1) {
+		fprintf(stderr, "Usage : %s name [-s seconds] [-d msec]\n", argv[0]);
+		exit(-1);
+	}
+
+	SHMRING* pRing = shmring_open(argv[optind]);
+	if(pRing == NULL) {
+		exit(-1);
+	}
+
+	signal(SIGINT, 	onSignal);
+	signal(SIGTERM, onSignal);
+
+	SHMRING_HEADER*		pHeader		= pRing->pHeader;
+	STATS_HISTOGRAM		age;
+	unsigned long long	nBegin		= stats_now();
+	unsigned long long	nReport		= nBegin + 1000000000ULL;
+	unsigned int		nFrames		= 0;
+	unsigned int		nLuma		= 0;
+	int64_t				nTimestampFirst	= -1;
+	unsigned long long	nTimeFirst	= 0;
+
+	stats_histogram_reset(&age);
+	while(!isInterrupted && (nSeconds == 0 || stats_now() - nBegin < nSeconds * 1000000000ULL)) {
+		const SHMRING_SLOT* pSlot = shmring_read(pRing, READ_TIMEOUT);
+		if(pSlot == NULL) {
+			if(pHeader->isClosed) break;
+			continue;
+		}
+
+		// Frame is read in place. Mean luma of every 8th pixel and line.
+		const uint8_t*		pY		= (const uint8_t*)pSlot + SHMRING_PAYLOAD;
+		unsigned long long	nSum	= 0;
+		unsigned int		nCount	= 0;
+		for(unsigned int y = 0; y < pHeader->nHeight; y += 8) {
+			for(unsigned int x = 0; x < pHeader->nWidth; x += 8, nCount++) {
+				nSum += pY[y * pHeader->nStride + x];
+			}
+		}
+		int64_t nTimeStamp = pSlot->nTimeStamp;
+		if(nDelay) usleep(nDelay * 1000);
+
+		if(!shmring_done(pRing, pSlot)) continue;
+		nLuma = nCount ? nSum / nCount : 0;
+		nFrames++;
+
+		// Clocks of the processes differ, so age is against the first frame.
+		unsigned long long nNow = stats_now();
+		if(nTimestampFirst < 0) {
+			nTimestampFirst	= nTimeStamp;
+			nTimeFirst		= nNow;
+		}
+		long long nAge = (long long)(nNow - nTimeFirst) - (nTimeStamp - nTimestampFirst) * 1000;
+		stats_histogram_add(&age, nAge > 0 ? nAge : 0);
+
+		if(nNow >= nReport) {
+			print_log("READER : %d fps, luma %d, %d skipped, %d torn", nFrames, nLuma, pRing->nSkipped, pRing->nTorn);
+			nFrames	= 0;
+			nReport	+= 1000000000ULL;
+		}
+	}
+	print_log("READER : Delay behind the first frame p50 %.1f us, p99 %.1f us",
+			stats_histogram_percentile(&age, 50) / 1000.0,
+			stats_histogram_percentile(&age, 99) / 1000.0);
+	shmring_close(pRing);
+
+	return 0;
+}
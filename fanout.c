@@ -0,0 +1,204 @@
+/*
+ ============================================================================
+ Name        : fanout.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Fan-out of captured frames for rpi-omx-tutorial.
+ ============================================================================
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "trace.h"
+#include "fanout.h"
+
+/*
+ * Move every queued frame of the consumer to released. Must be called with
+ * mutex locked. Frames are released by the caller after unlocking, since
+ * the last release calls back to the client.
+ */
+static unsigned int fanout_flush(FANOUT_CONSUMER* pConsumer, FANOUT_FRAME** released) {
+	unsigned int nReleased = 0;
+
+	while(pConsumer->nHead != pConsumer->nTail) {
+		released[nReleased++] = pConsumer->frames[pConsumer->nHead++ % FANOUT_QUEUE];
+	}
+	return nReleased;
+}
+
+void fanout_init(FANOUT* pFanout, FANOUT_RELEASE release, void* pData) {
+	memset(pFanout, 0x00, sizeof(FANOUT));
+	pthread_mutex_init(&pFanout->mutex, NULL);
+	pthread_cond_init(&pFanout->cond, NULL);
+	pFanout->release	= release;
+	pFanout->pData		= pData;
+	pFanout->isRunning	= 1;
+
+	for(int i = FANOUT_FRAMES - 1; i >= 0; i--) {
+		pFanout->frames[i].pFanout	= pFanout;
+		pFanout->frames[i].pNext	= pFanout->pFree;
+		pFanout->pFree				= &pFanout->frames[i];
+	}
+}
+
+int fanout_attach(FANOUT* pFanout, FANOUT_CONSUMER* pConsumer, const char* pName, unsigned int nLagMax) {
+	unsigned int i;
+
+	pthread_mutex_lock(&pFanout->mutex);
+	for(i = 0; i < pFanout->nConsumers && pFanout->consumers[i] != pConsumer; i++);
+	if(!pFanout->isRunning || (i == pFanout->nConsumers && i == FANOUT_CONSUMERS)) {
+		pthread_mutex_unlock(&pFanout->mutex);
+		return 0;
+	}
+
+	if(i == pFanout->nConsumers) {
+		memset(pConsumer, 0x00, sizeof(FANOUT_CONSUMER));
+		pConsumer->pFanout	= pFanout;
+		pConsumer->pName	= pName;
+		pFanout->consumers[pFanout->nConsumers++] = pConsumer;
+	}
+	pConsumer->nLagMax		= nLagMax < 1 ? 1 : nLagMax > FANOUT_QUEUE ? FANOUT_QUEUE : nLagMax;
+	pConsumer->isAttached	= 1;
+	pthread_mutex_unlock(&pFanout->mutex);
+
+	return 1;
+}
+
+int fanout_publish(FANOUT* pFanout, OMX_BUFFERHEADERTYPE* pBuffer, FANOUT_FRAME** ppFrame) {
+	FANOUT_FRAME*	released[FANOUT_CONSUMERS * FANOUT_QUEUE];
+	unsigned int	nReleased	= 0;
+	int				nQueued		= 0;
+
+	pthread_mutex_lock(&pFanout->mutex);
+	FANOUT_FRAME* pFrame = pFanout->isRunning ? pFanout->pFree : NULL;
+	if(ppFrame) *ppFrame = pFrame;
+	if(pFrame == NULL) {
+		pFanout->nUnconsumed++;
+		pthread_mutex_unlock(&pFanout->mutex);
+		pFanout->release(pBuffer, pFanout->pData);
+		return 0;
+	}
+	pFanout->pFree = pFrame->pNext;
+
+	// Publisher holds a reference until every consumer has it.
+	pFrame->pBuffer		= pBuffer;
+	pFrame->nRefs		= 1;
+	pFrame->nSequence	= pFanout->nSequence++;
+	pFrame->nPublished	= stats_now();
+	pFanout->nPublished++;
+
+	for(unsigned int i = 0; i < pFanout->nConsumers; i++) {
+		FANOUT_CONSUMER* pConsumer = pFanout->consumers[i];
+		if(!pConsumer->isAttached) continue;
+
+		unsigned int nLag = pConsumer->nTail - pConsumer->nHead;
+		if(nLag >= pConsumer->nLagMax) {
+			// Too slow. Capture goes on without it.
+			unsigned int nFlushed = fanout_flush(pConsumer, &released[nReleased]);
+			nReleased					+= nFlushed;
+			pConsumer->nFramesLost		+= nFlushed;
+			pConsumer->nDropped++;
+			pConsumer->isAttached		= 0;
+			TRACE_INSTANT("fanout drop");
+			continue;
+		}
+
+		__atomic_add_fetch(&pFrame->nRefs, 1, __ATOMIC_RELAXED);
+		pConsumer->frames[pConsumer->nTail++ % FANOUT_QUEUE] = pFrame;
+		if(nLag + 1 > pConsumer->nLagPeak) pConsumer->nLagPeak = nLag + 1;
+		nQueued++;
+	}
+	if(nQueued == 0 && ppFrame == NULL) pFanout->nUnconsumed++;
+	pthread_cond_broadcast(&pFanout->cond);
+	pthread_mutex_unlock(&pFanout->mutex);
+
+	for(unsigned int i = 0; i < nReleased; i++) {
+		fanout_release(released[i]);
+	}
+	// Publisher's reference is the caller's if asked.
+	if(ppFrame == NULL) fanout_release(pFrame);
+
+	return nQueued;
+}
+
+FANOUT_FRAME* fanout_take(FANOUT_CONSUMER* pConsumer) {
+	FANOUT*			pFanout	= pConsumer->pFanout;
+	FANOUT_FRAME*	pFrame	= NULL;
+
+	pthread_mutex_lock(&pFanout->mutex);
+	while(pFanout->isRunning && pConsumer->isAttached && pConsumer->nHead == pConsumer->nTail) {
+		pthread_cond_wait(&pFanout->cond, &pFanout->mutex);
+	}
+	if(pConsumer->nHead != pConsumer->nTail) {
+		pFrame = pConsumer->frames[pConsumer->nHead++ % FANOUT_QUEUE];
+		pConsumer->nTaken++;
+		stats_histogram_add(&pConsumer->lag, stats_now() - pFrame->nPublished);
+	}
+	pthread_mutex_unlock(&pFanout->mutex);
+
+	return pFrame;
+}
+
+FANOUT_FRAME* fanout_ref(FANOUT_FRAME* pFrame) {
+	__atomic_add_fetch(&pFrame->nRefs, 1, __ATOMIC_RELAXED);
+	return pFrame;
+}
+
+void fanout_release(FANOUT_FRAME* pFrame) {
+	FANOUT* pFanout = pFrame->pFanout;
+
+	// Reads of the buffer happen before the last reference drops.
+	if(__atomic_sub_fetch(&pFrame->nRefs, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+
+	OMX_BUFFERHEADERTYPE* pBuffer = pFrame->pBuffer;
+	pthread_mutex_lock(&pFanout->mutex);
+	pFrame->pBuffer	= NULL;
+	pFrame->pNext	= pFanout->pFree;
+	pFanout->pFree	= pFrame;
+	pthread_mutex_unlock(&pFanout->mutex);
+
+	pFanout->release(pBuffer, pFanout->pData);
+}
+
+void fanout_stop(FANOUT* pFanout) {
+	FANOUT_FRAME*	released[FANOUT_CONSUMERS * FANOUT_QUEUE];
+	unsigned int	nReleased = 0;
+
+	pthread_mutex_lock(&pFanout->mutex);
+	pFanout->isRunning = 0;
+	for(unsigned int i = 0; i < pFanout->nConsumers; i++) {
+		nReleased += fanout_flush(pFanout->consumers[i], &released[nReleased]);
+	}
+	pthread_cond_broadcast(&pFanout->cond);
+	pthread_mutex_unlock(&pFanout->mutex);
+
+	for(unsigned int i = 0; i < nReleased; i++) {
+		fanout_release(released[i]);
+	}
+}
+
+void fanout_report(FANOUT* pFanout) {
+	print_log("FANOUT : %d frames published, %d with no consumer", pFanout->nPublished, pFanout->nUnconsumed);
+	for(unsigned int i = 0; i < pFanout->nConsumers; i++) {
+		FANOUT_CONSUMER* pConsumer = pFanout->consumers[i];
+		print_log("FANOUT : %-8s %d taken, lag peak %d frames, p50 %.1f us, p99 %.1f us, dropped %d times with %d frames",
+				pConsumer->pName,
+				pConsumer->nTaken,
+				pConsumer->nLagPeak,
+				stats_histogram_percentile(&pConsumer->lag, 50) / 1000.0,
+				stats_histogram_percentile(&pConsumer->lag, 99) / 1000.0,
+				pConsumer->nDropped,
+				pConsumer->nFramesLost);
+	}
+}
+
+void fanout_destroy(FANOUT* pFanout) {
+	fanout_stop(pFanout);
+	pthread_cond_destroy(&pFanout->cond);
+	pthread_mutex_destroy(&pFanout->mutex);
+}
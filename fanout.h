@@ -0,0 +1,123 @@
+/*
+ ============================================================================
+ Name        : fanout.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Fan-out of captured frames for rpi-omx-tutorial.
+               A frame published once is queued to every attached consumer
+               as a reference counted handle over the OMX buffer itself, so
+               nothing is copied and consumers only read it. When the last
+               reference drops, the buffer goes to the release callback,
+               which usually hands it back to the camera.
+
+               Each consumer lags behind by the frames in its queue. A
+               consumer which has nLagMax frames queued when the next one
+               is published is dropped. Its queue is released, so capture
+               never waits for it, and fanout_take() returns NULL. It may
+               attach again to go on from the live frame.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_FANOUT_H_
+#define RPI_OMX_TUTORIAL_SRC_FANOUT_H_
+
+#include <pthread.h>
+
+#include <IL/OMX_Core.h>
+
+#include "stats.h"
+
+#define FANOUT_CONSUMERS	8		// Max number of consumers
+#define FANOUT_FRAMES		16		// Frames in flight
+#define FANOUT_QUEUE		8		// Frames a consumer may lag behind. Power of two.
+
+typedef void (*FANOUT_RELEASE)(OMX_BUFFERHEADERTYPE* pBuffer, void* pData);
+
+struct FANOUT;
+
+typedef struct FANOUT_FRAME {
+	struct FANOUT*			pFanout;
+	OMX_BUFFERHEADERTYPE*	pBuffer;			// Read only while referenced
+	unsigned int			nRefs;
+	unsigned long long		nSequence;
+	unsigned long long		nPublished;			// nsec
+	struct FANOUT_FRAME*	pNext;				// Free list
+} FANOUT_FRAME;
+
+typedef struct FANOUT_CONSUMER {
+	struct FANOUT*			pFanout;
+	const char*				pName;
+	FANOUT_FRAME*			frames[FANOUT_QUEUE];
+	unsigned int			nHead;				// Next frame to take
+	unsigned int			nTail;				// Next frame to queue
+	unsigned int			nLagMax;			// Frames queued before being dropped
+	int						isAttached;
+	unsigned int			nTaken;
+	unsigned int			nLagPeak;			// Most frames queued at once
+	unsigned int			nDropped;			// Times dropped for lagging
+	unsigned int			nFramesLost;		// Frames released from the queue on drop
+	STATS_HISTOGRAM			lag;				// nsec, publish to take
+} FANOUT_CONSUMER;
+
+typedef struct FANOUT {
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	FANOUT_RELEASE			release;
+	void*					pData;
+	FANOUT_FRAME			frames[FANOUT_FRAMES];
+	FANOUT_FRAME*			pFree;
+	FANOUT_CONSUMER*		consumers[FANOUT_CONSUMERS];
+	unsigned int			nConsumers;
+	unsigned long long		nSequence;
+	unsigned int			nPublished;
+	unsigned int			nUnconsumed;		// Released at once, no consumer attached
+	int						isRunning;
+} FANOUT;
+
+void fanout_init(FANOUT* pFanout, FANOUT_RELEASE release, void* pData);
+
+/*
+ * Attach a consumer, or attach a dropped one again. It gets frames
+ * published from now on. nLagMax is clamped to FANOUT_QUEUE.
+ * Returns 0 if there are FANOUT_CONSUMERS already or it is stopped.
+ */
+int fanout_attach(FANOUT* pFanout, FANOUT_CONSUMER* pConsumer, const char* pName, unsigned int nLagMax);
+
+/*
+ * Queue the buffer to every attached consumer. Safe from any thread,
+ * including OMX callbacks. Returns the number of consumers it is queued
+ * to. If ppFrame is not NULL, the caller gets a reference too, or NULL
+ * when stopped. With no reference, the buffer is released before this
+ * returns.
+ */
+int fanout_publish(FANOUT* pFanout, OMX_BUFFERHEADERTYPE* pBuffer, FANOUT_FRAME** ppFrame);
+
+/*
+ * Wait for the next frame of the consumer. The caller owns a reference
+ * and must fanout_release() it. NULL if the consumer is dropped or
+ * fan-out is stopped.
+ */
+FANOUT_FRAME* fanout_take(FANOUT_CONSUMER* pConsumer);
+
+/*
+ * Another reference for the caller, to keep the frame beyond the next take.
+ */
+FANOUT_FRAME* fanout_ref(FANOUT_FRAME* pFrame);
+
+/*
+ * Drop a reference. The last one releases the buffer on the calling thread.
+ */
+void fanout_release(FANOUT_FRAME* pFrame);
+
+/*
+ * Release every queued frame and wake consumers. Publish releases the
+ * buffer at once after this. Frames taken already are released by their
+ * consumers as usual.
+ */
+void fanout_stop(FANOUT* pFanout);
+
+void fanout_report(FANOUT* pFanout);
+
+void fanout_destroy(FANOUT* pFanout);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_FANOUT_H_ */
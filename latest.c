@@ -0,0 +1,128 @@
+/*
+ ============================================================================
+ Name        : latest.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Snapshot of the latest frame for rpi-omx-tutorial.
+ ============================================================================
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "common.h"
+#include "trace.h"
+#include "latest.h"
+
+/*
+ * Writer takes the slot unless a reader pins it. Sequence is odd while
+ * the slot is taken. Both sides store, then load the other, in one total
+ * order, so they never miss each other.
+ */
+static int latest_claim(LATEST_SLOT* pSlot) {
+	if(__atomic_load_n(&pSlot->nReaders, __ATOMIC_SEQ_CST) > 0) return 0;
+
+	__atomic_store_n(&pSlot->nSeq, pSlot->nSeq + 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&pSlot->nReaders, __ATOMIC_SEQ_CST) > 0) {
+		__atomic_store_n(&pSlot->nSeq, pSlot->nSeq + 1, __ATOMIC_RELEASE);
+		return 0;
+	}
+	return 1;
+}
+
+static void latest_unclaim(LATEST_SLOT* pSlot) {
+	__atomic_store_n(&pSlot->nSeq, pSlot->nSeq + 1, __ATOMIC_RELEASE);
+}
+
+void latest_init(LATEST* pLatest, LATEST_RELEASE release, void* pData) {
+	memset(pLatest, 0x00, sizeof(LATEST));
+	pLatest->nCurrent	= LATEST_NONE;
+	pLatest->release	= release;
+	pLatest->pData		= pData;
+}
+
+int latest_publish(LATEST* pLatest, void* pFrame, const LATEST_META* pMeta) {
+	unsigned int	nCurrent	= pLatest->nCurrent;
+	LATEST_SLOT*	pSlot		= NULL;
+	unsigned int	index;
+
+	for(unsigned int i = 1; i <= LATEST_SLOTS && pSlot == NULL; i++) {
+		index = (nCurrent + i) % LATEST_SLOTS;
+		if(index == nCurrent) continue;
+		if(latest_claim(&pLatest->slots[index])) pSlot = &pLatest->slots[index];
+	}
+	if(pSlot == NULL) {
+		pLatest->nSkipped++;
+		TRACE_INSTANT("latest skipped");
+		pLatest->release(pFrame, pLatest->pData);
+		return 0;
+	}
+
+	void* pFrameOld	= pSlot->pFrame;
+	pSlot->meta		= *pMeta;
+	pSlot->pFrame	= pFrame;
+	latest_unclaim(pSlot);
+	__atomic_store_n(&pLatest->nCurrent, index, __ATOMIC_SEQ_CST);
+	pLatest->nPublished++;
+	if(pFrameOld) pLatest->release(pFrameOld, pLatest->pData);
+
+	// Frames nobody can reach any more go back now.
+	for(unsigned int i = 0; i < LATEST_SLOTS; i++) {
+		LATEST_SLOT* pOld = &pLatest->slots[i];
+		if(i == index || pOld->pFrame == NULL || !latest_claim(pOld)) continue;
+
+		pFrameOld		= pOld->pFrame;
+		pOld->pFrame	= NULL;
+		latest_unclaim(pOld);
+		pLatest->release(pFrameOld, pLatest->pData);
+	}
+
+	return 1;
+}
+
+const LATEST_META* latest_acquire(LATEST* pLatest) {
+	for(unsigned int i = 0; i < LATEST_SLOTS; i++) {
+		unsigned int index = __atomic_load_n(&pLatest->nCurrent, __ATOMIC_SEQ_CST);
+		if(index == LATEST_NONE) return NULL;
+
+		LATEST_SLOT* pSlot = &pLatest->slots[index];
+		__atomic_add_fetch(&pSlot->nReaders, 1, __ATOMIC_SEQ_CST);
+		unsigned int nSeq = __atomic_load_n(&pSlot->nSeq, __ATOMIC_SEQ_CST);
+
+		// Even sequence with the reader counted in : writer stays out until release.
+		if(!(nSeq & 1) && pSlot->pFrame) {
+			__atomic_add_fetch(&pLatest->nAcquired, 1, __ATOMIC_RELAXED);
+			return &pSlot->meta;
+		}
+		__atomic_sub_fetch(&pSlot->nReaders, 1, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&pLatest->nRetried, 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_add_fetch(&pLatest->nMissed, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+void latest_release(LATEST* pLatest, const LATEST_META* pMeta) {
+	LATEST_SLOT* pSlot = (LATEST_SLOT*)((char*)pMeta - offsetof(LATEST_SLOT, meta));
+
+	// Reads of the frame happen before the writer may take the slot.
+	__atomic_sub_fetch(&pSlot->nReaders, 1, __ATOMIC_RELEASE);
+}
+
+void latest_clear(LATEST* pLatest) {
+	__atomic_store_n(&pLatest->nCurrent, LATEST_NONE, __ATOMIC_SEQ_CST);
+	for(unsigned int i = 0; i < LATEST_SLOTS; i++) {
+		LATEST_SLOT* pSlot = &pLatest->slots[i];
+		if(pSlot->pFrame == NULL) continue;
+
+		pLatest->release(pSlot->pFrame, pLatest->pData);
+		pSlot->pFrame = NULL;
+	}
+}
+
+void latest_report(LATEST* pLatest) {
+	print_log("LATEST : %d published, %d skipped, %d snapshots read, %d retried, %d missed",
+			pLatest->nPublished, pLatest->nSkipped, pLatest->nAcquired, pLatest->nRetried, pLatest->nMissed);
+}
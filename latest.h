@@ -0,0 +1,95 @@
+/*
+ ============================================================================
+ Name        : latest.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Snapshot of the latest frame for rpi-omx-tutorial.
+               One writer, usually the capture path, publishes a frame and
+               its metadata into one of a few slots. Readers pin the current
+               slot and read it as it is, with no lock and no copy, until
+               they release it.
+
+               Each slot has a sequence count and a reader count. Writer
+               makes the sequence odd before it touches a slot, then checks
+               readers. Reader counts itself in, then checks the sequence.
+               Either writer sees the reader and takes another slot, or
+               reader sees the writer and tries the new current slot, so
+               neither ever waits for the other. Reader gives up after
+               LATEST_SLOTS tries, which needs the writer to lap it that
+               many times. Writer skips the frame if readers pin every
+               other slot.
+
+               Frame of a slot is released when the slot is no longer
+               current and has no reader, so the latest frame and pinned
+               ones are all that is held.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_LATEST_H_
+#define RPI_OMX_TUTORIAL_SRC_LATEST_H_
+
+#include <IL/OMX_Core.h>
+
+#define LATEST_SLOTS		4
+#define LATEST_NONE			0xFFFFFFFF		// Nothing is published yet
+
+typedef void (*LATEST_RELEASE)(void* pFrame, void* pData);
+
+typedef struct LATEST_META {
+	unsigned long long		nSequence;
+	OMX_S64					nTimeStamp;			// usec, of the camera
+	unsigned long long		nPublished;			// nsec
+	unsigned int			nWidth;
+	unsigned int			nHeight;
+	unsigned int			nStride;
+	unsigned int			nLumaMean;
+	const OMX_U8*			pY;					// Valid while the snapshot is pinned
+} LATEST_META;
+
+typedef struct LATEST_SLOT {
+	unsigned int			nSeq;				// Odd while writer owns the slot
+	unsigned int			nReaders;
+	LATEST_META				meta;
+	void*					pFrame;				// NULL if released
+} LATEST_SLOT;
+
+typedef struct LATEST {
+	LATEST_SLOT				slots[LATEST_SLOTS];
+	unsigned int			nCurrent;			// Index of the current slot
+	LATEST_RELEASE			release;
+	void*					pData;
+
+	// Writer only
+	unsigned int			nPublished;
+	unsigned int			nSkipped;			// Every other slot was pinned
+
+	// Readers
+	unsigned int			nAcquired;
+	unsigned int			nRetried;			// Slot was taken by the writer meanwhile
+	unsigned int			nMissed;			// Gave up after LATEST_SLOTS tries
+} LATEST;
+
+void latest_init(LATEST* pLatest, LATEST_RELEASE release, void* pData);
+
+/*
+ * Publish a frame and its metadata. Writer is one thread. Takes over the
+ * frame. It is released now if every other slot is pinned, then returns 0.
+ */
+int latest_publish(LATEST* pLatest, void* pFrame, const LATEST_META* pMeta);
+
+/*
+ * Pin the current snapshot. NULL if nothing is published or the writer
+ * lapped this reader. Any thread, any number of readers.
+ */
+const LATEST_META* latest_acquire(LATEST* pLatest);
+
+void latest_release(LATEST* pLatest, const LATEST_META* pMeta);
+
+/*
+ * Release every frame. No reader may hold a snapshot.
+ */
+void latest_clear(LATEST* pLatest);
+
+void latest_report(LATEST* pLatest);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_LATEST_H_ */
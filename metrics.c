@@ -0,0 +1,252 @@
+/*
+ ============================================================================
+ Name        : metrics.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Metrics endpoint for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "metrics.h"
+
+#define METRICS_MAX		64
+
+typedef enum METRIC_SOURCE {
+	SourceU32	= 0x00,
+	SourceU64,
+	SourceFunction,
+	SourceHistogram
+} METRIC_SOURCE;
+
+typedef struct {
+	const char*			pName;
+	const char*			pHelp;
+	METRIC_TYPE			eType;
+	METRIC_SOURCE		eSource;
+	const void*			pValue;
+	double				(*read)(void*);
+	void*				pUser;
+	double				scale;
+} METRIC;
+
+static METRIC		metrics[METRICS_MAX];
+static int			nMetrics		= 0;
+static int			fdMetrics		= -1;
+static int			isMetricsValid	= 0;
+static char			pathMetrics[108];
+static pthread_t	threadMetrics;
+
+static METRIC* metrics_add(const char* name, const char* help, METRIC_TYPE type, METRIC_SOURCE source) {
+	if(nMetrics >= METRICS_MAX) {
+		fprintf(stderr, "METRICS > Too many metrics. %s is ignored.\n", name);
+		return NULL;
+	}
+
+	METRIC* pMetric = &metrics[nMetrics++];
+	memset(pMetric, 0x00, sizeof(METRIC));
+	pMetric->pName		= strdup(name);		// Caller may have built it on the stack
+	pMetric->pHelp		= help;
+	pMetric->eType		= type;
+	pMetric->eSource	= source;
+	return pMetric;
+}
+
+void metrics_add_u32(const char* name, const char* help, METRIC_TYPE type, const unsigned int* pValue) {
+	METRIC* pMetric = metrics_add(name, help, type, SourceU32);
+	if(pMetric) pMetric->pValue = pValue;
+}
+
+void metrics_add_u64(const char* name, const char* help, METRIC_TYPE type, const unsigned long long* pValue) {
+	METRIC* pMetric = metrics_add(name, help, type, SourceU64);
+	if(pMetric) pMetric->pValue = pValue;
+}
+
+void metrics_add_function(const char* name, const char* help, METRIC_TYPE type, double (*read)(void*), void* pUser) {
+	METRIC* pMetric = metrics_add(name, help, type, SourceFunction);
+	if(pMetric) {
+		pMetric->read	= read;
+		pMetric->pUser	= pUser;
+	}
+}
+
+void metrics_add_histogram(const char* name, const char* help, STATS_HISTOGRAM* pHistogram, double scale) {
+	METRIC* pMetric = metrics_add(name, help, MetricGauge, SourceHistogram);
+	if(pMetric) {
+		pMetric->pValue	= pHistogram;
+		pMetric->scale	= scale;
+	}
+}
+
+static double metrics_process_cpu(void* pUser) {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Length of the name before labels, if any. */
+static int metrics_family(const char* pName) {
+	const char* pLabels = strchr(pName, '{');
+	return pLabels ? pLabels - pName : strlen(pName);
+}
+
+static void metrics_write(FILE* fp) {
+	static const double quantiles[] = { 0.5, 0.9, 0.99 };
+
+	for(int i = 0; i < nMetrics; i++) {
+		METRIC*		pMetric		= &metrics[i];
+		const char*	pName		= pMetric->pName;
+		int			nFamily		= metrics_family(pName);
+		const char*	pLabels		= pName + nFamily;		// "{...}" or ""
+		const char*	pType		= pMetric->eSource == SourceHistogram ? "summary" : pMetric->eType == MetricCounter ? "counter" : "gauge";
+
+		// Series of a family follow one another, under one HELP and TYPE.
+		if(i == 0 || metrics_family(metrics[i - 1].pName) != nFamily || strncmp(metrics[i - 1].pName, pName, nFamily) != 0) {
+			fprintf(fp, "# HELP %.*s %s\n", nFamily, pName, pMetric->pHelp);
+			fprintf(fp, "# TYPE %.*s %s\n", nFamily, pName, pType);
+		}
+
+		switch(pMetric->eSource) {
+		case SourceU32 :
+			fprintf(fp, "%s %u\n", pName, __atomic_load_n((const unsigned int*)pMetric->pValue, __ATOMIC_RELAXED));
+			break;
+		case SourceU64 :
+			fprintf(fp, "%s %llu\n", pName, __atomic_load_n((const unsigned long long*)pMetric->pValue, __ATOMIC_RELAXED));
+			break;
+		case SourceFunction :
+			fprintf(fp, "%s %.6f\n", pName, pMetric->read(pMetric->pUser));
+			break;
+		case SourceHistogram : {
+			STATS_HISTOGRAM* pHistogram = (STATS_HISTOGRAM*)pMetric->pValue;
+			// quantile goes into the labels of the series.
+			int nLabels = *pLabels ? strlen(pLabels) - 2 : 0;
+			for(int q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+				fprintf(fp, "%.*s{%.*s%squantile=\"%g\"} %.9g\n", nFamily, pName, nLabels, pLabels + 1, nLabels ? "," : "",
+						quantiles[q], stats_histogram_percentile(pHistogram, quantiles[q] * 100) * pMetric->scale);
+			}
+			fprintf(fp, "%.*s_sum%s %.9g\n", nFamily, pName, pLabels, __atomic_load_n(&pHistogram->nSum, __ATOMIC_RELAXED) * pMetric->scale);
+			fprintf(fp, "%.*s_count%s %llu\n", nFamily, pName, pLabels, __atomic_load_n(&pHistogram->nCount, __ATOMIC_RELAXED));
+			break;
+		}
+		}
+	}
+}
+
+static void metrics_serve(int fdClient) {
+	char	request[512];
+	char*	pBody		= NULL;
+	size_t	nBody		= 0;
+
+	// Scraper may send HTTP request or nothing at all. Do not wait long for it.
+	struct pollfd pfd = { fdClient, POLLIN, 0 };
+	int isHTTP = 0;
+	if(poll(&pfd, 1, 100) > 0) {
+		ssize_t n = recv(fdClient, request, sizeof(request) - 1, MSG_DONTWAIT);
+		isHTTP = (n >= 4 && memcmp(request, "GET ", 4) == 0);
+	}
+
+	FILE* fp = open_memstream(&pBody, &nBody);
+	if(fp == NULL) return;
+	metrics_write(fp);
+	fclose(fp);
+
+	if(isHTTP) {
+		char header[128];
+		int nHeader = snprintf(header, sizeof(header),
+				"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", nBody);
+		send(fdClient, header, nHeader, MSG_NOSIGNAL);
+	}
+	for(size_t nSent = 0; nSent < nBody; ) {
+		ssize_t n = send(fdClient, pBody + nSent, nBody - nSent, MSG_NOSIGNAL);
+		if(n <= 0) break;
+		nSent += n;
+	}
+	free(pBody);
+}
+
+static void* thread_metrics(void* data) {
+	pthread_setname_np(pthread_self(), "metrics");
+
+	// Server shall never take CPU from capture path.
+	struct sched_param param = { 0 };
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+	while(__atomic_load_n(&isMetricsValid, __ATOMIC_ACQUIRE)) {
+		struct pollfd pfd = { fdMetrics, POLLIN, 0 };
+		if(poll(&pfd, 1, 200) <= 0) continue;
+
+		int fdClient = accept(fdMetrics, NULL, NULL);
+		if(fdClient < 0) continue;
+
+		struct timeval timeout = { 1, 0 };
+		setsockopt(fdClient, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		metrics_serve(fdClient);
+		close(fdClient);
+	}
+
+	pthread_exit(NULL);
+}
+
+int metrics_start(const char* path) {
+	if(path == NULL || *path == '\0') return -1;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "METRICS > Socket path is too long : %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	if((fdMetrics = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		perror("METRICS > socket");
+		return -1;
+	}
+	unlink(path);
+	if(bind(fdMetrics, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fdMetrics, 4) < 0) {
+		perror("METRICS > bind");
+		close(fdMetrics);
+		fdMetrics = -1;
+		return -1;
+	}
+	strcpy(pathMetrics, path);
+
+	metrics_add_function("process_cpu_seconds_total", "Total user and system CPU time in seconds.", MetricCounter, metrics_process_cpu, NULL);
+
+	isMetricsValid = 1;
+	if(pthread_create(&threadMetrics, NULL, thread_metrics, NULL) != 0) {
+		isMetricsValid = 0;
+		close(fdMetrics);
+		fdMetrics = -1;
+		unlink(pathMetrics);
+		return -1;
+	}
+
+	printf("METRICS > Serving on %s\n", path);
+	return 0;
+}
+
+void metrics_stop() {
+	if(fdMetrics < 0) return;
+
+	__atomic_store_n(&isMetricsValid, 0, __ATOMIC_RELEASE);
+	pthread_join(threadMetrics, NULL);
+	close(fdMetrics);
+	fdMetrics = -1;
+	unlink(pathMetrics);
+}
@@ -0,0 +1,57 @@
+/*
+ ============================================================================
+ Name        : metrics.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Metrics endpoint for rpi-omx-tutorial.
+               Serves registered values in Prometheus text format over
+               Unix domain socket. e.g.
+               curl --unix-socket /tmp/omx.sock http://localhost/metrics
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_METRICS_H_
+#define RPI_OMX_TUTORIAL_SRC_METRICS_H_
+
+#include "stats.h"
+
+typedef enum METRIC_TYPE {
+	MetricCounter	= 0x00,
+	MetricGauge
+} METRIC_TYPE;
+
+/*
+ * Register a value to be served. The value is only read by the server thread
+ * with atomic load, so capture path just updates it as usual.
+ * Every register function should be called before metrics_start().
+ *
+ * Name may carry labels, as omx_fps{camera="0"}. Series of one name are
+ * registered one after another and share help of the first.
+ */
+void metrics_add_u32(const char* name, const char* help, METRIC_TYPE type, const unsigned int* pValue);
+
+void metrics_add_u64(const char* name, const char* help, METRIC_TYPE type, const unsigned long long* pValue);
+
+/*
+ * Register a value computed on every scrape. read() runs on server thread.
+ */
+void metrics_add_function(const char* name, const char* help, METRIC_TYPE type, double (*read)(void*), void* pUser);
+
+/*
+ * Register a histogram as summary. scale converts the unit of histogram
+ * into the unit of metric. e.g. 1e-9 for nsec -> sec.
+ */
+void metrics_add_histogram(const char* name, const char* help, STATS_HISTOGRAM* pHistogram, double scale);
+
+/*
+ * Start the server thread on socket path with the lowest priority.
+ * Returns 0 on success, -1 if path is NULL or socket is not available.
+ */
+int metrics_start(const char* path);
+
+/*
+ * Stop the server thread and remove the socket.
+ */
+void metrics_stop();
+
+#endif /* RPI_OMX_TUTORIAL_SRC_METRICS_H_ */
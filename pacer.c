@@ -0,0 +1,89 @@
+/*
+ ============================================================================
+ Name        : pacer.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Frame pacing for rpi-omx-tutorial.
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include "common.h"
+#include "pacer.h"
+
+void pacer_init(PACER* pPacer, unsigned int nFramerate, unsigned long long nDelay) {
+	memset(pPacer, 0x00, sizeof(PACER));
+	pPacer->nInterval	= 1000000000ULL / (nFramerate ? nFramerate : 1);
+	pPacer->nDelay		= nDelay ? nDelay : pPacer->nInterval;
+	pPacer->isAnchored	= OMX_FALSE;
+}
+
+static void pacer_anchor(PACER* pPacer, long long nTime, unsigned long long nNow) {
+	pPacer->nOffset		= (long long)(nNow + pPacer->nDelay) - nTime;
+	pPacer->nNextSlot	= nNow + pPacer->nDelay;
+	pPacer->isAnchored	= OMX_TRUE;
+}
+
+unsigned long long pacer_schedule(PACER* pPacer, OMX_S64 nTimestamp, unsigned long long nNow) {
+	long long nTime = nTimestamp * 1000;
+
+	if(!pPacer->isAnchored) {
+		pacer_anchor(pPacer, nTime, nNow);
+	}
+
+	// Camera clock drifted or jumped, like a replay starting over.
+	long long nDue = nTime + pPacer->nOffset;
+	long long nSpan = (long long)pPacer->nInterval * PACER_RESYNC;
+	if(nDue < (long long)nNow - nSpan || nDue > (long long)(nNow + pPacer->nDelay) + nSpan) {
+		pacer_anchor(pPacer, nTime, nNow);
+		nDue = nTime + pPacer->nOffset;
+		pPacer->nResync++;
+	}
+
+	// Snap to the nearest slot, not earlier than the one after last frame.
+	long long nSlot = pPacer->nNextSlot;
+	long long nDiff = nDue - nSlot;
+	if(nDiff < -(long long)pPacer->nInterval / 2) {
+		pPacer->nSkipped++;
+		return 0;
+	}
+	if(nDiff > 0) {
+		nSlot += (nDiff + pPacer->nInterval / 2) / pPacer->nInterval * pPacer->nInterval;
+	}
+	pPacer->nNextSlot = nSlot + pPacer->nInterval;
+
+	return pacer_is_late(pPacer, nSlot, nNow) ? 0 : nSlot;
+}
+
+OMX_BOOL pacer_is_late(PACER* pPacer, unsigned long long nSlot, unsigned long long nNow) {
+	if(nNow <= nSlot + pPacer->nInterval / 2) return OMX_FALSE;
+
+	pPacer->nLate++;
+	return OMX_TRUE;
+}
+
+void pacer_release(PACER* pPacer, unsigned long long nSlot, unsigned long long nNow) {
+	stats_histogram_add(&pPacer->error, nNow > nSlot ? nNow - nSlot : 0);
+	if(pPacer->nLastRelease) {
+		unsigned long long nPeriod = nNow - pPacer->nLastRelease;
+		stats_histogram_add(&pPacer->jitter, nPeriod > pPacer->nInterval ? nPeriod - pPacer->nInterval : pPacer->nInterval - nPeriod);
+	}
+	pPacer->nLastRelease = nNow;
+	pPacer->nReleased++;
+}
+
+void pacer_report(PACER* pPacer) {
+	print_log("PACE : %.2f ms interval, %.2f ms delay, %d released, %d skipped, %d late, %d resync",
+			pPacer->nInterval / 1e6, pPacer->nDelay / 1e6,
+			pPacer->nReleased, pPacer->nSkipped, pPacer->nLate, pPacer->nResync);
+	print_log("PACE : Error p50 %.1f us, p99 %.1f us, max %.1f us",
+			stats_histogram_percentile(&pPacer->error, 50) / 1000.0,
+			stats_histogram_percentile(&pPacer->error, 99) / 1000.0,
+			pPacer->error.nMax / 1000.0);
+	print_log("PACE : Jitter p50 %.1f us, p99 %.1f us, max %.1f us",
+			stats_histogram_percentile(&pPacer->jitter, 50) / 1000.0,
+			stats_histogram_percentile(&pPacer->jitter, 99) / 1000.0,
+			pPacer->jitter.nMax / 1000.0);
+}
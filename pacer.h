@@ -0,0 +1,68 @@
+/*
+ ============================================================================
+ Name        : pacer.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Frame pacing for rpi-omx-tutorial.
+               Maps nTimeStamp of the camera onto CLOCK_MONOTONIC with a
+               fixed playout delay and snaps it to slots of the display
+               interval. Client releases each frame at its slot, so jitter
+               of the camera is absorbed and the render gets steady cadence.
+               A frame whose slot is taken by the previous frame, or which
+               is already past its slot, is skipped.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_PACER_H_
+#define RPI_OMX_TUTORIAL_SRC_PACER_H_
+
+#include <IL/OMX_Core.h>
+
+#include "stats.h"
+
+/* Re-anchor when the camera clock is off by this number of intervals. */
+#define PACER_RESYNC		4
+
+typedef struct PACER {
+	unsigned long long	nInterval;			// nsec, display interval
+	unsigned long long	nDelay;				// nsec, playout delay from the first frame
+	OMX_BOOL			isAnchored;
+	long long			nOffset;			// nsec, CLOCK_MONOTONIC - nTimeStamp
+	unsigned long long	nNextSlot;			// nsec, earliest slot of the next frame
+	unsigned long long	nLastRelease;		// nsec
+
+	unsigned int		nReleased;
+	unsigned int		nSkipped;			// Slot was taken by the previous frame
+	unsigned int		nLate;				// Slot was over before release
+	unsigned int		nResync;
+	STATS_HISTOGRAM		error;				// nsec, release - slot
+	STATS_HISTOGRAM		jitter;				// nsec, |release interval - nInterval|
+} PACER;
+
+/*
+ * nFramerate is the display rate. nDelay of 0 is one display interval.
+ */
+void pacer_init(PACER* pPacer, unsigned int nFramerate, unsigned long long nDelay);
+
+/*
+ * Slot of the frame with nTimeStamp (usec) in nsec of CLOCK_MONOTONIC.
+ * 0 : The frame shall be skipped.
+ */
+unsigned long long pacer_schedule(PACER* pPacer, OMX_S64 nTimestamp, unsigned long long nNow);
+
+/*
+ * Whether the frame of nSlot is too late to be shown at nNow. Counted as late if so.
+ */
+OMX_BOOL pacer_is_late(PACER* pPacer, unsigned long long nSlot, unsigned long long nNow);
+
+/*
+ * Frame of nSlot is handed to the render at nNow.
+ */
+void pacer_release(PACER* pPacer, unsigned long long nSlot, unsigned long long nNow);
+
+/*
+ * Print pacing error statistics.
+ */
+void pacer_report(PACER* pPacer);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_PACER_H_ */
@@ -0,0 +1,266 @@
+/*
+ ============================================================================
+ Name        : preroll.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Pre-event recorder for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#include "common.h"
+#include "stats.h"
+#include "trace.h"
+#include "preroll.h"
+
+/* Lines of a plane without padding. Returns the end of them. */
+static uint8_t* preroll_pack_plane(uint8_t* pDst, const OMX_U8* pPlane, unsigned int nWidth, unsigned int nHeight, unsigned int nStride) {
+	if(nWidth == nStride) {
+		memcpy(pDst, pPlane, nWidth * nHeight);
+		return pDst + nWidth * nHeight;
+	}
+	for(unsigned int y = 0; y < nHeight; y++, pDst += nWidth) {
+		memcpy(pDst, pPlane + y * nStride, nWidth);
+	}
+	return pDst;
+}
+
+/*
+ * Copy a frame from the ring file. copy_file_range() is missing on kernels
+ * before 4.5 and refused by some file systems, and then sendfile() is used
+ * from then on. Both copy in the kernel.
+ */
+static OMX_BOOL preroll_copy(PREROLL* pPreroll, int fdOut, off_t nOffset, size_t nSize, OMX_BOOL* pIsSendfile) {
+	while(nSize > 0) {
+		ssize_t nCopied;
+		if(*pIsSendfile)	nCopied = sendfile(fdOut, pPreroll->fd, &nOffset, nSize);
+		else				nCopied = copy_file_range(pPreroll->fd, &nOffset, fdOut, NULL, nSize, 0);
+
+		if(nCopied < 0 && !*pIsSendfile && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+			*pIsSendfile = OMX_TRUE;
+			continue;
+		}
+		if(nCopied <= 0) {
+			if(nCopied < 0 && errno == EINTR) continue;
+			print_log("PREROLL : Failed to copy. %s", nCopied < 0 ? strerror(errno) : "Short file");
+			return OMX_FALSE;
+		}
+		nSize -= nCopied;
+	}
+	return OMX_TRUE;
+}
+
+/* Copy frames of the window, oldest first. */
+static void preroll_flush(PREROLL* pPreroll, uint64_t nFirst, uint64_t nEnd, const char* pReason) {
+	PREROLL_HEADER*	pHeader		= pPreroll->pHeader;
+	OMX_BOOL		isSendfile	= OMX_FALSE;
+	unsigned int	nFrames		= 0;
+	int64_t			nTimeFirst	= 0;
+	int64_t			nTimeLast	= 0;
+	char			path[300];
+
+	snprintf(path, sizeof(path), "%s-%04u.yuv", pPreroll->prefix, pPreroll->nEvents);
+	int fdOut = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fdOut < 0) {
+		print_log("PREROLL : Failed to open %s. %s", path, strerror(errno));
+		return;
+	}
+
+	TRACE_BEGIN("preroll_flush");
+	unsigned long long nBegin = stats_now();
+	for(uint64_t nFrame = nFirst; nFrame < nEnd; nFrame++) {
+		unsigned int	nSlot		= nFrame % pHeader->nSlots;
+		PREROLL_INDEX*	pIndex		= &pPreroll->pIndex[nSlot];
+		int64_t			nTimeStamp	= pIndex->nTimeStamp;
+		OMX_BOOL		isValid		= pIndex->nFrame == nFrame + 1;
+
+		if(isValid && !preroll_copy(pPreroll, fdOut, (off_t)pHeader->nHeaderSize + (off_t)nSlot * pHeader->nSlotSize, pHeader->nFrameSize, &isSendfile)) {
+			break;
+		}
+		// Writer may take the slot from now on.
+		__atomic_store_n(&pPreroll->nCopied, nFrame + 1, __ATOMIC_RELEASE);
+		if(!isValid) continue;
+		if(nFrames++ == 0) nTimeFirst = nTimeStamp;
+		nTimeLast = nTimeStamp;
+	}
+	double nElapsed = (stats_now() - nBegin) / 1e6;
+	TRACE_END("preroll_flush");
+	close(fdOut);
+
+	print_log("PREROLL : %s, %d frames of %.2f sec before %s, copied in %.1f ms by %s", path, nFrames,
+			(nTimeLast - nTimeFirst) / 1e6, pReason, nElapsed, isSendfile ? "sendfile" : "copy_file_range");
+}
+
+static void* preroll_thread(void* data) {
+	PREROLL* pPreroll = (PREROLL*)data;
+
+	pthread_setname_np(pthread_self(), "preroll_copy");
+	cpu_thread_register("preroll_copy");
+
+	pthread_mutex_lock(&pPreroll->mutex);
+	while(pPreroll->isRunning || pPreroll->isFrozen) {
+		if(!pPreroll->isFrozen) {
+			pthread_cond_wait(&pPreroll->cond, &pPreroll->mutex);
+			continue;
+		}
+
+		uint64_t	nFirst	= pPreroll->nFirst;
+		uint64_t	nEnd	= pPreroll->nEnd;
+		const char*	pReason	= pPreroll->pReason;
+		pthread_mutex_unlock(&pPreroll->mutex);
+		preroll_flush(pPreroll, nFirst, nEnd, pReason);
+		pthread_mutex_lock(&pPreroll->mutex);
+
+		pPreroll->nEvents++;
+		pPreroll->pReason	= NULL;
+		pPreroll->isFrozen	= OMX_FALSE;
+	}
+	pthread_mutex_unlock(&pPreroll->mutex);
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+/* Window is the frames written so far, up to a ring. Must be called with mutex locked. */
+static void preroll_freeze(PREROLL* pPreroll) {
+	uint64_t nWritten = pPreroll->pHeader->nWritten;
+
+	pPreroll->nEnd		= nWritten;
+	pPreroll->nFirst	= nWritten > pPreroll->pHeader->nSlots ? nWritten - pPreroll->pHeader->nSlots : 0;
+	pPreroll->isFrozen	= OMX_TRUE;
+	__atomic_store_n(&pPreroll->nCopied, pPreroll->nFirst, __ATOMIC_RELAXED);
+	pthread_cond_signal(&pPreroll->cond);
+}
+
+PREROLL* preroll_open(const char* pPrefix, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef, unsigned int nSlots) {
+	OMX_VIDEO_PORTDEFINITIONTYPE*	pVideo		= &pPortDef->format.video;
+	long							nPage		= sysconf(_SC_PAGESIZE);
+	uint32_t						nFrameSize	= pVideo->nFrameWidth * pVideo->nFrameHeight * 3 / 2;
+	uint32_t						nSlotSize	= (nFrameSize + nPage - 1) / nPage * nPage;
+	uint32_t						nHeaderSize	= (sizeof(PREROLL_HEADER) + nSlots * sizeof(PREROLL_INDEX) + nPage - 1) / nPage * nPage;
+	PREROLL*						pPreroll	= calloc(1, sizeof(PREROLL));
+	char							path[300];
+
+	snprintf(pPreroll->prefix, sizeof(pPreroll->prefix), "%s", pPrefix);
+	snprintf(path, sizeof(path), "%s.ring", pPrefix);
+	pPreroll->nSize			= nHeaderSize + (size_t)nSlotSize * nSlots;
+	pPreroll->nStride		= pVideo->nStride > 0 ? pVideo->nStride : pVideo->nFrameWidth;
+	pPreroll->nSliceHeight	= pVideo->nSliceHeight > 0 ? pVideo->nSliceHeight : pVideo->nFrameHeight;
+
+	if((pPreroll->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0
+			|| ftruncate(pPreroll->fd, pPreroll->nSize) != 0
+			|| (pPreroll->pBase = mmap(NULL, pPreroll->nSize, PROT_READ | PROT_WRITE, MAP_SHARED, pPreroll->fd, 0)) == MAP_FAILED) {
+		print_log("PREROLL : Failed to create %s. %s", path, strerror(errno));
+		if(pPreroll->fd >= 0) close(pPreroll->fd);
+		free(pPreroll);
+		return NULL;
+	}
+
+	// Frames of the last run are forgotten.
+	PREROLL_HEADER* pHeader = pPreroll->pHeader = (PREROLL_HEADER*)pPreroll->pBase;
+	pPreroll->pIndex = (PREROLL_INDEX*)(pPreroll->pBase + sizeof(PREROLL_HEADER));
+	memset(pPreroll->pBase, 0x00, nHeaderSize);
+	memcpy(pHeader->magic, PREROLL_MAGIC, sizeof(pHeader->magic));
+	pHeader->nWidth			= pVideo->nFrameWidth;
+	pHeader->nHeight		= pVideo->nFrameHeight;
+	pHeader->nFrameSize		= nFrameSize;
+	pHeader->nSlots			= nSlots;
+	pHeader->nSlotSize		= nSlotSize;
+	pHeader->nHeaderSize	= nHeaderSize;
+
+	pthread_mutex_init(&pPreroll->mutex, NULL);
+	pthread_cond_init(&pPreroll->cond, NULL);
+	pPreroll->isRunning = OMX_TRUE;
+	if(pthread_create(&pPreroll->thread, NULL, preroll_thread, pPreroll) != 0) {
+		print_log("PREROLL : Failed to start the copier.");
+		munmap(pPreroll->pBase, pPreroll->nSize);
+		close(pPreroll->fd);
+		free(pPreroll);
+		return NULL;
+	}
+
+	print_log("PREROLL : %s, %d frames of %dx%d, %zu bytes", path, nSlots, pHeader->nWidth, pHeader->nHeight, pPreroll->nSize);
+	return pPreroll;
+}
+
+void preroll_write(PREROLL* pPreroll, OMX_BUFFERHEADERTYPE* pBuffer) {
+	PREROLL_HEADER* pHeader = pPreroll->pHeader;
+
+	pthread_mutex_lock(&pPreroll->mutex);
+	if(pPreroll->pReason && !pPreroll->isFrozen) {
+		preroll_freeze(pPreroll);
+	}
+	OMX_BOOL isFrozen = pPreroll->isFrozen;
+	pthread_mutex_unlock(&pPreroll->mutex);
+
+	// Frame in the slot must be copied before it is overwritten.
+	uint64_t nFrame = pHeader->nWritten;
+	if(isFrozen && nFrame >= pHeader->nSlots && nFrame - pHeader->nSlots >= __atomic_load_n(&pPreroll->nCopied, __ATOMIC_ACQUIRE)) {
+		pPreroll->nFramesMissed++;
+		return;
+	}
+
+	// Slot is marked empty while written, for a reader after a crash.
+	unsigned int	nSlot	= nFrame % pHeader->nSlots;
+	PREROLL_INDEX*	pIndex	= &pPreroll->pIndex[nSlot];
+	pIndex->nFrame = 0;
+
+	TRACE_BEGIN("preroll_write");
+	const OMX_U8*	pY		= pBuffer->pBuffer + pBuffer->nOffset;
+	unsigned int	nSizeY	= pPreroll->nStride * pPreroll->nSliceHeight;
+	uint8_t*		pDst	= pPreroll->pBase + pHeader->nHeaderSize + (size_t)nSlot * pHeader->nSlotSize;
+	pDst = preroll_pack_plane(pDst, pY, pHeader->nWidth, pHeader->nHeight, pPreroll->nStride);
+	pDst = preroll_pack_plane(pDst, pY + nSizeY, pHeader->nWidth / 2, pHeader->nHeight / 2, pPreroll->nStride / 2);
+	preroll_pack_plane(pDst, pY + nSizeY * 5 / 4, pHeader->nWidth / 2, pHeader->nHeight / 2, pPreroll->nStride / 2);
+	TRACE_END("preroll_write");
+
+	pIndex->nTimeStamp	= OMX_TICKS_TO_S64(pBuffer->nTimeStamp);
+	pIndex->nFrame		= nFrame + 1;
+	pHeader->nWritten	= nFrame + 1;
+}
+
+void preroll_trigger(PREROLL* pPreroll, const char* pReason) {
+	pthread_mutex_lock(&pPreroll->mutex);
+	if(pPreroll->pReason || pPreroll->isFrozen) {
+		pPreroll->nTriggersIgnored++;
+		pthread_mutex_unlock(&pPreroll->mutex);
+		return;
+	}
+	pPreroll->pReason = pReason;
+	pthread_mutex_unlock(&pPreroll->mutex);
+
+	print_log("PREROLL : Triggered by %s.", pReason);
+}
+
+void preroll_close(PREROLL* pPreroll) {
+	if(pPreroll == NULL) return;
+
+	// Writer is gone. A trigger with no frame after it is frozen here.
+	pthread_mutex_lock(&pPreroll->mutex);
+	if(pPreroll->pReason && !pPreroll->isFrozen) {
+		preroll_freeze(pPreroll);
+	}
+	pPreroll->isRunning = OMX_FALSE;
+	pthread_cond_signal(&pPreroll->cond);
+	pthread_mutex_unlock(&pPreroll->mutex);
+	pthread_join(pPreroll->thread, NULL);
+
+	print_log("PREROLL : %llu frames written, %d events copied, %d triggers ignored, %d frames missed while copying",
+			(unsigned long long)pPreroll->pHeader->nWritten, pPreroll->nEvents, pPreroll->nTriggersIgnored, pPreroll->nFramesMissed);
+
+	pthread_cond_destroy(&pPreroll->cond);
+	pthread_mutex_destroy(&pPreroll->mutex);
+	munmap(pPreroll->pBase, pPreroll->nSize);
+	close(pPreroll->fd);
+	free(pPreroll);
+}
@@ -0,0 +1,103 @@
+/*
+ ============================================================================
+ Name        : preroll.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Pre-event recorder for rpi-omx-tutorial.
+               Frames are packed as planar I420 into a ring file of fixed
+               size which is mapped shared, so the last nSlots frames are
+               always there, and memory and storage never grow with time.
+               Index in the header tells the frame and time of each slot,
+               so the ring can be read even after a crash.
+
+               On a trigger, the window is frozen at the next frame and a
+               thread of its own copies it to <prefix>-0000.yuv and on, in
+               order, by copy_file_range() or sendfile(). Frames never go
+               through a user buffer. Frames coming while it is copied go
+               on into slots copied already, so one is missed only when
+               copying falls behind by a ring.
+
+               Ring file : PREROLL_HEADER and PREROLL_INDEX of each slot in
+               nHeaderSize bytes, then nSlots slots of nSlotSize bytes.
+               Integers are in host byte order.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_PREROLL_H_
+#define RPI_OMX_TUTORIAL_SRC_PREROLL_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Component.h>
+
+#define PREROLL_MAGIC		"OMXPRE01"
+
+typedef struct PREROLL_HEADER {
+	char				magic[8];
+	uint32_t			nWidth;
+	uint32_t			nHeight;
+	uint32_t			nFrameSize;			// Packed I420
+	uint32_t			nSlots;
+	uint32_t			nSlotSize;			// Page aligned
+	uint32_t			nHeaderSize;		// Page aligned. Slots follow.
+	uint64_t			nWritten;			// Frames written. Next one goes to nWritten % nSlots.
+} PREROLL_HEADER;
+
+typedef struct PREROLL_INDEX {
+	uint64_t			nFrame;				// Frame + 1 in the slot. 0 if empty.
+	int64_t				nTimeStamp;			// usec, of the camera
+} PREROLL_INDEX;
+
+typedef struct PREROLL {
+	char				prefix[256];
+	int					fd;
+	uint8_t*			pBase;
+	size_t				nSize;
+	PREROLL_HEADER*		pHeader;
+	PREROLL_INDEX*		pIndex;
+	unsigned int		nStride;			// Of #71
+	unsigned int		nSliceHeight;		// Of #71
+
+	pthread_t			thread;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+	OMX_BOOL			isRunning;
+	const char*			pReason;			// Of the trigger pending. NULL if none.
+	OMX_BOOL			isFrozen;			// Window is being copied
+	uint64_t			nFirst;				// Frames of the window frozen
+	uint64_t			nEnd;
+	uint64_t			nCopied;			// Frames of the window before this are copied
+
+	unsigned int		nEvents;			// Windows copied
+	unsigned int		nTriggersIgnored;	// While a window is being copied
+	unsigned int		nFramesMissed;		// Slot was not copied yet
+} PREROLL;
+
+/*
+ * Create the ring file <prefix>.ring of nSlots frames, or reuse it. Layout
+ * of frames is taken from pPortDef of camera port #71. Returns NULL on
+ * failure.
+ */
+PREROLL* preroll_open(const char* pPrefix, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef, unsigned int nSlots);
+
+/*
+ * Freeze the window if triggered, then write the frame into the oldest slot
+ * unless it is not copied yet. Call from one thread.
+ */
+void preroll_write(PREROLL* pPreroll, OMX_BUFFERHEADERTYPE* pBuffer);
+
+/*
+ * Ask for the window to be copied. Safe from any thread but not from a
+ * signal handler. Ignored while one is being copied.
+ */
+void preroll_trigger(PREROLL* pPreroll, const char* pReason);
+
+/*
+ * Copy a window triggered but not frozen yet, wait for the copy and report.
+ * Ring file is kept.
+ */
+void preroll_close(PREROLL* pPreroll);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_PREROLL_H_ */
@@ -0,0 +1,287 @@
+/*
+ ============================================================================
+ Name        : replay.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Raw record and replay of camera output for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "replay.h"
+#include "common.h"
+#include "stats.h"
+#include "trace.h"
+
+REPLAY_RECORDER* replay_record_open(const char* path, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef) {
+	REPLAY_HEADER header;
+
+	FILE* fp = fopen(path, "wb");
+	if(fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	memset(&header, 0x00, sizeof(header));
+	memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+	header.nFrameWidth	= pPortDef->format.video.nFrameWidth;
+	header.nFrameHeight	= pPortDef->format.video.nFrameHeight;
+	header.nStride		= pPortDef->format.video.nStride;
+	header.nSliceHeight	= pPortDef->format.video.nSliceHeight;
+	header.xFramerate	= pPortDef->format.video.xFramerate;
+	header.eColorFormat	= pPortDef->format.video.eColorFormat;
+	header.nBufferSize	= pPortDef->nBufferSize;
+	if(fwrite(&header, sizeof(header), 1, fp) != 1) {
+		perror(path);
+		fclose(fp);
+		return NULL;
+	}
+
+	REPLAY_RECORDER* pRecorder = calloc(1, sizeof(REPLAY_RECORDER));
+	pRecorder->fp = fp;
+	print_log("RECORD : %s, %dx%d, stride %d, slice %d", path,
+			header.nFrameWidth, header.nFrameHeight, header.nStride, header.nSliceHeight);
+
+	return pRecorder;
+}
+
+void replay_record(REPLAY_RECORDER* pRecorder, OMX_BUFFERHEADERTYPE* pBuffer) {
+	REPLAY_RECORD record;
+
+	if(pRecorder == NULL || pRecorder->fp == NULL) return;
+
+	TRACE_BEGIN("replay_record");
+	memset(&record, 0x00, sizeof(record));
+	record.nFilledLen	= pBuffer->nFilledLen;
+	record.nOffset		= pBuffer->nOffset;
+	record.nFlags		= pBuffer->nFlags;
+	record.nTimeStamp	= OMX_TICKS_TO_S64(pBuffer->nTimeStamp);
+
+	if(fwrite(&record, sizeof(record), 1, pRecorder->fp) != 1
+			|| fwrite(pBuffer->pBuffer + pBuffer->nOffset, 1, pBuffer->nFilledLen, pRecorder->fp) != pBuffer->nFilledLen) {
+		perror("RECORD");
+		fclose(pRecorder->fp);
+		pRecorder->fp = NULL;
+	}
+	else {
+		pRecorder->nRecords++;
+		pRecorder->nBytes += sizeof(record) + pBuffer->nFilledLen;
+	}
+	TRACE_END("replay_record");
+}
+
+void replay_record_close(REPLAY_RECORDER* pRecorder) {
+	if(pRecorder == NULL) return;
+
+	if(pRecorder->fp) fclose(pRecorder->fp);
+	print_log("RECORD : %d buffers, %llu bytes", pRecorder->nRecords, pRecorder->nBytes);
+	free(pRecorder);
+}
+
+REPLAY* replay_open(const char* path, OMX_BOOL isRealtime) {
+	REPLAY_HEADER header;
+
+	FILE* fp = fopen(path, "rb");
+	if(fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	REPLAY* pReplay = calloc(1, sizeof(REPLAY));
+	if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0) {
+		// Y4M clip, laid out as a camera which gives whole frames without padding.
+		rewind(fp);
+		if(!y4m_read_header(fp, &pReplay->y4m)) {
+			print_log("REPLAY : %s is not a record file.", path);
+			fclose(fp);
+			free(pReplay);
+			return NULL;
+		}
+		memset(&header, 0x00, sizeof(header));
+		memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+		header.nFrameWidth	= pReplay->y4m.nWidth;
+		header.nFrameHeight	= pReplay->y4m.nHeight;
+		header.nStride		= pReplay->y4m.nWidth;
+		header.nSliceHeight	= pReplay->y4m.nHeight;
+		header.xFramerate	= ((unsigned long long)pReplay->y4m.nFramerateNum << 16) / pReplay->y4m.nFramerateDen;
+		header.eColorFormat	= OMX_COLOR_FormatYUV420PackedPlanar;
+		header.nBufferSize	= pReplay->y4m.nWidth * pReplay->y4m.nHeight * 3 / 2;
+		pReplay->isY4M		= OMX_TRUE;
+	}
+
+	pReplay->fp			= fp;
+	pReplay->header		= header;
+	pReplay->isRealtime	= isRealtime;
+	pthread_mutex_init(&pReplay->mutex, NULL);
+	pthread_cond_init(&pReplay->cond, NULL);
+	print_log("REPLAY : %s, %dx%d, stride %d, slice %d, %s", path,
+			header.nFrameWidth, header.nFrameHeight, header.nStride, header.nSliceHeight,
+			isRealtime ? "original speed" : "maximum speed");
+
+	return pReplay;
+}
+
+void replay_port_definition(REPLAY* pReplay, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef) {
+	OMX_VIDEO_PORTDEFINITIONTYPE* formatVideo = &pPortDef->format.video;
+
+	formatVideo->nFrameWidth	= pReplay->header.nFrameWidth;
+	formatVideo->nFrameHeight	= pReplay->header.nFrameHeight;
+	formatVideo->nStride		= pReplay->header.nStride;
+	formatVideo->nSliceHeight	= pReplay->header.nSliceHeight;
+	formatVideo->xFramerate		= pReplay->header.xFramerate;
+	formatVideo->eColorFormat	= pReplay->header.eColorFormat;
+	pPortDef->nBufferSize		= pReplay->header.nBufferSize;
+}
+
+OMX_BUFFERHEADERTYPE* replay_allocate_buffer(REPLAY* pReplay, OMX_PTR pAppPrivate) {
+	OMX_BUFFERHEADERTYPE* pBuffer = calloc(1, sizeof(OMX_BUFFERHEADERTYPE));
+
+	pBuffer->nSize			= sizeof(OMX_BUFFERHEADERTYPE);
+	pBuffer->nAllocLen		= pReplay->header.nBufferSize;
+	pBuffer->pAppPrivate	= pAppPrivate;
+	if(posix_memalign((void**)&pBuffer->pBuffer, 64, pBuffer->nAllocLen) != 0) {
+		free(pBuffer);
+		return NULL;
+	}
+	pReplay->pAllocated = pBuffer;
+
+	return pBuffer;
+}
+
+/*
+ * Read next record into the buffer. Returns OMX_FALSE at the end of file.
+ */
+static OMX_BOOL replay_read(REPLAY* pReplay, OMX_BUFFERHEADERTYPE* pBuffer) {
+	REPLAY_RECORD record;
+
+	if(pReplay->isY4M) {
+		if(!y4m_read_frame(pReplay->fp, &pReplay->y4m, pBuffer->pBuffer)) return OMX_FALSE;
+		memset(&record, 0x00, sizeof(record));
+		record.nFilledLen	= pReplay->header.nBufferSize;
+		record.nFlags		= OMX_BUFFERFLAG_ENDOFFRAME;
+		record.nTimeStamp	= (OMX_S64)pReplay->nRecords * 1000000 * pReplay->y4m.nFramerateDen / pReplay->y4m.nFramerateNum;
+	}
+	else {
+		if(fread(&record, sizeof(record), 1, pReplay->fp) != 1) return OMX_FALSE;
+		if(record.nFilledLen > pBuffer->nAllocLen) {
+			print_log("REPLAY : Record of %d bytes is larger than buffer.", record.nFilledLen);
+			return OMX_FALSE;
+		}
+		if(fread(pBuffer->pBuffer, 1, record.nFilledLen, pReplay->fp) != record.nFilledLen) return OMX_FALSE;
+	}
+
+	// Payload is stored without offset, so the buffer starts from 0.
+	pBuffer->nOffset	= 0;
+	pBuffer->nFilledLen	= record.nFilledLen;
+	pBuffer->nFlags		= record.nFlags;
+	OMX_S64_TO_TICKS(pBuffer->nTimeStamp, record.nTimeStamp);
+
+	if(pReplay->nRecords++ == 0) {
+		pReplay->nTimestampFirst	= record.nTimeStamp;
+		pReplay->nTimeBase			= stats_now();
+	}
+	else if(pReplay->isRealtime) {
+		unsigned long long nDue = pReplay->nTimeBase + (record.nTimeStamp - pReplay->nTimestampFirst) * 1000ULL;
+		struct timespec ts;
+		ts.tv_sec	= nDue / 1000000000ULL;
+		ts.tv_nsec	= nDue % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	return OMX_TRUE;
+}
+
+static void* replay_thread(void* data) {
+	REPLAY* pReplay = (REPLAY*)data;
+
+	pthread_setname_np(pthread_self(), "replay");
+	pthread_mutex_lock(&pReplay->mutex);
+	while(pReplay->isRunning) {
+		if(pReplay->pPending == NULL) {
+			pthread_cond_wait(&pReplay->cond, &pReplay->mutex);
+			continue;
+		}
+
+		OMX_BUFFERHEADERTYPE* pBuffer = pReplay->pPending;
+		pthread_mutex_unlock(&pReplay->mutex);
+		OMX_BOOL isRead = replay_read(pReplay, pBuffer);
+		pthread_mutex_lock(&pReplay->mutex);
+
+		if(!isRead) {
+			pReplay->isEnd = OMX_TRUE;
+			print_log("REPLAY : End of record. %d buffers played.", pReplay->nRecords);
+			break;
+		}
+
+		// Client may call replay_fill() in the callback.
+		pReplay->pPending = NULL;
+		pthread_mutex_unlock(&pReplay->mutex);
+		pReplay->callback((OMX_HANDLETYPE)pReplay, pReplay->pAppData, pBuffer);
+		pthread_mutex_lock(&pReplay->mutex);
+	}
+	pthread_mutex_unlock(&pReplay->mutex);
+
+	return NULL;
+}
+
+OMX_ERRORTYPE replay_start(REPLAY* pReplay, REPLAY_CALLBACK callback, OMX_PTR pAppData) {
+	pReplay->callback	= callback;
+	pReplay->pAppData	= pAppData;
+	pReplay->isRunning	= OMX_TRUE;
+
+	if(pthread_create(&pReplay->thread, NULL, replay_thread, pReplay) != 0) {
+		pReplay->isRunning = OMX_FALSE;
+		return OMX_ErrorInsufficientResources;
+	}
+
+	return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE replay_fill(REPLAY* pReplay, OMX_BUFFERHEADERTYPE* pBuffer) {
+	OMX_ERRORTYPE err = OMX_ErrorNone;
+
+	pthread_mutex_lock(&pReplay->mutex);
+	if(pReplay->isEnd)					err = OMX_ErrorNoMore;
+	else if(pReplay->pPending != NULL)	err = OMX_ErrorInsufficientResources;
+	else {
+		pReplay->pPending = pBuffer;
+		pthread_cond_signal(&pReplay->cond);
+	}
+	pthread_mutex_unlock(&pReplay->mutex);
+
+	return err;
+}
+
+OMX_BOOL replay_is_end(REPLAY* pReplay) {
+	pthread_mutex_lock(&pReplay->mutex);
+	OMX_BOOL isEnd = pReplay->isEnd;
+	pthread_mutex_unlock(&pReplay->mutex);
+
+	return isEnd;
+}
+
+void replay_close(REPLAY* pReplay) {
+	if(pReplay == NULL) return;
+
+	pthread_mutex_lock(&pReplay->mutex);
+	OMX_BOOL isStarted = pReplay->isRunning || pReplay->isEnd;
+	pReplay->isRunning = OMX_FALSE;
+	pthread_cond_signal(&pReplay->cond);
+	pthread_mutex_unlock(&pReplay->mutex);
+	if(isStarted) pthread_join(pReplay->thread, NULL);
+
+	if(pReplay->pAllocated) {
+		free(pReplay->pAllocated->pBuffer);
+		free(pReplay->pAllocated);
+	}
+	fclose(pReplay->fp);
+	pthread_cond_destroy(&pReplay->cond);
+	pthread_mutex_destroy(&pReplay->mutex);
+	free(pReplay);
+}
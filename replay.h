@@ -0,0 +1,131 @@
+/*
+ ============================================================================
+ Name        : replay.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Raw record and replay of camera output for rpi-omx-tutorial.
+               Recorder writes every buffer header as it was filled by the
+               camera, slice by slice, with nFilledLen, nOffset, nFlags and
+               nTimeStamp. Replay plays the role of the camera : client hands
+               a buffer by replay_fill() and gets it back by FillBufferDone
+               callback, just like OMX_FillThisBuffer().
+
+               File : REPLAY_HEADER, then REPLAY_RECORD + nFilledLen bytes of
+               payload per buffer. Integers are in host byte order.
+
+               A Y4M clip plays as well. Each frame is a whole buffer without
+               padding, stamped by the frame rate of the clip.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_REPLAY_H_
+#define RPI_OMX_TUTORIAL_SRC_REPLAY_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Component.h>
+
+#include "y4m.h"
+
+#define REPLAY_MAGIC	"OMXRAW01"
+
+typedef struct REPLAY_HEADER {
+	char		magic[8];
+	OMX_U32		nFrameWidth;
+	OMX_U32		nFrameHeight;
+	OMX_S32		nStride;
+	OMX_U32		nSliceHeight;
+	OMX_U32		xFramerate;			// Q16
+	OMX_U32		eColorFormat;
+	OMX_U32		nBufferSize;
+	OMX_U32		nReserved;
+} REPLAY_HEADER;
+
+typedef struct REPLAY_RECORD {
+	OMX_U32		nFilledLen;
+	OMX_U32		nOffset;
+	OMX_U32		nFlags;
+	OMX_U32		nReserved;
+	OMX_S64		nTimeStamp;			// usec
+} REPLAY_RECORD;
+
+typedef struct REPLAY_RECORDER {
+	FILE*				fp;
+	unsigned int		nRecords;
+	unsigned long long	nBytes;
+} REPLAY_RECORDER;
+
+typedef OMX_ERRORTYPE (*REPLAY_CALLBACK)(OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_BUFFERHEADERTYPE* pBuffer);
+
+typedef struct REPLAY {
+	FILE*					fp;
+	REPLAY_HEADER			header;
+	OMX_BOOL				isY4M;
+	Y4M_FORMAT				y4m;				// Of a Y4M clip
+	OMX_BOOL				isRealtime;			// Keep gaps of nTimeStamp. Otherwise as fast as possible.
+	REPLAY_CALLBACK			callback;
+	OMX_PTR					pAppData;
+	OMX_BUFFERHEADERTYPE*	pAllocated;			// By replay_allocate_buffer()
+
+	pthread_t				thread;
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	OMX_BUFFERHEADERTYPE*	pPending;			// Handed by replay_fill()
+	OMX_BOOL				isRunning;
+	OMX_BOOL				isEnd;				// Every record is played
+
+	OMX_S64					nTimestampFirst;	// usec
+	unsigned long long		nTimeBase;			// nsec, when first record is played
+	unsigned int			nRecords;
+} REPLAY;
+
+/*
+ * Create a record file. Layout of the buffers is taken from pPortDef,
+ * usually the definition of camera port #71. Returns NULL on failure.
+ */
+REPLAY_RECORDER* replay_record_open(const char* path, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef);
+
+/*
+ * Append a filled buffer. Call this before the buffer is given back to the
+ * component, since the payload is copied by fwrite().
+ */
+void replay_record(REPLAY_RECORDER* pRecorder, OMX_BUFFERHEADERTYPE* pBuffer);
+
+void replay_record_close(REPLAY_RECORDER* pRecorder);
+
+/*
+ * Open a record file or a Y4M clip to play. Returns NULL on failure.
+ */
+REPLAY* replay_open(const char* path, OMX_BOOL isRealtime);
+
+/*
+ * Fill format.video and nBufferSize of pPortDef as the recorded port was.
+ */
+void replay_port_definition(REPLAY* pReplay, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef);
+
+/*
+ * Allocate a buffer header large enough for every record. Freed by replay_close().
+ */
+OMX_BUFFERHEADERTYPE* replay_allocate_buffer(REPLAY* pReplay, OMX_PTR pAppPrivate);
+
+/*
+ * Start playing thread. callback is called with the buffer handed by
+ * replay_fill(), as FillBufferDone of OMX_CALLBACKTYPE.
+ */
+OMX_ERRORTYPE replay_start(REPLAY* pReplay, REPLAY_CALLBACK callback, OMX_PTR pAppData);
+
+/*
+ * Counterpart of OMX_FillThisBuffer(). Only one buffer may be pending.
+ */
+OMX_ERRORTYPE replay_fill(REPLAY* pReplay, OMX_BUFFERHEADERTYPE* pBuffer);
+
+/*
+ * OMX_TRUE after the last record is handed back.
+ */
+OMX_BOOL replay_is_end(REPLAY* pReplay);
+
+void replay_close(REPLAY* pReplay);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_REPLAY_H_ */
@@ -0,0 +1,198 @@
+/*
+ ============================================================================
+ Name        : shmring.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Frame ring in POSIX shared memory for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "common.h"
+#include "trace.h"
+#include "shmring.h"
+
+/* Futex is shared between processes, so no FUTEX_PRIVATE_FLAG. */
+static long shmring_futex(uint32_t* pWord, int op, uint32_t nValue, const struct timespec* pTimeout) {
+	return syscall(SYS_futex, pWord, op, nValue, pTimeout, NULL, 0);
+}
+
+static SHMRING_SLOT* shmring_slot(SHMRING* pRing, uint64_t nFrame) {
+	SHMRING_HEADER* pHeader = pRing->pHeader;
+	return (SHMRING_SLOT*)((uint8_t*)pRing->pBase + SHMRING_HEADER_SIZE + (nFrame % pHeader->nSlots) * pHeader->nSlotSize);
+}
+
+SHMRING* shmring_create(const char* pName, uint32_t nWidth, uint32_t nHeight, uint32_t nStride, uint32_t nSliceHeight,
+		uint32_t nFrameSize, uint32_t nSlots) {
+	long		nPage		= sysconf(_SC_PAGESIZE);
+	uint32_t	nSlotSize	= (SHMRING_PAYLOAD + nFrameSize + nPage - 1) / nPage * nPage;
+	SHMRING*	pRing		= calloc(1, sizeof(SHMRING));
+
+	snprintf(pRing->name, sizeof(pRing->name), "/%s", pName);
+	pRing->nSize	= SHMRING_HEADER_SIZE + (size_t)nSlotSize * nSlots;
+	pRing->isWriter	= 1;
+
+	shm_unlink(pRing->name);
+	if((pRing->fd = shm_open(pRing->name, O_RDWR | O_CREAT | O_EXCL, 0660)) < 0
+			|| ftruncate(pRing->fd, pRing->nSize) != 0
+			|| (pRing->pBase = mmap(NULL, pRing->nSize, PROT_READ | PROT_WRITE, MAP_SHARED, pRing->fd, 0)) == MAP_FAILED) {
+		print_log("SHMRING : Failed to create %s. %s", pRing->name, strerror(errno));
+		if(pRing->fd >= 0) {
+			close(pRing->fd);
+			shm_unlink(pRing->name);
+		}
+		free(pRing);
+		return NULL;
+	}
+
+	// Pages are zero. Magic goes last so a reader never sees a half made header.
+	SHMRING_HEADER* pHeader = pRing->pHeader = (SHMRING_HEADER*)pRing->pBase;
+	pHeader->nVersion		= SHMRING_VERSION;
+	pHeader->nWidth			= nWidth;
+	pHeader->nHeight		= nHeight;
+	pHeader->nStride		= nStride;
+	pHeader->nSliceHeight	= nSliceHeight;
+	pHeader->nFrameSize		= nFrameSize;
+	pHeader->nSlots			= nSlots;
+	pHeader->nSlotSize		= nSlotSize;
+	__atomic_store_n(&pHeader->nMagic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+
+	print_log("SHMRING : /dev/shm%s, %d slots of %d bytes", pRing->name, nSlots, nSlotSize);
+	return pRing;
+}
+
+void shmring_write(SHMRING* pRing, const void* pFrame, uint32_t nFilledLen, int64_t nTimeStamp) {
+	SHMRING_HEADER*	pHeader	= pRing->pHeader;
+	uint64_t		nFrame	= pHeader->nWritten;
+	SHMRING_SLOT*	pSlot	= shmring_slot(pRing, nFrame);
+
+	if(nFilledLen > pHeader->nFrameSize) nFilledLen = pHeader->nFrameSize;
+
+	TRACE_BEGIN("shmring_write");
+	__atomic_store_n(&pSlot->nSeq, nFrame * 2 + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((uint8_t*)pSlot + SHMRING_PAYLOAD, pFrame, nFilledLen);
+	pSlot->nTimeStamp	= nTimeStamp;
+	pSlot->nFilledLen	= nFilledLen;
+	__atomic_store_n(&pSlot->nSeq, nFrame * 2 + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&pHeader->nWritten, nFrame + 1, __ATOMIC_RELEASE);
+	TRACE_END("shmring_write");
+
+	__atomic_add_fetch(&pHeader->nFutex, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&pHeader->nWaiters, __ATOMIC_SEQ_CST) > 0) {
+		shmring_futex(&pHeader->nFutex, FUTEX_WAKE, INT_MAX, NULL);
+	}
+}
+
+SHMRING* shmring_open(const char* pName) {
+	SHMRING*	pRing = calloc(1, sizeof(SHMRING));
+	struct stat	st;
+
+	snprintf(pRing->name, sizeof(pRing->name), "/%s", pName);
+	// Readers count themselves in nWaiters, so only the slots are read only.
+	if((pRing->fd = shm_open(pRing->name, O_RDWR, 0)) < 0
+			|| fstat(pRing->fd, &st) != 0 || st.st_size < SHMRING_HEADER_SIZE
+			|| (pRing->pBase = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, pRing->fd, 0)) == MAP_FAILED) {
+		print_log("SHMRING : Failed to open %s. %s", pRing->name, strerror(errno));
+		if(pRing->fd >= 0) close(pRing->fd);
+		free(pRing);
+		return NULL;
+	}
+	pRing->nSize	= st.st_size;
+	pRing->pHeader	= (SHMRING_HEADER*)pRing->pBase;
+
+	SHMRING_HEADER* pHeader = pRing->pHeader;
+	if(__atomic_load_n(&pHeader->nMagic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC || pHeader->nVersion != SHMRING_VERSION
+			|| SHMRING_HEADER_SIZE + (size_t)pHeader->nSlotSize * pHeader->nSlots > pRing->nSize) {
+		print_log("SHMRING : %s is not a frame ring.", pRing->name);
+		munmap(pRing->pBase, pRing->nSize);
+		close(pRing->fd);
+		free(pRing);
+		return NULL;
+	}
+	mprotect((uint8_t*)pRing->pBase + SHMRING_HEADER_SIZE, pRing->nSize - SHMRING_HEADER_SIZE, PROT_READ);
+	pRing->nNext = __atomic_load_n(&pHeader->nWritten, __ATOMIC_ACQUIRE);
+
+	print_log("SHMRING : %s, %dx%d, %d slots", pRing->name, pHeader->nWidth, pHeader->nHeight, pHeader->nSlots);
+	return pRing;
+}
+
+const SHMRING_SLOT* shmring_read(SHMRING* pRing, int nTimeout) {
+	SHMRING_HEADER*	pHeader = pRing->pHeader;
+	struct timespec	timeout = { nTimeout / 1000, (nTimeout % 1000) * 1000000L };
+
+	while(1) {
+		uint32_t nFutex		= __atomic_load_n(&pHeader->nFutex, __ATOMIC_SEQ_CST);
+		uint64_t nWritten	= __atomic_load_n(&pHeader->nWritten, __ATOMIC_ACQUIRE);
+
+		if(nWritten > pRing->nNext) {
+			// Slot of the oldest frame may be written now. Newest one is safe for a while.
+			if(nWritten - pRing->nNext >= pHeader->nSlots) {
+				pRing->nSkipped	+= nWritten - 1 - pRing->nNext;
+				pRing->nNext	= nWritten - 1;
+			}
+
+			SHMRING_SLOT* pSlot = shmring_slot(pRing, pRing->nNext);
+			if(__atomic_load_n(&pSlot->nSeq, __ATOMIC_ACQUIRE) == pRing->nNext * 2 + 2) {
+				return pSlot;
+			}
+			// Overwritten already. Catch up.
+			pRing->nSkipped++;
+			pRing->nNext++;
+			continue;
+		}
+		if(__atomic_load_n(&pHeader->isClosed, __ATOMIC_ACQUIRE)) {
+			return NULL;
+		}
+
+		__atomic_add_fetch(&pHeader->nWaiters, 1, __ATOMIC_SEQ_CST);
+		long err = shmring_futex(&pHeader->nFutex, FUTEX_WAIT, nFutex, &timeout);
+		__atomic_sub_fetch(&pHeader->nWaiters, 1, __ATOMIC_SEQ_CST);
+		if(err != 0 && errno == ETIMEDOUT) {
+			return NULL;
+		}
+	}
+}
+
+int shmring_done(SHMRING* pRing, const SHMRING_SLOT* pSlot) {
+	// Reads of the frame happen before the sequence is checked again.
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	int isIntact = __atomic_load_n(&pSlot->nSeq, __ATOMIC_RELAXED) == pRing->nNext * 2 + 2;
+
+	if(isIntact)	pRing->nRead++;
+	else			pRing->nTorn++;
+	pRing->nNext++;
+	return isIntact;
+}
+
+void shmring_close(SHMRING* pRing) {
+	if(pRing == NULL) return;
+
+	if(pRing->isWriter) {
+		__atomic_store_n(&pRing->pHeader->isClosed, 1, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&pRing->pHeader->nFutex, 1, __ATOMIC_SEQ_CST);
+		shmring_futex(&pRing->pHeader->nFutex, FUTEX_WAKE, INT_MAX, NULL);
+		shm_unlink(pRing->name);
+		print_log("SHMRING : %s closed after %llu frames", pRing->name, (unsigned long long)pRing->pHeader->nWritten);
+	}
+	else {
+		print_log("SHMRING : %s, %d frames read, %d skipped, %d torn", pRing->name, pRing->nRead, pRing->nSkipped, pRing->nTorn);
+	}
+	munmap(pRing->pBase, pRing->nSize);
+	close(pRing->fd);
+	free(pRing);
+}
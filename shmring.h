@@ -0,0 +1,110 @@
+/*
+ ============================================================================
+ Name        : shmring.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Frame ring in POSIX shared memory for rpi-omx-tutorial.
+               Capture program creates /dev/shm/<name> and writes each frame
+               into the oldest slot. Other processes map the slots read
+               only and read frames in place.
+
+               Writer never waits for readers. Slot sequence is odd while
+               the slot is written, and a reader checks it again after
+               reading, so a reader which was overtaken knows the frame is
+               torn and skips it. A reader falling more than a ring behind
+               jumps to the newest frame. Header has a futex word which is
+               bumped on every frame, and readers sleep on it.
+
+               Layout is the header in SHMRING_HEADER_SIZE bytes, then
+               nSlots slots of nSlotSize bytes. Each slot is SHMRING_SLOT
+               followed by the frame at offset SHMRING_PAYLOAD, laid out as
+               port #71 of the camera.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_SHMRING_H_
+#define RPI_OMX_TUTORIAL_SRC_SHMRING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHMRING_MAGIC		0x474E4952		// "RING"
+#define SHMRING_VERSION		1
+#define SHMRING_PAYLOAD		64				// Offset of frame in a slot
+#define SHMRING_HEADER_SIZE	4096			// Size of header
+
+typedef struct SHMRING_HEADER {
+	uint32_t			nMagic;
+	uint32_t			nVersion;
+	uint32_t			nWidth;
+	uint32_t			nHeight;
+	uint32_t			nStride;
+	uint32_t			nSliceHeight;		// Padded height. U plane is at nStride * nSliceHeight.
+	uint32_t			nFrameSize;			// Max bytes of a frame
+	uint32_t			nSlots;
+	uint32_t			nSlotSize;			// Page aligned
+	uint32_t			nFutex;				// Bumped on every frame
+	uint32_t			nWaiters;			// Readers sleeping on nFutex
+	uint32_t			isClosed;			// Writer is gone
+	uint64_t			nWritten;			// Frames written. Next one goes to nWritten % nSlots.
+} SHMRING_HEADER;
+
+typedef struct SHMRING_SLOT {
+	uint64_t			nSeq;				// Frame * 2 + 1 while written, frame * 2 + 2 after
+	int64_t				nTimeStamp;			// usec, of the camera
+	uint32_t			nFilledLen;
+	uint32_t			nReserved;
+} SHMRING_SLOT;
+
+typedef struct SHMRING {
+	char				name[64];
+	int					fd;
+	void*				pBase;
+	size_t				nSize;
+	SHMRING_HEADER*		pHeader;
+	int					isWriter;
+
+	// Reader only
+	uint64_t			nNext;				// Frame to read next
+	unsigned int		nRead;
+	unsigned int		nSkipped;			// Overwritten before being read
+	unsigned int		nTorn;				// Overwritten while being read
+} SHMRING;
+
+/*
+ * Create the ring, replacing one of the same name. Returns NULL on failure.
+ */
+SHMRING* shmring_create(const char* pName, uint32_t nWidth, uint32_t nHeight, uint32_t nStride, uint32_t nSliceHeight,
+		uint32_t nFrameSize, uint32_t nSlots);
+
+/*
+ * Copy the frame into the oldest slot and wake readers. Never waits.
+ */
+void shmring_write(SHMRING* pRing, const void* pFrame, uint32_t nFilledLen, int64_t nTimeStamp);
+
+/*
+ * Map the ring of a writer. Slots are read only. Reading starts from the
+ * next frame.
+ * Returns NULL if there is none.
+ */
+SHMRING* shmring_open(const char* pName);
+
+/*
+ * Wait up to nTimeout msec for the next frame. The frame is read in place
+ * from SHMRING_PAYLOAD of the slot, then shmring_done() tells if it was
+ * intact. NULL on timeout or when the writer is gone.
+ */
+const SHMRING_SLOT* shmring_read(SHMRING* pRing, int nTimeout);
+
+/*
+ * Returns 0 if the writer overwrote the slot while it was read.
+ */
+int shmring_done(SHMRING* pRing, const SHMRING_SLOT* pSlot);
+
+/*
+ * Writer marks the ring closed and removes the name. Mappings of readers
+ * stay valid until they close.
+ */
+void shmring_close(SHMRING* pRing);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_SHMRING_H_ */
@@ -0,0 +1,1076 @@
+/*
+ ============================================================================
+ Name        : OMXsim.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : OMXsim is a stand-in OMX IL core which runs without Raspberry PI.
+               It implements the part of OMX IL and components which programs
+               of rpi-omx-tutorial use, so they run unmodified on any Linux.
+
+               OMX.broadcom.camera       : Emits synthetic YUV420PackedPlanar
+                                           frames at xFramerate of port #71 in
+                                           slices of nSliceHeight. xFramerate
+                                           may be changed while capturing by
+                                           OMX_IndexConfigVideoFramerate.
+               OMX.broadcom.video_render : Null display. Holds the last frame
+                                           and returns it on next vsync.
+               OMX.broadcom.video_splitter : Copies each frame of #250 to every
+                                           enabled output of #251-#254. Output
+                                           without a buffer skips the frame.
+
+               Environment variables
+               OMXSIM_SLICE_HEIGHT : nSliceHeight of camera unless client sets
+                                     a multiple of 16. Default 16.
+               OMXSIM_VSYNC_HZ     : Refresh rate of render. 0 returns buffers
+                                     immediately. Default 60.
+               OMXSIM_VERBOSE      : Print every command when set.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Component.h>
+#include <IL/OMX_Video.h>
+#include <IL/OMX_Broadcom.h>
+
+#include "bcm_host.h"
+#include "../common.h"
+
+#define SIM_PORTS_MAX		8
+#define SIM_BUFFERS_MAX		32
+#define SIM_EVENTS_MAX		32
+#define SIM_IDLE_WAIT		(100 * 1000 * 1000ULL)	// nsec, wake up at least this often
+
+struct SIM_COMPONENT;
+
+/*
+ * Frame handed through a tunnel. Planes are packed in one block with the
+ * layout of OMX_COLOR_FormatYUV420PackedPlanar of a single slice.
+ */
+typedef struct SIM_FRAME {
+	OMX_U8*			pData;
+	OMX_U32			nWidth;
+	OMX_U32			nHeight;
+	OMX_U32			nStride;
+	OMX_U32			nSliceHeight;		// Padded height of the frame
+	OMX_S64			nTimestamp;			// usec
+} SIM_FRAME;
+
+typedef struct SIM_PORT {
+	OMX_PARAM_PORTDEFINITIONTYPE	def;
+	OMX_BUFFERHEADERTYPE*			buffers[SIM_BUFFERS_MAX];
+	unsigned int					nBuffers;
+	OMX_BOOL						isAllocated[SIM_BUFFERS_MAX];	// pBuffer is owned by OMXsim
+	OMX_BUFFERHEADERTYPE*			queue[SIM_BUFFERS_MAX];		// Handed by client
+	unsigned int					nQueueHead;
+	unsigned int					nQueued;
+	struct SIM_COMPONENT*			pTunnel;
+	OMX_U32							nTunnelPort;
+	OMX_BOOL						isCapturing;
+} SIM_PORT;
+
+typedef struct SIM_EVENT {
+	OMX_EVENTTYPE	eEvent;
+	OMX_U32			nData1;
+	OMX_U32			nData2;
+} SIM_EVENT;
+
+typedef struct SIM_TYPE {
+	const char*		pName;
+	void			(*init)(struct SIM_COMPONENT* pComponent);
+	/* Do the work of executing state. Returns deadline of next work in nsec. */
+	unsigned long long	(*process)(struct SIM_COMPONENT* pComponent, unsigned long long nNow);
+	/* Receive a frame from tunneled output port. */
+	void			(*receive)(struct SIM_COMPONENT* pComponent, OMX_U32 nPortIndex, SIM_FRAME* pFrame);
+	/* Check and apply parameters of port definition. */
+	void			(*configure)(struct SIM_COMPONENT* pComponent, SIM_PORT* pPort);
+} SIM_TYPE;
+
+typedef struct SIM_COMPONENT {
+	OMX_COMPONENTTYPE		omx;				// Handle points here
+	const SIM_TYPE*			pType;
+	OMX_CALLBACKTYPE		callbacks;
+	OMX_PTR					pAppData;
+
+	OMX_STATETYPE			eState;
+	OMX_STATETYPE			eStateTarget;		// Same as eState if no transition
+	SIM_PORT				ports[SIM_PORTS_MAX];
+	unsigned int			nPorts;
+	SIM_EVENT				events[SIM_EVENTS_MAX];
+	unsigned int			nEvents;
+
+	pthread_t				thread;
+	pthread_mutex_t			mutex;
+	pthread_cond_t			cond;
+	OMX_BOOL				isAlive;
+
+	/* Camera */
+	OMX_BOOL				isCallbackDevice;	// OMX_IndexConfigRequestCallback of device number
+	OMX_U32					nDeviceNumber;
+	unsigned long long		nBase;				// nsec, start of executing
+	unsigned long long		nNextFrame;			// nsec
+	OMX_U32					nFrameCount;
+	OMX_U32					nSliceNext;			// Next slice of frame in progress
+	OMX_U32					nSlices;			// 0 if no frame is in progress
+	OMX_S64					nFrameTimestamp;
+	SIM_FRAME				frame;				// Scratch frame for tunnel
+
+	/* Render */
+	unsigned long long		nNextVsync;
+	OMX_BUFFERHEADERTYPE*	pDisplayed;
+	OMX_U32					nFrameDisplayed;
+} SIM_COMPONENT;
+
+static int	nSimInit		= 0;
+static int	isSimVerbose	= 0;
+
+static unsigned long long sim_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sim_env(const char* name, int nDefault) {
+	const char* value = getenv(name);
+	return (value && *value) ? atoi(value) : nDefault;
+}
+
+static SIM_PORT* sim_port(SIM_COMPONENT* pComponent, OMX_U32 nPortIndex) {
+	for(int i = 0; i < pComponent->nPorts; i++) {
+		if(pComponent->ports[i].def.nPortIndex == nPortIndex) return &pComponent->ports[i];
+	}
+
+	return NULL;
+}
+
+static void sim_port_add(SIM_COMPONENT* pComponent, OMX_U32 nPortIndex, OMX_DIRTYPE eDir, OMX_PORTDOMAINTYPE eDomain) {
+	SIM_PORT* pPort = &pComponent->ports[pComponent->nPorts++];
+	OMX_PARAM_PORTDEFINITIONTYPE* pDef = &pPort->def;
+
+	memset(pPort, 0x00, sizeof(SIM_PORT));
+	pDef->nSize						= sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
+	pDef->nVersion.nVersion			= OMX_VERSION;
+	pDef->nPortIndex				= nPortIndex;
+	pDef->eDir						= eDir;
+	pDef->nBufferCountActual		= 1;
+	pDef->nBufferCountMin			= 1;
+	pDef->bEnabled					= OMX_TRUE;
+	pDef->eDomain					= eDomain;
+	pDef->nBufferAlignment			= 16;
+	pDef->format.video.nFrameWidth	= 640;
+	pDef->format.video.nFrameHeight	= 480;
+	pDef->format.video.nStride		= 640;
+	pDef->format.video.nSliceHeight	= 480;
+	pDef->format.video.xFramerate	= 30 << 16;
+	pDef->format.video.eColorFormat	= OMX_COLOR_FormatYUV420PackedPlanar;
+	pDef->format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+}
+
+/* Size of YUV420 planar buffer of the port */
+static void sim_port_size(SIM_PORT* pPort) {
+	OMX_VIDEO_PORTDEFINITIONTYPE* pVideo = &pPort->def.format.video;
+
+	if(pVideo->nStride < (OMX_S32)pVideo->nFrameWidth) {
+		pVideo->nStride = (pVideo->nFrameWidth + 31) & ~31;
+	}
+	pPort->def.nBufferSize = pVideo->nStride * pVideo->nSliceHeight * 3 / 2;
+}
+
+/*
+ * Queue an event to be delivered by component thread.
+ * Must be called with mutex locked.
+ */
+static void sim_event(SIM_COMPONENT* pComponent, OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2) {
+	if(pComponent->nEvents < SIM_EVENTS_MAX) {
+		SIM_EVENT* pEvent = &pComponent->events[pComponent->nEvents++];
+		pEvent->eEvent	= eEvent;
+		pEvent->nData1	= nData1;
+		pEvent->nData2	= nData2;
+	}
+	pthread_cond_signal(&pComponent->cond);
+}
+
+/*
+ * Hand a buffer back to client. Client may call into the component from the
+ * callback, so mutex is released during the call.
+ */
+static void sim_buffer_done(SIM_COMPONENT* pComponent, SIM_PORT* pPort, OMX_BUFFERHEADERTYPE* pBuffer) {
+	pthread_mutex_unlock(&pComponent->mutex);
+	if(pPort->def.eDir == OMX_DirInput) {
+		if(pComponent->callbacks.EmptyBufferDone) pComponent->callbacks.EmptyBufferDone(pComponent, pComponent->pAppData, pBuffer);
+	}
+	else {
+		if(pComponent->callbacks.FillBufferDone) pComponent->callbacks.FillBufferDone(pComponent, pComponent->pAppData, pBuffer);
+	}
+	pthread_mutex_lock(&pComponent->mutex);
+}
+
+static OMX_BUFFERHEADERTYPE* sim_queue_pop(SIM_PORT* pPort) {
+	if(pPort->nQueued == 0) return NULL;
+
+	OMX_BUFFERHEADERTYPE* pBuffer = pPort->queue[pPort->nQueueHead];
+	pPort->nQueueHead = (pPort->nQueueHead + 1) % SIM_BUFFERS_MAX;
+	pPort->nQueued--;
+	return pBuffer;
+}
+
+/* Return every buffer queued on the port to client */
+static void sim_port_flush(SIM_COMPONENT* pComponent, SIM_PORT* pPort) {
+	OMX_BUFFERHEADERTYPE* pBuffer;
+	while((pBuffer = sim_queue_pop(pPort))) {
+		if(pPort->def.eDir == OMX_DirInput) pBuffer->nFilledLen = 0;
+		sim_buffer_done(pComponent, pPort, pBuffer);
+	}
+}
+
+static OMX_BOOL sim_port_is_populated(SIM_PORT* pPort) {
+	if(!pPort->def.bEnabled || pPort->pTunnel) return OMX_TRUE;
+	return pPort->nBuffers >= pPort->def.nBufferCountActual;
+}
+
+static OMX_BOOL sim_port_is_empty(SIM_PORT* pPort) {
+	return pPort->nBuffers == 0;
+}
+
+/*
+ * Hand a frame to the peer of tunneled output port, if the peer is executing.
+ * Must be called with mutex locked. It is released while the peer receives.
+ */
+static void sim_tunnel_send(SIM_COMPONENT* pComponent, SIM_PORT* pPort, SIM_FRAME* pFrame) {
+	SIM_COMPONENT*	pPeer		= pPort->pTunnel;
+	OMX_U32			nPeerPort	= pPort->nTunnelPort;
+
+	pthread_mutex_unlock(&pComponent->mutex);
+	pthread_mutex_lock(&pPeer->mutex);
+	if(pPeer->eState == OMX_StateExecuting && pPeer->pType->receive) {
+		pPeer->pType->receive(pPeer, nPeerPort, pFrame);
+	}
+	pthread_mutex_unlock(&pPeer->mutex);
+	pthread_mutex_lock(&pComponent->mutex);
+}
+
+/*
+ * Fill YUV420 planes of rows [nRowFrom, nRowFrom + nRows) with moving bars.
+ */
+static void sim_pattern(OMX_U8* pY, OMX_U8* pU, OMX_U8* pV, OMX_U32 nStride, OMX_U32 nRowFrom, OMX_U32 nRows, OMX_U32 nFrame) {
+	for(OMX_U32 row = 0; row < nRows; row++) {
+		memset(pY + row * nStride, ((nRowFrom + row) + nFrame * 4) & 0xFF, nStride);
+	}
+	memset(pU, (nFrame * 2) & 0xFF, nStride / 2 * nRows / 2);
+	memset(pV, 0x80, nStride / 2 * nRows / 2);
+}
+
+/* OMX.broadcom.camera */
+static void camera_init(SIM_COMPONENT* pComponent) {
+	sim_port_add(pComponent, 70, OMX_DirOutput, OMX_PortDomainVideo);
+	sim_port_add(pComponent, 71, OMX_DirOutput, OMX_PortDomainVideo);
+	sim_port_add(pComponent, 72, OMX_DirOutput, OMX_PortDomainImage);
+	sim_port_add(pComponent, 73, OMX_DirInput, OMX_PortDomainOther);
+
+	for(int i = 0; i < 3; i++) {
+		pComponent->ports[i].def.format.video.nSliceHeight = sim_env("OMXSIM_SLICE_HEIGHT", 16);
+		sim_port_size(&pComponent->ports[i]);
+	}
+}
+
+static void camera_configure(SIM_COMPONENT* pComponent, SIM_PORT* pPort) {
+	OMX_VIDEO_PORTDEFINITIONTYPE* pVideo = &pPort->def.format.video;
+
+	if(pPort->def.nPortIndex > 72) return;
+
+	// Camera emits slices of multiple of 16 lines, up to the padded frame.
+	OMX_U32 nHeightMax = (pVideo->nFrameHeight + 15) & ~15;
+	if(pVideo->nSliceHeight == 0 || pVideo->nSliceHeight % 16) {
+		pVideo->nSliceHeight = sim_env("OMXSIM_SLICE_HEIGHT", 16);
+	}
+	if(pVideo->nSliceHeight > nHeightMax) pVideo->nSliceHeight = nHeightMax;
+	if(pVideo->xFramerate == 0) pVideo->xFramerate = 30 << 16;
+	sim_port_size(pPort);
+}
+
+static void camera_start_frame(SIM_COMPONENT* pComponent, SIM_PORT* pPort, unsigned long long nNow) {
+	OMX_VIDEO_PORTDEFINITIONTYPE* pVideo = &pPort->def.format.video;
+
+	pComponent->nFrameCount++;
+	pComponent->nFrameTimestamp	= (nNow - pComponent->nBase) / 1000;
+	pComponent->nSliceNext		= 0;
+	pComponent->nSlices			= (pVideo->nFrameHeight + pVideo->nSliceHeight - 1) / pVideo->nSliceHeight;
+
+	if(pPort->pTunnel == NULL) return;
+
+	// Tunneled : Whole frame is handed to the peer at once.
+	SIM_FRAME*	pFrame		= &pComponent->frame;
+	OMX_U32		nHeight		= pComponent->nSlices * pVideo->nSliceHeight;
+	OMX_U32		nSize		= pVideo->nStride * nHeight * 3 / 2;
+	if(pFrame->pData == NULL || pFrame->nStride * pFrame->nSliceHeight * 3 / 2 < nSize) {
+		free(pFrame->pData);
+		pFrame->pData = malloc(nSize);
+	}
+	pFrame->nWidth			= pVideo->nFrameWidth;
+	pFrame->nHeight			= pVideo->nFrameHeight;
+	pFrame->nStride			= pVideo->nStride;
+	pFrame->nSliceHeight	= nHeight;
+	pFrame->nTimestamp		= pComponent->nFrameTimestamp;
+
+	OMX_U8* pY = pFrame->pData;
+	OMX_U8* pU = pY + pFrame->nStride * nHeight;
+	OMX_U8* pV = pU + pFrame->nStride * nHeight / 4;
+	sim_pattern(pY, pU, pV, pFrame->nStride, 0, nHeight, pComponent->nFrameCount);
+	pComponent->nSlices = 0;
+
+	sim_tunnel_send(pComponent, pPort, pFrame);
+}
+
+static unsigned long long camera_process(SIM_COMPONENT* pComponent, unsigned long long nNow) {
+	SIM_PORT* pPort = sim_port(pComponent, 71);
+	OMX_VIDEO_PORTDEFINITIONTYPE* pVideo = &pPort->def.format.video;
+
+	if(!pPort->isCapturing || !pPort->def.bEnabled) {
+		pComponent->nNextFrame	= 0;
+		pComponent->nSlices		= 0;
+		return nNow + SIM_IDLE_WAIT;
+	}
+
+	unsigned long long nPeriod = (1000000000ULL << 16) / (pVideo->xFramerate ? pVideo->xFramerate : (30 << 16));
+	if(pComponent->nNextFrame == 0) pComponent->nNextFrame = nNow;
+
+	if(nNow >= pComponent->nNextFrame) {
+		if(pComponent->nSliceNext < pComponent->nSlices) {
+			// Client did not take the last frame in time. Sensor moves on anyway.
+			if(isSimVerbose) printf("OMXSIM > camera : frame dropped\n");
+		}
+		else {
+			camera_start_frame(pComponent, pPort, nNow);
+		}
+
+		pComponent->nNextFrame += nPeriod;
+		if(pComponent->nNextFrame < nNow) pComponent->nNextFrame = nNow + nPeriod;
+	}
+
+	OMX_BUFFERHEADERTYPE* pBuffer;
+	while(pComponent->nSliceNext < pComponent->nSlices && (pBuffer = sim_queue_pop(pPort))) {
+		OMX_U32 nSizeY	= pVideo->nStride * pVideo->nSliceHeight;
+		OMX_U8* pY		= pBuffer->pBuffer;
+		OMX_U8* pU		= pY + nSizeY;
+		OMX_U8* pV		= pU + nSizeY / 4;
+
+		sim_pattern(pY, pU, pV, pVideo->nStride, pComponent->nSliceNext * pVideo->nSliceHeight, pVideo->nSliceHeight, pComponent->nFrameCount);
+		pBuffer->nOffset	= 0;
+		pBuffer->nFilledLen	= nSizeY * 3 / 2;
+		pBuffer->nFlags		= 0;
+		OMX_S64_TO_TICKS(pBuffer->nTimeStamp, pComponent->nFrameTimestamp);
+
+		if(++pComponent->nSliceNext == pComponent->nSlices) {
+			pBuffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+		}
+		sim_buffer_done(pComponent, pPort, pBuffer);
+	}
+
+	return pComponent->nNextFrame;
+}
+
+/* OMX.broadcom.video_render */
+static void render_init(SIM_COMPONENT* pComponent) {
+	sim_port_add(pComponent, 90, OMX_DirInput, OMX_PortDomainVideo);
+	pComponent->ports[0].def.nBufferCountActual = 3;
+	sim_port_size(&pComponent->ports[0]);
+}
+
+static void render_configure(SIM_COMPONENT* pComponent, SIM_PORT* pPort) {
+	OMX_VIDEO_PORTDEFINITIONTYPE* pVideo = &pPort->def.format.video;
+
+	if(pVideo->nSliceHeight < pVideo->nFrameHeight) pVideo->nSliceHeight = pVideo->nFrameHeight;
+	sim_port_size(pPort);
+}
+
+static unsigned long long render_process(SIM_COMPONENT* pComponent, unsigned long long nNow) {
+	SIM_PORT*		pPort	= &pComponent->ports[0];
+	unsigned int	nHz		= sim_env("OMXSIM_VSYNC_HZ", 60);
+
+	if(nHz == 0) {
+		OMX_BUFFERHEADERTYPE* pBuffer;
+		while((pBuffer = sim_queue_pop(pPort))) {
+			pComponent->nFrameDisplayed++;
+			pBuffer->nFilledLen = 0;
+			sim_buffer_done(pComponent, pPort, pBuffer);
+		}
+		return nNow + SIM_IDLE_WAIT;
+	}
+
+	unsigned long long nPeriod = 1000000000ULL / nHz;
+	if(pComponent->nNextVsync == 0) pComponent->nNextVsync = nNow;
+	if(nNow < pComponent->nNextVsync) return pComponent->nNextVsync;
+
+	pComponent->nNextVsync += nPeriod;
+	if(pComponent->nNextVsync < nNow) pComponent->nNextVsync = nNow + nPeriod;
+
+	// Show the oldest frame and release the one on screen.
+	OMX_BUFFERHEADERTYPE* pBuffer = sim_queue_pop(pPort);
+	if(pBuffer) {
+		OMX_BUFFERHEADERTYPE* pReleased = pComponent->pDisplayed;
+		pComponent->pDisplayed = pBuffer;
+		pComponent->nFrameDisplayed++;
+		if(pReleased) {
+			pReleased->nFilledLen = 0;
+			sim_buffer_done(pComponent, pPort, pReleased);
+		}
+	}
+
+	return pComponent->nNextVsync;
+}
+
+static void render_receive(SIM_COMPONENT* pComponent, OMX_U32 nPortIndex, SIM_FRAME* pFrame) {
+	pComponent->nFrameDisplayed++;
+}
+
+/* OMX.broadcom.video_splitter */
+static void splitter_init(SIM_COMPONENT* pComponent) {
+	sim_port_add(pComponent, 250, OMX_DirInput, OMX_PortDomainVideo);
+	for(OMX_U32 nPortIndex = 251; nPortIndex <= 254; nPortIndex++) {
+		sim_port_add(pComponent, nPortIndex, OMX_DirOutput, OMX_PortDomainVideo);
+	}
+	for(int i = 0; i < pComponent->nPorts; i++) {
+		sim_port_size(&pComponent->ports[i]);
+	}
+}
+
+static void splitter_configure(SIM_COMPONENT* pComponent, SIM_PORT* pPort) {
+	OMX_VIDEO_PORTDEFINITIONTYPE* pVideo = &pPort->def.format.video;
+
+	// Splitter handles whole frames.
+	if(pVideo->nSliceHeight < pVideo->nFrameHeight) pVideo->nSliceHeight = pVideo->nFrameHeight;
+	sim_port_size(pPort);
+}
+
+/*
+ * Copy the frame into a buffer of the port. Planes are cut or left as they
+ * are if layouts differ.
+ */
+static void splitter_copy(SIM_PORT* pPort, OMX_BUFFERHEADERTYPE* pBuffer, SIM_FRAME* pFrame) {
+	OMX_VIDEO_PORTDEFINITIONTYPE* pVideo = &pPort->def.format.video;
+
+	OMX_U32 nStride	= pVideo->nStride < pFrame->nStride ? pVideo->nStride : pFrame->nStride;
+	OMX_U32 nRows	= pVideo->nSliceHeight < pFrame->nSliceHeight ? pVideo->nSliceHeight : pFrame->nSliceHeight;
+	OMX_U8* pSrc	= pFrame->pData;
+	OMX_U8* pDst	= pBuffer->pBuffer;
+
+	for(OMX_U32 row = 0; row < nRows; row++) {
+		memcpy(pDst + row * pVideo->nStride, pSrc + row * pFrame->nStride, nStride);
+	}
+	pSrc += pFrame->nStride * pFrame->nSliceHeight;
+	pDst += pVideo->nStride * pVideo->nSliceHeight;
+	for(int plane = 0; plane < 2; plane++) {
+		for(OMX_U32 row = 0; row < nRows / 2; row++) {
+			memcpy(pDst + row * pVideo->nStride / 2, pSrc + row * pFrame->nStride / 2, nStride / 2);
+		}
+		pSrc += pFrame->nStride * pFrame->nSliceHeight / 4;
+		pDst += pVideo->nStride * pVideo->nSliceHeight / 4;
+	}
+
+	pBuffer->nOffset	= 0;
+	pBuffer->nFilledLen	= pVideo->nStride * pVideo->nSliceHeight * 3 / 2;
+	pBuffer->nFlags		= OMX_BUFFERFLAG_ENDOFFRAME;
+	OMX_S64_TO_TICKS(pBuffer->nTimeStamp, pFrame->nTimestamp);
+}
+
+static void splitter_receive(SIM_COMPONENT* pComponent, OMX_U32 nPortIndex, SIM_FRAME* pFrame) {
+	for(int i = 0; i < pComponent->nPorts; i++) {
+		SIM_PORT* pPort = &pComponent->ports[i];
+		if(pPort->def.eDir != OMX_DirOutput || !pPort->def.bEnabled) continue;
+
+		if(pPort->pTunnel) {
+			sim_tunnel_send(pComponent, pPort, pFrame);
+			continue;
+		}
+
+		// Client did not hand a buffer. Nothing is copied for the port.
+		OMX_BUFFERHEADERTYPE* pBuffer = sim_queue_pop(pPort);
+		if(pBuffer == NULL) continue;
+
+		splitter_copy(pPort, pBuffer, pFrame);
+		sim_buffer_done(pComponent, pPort, pBuffer);
+	}
+}
+
+static const SIM_TYPE simTypes[] = {
+	{ "OMX.broadcom.camera",		camera_init,	camera_process,	NULL,			camera_configure },
+	{ "OMX.broadcom.video_render",	render_init,	render_process,	render_receive,	render_configure },
+	{ "OMX.broadcom.video_splitter",	splitter_init,	NULL,			splitter_receive,	splitter_configure },
+};
+
+/*
+ * Complete state transition if the condition is satisfied.
+ * Must be called with mutex locked.
+ */
+static void sim_transition(SIM_COMPONENT* pComponent) {
+	OMX_STATETYPE eFrom	= pComponent->eState;
+	OMX_STATETYPE eTo	= pComponent->eStateTarget;
+	if(eFrom == eTo) return;
+
+	if(eFrom == OMX_StateLoaded && eTo == OMX_StateIdle) {
+		for(int i = 0; i < pComponent->nPorts; i++) {
+			if(!sim_port_is_populated(&pComponent->ports[i])) return;
+		}
+	}
+	else if(eFrom == OMX_StateIdle && eTo == OMX_StateLoaded) {
+		for(int i = 0; i < pComponent->nPorts; i++) {
+			if(!sim_port_is_empty(&pComponent->ports[i])) return;
+		}
+	}
+	else if(eTo == OMX_StateIdle) {
+		// Executing or Pause -> Idle : Every buffer goes back to client.
+		for(int i = 0; i < pComponent->nPorts; i++) {
+			SIM_PORT* pPort = &pComponent->ports[i];
+			if(pComponent->pDisplayed && pPort->def.eDir == OMX_DirInput) {
+				OMX_BUFFERHEADERTYPE* pDisplayed = pComponent->pDisplayed;
+				pComponent->pDisplayed = NULL;
+				pDisplayed->nFilledLen = 0;
+				sim_buffer_done(pComponent, pPort, pDisplayed);
+			}
+			sim_port_flush(pComponent, pPort);
+		}
+		pComponent->nSlices		= 0;
+		pComponent->nNextFrame	= 0;
+		pComponent->nNextVsync	= 0;
+	}
+	else if(eTo == OMX_StateExecuting) {
+		pComponent->nBase		= sim_now();
+	}
+
+	pComponent->eState = eTo;
+	if(isSimVerbose) printf("OMXSIM > %s : state %d -> %d\n", pComponent->pType->pName, eFrom, eTo);
+	sim_event(pComponent, OMX_EventCmdComplete, OMX_CommandStateSet, eTo);
+}
+
+static void* sim_thread(void* data) {
+	SIM_COMPONENT* pComponent = (SIM_COMPONENT*)data;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	while(pComponent->isAlive) {
+		unsigned long long nNow			= sim_now();
+		unsigned long long nDeadline	= nNow + SIM_IDLE_WAIT;
+
+		sim_transition(pComponent);
+
+		if(pComponent->eState == OMX_StateExecuting && pComponent->pType->process) {
+			nDeadline = pComponent->pType->process(pComponent, nNow);
+		}
+
+		// Deliver events. Client may call into the component from the handler.
+		while(pComponent->nEvents) {
+			SIM_EVENT event = pComponent->events[0];
+			memmove(&pComponent->events[0], &pComponent->events[1], sizeof(SIM_EVENT) * --pComponent->nEvents);
+
+			pthread_mutex_unlock(&pComponent->mutex);
+			if(pComponent->callbacks.EventHandler) {
+				pComponent->callbacks.EventHandler(pComponent, pComponent->pAppData, event.eEvent, event.nData1, event.nData2, NULL);
+			}
+			pthread_mutex_lock(&pComponent->mutex);
+			nDeadline = sim_now();
+		}
+
+		if(nDeadline > sim_now() && pComponent->isAlive) {
+			struct timespec ts;
+			ts.tv_sec	= nDeadline / 1000000000ULL;
+			ts.tv_nsec	= nDeadline % 1000000000ULL;
+			pthread_cond_timedwait(&pComponent->cond, &pComponent->mutex, &ts);
+		}
+	}
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return NULL;
+}
+
+/* Component methods */
+static OMX_ERRORTYPE sim_SendCommand(OMX_HANDLETYPE hComponent, OMX_COMMANDTYPE Cmd, OMX_U32 nParam1, OMX_PTR pCmdData) {
+	SIM_COMPONENT*	pComponent	= (SIM_COMPONENT*)hComponent;
+	OMX_ERRORTYPE	err			= OMX_ErrorNone;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	if(isSimVerbose) printf("OMXSIM > %s : command %d (%d)\n", pComponent->pType->pName, Cmd, nParam1);
+
+	switch(Cmd) {
+	case OMX_CommandStateSet :
+		if(pComponent->eState != pComponent->eStateTarget) {
+			err = OMX_ErrorIncorrectStateOperation;
+		}
+		else if(nParam1 == pComponent->eState) {
+			sim_event(pComponent, OMX_EventError, OMX_ErrorSameState, 0);
+		}
+		else if((pComponent->eState == OMX_StateLoaded && nParam1 != OMX_StateIdle)
+				|| (pComponent->eState == OMX_StateIdle && nParam1 == OMX_StateInvalid)) {
+			sim_event(pComponent, OMX_EventError, OMX_ErrorIncorrectStateTransition, 0);
+		}
+		else {
+			pComponent->eStateTarget = nParam1;
+			pthread_cond_signal(&pComponent->cond);
+		}
+		break;
+
+	case OMX_CommandPortDisable :
+	case OMX_CommandPortEnable :
+	case OMX_CommandFlush :
+		for(int i = 0; i < pComponent->nPorts; i++) {
+			SIM_PORT* pPort = &pComponent->ports[i];
+			if(nParam1 != OMX_ALL && pPort->def.nPortIndex != nParam1) continue;
+
+			if(Cmd == OMX_CommandFlush) {
+				sim_port_flush(pComponent, pPort);
+			}
+			else {
+				pPort->def.bEnabled = (Cmd == OMX_CommandPortEnable);
+				if(!pPort->def.bEnabled) sim_port_flush(pComponent, pPort);
+			}
+			sim_event(pComponent, OMX_EventCmdComplete, Cmd, pPort->def.nPortIndex);
+		}
+		if(nParam1 != OMX_ALL && sim_port(pComponent, nParam1) == NULL) err = OMX_ErrorBadPortIndex;
+		break;
+
+	default :
+		err = OMX_ErrorNotImplemented;
+	}
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return err;
+}
+
+static OMX_ERRORTYPE sim_GetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nParamIndex, OMX_PTR pParam) {
+	SIM_COMPONENT*	pComponent	= (SIM_COMPONENT*)hComponent;
+	OMX_ERRORTYPE	err			= OMX_ErrorNone;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	switch(nParamIndex) {
+	case OMX_IndexParamPortDefinition : {
+		OMX_PARAM_PORTDEFINITIONTYPE* pDef = (OMX_PARAM_PORTDEFINITIONTYPE*)pParam;
+		SIM_PORT* pPort = sim_port(pComponent, pDef->nPortIndex);
+		if(pPort == NULL) {
+			err = OMX_ErrorBadPortIndex;
+			break;
+		}
+		*pDef = pPort->def;
+		pDef->bPopulated = sim_port_is_populated(pPort) && pPort->nBuffers > 0;
+		break;
+	}
+	case OMX_IndexParamCameraDeviceNumber :
+		((OMX_PARAM_U32TYPE*)pParam)->nU32 = pComponent->nDeviceNumber;
+		break;
+	case OMX_IndexParamAudioInit :
+	case OMX_IndexParamImageInit :
+	case OMX_IndexParamVideoInit :
+	case OMX_IndexParamOtherInit : {
+		// Ports of a domain are consecutive.
+		OMX_PORT_PARAM_TYPE* pPorts = (OMX_PORT_PARAM_TYPE*)pParam;
+		OMX_PORTDOMAINTYPE eDomain =
+				nParamIndex == OMX_IndexParamAudioInit ? OMX_PortDomainAudio :
+				nParamIndex == OMX_IndexParamImageInit ? OMX_PortDomainImage :
+				nParamIndex == OMX_IndexParamVideoInit ? OMX_PortDomainVideo : OMX_PortDomainOther;
+		pPorts->nPorts				= 0;
+		pPorts->nStartPortNumber	= 0;
+		for(int i = 0; i < pComponent->nPorts; i++) {
+			if(pComponent->ports[i].def.eDomain != eDomain) continue;
+			if(pPorts->nPorts++ == 0) pPorts->nStartPortNumber = pComponent->ports[i].def.nPortIndex;
+		}
+		break;
+	}
+	default :
+		err = OMX_ErrorUnsupportedIndex;
+	}
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return err;
+}
+
+static OMX_ERRORTYPE sim_SetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pParam) {
+	SIM_COMPONENT*	pComponent	= (SIM_COMPONENT*)hComponent;
+	OMX_ERRORTYPE	err			= OMX_ErrorNone;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	switch(nIndex) {
+	case OMX_IndexParamPortDefinition : {
+		OMX_PARAM_PORTDEFINITIONTYPE* pDef = (OMX_PARAM_PORTDEFINITIONTYPE*)pParam;
+		SIM_PORT* pPort = sim_port(pComponent, pDef->nPortIndex);
+		if(pPort == NULL) {
+			err = OMX_ErrorBadPortIndex;
+			break;
+		}
+		if(pComponent->eState != OMX_StateLoaded && pPort->def.bEnabled) {
+			err = OMX_ErrorIncorrectStateOperation;
+			break;
+		}
+		if(pDef->nBufferCountActual < pPort->def.nBufferCountMin) {
+			err = OMX_ErrorBadParameter;
+			break;
+		}
+		pPort->def.nBufferCountActual	= pDef->nBufferCountActual;
+		pPort->def.format				= pDef->format;
+		if(pComponent->pType->configure) pComponent->pType->configure(pComponent, pPort);
+		break;
+	}
+	case OMX_IndexParamCameraDeviceNumber :
+		pComponent->nDeviceNumber = ((OMX_PARAM_U32TYPE*)pParam)->nU32;
+		if(pComponent->isCallbackDevice) {
+			sim_event(pComponent, OMX_EventParamOrConfigChanged, 0, OMX_IndexParamCameraDeviceNumber);
+		}
+		break;
+	default :
+		err = OMX_ErrorUnsupportedIndex;
+	}
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return err;
+}
+
+static OMX_ERRORTYPE sim_GetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pConfig) {
+	SIM_COMPONENT*	pComponent	= (SIM_COMPONENT*)hComponent;
+	OMX_ERRORTYPE	err			= OMX_ErrorNone;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	switch(nIndex) {
+	case OMX_IndexConfigPortCapturing : {
+		OMX_CONFIG_PORTBOOLEANTYPE* pCapturing = (OMX_CONFIG_PORTBOOLEANTYPE*)pConfig;
+		SIM_PORT* pPort = sim_port(pComponent, pCapturing->nPortIndex);
+		if(pPort)	pCapturing->bEnabled = pPort->isCapturing;
+		else		err = OMX_ErrorBadPortIndex;
+		break;
+	}
+	case OMX_IndexConfigVideoFramerate : {
+		OMX_CONFIG_FRAMERATETYPE* pFramerate = (OMX_CONFIG_FRAMERATETYPE*)pConfig;
+		SIM_PORT* pPort = sim_port(pComponent, pFramerate->nPortIndex);
+		if(pPort)	pFramerate->xEncodeFramerate = pPort->def.format.video.xFramerate;
+		else		err = OMX_ErrorBadPortIndex;
+		break;
+	}
+	default :
+		err = OMX_ErrorUnsupportedIndex;
+	}
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return err;
+}
+
+static OMX_ERRORTYPE sim_SetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pConfig) {
+	SIM_COMPONENT*	pComponent	= (SIM_COMPONENT*)hComponent;
+	OMX_ERRORTYPE	err			= OMX_ErrorNone;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	switch(nIndex) {
+	case OMX_IndexConfigRequestCallback : {
+		OMX_CONFIG_REQUESTCALLBACKTYPE* pRequest = (OMX_CONFIG_REQUESTCALLBACKTYPE*)pConfig;
+		if(pRequest->nIndex == OMX_IndexParamCameraDeviceNumber) {
+			pComponent->isCallbackDevice = pRequest->bEnable;
+		}
+		break;
+	}
+	case OMX_IndexConfigPortCapturing : {
+		OMX_CONFIG_PORTBOOLEANTYPE* pCapturing = (OMX_CONFIG_PORTBOOLEANTYPE*)pConfig;
+		SIM_PORT* pPort = sim_port(pComponent, pCapturing->nPortIndex);
+		if(pPort)	pPort->isCapturing = pCapturing->bEnabled;
+		else		err = OMX_ErrorBadPortIndex;
+		pthread_cond_signal(&pComponent->cond);
+		break;
+	}
+	case OMX_IndexConfigVideoFramerate : {
+		// Takes effect from the next frame while capturing.
+		OMX_CONFIG_FRAMERATETYPE* pFramerate = (OMX_CONFIG_FRAMERATETYPE*)pConfig;
+		SIM_PORT* pPort = sim_port(pComponent, pFramerate->nPortIndex);
+		if(pPort == NULL || pPort->def.eDomain != OMX_PortDomainVideo)	err = OMX_ErrorBadPortIndex;
+		else if(pFramerate->xEncodeFramerate == 0)						err = OMX_ErrorBadParameter;
+		else pPort->def.format.video.xFramerate = pFramerate->xEncodeFramerate;
+		pthread_cond_signal(&pComponent->cond);
+		break;
+	}
+	case OMX_IndexConfigDisplayRegion :
+		// Null display. Nothing to place.
+		break;
+	default :
+		err = OMX_ErrorUnsupportedIndex;
+	}
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return err;
+}
+
+static OMX_ERRORTYPE sim_GetState(OMX_HANDLETYPE hComponent, OMX_STATETYPE* pState) {
+	SIM_COMPONENT* pComponent = (SIM_COMPONENT*)hComponent;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	*pState = pComponent->eState;
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE sim_assign_buffer(
+		SIM_COMPONENT* pComponent, OMX_BUFFERHEADERTYPE** ppBuffer, OMX_U32 nPortIndex,
+		OMX_PTR pAppPrivate, OMX_U32 nSizeBytes, OMX_U8* pData) {
+	OMX_ERRORTYPE err = OMX_ErrorNone;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	SIM_PORT* pPort = sim_port(pComponent, nPortIndex);
+	if(pPort == NULL) {
+		err = OMX_ErrorBadPortIndex;
+	}
+	else if(!(pComponent->eState == OMX_StateLoaded && pComponent->eStateTarget == OMX_StateIdle) && pPort->def.bEnabled) {
+		err = OMX_ErrorIncorrectStateOperation;
+	}
+	else if(nSizeBytes < pPort->def.nBufferSize || pPort->nBuffers >= SIM_BUFFERS_MAX) {
+		err = OMX_ErrorBadParameter;
+	}
+	else {
+		OMX_BUFFERHEADERTYPE* pBuffer = calloc(1, sizeof(OMX_BUFFERHEADERTYPE));
+		OMX_BOOL isAllocated = (pData == NULL);
+		if(isAllocated && posix_memalign((void**)&pData, 16, nSizeBytes) != 0) pData = NULL;
+		if(pBuffer == NULL || pData == NULL) {
+			free(pBuffer);
+			err = OMX_ErrorInsufficientResources;
+		}
+		else {
+			pBuffer->nSize				= sizeof(OMX_BUFFERHEADERTYPE);
+			pBuffer->nVersion.nVersion	= OMX_VERSION;
+			pBuffer->pBuffer			= pData;
+			pBuffer->nAllocLen			= nSizeBytes;
+			pBuffer->pAppPrivate		= pAppPrivate;
+			if(pPort->def.eDir == OMX_DirInput)	pBuffer->nInputPortIndex	= nPortIndex;
+			else								pBuffer->nOutputPortIndex	= nPortIndex;
+
+			pPort->isAllocated[pPort->nBuffers]	= isAllocated;
+			pPort->buffers[pPort->nBuffers++]	= pBuffer;
+			*ppBuffer = pBuffer;
+			pthread_cond_signal(&pComponent->cond);
+		}
+	}
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return err;
+}
+
+static OMX_ERRORTYPE sim_UseBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE** ppBufferHdr, OMX_U32 nPortIndex, OMX_PTR pAppPrivate, OMX_U32 nSizeBytes, OMX_U8* pBuffer) {
+	if(pBuffer == NULL) return OMX_ErrorBadParameter;
+	return sim_assign_buffer((SIM_COMPONENT*)hComponent, ppBufferHdr, nPortIndex, pAppPrivate, nSizeBytes, pBuffer);
+}
+
+static OMX_ERRORTYPE sim_AllocateBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE** ppBuffer, OMX_U32 nPortIndex, OMX_PTR pAppPrivate, OMX_U32 nSizeBytes) {
+	return sim_assign_buffer((SIM_COMPONENT*)hComponent, ppBuffer, nPortIndex, pAppPrivate, nSizeBytes, NULL);
+}
+
+static OMX_ERRORTYPE sim_FreeBuffer(OMX_HANDLETYPE hComponent, OMX_U32 nPortIndex, OMX_BUFFERHEADERTYPE* pBuffer) {
+	SIM_COMPONENT*	pComponent	= (SIM_COMPONENT*)hComponent;
+	OMX_ERRORTYPE	err			= OMX_ErrorBadParameter;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	SIM_PORT* pPort = sim_port(pComponent, nPortIndex);
+	for(int i = 0; pPort && i < pPort->nBuffers; i++) {
+		if(pPort->buffers[i] != pBuffer) continue;
+
+		if(pPort->isAllocated[i]) free(pBuffer->pBuffer);
+		free(pBuffer);
+		pPort->nBuffers--;
+		memmove(&pPort->buffers[i], &pPort->buffers[i + 1], sizeof(pPort->buffers[0]) * (pPort->nBuffers - i));
+		memmove(&pPort->isAllocated[i], &pPort->isAllocated[i + 1], sizeof(pPort->isAllocated[0]) * (pPort->nBuffers - i));
+		if(pComponent->pDisplayed == pBuffer) pComponent->pDisplayed = NULL;
+		pthread_cond_signal(&pComponent->cond);
+		err = OMX_ErrorNone;
+		break;
+	}
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return err;
+}
+
+static OMX_ERRORTYPE sim_queue_buffer(SIM_COMPONENT* pComponent, OMX_BUFFERHEADERTYPE* pBuffer, OMX_DIRTYPE eDir) {
+	OMX_ERRORTYPE err = OMX_ErrorNone;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	SIM_PORT* pPort = sim_port(pComponent, eDir == OMX_DirInput ? pBuffer->nInputPortIndex : pBuffer->nOutputPortIndex);
+	if(pPort == NULL || pPort->def.eDir != eDir) {
+		err = OMX_ErrorBadPortIndex;
+	}
+	else if(pComponent->eState != OMX_StateExecuting && pComponent->eState != OMX_StatePause && pComponent->eState != OMX_StateIdle) {
+		err = OMX_ErrorIncorrectStateOperation;
+	}
+	else if(pPort->nQueued >= SIM_BUFFERS_MAX) {
+		err = OMX_ErrorInsufficientResources;
+	}
+	else {
+		pPort->queue[(pPort->nQueueHead + pPort->nQueued++) % SIM_BUFFERS_MAX] = pBuffer;
+		pthread_cond_signal(&pComponent->cond);
+	}
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return err;
+}
+
+static OMX_ERRORTYPE sim_EmptyThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE* pBuffer) {
+	return sim_queue_buffer((SIM_COMPONENT*)hComponent, pBuffer, OMX_DirInput);
+}
+
+static OMX_ERRORTYPE sim_FillThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE* pBuffer) {
+	return sim_queue_buffer((SIM_COMPONENT*)hComponent, pBuffer, OMX_DirOutput);
+}
+
+static OMX_ERRORTYPE sim_SetCallbacks(OMX_HANDLETYPE hComponent, OMX_CALLBACKTYPE* pCallbacks, OMX_PTR pAppData) {
+	SIM_COMPONENT* pComponent = (SIM_COMPONENT*)hComponent;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	pComponent->callbacks			= *pCallbacks;
+	pComponent->pAppData			= pAppData;
+	pComponent->omx.pApplicationPrivate = pAppData;
+	pthread_mutex_unlock(&pComponent->mutex);
+
+	return OMX_ErrorNone;
+}
+
+/* Core */
+void bcm_host_init(void) {
+}
+
+void bcm_host_deinit(void) {
+}
+
+OMX_ERRORTYPE OMX_Init(void) {
+	if(nSimInit++ == 0) {
+		isSimVerbose = getenv("OMXSIM_VERBOSE") != NULL;
+		printf("OMXSIM > Stand-in OMX IL core. No hardware is used.\n");
+	}
+	return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_Deinit(void) {
+	if(nSimInit > 0) nSimInit--;
+	return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_ComponentNameEnum(OMX_STRING cComponentName, OMX_U32 nNameLength, OMX_U32 nIndex) {
+	if(nIndex >= sizeof(simTypes) / sizeof(simTypes[0])) return OMX_ErrorNoMore;
+
+	snprintf(cComponentName, nNameLength, "%s", simTypes[nIndex].pName);
+	return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_GetHandle(OMX_HANDLETYPE* pHandle, OMX_STRING cComponentName, OMX_PTR pAppData, OMX_CALLBACKTYPE* pCallBacks) {
+	const SIM_TYPE* pType = NULL;
+
+	if(nSimInit == 0) return OMX_ErrorNotReady;
+	for(int i = 0; i < sizeof(simTypes) / sizeof(simTypes[0]); i++) {
+		if(strcmp(simTypes[i].pName, cComponentName) == 0) pType = &simTypes[i];
+	}
+	if(pType == NULL) return OMX_ErrorComponentNotFound;
+
+	SIM_COMPONENT* pComponent = calloc(1, sizeof(SIM_COMPONENT));
+	if(pComponent == NULL) return OMX_ErrorInsufficientResources;
+
+	pComponent->omx.nSize				= sizeof(OMX_COMPONENTTYPE);
+	pComponent->omx.nVersion.nVersion	= OMX_VERSION;
+	pComponent->omx.pComponentPrivate	= pComponent;
+	pComponent->omx.SendCommand			= sim_SendCommand;
+	pComponent->omx.GetParameter		= sim_GetParameter;
+	pComponent->omx.SetParameter		= sim_SetParameter;
+	pComponent->omx.GetConfig			= sim_GetConfig;
+	pComponent->omx.SetConfig			= sim_SetConfig;
+	pComponent->omx.GetState			= sim_GetState;
+	pComponent->omx.UseBuffer			= sim_UseBuffer;
+	pComponent->omx.AllocateBuffer		= sim_AllocateBuffer;
+	pComponent->omx.FreeBuffer			= sim_FreeBuffer;
+	pComponent->omx.EmptyThisBuffer		= sim_EmptyThisBuffer;
+	pComponent->omx.FillThisBuffer		= sim_FillThisBuffer;
+	pComponent->omx.SetCallbacks		= sim_SetCallbacks;
+
+	pComponent->pType			= pType;
+	pComponent->eState			= OMX_StateLoaded;
+	pComponent->eStateTarget	= OMX_StateLoaded;
+	pComponent->isAlive			= OMX_TRUE;
+	if(pCallBacks) pComponent->callbacks = *pCallBacks;
+	pComponent->pAppData		= pAppData;
+	pComponent->omx.pApplicationPrivate = pAppData;
+	pType->init(pComponent);
+
+	pthread_mutex_init(&pComponent->mutex, NULL);
+	pthread_condattr_t condattr;
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pComponent->cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+
+	if(pthread_create(&pComponent->thread, NULL, sim_thread, pComponent) != 0) {
+		free(pComponent);
+		return OMX_ErrorInsufficientResources;
+	}
+	char name[16];
+	snprintf(name, sizeof(name), "sim.%s", pType->pName + strlen("OMX.broadcom."));
+	pthread_setname_np(pComponent->thread, name);
+
+	*pHandle = (OMX_HANDLETYPE)pComponent;
+	return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_FreeHandle(OMX_HANDLETYPE hComponent) {
+	SIM_COMPONENT* pComponent = (SIM_COMPONENT*)hComponent;
+	if(pComponent == NULL) return OMX_ErrorBadParameter;
+
+	pthread_mutex_lock(&pComponent->mutex);
+	pComponent->isAlive = OMX_FALSE;
+	pthread_cond_signal(&pComponent->cond);
+	pthread_mutex_unlock(&pComponent->mutex);
+	pthread_join(pComponent->thread, NULL);
+
+	if(pComponent->nFrameCount)		printf("OMXSIM > %s : %d frames captured\n", pComponent->pType->pName, pComponent->nFrameCount);
+	if(pComponent->nFrameDisplayed)	printf("OMXSIM > %s : %d frames displayed\n", pComponent->pType->pName, pComponent->nFrameDisplayed);
+
+	for(int i = 0; i < pComponent->nPorts; i++) {
+		SIM_PORT* pPort = &pComponent->ports[i];
+		if(pPort->pTunnel) {
+			SIM_PORT* pPeerPort = sim_port(pPort->pTunnel, pPort->nTunnelPort);
+			if(pPeerPort) pPeerPort->pTunnel = NULL;
+		}
+		for(int j = 0; j < pPort->nBuffers; j++) {
+			if(pPort->isAllocated[j]) free(pPort->buffers[j]->pBuffer);
+			free(pPort->buffers[j]);
+		}
+	}
+
+	free(pComponent->frame.pData);
+	pthread_cond_destroy(&pComponent->cond);
+	pthread_mutex_destroy(&pComponent->mutex);
+	free(pComponent);
+
+	return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_SetupTunnel(OMX_HANDLETYPE hOutput, OMX_U32 nPortOutput, OMX_HANDLETYPE hInput, OMX_U32 nPortInput) {
+	SIM_COMPONENT*	pOutput		= (SIM_COMPONENT*)hOutput;
+	SIM_COMPONENT*	pInput		= (SIM_COMPONENT*)hInput;
+	SIM_PORT*		pPortOutput	= pOutput ? sim_port(pOutput, nPortOutput) : NULL;
+	SIM_PORT*		pPortInput	= pInput ? sim_port(pInput, nPortInput) : NULL;
+
+	if((pOutput && !pPortOutput) || (pInput && !pPortInput)) return OMX_ErrorBadPortIndex;
+	if(pPortOutput && pPortOutput->def.eDir != OMX_DirOutput) return OMX_ErrorBadParameter;
+	if(pPortInput && pPortInput->def.eDir != OMX_DirInput) return OMX_ErrorBadParameter;
+
+	if(pPortOutput) {
+		pthread_mutex_lock(&pOutput->mutex);
+		pPortOutput->pTunnel		= pInput;
+		pPortOutput->nTunnelPort	= nPortInput;
+		pthread_mutex_unlock(&pOutput->mutex);
+	}
+	if(pPortInput) {
+		pthread_mutex_lock(&pInput->mutex);
+		pPortInput->pTunnel			= pOutput;
+		pPortInput->nTunnelPort		= nPortOutput;
+		// Tunnel carries the format of the output port.
+		if(pPortOutput) {
+			pPortInput->def.format = pPortOutput->def.format;
+			if(pInput->pType->configure) pInput->pType->configure(pInput, pPortInput);
+		}
+		pthread_mutex_unlock(&pInput->mutex);
+	}
+
+	return OMX_ErrorNone;
+}
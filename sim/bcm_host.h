@@ -0,0 +1,24 @@
+/*
+ ============================================================================
+ Name        : bcm_host.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Stand-in of bcm_host.h for OMXsim.
+               Only what programs of rpi-omx-tutorial use from bcm_host.
+               Real bcm_host.h brings standard headers in, so do this.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SIM_BCM_HOST_H_
+#define RPI_OMX_TUTORIAL_SIM_BCM_HOST_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+void bcm_host_init(void);
+
+void bcm_host_deinit(void);
+
+#endif /* RPI_OMX_TUTORIAL_SIM_BCM_HOST_H_ */
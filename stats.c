@@ -0,0 +1,82 @@
+/*
+ ============================================================================
+ Name        : stats.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Latency statistics for rpi-omx-tutorial.
+ ============================================================================
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+#define STATS_SUB_COUNT	(1 << STATS_SUB_BITS)
+
+unsigned long long stats_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int stats_bucket_of(unsigned long long value) {
+	if(value < STATS_SUB_COUNT) return value;
+
+	unsigned int msb = 63 - __builtin_clzll(value);
+	unsigned int sub = (value >> (msb - STATS_SUB_BITS)) & (STATS_SUB_COUNT - 1);
+	return ((msb - STATS_SUB_BITS + 1) << STATS_SUB_BITS) + sub;
+}
+
+static unsigned long long stats_bucket_upper(unsigned int bucket) {
+	if(bucket < STATS_SUB_COUNT) return bucket;
+
+	unsigned int 		shift	= (bucket >> STATS_SUB_BITS) - 1;
+	unsigned long long	lower	= (unsigned long long)(STATS_SUB_COUNT + (bucket & (STATS_SUB_COUNT - 1))) << shift;
+	return lower + ((1ULL << shift) - 1);
+}
+
+void stats_histogram_reset(STATS_HISTOGRAM* pHistogram) {
+	memset(pHistogram, 0x00, sizeof(STATS_HISTOGRAM));
+}
+
+void stats_histogram_add(STATS_HISTOGRAM* pHistogram, unsigned long long value) {
+	__atomic_add_fetch(&pHistogram->buckets[stats_bucket_of(value)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pHistogram->nSum, value, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&pHistogram->nCount, 1, __ATOMIC_RELAXED);
+
+	unsigned long long max = __atomic_load_n(&pHistogram->nMax, __ATOMIC_RELAXED);
+	while(value > max && !__atomic_compare_exchange_n(&pHistogram->nMax, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+unsigned long long stats_histogram_percentile(STATS_HISTOGRAM* pHistogram, double percentile) {
+	unsigned long long nCount = 0;
+	for(int i = 0; i < STATS_BUCKETS; i++) {
+		nCount += __atomic_load_n(&pHistogram->buckets[i], __ATOMIC_RELAXED);
+	}
+	if(nCount == 0) return 0;
+
+	unsigned long long nRank = (unsigned long long)(nCount * percentile / 100.0 + 0.5);
+	if(nRank < 1) 		nRank = 1;
+	if(nRank > nCount)	nRank = nCount;
+
+	unsigned long long nSeen = 0;
+	unsigned long long nMax  = __atomic_load_n(&pHistogram->nMax, __ATOMIC_RELAXED);
+	for(int i = 0; i < STATS_BUCKETS; i++) {
+		nSeen += __atomic_load_n(&pHistogram->buckets[i], __ATOMIC_RELAXED);
+		if(nSeen >= nRank) {
+			unsigned long long upper = stats_bucket_upper(i);
+			return upper < nMax ? upper : nMax;
+		}
+	}
+
+	return nMax;
+}
+
+unsigned long long stats_histogram_mean(STATS_HISTOGRAM* pHistogram) {
+	unsigned long long nCount = __atomic_load_n(&pHistogram->nCount, __ATOMIC_RELAXED);
+	if(nCount == 0) return 0;
+
+	return __atomic_load_n(&pHistogram->nSum, __ATOMIC_RELAXED) / nCount;
+}
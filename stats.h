@@ -0,0 +1,55 @@
+/*
+ ============================================================================
+ Name        : stats.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Latency statistics for rpi-omx-tutorial.
+               Log-linear histogram which can be updated from any thread
+               without lock and reports count, mean, max and percentiles.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_STATS_H_
+#define RPI_OMX_TUTORIAL_SRC_STATS_H_
+
+/*
+ * Each power of two is divided into 8 buckets, so the error of percentile is
+ * less than 12.5%. Values are usually nsec but any unit is fine.
+ */
+#define STATS_SUB_BITS		3
+#define STATS_BUCKETS		(64 << STATS_SUB_BITS)
+
+typedef struct STATS_HISTOGRAM {
+	unsigned long long	nCount;
+	unsigned long long	nSum;
+	unsigned long long	nMax;
+	unsigned int		buckets[STATS_BUCKETS];
+} STATS_HISTOGRAM;
+
+/*
+ * Current time of CLOCK_MONOTONIC in nsec.
+ */
+unsigned long long stats_now();
+
+/*
+ * Reset histogram. Must not race with stats_histogram_add().
+ */
+void stats_histogram_reset(STATS_HISTOGRAM* pHistogram);
+
+/*
+ * Add a value. Lock-free, safe to call from any thread.
+ */
+void stats_histogram_add(STATS_HISTOGRAM* pHistogram, unsigned long long value);
+
+/*
+ * Value at percentile (0.0 ~ 100.0). Returns upper bound of the bucket, but
+ * never larger than observed maximum. 0 if histogram is empty.
+ */
+unsigned long long stats_histogram_percentile(STATS_HISTOGRAM* pHistogram, double percentile);
+
+/*
+ * Mean of added values. 0 if histogram is empty.
+ */
+unsigned long long stats_histogram_mean(STATS_HISTOGRAM* pHistogram);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_STATS_H_ */
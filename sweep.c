@@ -0,0 +1,291 @@
+/*
+ ============================================================================
+ Name        : sweep.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Sustainable rate finder for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sweep.h"
+#include "stats.h"
+#include "config.h"
+
+#define SWEEP_RESULT_PREFIX		"RESULT "
+#define SWEEP_SUSTAIN_RATIO		0.95	// Achieved FPS must be at least this ratio of requested
+
+void sweep_report(SWEEP_RESULT* pResult) {
+	printf(SWEEP_RESULT_PREFIX "%u %u %u %u %u %u %.3f %llu\n",
+			pResult->nWidth, pResult->nHeight, pResult->nFramerate, pResult->nBuffers,
+			pResult->nFrames, pResult->nDropped, pResult->nFPS, pResult->nLatencyP99);
+	fflush(stdout);
+}
+
+int sweep_parse_resolutions(SWEEP* pSweep, char* pList) {
+	char* pSave = NULL;
+
+	pSweep->nResolutions = 0;
+	for(char* pToken = strtok_r(pList, ",", &pSave); pToken; pToken = strtok_r(NULL, ",", &pSave)) {
+		if(pSweep->nResolutions >= SWEEP_MAX) return 0;
+		unsigned int* pResolution = pSweep->resolutions[pSweep->nResolutions];
+		if(!config_size(pToken, &pResolution[0], &pResolution[1])) return 0;
+		if(pResolution[0] == 0 || pResolution[1] == 0) return 0;
+		pSweep->nResolutions++;
+	}
+
+	return pSweep->nResolutions > 0;
+}
+
+int sweep_parse_buffers(SWEEP* pSweep, char* pList) {
+	char* pSave = NULL;
+
+	pSweep->nBuffers = 0;
+	for(char* pToken = strtok_r(pList, ",", &pSave); pToken; pToken = strtok_r(NULL, ",", &pSave)) {
+		if(pSweep->nBuffers >= SWEEP_MAX) return 0;
+		if(!config_uint(pToken, &pSweep->buffers[pSweep->nBuffers])) return 0;
+		pSweep->nBuffers++;
+	}
+
+	return pSweep->nBuffers > 0;
+}
+
+int sweep_add_arg(SWEEP* pSweep, const char* pFormat, ...) {
+	va_list ap;
+
+	if(pSweep->nArgs >= SWEEP_ARGS) return 0;
+	va_start(ap, pFormat);
+	int nLength = vsnprintf(pSweep->args[pSweep->nArgs], SWEEP_ARG_MAX, pFormat, ap);
+	va_end(ap);
+	if(nLength < 0 || nLength >= SWEEP_ARG_MAX) return 0;
+	pSweep->nArgs++;
+
+	return 1;
+}
+
+/*
+ * Run one trial as a child and read its RESULT line.
+ * The child is killed if it does not finish in twice of the expected time.
+ */
+static void sweep_trial(SWEEP* pSweep, const char* pProgram, SWEEP_RESULT* pResult) {
+	char resolution[32], framerate[16], buffers[16], frames[16];
+	int fds[2];
+
+	snprintf(resolution, sizeof(resolution), "%ux%u", pResult->nWidth, pResult->nHeight);
+	snprintf(framerate, sizeof(framerate), "%u", pResult->nFramerate);
+	snprintf(buffers, sizeof(buffers), "%u", pResult->nBuffers);
+	snprintf(frames, sizeof(frames), "%u", pSweep->nFrames);
+	pResult->isValid = 0;
+
+	if(pipe(fds) != 0) {
+		perror("pipe");
+		return;
+	}
+
+	pid_t pid = fork();
+	if(pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	}
+	if(pid == 0) {
+		int fdNull = open("/dev/null", O_RDWR);
+		dup2(fdNull, STDIN_FILENO);		// "Press enter to terminate." returns at once
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+
+		char* argv[SWEEP_ARGS + 10];
+		int nArg = 0;
+		argv[nArg++] = (char*)pProgram;
+		for(unsigned int i = 0; i < pSweep->nArgs; i++) argv[nArg++] = pSweep->args[i];
+		argv[nArg++] = "-r";	argv[nArg++] = resolution;
+		argv[nArg++] = "-f";	argv[nArg++] = framerate;
+		argv[nArg++] = "-c";	argv[nArg++] = buffers;
+		argv[nArg++] = pSweep->isHeadless ? "-b" : "-n";
+		argv[nArg++] = frames;
+		argv[nArg]   = NULL;
+		execv(pProgram, argv);
+		perror(pProgram);
+		_exit(127);
+	}
+	close(fds[1]);
+
+	unsigned long long	nDeadline	= stats_now() + (2ULL * pSweep->nFrames / pResult->nFramerate + 10) * 1000000000ULL;
+	char				line[512];
+	size_t				nLine		= 0;
+	int					isKilled	= 0;
+
+	while(1) {
+		unsigned long long nNow = stats_now();
+		if(nNow >= nDeadline) {
+			fprintf(stderr, "SWEEP > Trial %s @ %s fps timed out.\n", resolution, framerate);
+			kill(pid, SIGKILL);
+			isKilled = 1;
+			break;
+		}
+
+		struct pollfd pfd = { fds[0], POLLIN, 0 };
+		if(poll(&pfd, 1, (nDeadline - nNow) / 1000000 + 1) <= 0) continue;
+
+		// Read by byte. Output of the trial is small and nothing is left unread by poll().
+		char c;
+		ssize_t nRead = read(fds[0], &c, 1);
+		if(nRead <= 0) break;
+		if(c != '\n') {
+			if(nLine < sizeof(line) - 1) line[nLine++] = c;
+			continue;
+		}
+		line[nLine] = '\0';
+		nLine = 0;
+
+		if(strncmp(line, SWEEP_RESULT_PREFIX, strlen(SWEEP_RESULT_PREFIX)) == 0) {
+			SWEEP_RESULT result;
+			if(sscanf(line + strlen(SWEEP_RESULT_PREFIX), "%u %u %u %u %u %u %lf %llu",
+					&result.nWidth, &result.nHeight, &result.nFramerate, &result.nBuffers,
+					&result.nFrames, &result.nDropped, &result.nFPS, &result.nLatencyP99) == 8) {
+				pResult->nFrames		= result.nFrames;
+				pResult->nDropped		= result.nDropped;
+				pResult->nFPS			= result.nFPS;
+				pResult->nLatencyP99	= result.nLatencyP99;
+				pResult->isValid		= 1;
+			}
+		}
+	}
+	close(fds[0]);
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if(!isKilled && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "SWEEP > Trial %s @ %s fps exited abnormally (status 0x%x).\n", resolution, framerate, status);
+	}
+}
+
+static int sweep_is_sustained(SWEEP_RESULT* pResult) {
+	return pResult->isValid
+			&& pResult->nDropped == 0
+			&& pResult->nFPS >= pResult->nFramerate * SWEEP_SUSTAIN_RATIO;
+}
+
+static double sweep_drop_rate(SWEEP_RESULT* pResult) {
+	unsigned int nTotal = pResult->nFrames + pResult->nDropped;
+	return nTotal ? (double)pResult->nDropped / nTotal : 0;
+}
+
+static void sweep_write_csv(FILE* fp, SWEEP_RESULT* pResults, unsigned int nResults, SWEEP_RESULT* pMax, unsigned int nMax) {
+	fprintf(fp, "kind,width,height,buffers,fps_requested,fps_achieved,frames,dropped,drop_rate,latency_p99_us,sustained\n");
+	for(unsigned int i = 0; i < nResults; i++) {
+		SWEEP_RESULT* p = &pResults[i];
+		fprintf(fp, "trial,%u,%u,%u,%u,%.3f,%u,%u,%.4f,%.1f,%d\n",
+				p->nWidth, p->nHeight, p->nBuffers, p->nFramerate, p->nFPS,
+				p->nFrames, p->nDropped, sweep_drop_rate(p), p->nLatencyP99 / 1000.0, sweep_is_sustained(p));
+	}
+	for(unsigned int i = 0; i < nMax; i++) {
+		SWEEP_RESULT* p = &pMax[i];
+		fprintf(fp, "max,%u,%u,%u,%u,%.3f,%u,%u,%.4f,%.1f,%d\n",
+				p->nWidth, p->nHeight, p->nBuffers, p->nFramerate, p->nFPS,
+				p->nFrames, p->nDropped, sweep_drop_rate(p), p->nLatencyP99 / 1000.0, p->nFramerate > 0);
+	}
+}
+
+static void sweep_write_json(FILE* fp, SWEEP_RESULT* pResults, unsigned int nResults, SWEEP_RESULT* pMax, unsigned int nMax) {
+	fprintf(fp, "{\"trials\":[");
+	for(unsigned int i = 0; i < nResults; i++) {
+		SWEEP_RESULT* p = &pResults[i];
+		fprintf(fp, "%s\n{\"width\":%u,\"height\":%u,\"buffers\":%u,\"fps_requested\":%u,\"fps_achieved\":%.3f,"
+				"\"frames\":%u,\"dropped\":%u,\"drop_rate\":%.4f,\"latency_p99_us\":%.1f,\"valid\":%s,\"sustained\":%s}",
+				i ? "," : "", p->nWidth, p->nHeight, p->nBuffers, p->nFramerate, p->nFPS,
+				p->nFrames, p->nDropped, sweep_drop_rate(p), p->nLatencyP99 / 1000.0,
+				p->isValid ? "true" : "false", sweep_is_sustained(p) ? "true" : "false");
+	}
+	fprintf(fp, "\n],\"max\":[");
+	for(unsigned int i = 0; i < nMax; i++) {
+		SWEEP_RESULT* p = &pMax[i];
+		fprintf(fp, "%s\n{\"width\":%u,\"height\":%u,\"buffers\":%u,\"max_fps\":%u,\"fps_achieved\":%.3f}",
+				i ? "," : "", p->nWidth, p->nHeight, p->nBuffers, p->nFramerate, p->nFPS);
+	}
+	fprintf(fp, "\n]}\n");
+}
+
+int sweep_run(SWEEP* pSweep, const char* pProgram) {
+	unsigned int	nSteps		= 1;
+	unsigned int	nResults	= 0;
+	unsigned int	nMax		= 0;
+	int				ret			= 0;
+
+	// Binary search takes at most log2(range) + 1 trials per configuration.
+	for(unsigned int n = pSweep->nFramerateMax - pSweep->nFramerateMin + 1; n > 1; n >>= 1) nSteps++;
+	SWEEP_RESULT* pResults	= calloc(pSweep->nResolutions * pSweep->nBuffers * nSteps, sizeof(SWEEP_RESULT));
+	SWEEP_RESULT* pMax		= calloc(pSweep->nResolutions * pSweep->nBuffers, sizeof(SWEEP_RESULT));
+
+	for(unsigned int r = 0; r < pSweep->nResolutions; r++) {
+		for(unsigned int b = 0; b < pSweep->nBuffers; b++) {
+			unsigned int nLow	= pSweep->nFramerateMin;
+			unsigned int nHigh	= pSweep->nFramerateMax;
+			SWEEP_RESULT* pBest	= &pMax[nMax++];
+
+			pBest->nWidth	= pSweep->resolutions[r][0];
+			pBest->nHeight	= pSweep->resolutions[r][1];
+			pBest->nBuffers	= pSweep->buffers[b];
+
+			while(nLow <= nHigh) {
+				SWEEP_RESULT* pResult = &pResults[nResults++];
+				pResult->nWidth		= pBest->nWidth;
+				pResult->nHeight	= pBest->nHeight;
+				pResult->nBuffers	= pBest->nBuffers;
+				pResult->nFramerate	= nLow + (nHigh - nLow) / 2;
+				sweep_trial(pSweep, pProgram, pResult);
+
+				int isSustained = sweep_is_sustained(pResult);
+				fprintf(stderr, "SWEEP > %ux%u, %u buffers, %u fps : %.2f fps, %u dropped -> %s\n",
+						pResult->nWidth, pResult->nHeight, pResult->nBuffers, pResult->nFramerate,
+						pResult->nFPS, pResult->nDropped, isSustained ? "OK" : "FAIL");
+
+				if(isSustained) {
+					*pBest	= *pResult;
+					nLow	= pResult->nFramerate + 1;
+				}
+				else {
+					if(pResult->nFramerate == 0) break;
+					nHigh	= pResult->nFramerate - 1;
+				}
+			}
+			fprintf(stderr, "SWEEP > %ux%u, %u buffers : max %u fps\n",
+					pBest->nWidth, pBest->nHeight, pBest->nBuffers, pBest->nFramerate);
+		}
+	}
+
+	FILE* fp = pSweep->pOutput ? fopen(pSweep->pOutput, "w") : stdout;
+	if(fp == NULL) {
+		perror(pSweep->pOutput);
+		ret = -1;
+	}
+	else {
+		size_t nLength = pSweep->pOutput ? strlen(pSweep->pOutput) : 0;
+		if(nLength >= 5 && strcmp(pSweep->pOutput + nLength - 5, ".json") == 0) {
+			sweep_write_json(fp, pResults, nResults, pMax, nMax);
+		}
+		else {
+			sweep_write_csv(fp, pResults, nResults, pMax, nMax);
+		}
+		if(fp != stdout) fclose(fp);
+	}
+
+	free(pResults);
+	free(pMax);
+
+	return ret;
+}
@@ -0,0 +1,77 @@
+/*
+ ============================================================================
+ Name        : sweep.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Sustainable rate finder for rpi-omx-tutorial.
+               Runs the program itself as a child for every trial of
+               resolution x framerate x buffer count, so each trial starts
+               from fresh OMX components, and collects RESULT line of it.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_SWEEP_H_
+#define RPI_OMX_TUTORIAL_SRC_SWEEP_H_
+
+#define SWEEP_MAX		16
+#define SWEEP_ARGS		16		// Options given to every trial
+#define SWEEP_ARG_MAX	64
+
+typedef struct SWEEP_RESULT {
+	unsigned int		nWidth;
+	unsigned int		nHeight;
+	unsigned int		nFramerate;			// Requested
+	unsigned int		nBuffers;			// Render buffers. 0 : Port default
+	unsigned int		nFrames;
+	unsigned int		nDropped;			// By the camera
+	double				nFPS;				// Achieved
+	unsigned long long	nLatencyP99;		// nsec
+	int					isValid;			// Trial finished and RESULT was read
+} SWEEP_RESULT;
+
+typedef struct SWEEP {
+	unsigned int		resolutions[SWEEP_MAX][2];
+	unsigned int		nResolutions;
+	unsigned int		buffers[SWEEP_MAX];
+	unsigned int		nBuffers;
+	unsigned int		nFramerateMin;
+	unsigned int		nFramerateMax;
+	unsigned int		nFrames;			// Per trial
+	int					isHeadless;
+	const char*			pOutput;			// *.json for JSON, CSV otherwise
+	char				args[SWEEP_ARGS][SWEEP_ARG_MAX];
+	unsigned int		nArgs;
+} SWEEP;
+
+/*
+ * Print RESULT line which sweep_run() of the parent reads. Called by trial.
+ */
+void sweep_report(SWEEP_RESULT* pResult);
+
+/*
+ * Parse comma separated list of WxH into pSweep->resolutions. Returns 0 on error.
+ */
+int sweep_parse_resolutions(SWEEP* pSweep, char* pList);
+
+/*
+ * Parse comma separated list of buffer counts into pSweep->buffers. Returns 0 on error.
+ */
+int sweep_parse_buffers(SWEEP* pSweep, char* pList);
+
+/*
+ * Add an option which every trial takes, such as "--cpu=2". Options of the
+ * trial itself come later, so they win. Returns 0 if there is no room.
+ */
+int sweep_add_arg(SWEEP* pSweep, const char* pFormat, ...) __attribute__((format(printf, 2, 3)));
+
+/*
+ * For each resolution and buffer count, binary search the highest framerate
+ * in [nFramerateMin, nFramerateMax] which runs without a drop.
+ * pProgram is run with the options added, then -r WxH -f fps -c buffers
+ * and -n frames or -b frames.
+ * A trial which crashed or timed out counts as not sustained.
+ * Returns 0 if the result is written, -1 otherwise.
+ */
+int sweep_run(SWEEP* pSweep, const char* pProgram);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_SWEEP_H_ */
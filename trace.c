@@ -0,0 +1,170 @@
+/*
+ ============================================================================
+ Name        : trace.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Timeline tracer for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_EVENTS_PER_THREAD	(64 * 1024)
+
+typedef struct {
+	unsigned long long	nTimestamp;		// nsec, CLOCK_MONOTONIC
+	const char*			pName;
+	long long			nValue;
+	char				cPhase;
+} TRACE_EVENT;
+
+/*
+ * Each thread owns one buffer and it is the only writer of it.
+ * Buffers are chained into lock-free list on first use and never freed,
+ * so trace_flush() may read them even after the thread has exited.
+ */
+typedef struct TRACE_THREAD {
+	pid_t					tid;
+	char					name[16];
+	unsigned int			nEvents;
+	unsigned int			nDropped;
+	struct TRACE_THREAD*	pNext;
+	TRACE_EVENT				events[TRACE_EVENTS_PER_THREAD];
+} TRACE_THREAD;
+
+static TRACE_THREAD*			pTraceThreads	= NULL;
+static __thread TRACE_THREAD*	pTraceSelf		= NULL;
+static const char*				pTracePath		= NULL;
+static int						nTraceState		= 0;	// 0 : Not yet, 1 : Enabled, -1 : Disabled
+static int						isTraceFlushed	= 0;
+static unsigned long long		nTraceBase		= 0;
+static pthread_once_t			onceTrace		= PTHREAD_ONCE_INIT;
+
+static unsigned long long trace_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void trace_setup() {
+	pTracePath = getenv("OMX_TRACE");
+	if(pTracePath == NULL || *pTracePath == '\0') {
+		__atomic_store_n(&nTraceState, -1, __ATOMIC_RELEASE);
+		return;
+	}
+
+	nTraceBase = trace_now();
+	atexit(trace_flush);
+	__atomic_store_n(&nTraceState, 1, __ATOMIC_RELEASE);
+}
+
+static TRACE_THREAD* trace_register() {
+	TRACE_THREAD* pThread = calloc(1, sizeof(TRACE_THREAD));
+	if(pThread == NULL) return NULL;
+
+	pThread->tid = syscall(SYS_gettid);
+	pthread_getname_np(pthread_self(), pThread->name, sizeof(pThread->name));
+
+	pThread->pNext = __atomic_load_n(&pTraceThreads, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&pTraceThreads, &pThread->pNext, pThread, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	pTraceSelf = pThread;
+	return pThread;
+}
+
+void trace_event(char phase, const char* name, long long value) {
+	int state = __atomic_load_n(&nTraceState, __ATOMIC_ACQUIRE);
+	if(state == 0) {
+		pthread_once(&onceTrace, trace_setup);
+		state = __atomic_load_n(&nTraceState, __ATOMIC_ACQUIRE);
+	}
+	if(state < 0) return;
+
+	TRACE_THREAD* pThread = pTraceSelf;
+	if(pThread == NULL && (pThread = trace_register()) == NULL) return;
+
+	unsigned int n = pThread->nEvents;
+	if(n >= TRACE_EVENTS_PER_THREAD) {
+		pThread->nDropped++;
+		return;
+	}
+
+	TRACE_EVENT* pEvent = &pThread->events[n];
+	pEvent->nTimestamp	= trace_now();
+	pEvent->pName		= name;
+	pEvent->nValue		= value;
+	pEvent->cPhase		= phase;
+	__atomic_store_n(&pThread->nEvents, n + 1, __ATOMIC_RELEASE);
+}
+
+static void trace_write_string(FILE* fp, const char* str) {
+	fputc('"', fp);
+	for(; *str; str++) {
+		if(*str == '"' || *str == '\\')	fputc('\\', fp);
+		if((unsigned char)*str < 0x20)		continue;
+		fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+void trace_flush() {
+	if(__atomic_load_n(&nTraceState, __ATOMIC_ACQUIRE) <= 0) return;
+	if(__atomic_exchange_n(&isTraceFlushed, 1, __ATOMIC_ACQ_REL)) return;
+
+	FILE* fp = fopen(pTracePath, "w");
+	if(fp == NULL) {
+		perror(pTracePath);
+		return;
+	}
+
+	pid_t pid = getpid();
+	const char* separator = "";
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	TRACE_THREAD* pThread = __atomic_load_n(&pTraceThreads, __ATOMIC_ACQUIRE);
+	for(; pThread; pThread = pThread->pNext) {
+		unsigned int nEvents = __atomic_load_n(&pThread->nEvents, __ATOMIC_ACQUIRE);
+
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				separator, pid, pThread->tid, pThread->name[0] ? pThread->name : "unnamed");
+		separator = ",\n";
+
+		for(unsigned int i = 0; i < nEvents; i++) {
+			TRACE_EVENT* pEvent = &pThread->events[i];
+			unsigned long long ts = pEvent->nTimestamp - nTraceBase;
+
+			fprintf(fp, "%s{\"name\":", separator);
+			trace_write_string(fp, pEvent->pName);
+			fprintf(fp, ",\"cat\":\"omx\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d",
+					pEvent->cPhase, ts / 1000, ts % 1000, pid, pThread->tid);
+			switch(pEvent->cPhase) {
+			case 'C' :
+				fprintf(fp, ",\"args\":{\"value\":%lld}}", pEvent->nValue);
+				break;
+			case 'i' :
+				fprintf(fp, ",\"s\":\"t\"}");
+				break;
+			default :
+				fprintf(fp, "}");
+			}
+		}
+
+		if(pThread->nDropped) {
+			fprintf(stderr, "TRACE > %u events of thread %d are dropped. Buffer is full.\n", pThread->nDropped, pThread->tid);
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	fprintf(stderr, "TRACE > Written to %s\n", pTracePath);
+}
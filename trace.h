@@ -0,0 +1,49 @@
+/*
+ ============================================================================
+ Name        : trace.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Timeline tracer for rpi-omx-tutorial.
+               Records begin/end spans, instant events and counters into
+               per-thread buffers and writes them as Chrome trace JSON at exit.
+               The file can be opened by chrome://tracing or ui.perfetto.dev.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_TRACE_H_
+#define RPI_OMX_TUTORIAL_SRC_TRACE_H_
+
+/*
+ * Tracing is compiled in only with -DTRACE, otherwise every macro is empty.
+ * When compiled in, recording starts only if environment variable OMX_TRACE
+ * names the output file. e.g. OMX_TRACE=/tmp/omx.json ./camera_render_fps
+ *
+ * IMPORTANT : name must be a string literal or have static storage, since
+ *             only the pointer is recorded.
+ */
+#ifdef TRACE
+#define TRACE_BEGIN(name)				trace_event('B', (name), 0)
+#define TRACE_END(name)					trace_event('E', (name), 0)
+#define TRACE_INSTANT(name)				trace_event('i', (name), 0)
+#define TRACE_COUNTER(name, value)		trace_event('C', (name), (long long)(value))
+#else
+#define TRACE_BEGIN(name)				do {} while(0)
+#define TRACE_END(name)					do {} while(0)
+#define TRACE_INSTANT(name)				do {} while(0)
+#define TRACE_COUNTER(name, value)		do {} while(0)
+#endif
+
+/*
+ * Record an event of calling thread. phase is one of Chrome trace phases
+ * 'B'(begin), 'E'(end), 'i'(instant) and 'C'(counter).
+ * Never blocks. If the buffer of calling thread is full, the event is dropped.
+ */
+void trace_event(char phase, const char* name, long long value);
+
+/*
+ * Write recorded events to the file named by OMX_TRACE.
+ * Registered by atexit() automatically, so user rarely needs to call this.
+ */
+void trace_flush();
+
+#endif /* RPI_OMX_TUTORIAL_SRC_TRACE_H_ */
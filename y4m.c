@@ -0,0 +1,214 @@
+/*
+ ============================================================================
+ Name        : y4m.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : YUV4MPEG2 streams for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "trace.h"
+#include "y4m.h"
+
+Y4M_WRITER* y4m_writer_open(const char* path, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef) {
+	OMX_VIDEO_PORTDEFINITIONTYPE*	pVideo = &pPortDef->format.video;
+	char							header[128];
+
+	if((pVideo->nFrameWidth | pVideo->nFrameHeight) & 1) {
+		print_log("Y4M : %dx%d is not for 4:2:0.", pVideo->nFrameWidth, pVideo->nFrameHeight);
+		return NULL;
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	Y4M_WRITER* pWriter = calloc(1, sizeof(Y4M_WRITER));
+	pWriter->fd				= fd;
+	pWriter->format.nWidth	= pVideo->nFrameWidth;
+	pWriter->format.nHeight	= pVideo->nFrameHeight;
+	pWriter->nStride		= pVideo->nStride > 0 ? pVideo->nStride : pVideo->nFrameWidth;
+	pWriter->nSliceHeight	= pVideo->nSliceHeight > 0 ? pVideo->nSliceHeight : pVideo->nFrameHeight;
+	pWriter->iov			= calloc(1 + pVideo->nFrameHeight * 2, sizeof(struct iovec));
+
+	// xFramerate is Q16, as a fraction in lowest terms. Camera may leave it 0.
+	unsigned int nNum = pVideo->xFramerate ? pVideo->xFramerate : 30 << 16;
+	unsigned int nDen = 1 << 16;
+	while(!(nNum & 1) && !(nDen & 1)) {
+		nNum >>= 1;
+		nDen >>= 1;
+	}
+	pWriter->format.nFramerateNum	= nNum;
+	pWriter->format.nFramerateDen	= nDen;
+
+	int nHeader = snprintf(header, sizeof(header), Y4M_MAGIC " W%u H%u F%u:%u Ip A1:1 C420jpeg\n",
+			pWriter->format.nWidth, pWriter->format.nHeight, pWriter->format.nFramerateNum, pWriter->format.nFramerateDen);
+	if(write(fd, header, nHeader) != nHeader) {
+		perror(path);
+		y4m_writer_close(pWriter);
+		return NULL;
+	}
+	pWriter->nBytes = nHeader;
+
+	print_log("Y4M : %s, %dx%d, %d:%d fps", path, pWriter->format.nWidth, pWriter->format.nHeight,
+			pWriter->format.nFramerateNum, pWriter->format.nFramerateDen);
+	return pWriter;
+}
+
+/* Lines of a plane as they are in the buffer. Contiguous lines are one. */
+static unsigned int y4m_plane_iov(struct iovec* iov, OMX_U8* pPlane, unsigned int nWidth, unsigned int nHeight, unsigned int nStride) {
+	if(nWidth == nStride) {
+		iov->iov_base	= pPlane;
+		iov->iov_len	= nWidth * nHeight;
+		return 1;
+	}
+	for(unsigned int y = 0; y < nHeight; y++) {
+		iov[y].iov_base	= pPlane + y * nStride;
+		iov[y].iov_len	= nWidth;
+	}
+	return nHeight;
+}
+
+OMX_BOOL y4m_write(Y4M_WRITER* pWriter, OMX_BUFFERHEADERTYPE* pBuffer) {
+	struct iovec*	iov		= pWriter->iov;
+	OMX_U8*			pY		= pBuffer->pBuffer + pBuffer->nOffset;
+	unsigned int	nSizeY	= pWriter->nStride * pWriter->nSliceHeight;
+	unsigned int	nWidth	= pWriter->format.nWidth;
+	unsigned int	nHeight	= pWriter->format.nHeight;
+	unsigned int	nIov	= 0;
+
+	if(pWriter->fd < 0) return OMX_FALSE;
+
+	iov[nIov].iov_base	= Y4M_FRAME;
+	iov[nIov].iov_len	= sizeof(Y4M_FRAME) - 1;
+	nIov++;
+	nIov += y4m_plane_iov(&iov[nIov], pY, nWidth, nHeight, pWriter->nStride);
+	nIov += y4m_plane_iov(&iov[nIov], pY + nSizeY, nWidth / 2, nHeight / 2, pWriter->nStride / 2);
+	nIov += y4m_plane_iov(&iov[nIov], pY + nSizeY * 5 / 4, nWidth / 2, nHeight / 2, pWriter->nStride / 2);
+
+	// IOV_MAX at a time. A short write goes on from where it stopped.
+	TRACE_BEGIN("y4m_write");
+	while(nIov > 0) {
+		ssize_t nWritten = writev(pWriter->fd, iov, nIov < IOV_MAX ? nIov : IOV_MAX);
+		if(nWritten < 0) {
+			if(errno == EINTR) continue;
+			print_log("Y4M : Failed to write. %s", strerror(errno));
+			close(pWriter->fd);
+			pWriter->fd = -1;
+			TRACE_END("y4m_write");
+			return OMX_FALSE;
+		}
+		pWriter->nBytes += nWritten;
+
+		while(nIov > 0 && (size_t)nWritten >= iov->iov_len) {
+			nWritten -= iov->iov_len;
+			iov++;
+			nIov--;
+		}
+		if(nIov > 0) {
+			iov->iov_base	= (OMX_U8*)iov->iov_base + nWritten;
+			iov->iov_len	-= nWritten;
+		}
+	}
+	TRACE_END("y4m_write");
+	pWriter->nFrames++;
+
+	return OMX_TRUE;
+}
+
+void y4m_writer_close(Y4M_WRITER* pWriter) {
+	if(pWriter == NULL) return;
+
+	if(pWriter->fd >= 0) close(pWriter->fd);
+	print_log("Y4M : %d frames, %llu bytes", pWriter->nFrames, pWriter->nBytes);
+	free(pWriter->iov);
+	free(pWriter);
+}
+
+/* Read a line without the newline. Returns OMX_FALSE at the end or if it is too long. */
+static OMX_BOOL y4m_read_line(FILE* fp, char* line) {
+	int c;
+	int n = 0;
+
+	while((c = fgetc(fp)) != EOF && c != '\n') {
+		if(n == Y4M_LINE_MAX - 1) return OMX_FALSE;
+		line[n++] = c;
+	}
+	line[n] = '\0';
+	return c == '\n';
+}
+
+OMX_BOOL y4m_read_header(FILE* fp, Y4M_FORMAT* pFormat) {
+	char	line[Y4M_LINE_MAX];
+	char*	pSave;
+
+	if(!y4m_read_line(fp, line) || strncmp(line, Y4M_MAGIC " ", sizeof(Y4M_MAGIC)) != 0) {
+		return OMX_FALSE;
+	}
+
+	memset(pFormat, 0x00, sizeof(Y4M_FORMAT));
+	pFormat->nFramerateNum = 30;
+	pFormat->nFramerateDen = 1;
+	for(char* pTag = strtok_r(line + sizeof(Y4M_MAGIC), " ", &pSave); pTag; pTag = strtok_r(NULL, " ", &pSave)) {
+		switch(pTag[0]) {
+		case 'W' :
+			pFormat->nWidth = atoi(pTag + 1);
+			break;
+		case 'H' :
+			pFormat->nHeight = atoi(pTag + 1);
+			break;
+		case 'F' :
+			if(sscanf(pTag + 1, "%u:%u", &pFormat->nFramerateNum, &pFormat->nFramerateDen) != 2
+					|| pFormat->nFramerateNum == 0 || pFormat->nFramerateDen == 0) {
+				print_log("Y4M : Frame rate %s is not valid.", pTag + 1);
+				return OMX_FALSE;
+			}
+			break;
+		case 'I' :
+			if(pTag[1] != 'p' && pTag[1] != '?') {
+				print_log("Y4M : Interlaced stream is not supported.");
+				return OMX_FALSE;
+			}
+			break;
+		case 'C' :
+			// Chroma siting differs but the planes are the same. 420p10 and such are not.
+			if(strcmp(pTag + 1, "420") != 0 && strcmp(pTag + 1, "420jpeg") != 0
+					&& strcmp(pTag + 1, "420paldv") != 0 && strcmp(pTag + 1, "420mpeg2") != 0) {
+				print_log("Y4M : Colour space %s is not supported.", pTag + 1);
+				return OMX_FALSE;
+			}
+			break;
+		default :
+			// Aspect and extensions do not matter.
+			break;
+		}
+	}
+
+	if(pFormat->nWidth == 0 || pFormat->nHeight == 0 || ((pFormat->nWidth | pFormat->nHeight) & 1)) {
+		print_log("Y4M : %dx%d is not for 4:2:0.", pFormat->nWidth, pFormat->nHeight);
+		return OMX_FALSE;
+	}
+	return OMX_TRUE;
+}
+
+OMX_BOOL y4m_read_frame(FILE* fp, Y4M_FORMAT* pFormat, OMX_U8* pBuffer) {
+	char	line[Y4M_LINE_MAX];
+	size_t	nSize = pFormat->nWidth * pFormat->nHeight * 3 / 2;
+
+	// FRAME may have parameters, which do not matter.
+	if(!y4m_read_line(fp, line) || strncmp(line, "FRAME", 5) != 0) return OMX_FALSE;
+	return fread(pBuffer, 1, nSize, fp) == nSize;
+}
@@ -0,0 +1,76 @@
+/*
+ ============================================================================
+ Name        : y4m.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : YUV4MPEG2 streams for rpi-omx-tutorial.
+               Unlike a raw dump, a Y4M file tells its width, height and
+               frame rate, so ffmpeg, ffplay and mpv read it as it is.
+
+               Writer takes a whole frame of camera port #71 and hands the
+               lines of its planes to writev() in place, leaving padding of
+               stride and slice out, so nothing is copied in user space.
+               Reader is used by replay.c, so a Y4M clip plays instead of
+               the camera just as a record does.
+
+               Only 4:2:0 progressive is supported.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_Y4M_H_
+#define RPI_OMX_TUTORIAL_SRC_Y4M_H_
+
+#include <stdio.h>
+#include <sys/uio.h>
+
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Component.h>
+
+#define Y4M_MAGIC		"YUV4MPEG2"
+#define Y4M_FRAME		"FRAME\n"
+#define Y4M_LINE_MAX	1024		// Longest header line accepted
+
+typedef struct Y4M_FORMAT {
+	unsigned int		nWidth;
+	unsigned int		nHeight;
+	unsigned int		nFramerateNum;
+	unsigned int		nFramerateDen;
+} Y4M_FORMAT;
+
+typedef struct Y4M_WRITER {
+	int					fd;
+	Y4M_FORMAT			format;
+	unsigned int		nStride;			// Of #71
+	unsigned int		nSliceHeight;		// Of #71
+	struct iovec*		iov;				// FRAME and every line at most
+	unsigned int		nFrames;
+	unsigned long long	nBytes;
+} Y4M_WRITER;
+
+/*
+ * Create a Y4M file. Layout of frames is taken from pPortDef of camera
+ * port #71. Returns NULL on failure.
+ */
+Y4M_WRITER* y4m_writer_open(const char* path, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef);
+
+/*
+ * Append the frame of a whole frame buffer. Returns OMX_FALSE and stops
+ * writing on failure.
+ */
+OMX_BOOL y4m_write(Y4M_WRITER* pWriter, OMX_BUFFERHEADERTYPE* pBuffer);
+
+void y4m_writer_close(Y4M_WRITER* pWriter);
+
+/*
+ * Parse the stream header. Returns OMX_FALSE if fp is not at a Y4M stream
+ * which is supported.
+ */
+OMX_BOOL y4m_read_header(FILE* fp, Y4M_FORMAT* pFormat);
+
+/*
+ * Read the next frame into pBuffer as planar I420 without padding, which is
+ * nWidth * nHeight * 3 / 2 bytes. Returns OMX_FALSE at the end of stream.
+ */
+OMX_BOOL y4m_read_frame(FILE* fp, Y4M_FORMAT* pFormat, OMX_U8* pBuffer);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_Y4M_H_ */
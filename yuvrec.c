@@ -0,0 +1,275 @@
+/*
+ ============================================================================
+ Name        : yuvrec.c
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Raw YUV recorder for rpi-omx-tutorial.
+ ============================================================================
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "trace.h"
+#include "yuvrec.h"
+
+/*
+ * Open the next segment. O_DIRECT is not supported by every file system,
+ * tmpfs for one, and then it is written through page cache.
+ */
+static OMX_BOOL yuvrec_segment_open(YUVREC* pRec) {
+	char path[300];
+
+	snprintf(path, sizeof(path), "%s-%04u.yuv", pRec->prefix, pRec->nSegment);
+	pRec->isDirect	= OMX_TRUE;
+	pRec->fd		= open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if(pRec->fd < 0 && errno == EINVAL) {
+		pRec->isDirect	= OMX_FALSE;
+		pRec->fd		= open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if(pRec->fd < 0) {
+		print_log("YUVREC : Failed to open %s. %s", path, strerror(errno));
+		return OMX_FALSE;
+	}
+
+	print_log("YUVREC : %s%s", path, pRec->isDirect ? "" : ", without O_DIRECT");
+	pRec->nSegment++;
+	return OMX_TRUE;
+}
+
+static OMX_BOOL yuvrec_write_all(YUVREC* pRec, const OMX_U8* pData, size_t nSize) {
+	while(nSize > 0) {
+		ssize_t nWritten = write(pRec->fd, pData, nSize);
+		if(nWritten < 0) {
+			if(errno == EINTR) continue;
+			print_log("YUVREC : Failed to write. %s", strerror(errno));
+			return OMX_FALSE;
+		}
+		pData			+= nWritten;
+		nSize			-= nWritten;
+		pRec->nBytes	+= nWritten;
+	}
+	return OMX_TRUE;
+}
+
+/*
+ * Write a chunk to the segment. Only the last chunk of a segment may have
+ * a tail which is not aligned, and it goes without O_DIRECT.
+ */
+static OMX_BOOL yuvrec_chunk_write(YUVREC* pRec, YUVREC_BUFFER* pChunk) {
+	unsigned int nAligned = pChunk->nFilled & ~(YUVREC_ALIGN - 1);
+
+	if(pRec->fd < 0 && !yuvrec_segment_open(pRec)) {
+		return OMX_FALSE;
+	}
+
+	TRACE_BEGIN("yuvrec_write");
+	unsigned long long nBegin = stats_now();
+	OMX_BOOL isWritten = yuvrec_write_all(pRec, pChunk->pData, nAligned);
+	if(isWritten && pChunk->nFilled > nAligned) {
+		if(pRec->isDirect) fcntl(pRec->fd, F_SETFL, fcntl(pRec->fd, F_GETFL) & ~O_DIRECT);
+		isWritten = yuvrec_write_all(pRec, pChunk->pData + nAligned, pChunk->nFilled - nAligned);
+	}
+	stats_histogram_add(&pRec->writeTime, stats_now() - nBegin);
+	TRACE_END("yuvrec_write");
+
+	if(!isWritten || pChunk->isSegmentEnd) {
+		close(pRec->fd);
+		pRec->fd = -1;
+	}
+	return isWritten;
+}
+
+static void* yuvrec_thread(void* data) {
+	YUVREC* pRec = (YUVREC*)data;
+
+	pthread_setname_np(pthread_self(), "yuvrec");
+	cpu_thread_register("yuvrec");
+
+	pthread_mutex_lock(&pRec->mutex);
+	while(1) {
+		if(pRec->nQueued == 0) {
+			if(!pRec->isRunning) break;
+			pthread_cond_wait(&pRec->cond, &pRec->mutex);
+			continue;
+		}
+
+		YUVREC_BUFFER* pChunk = pRec->pQueued[0];
+		pthread_mutex_unlock(&pRec->mutex);
+		OMX_BOOL isWritten = !pRec->isFailed && yuvrec_chunk_write(pRec, pChunk);
+		pthread_mutex_lock(&pRec->mutex);
+
+		if(!isWritten) pRec->isFailed = OMX_TRUE;
+		memmove(&pRec->pQueued[0], &pRec->pQueued[1], --pRec->nQueued * sizeof(YUVREC_BUFFER*));
+		pRec->pFree[pRec->nFree++] = pChunk;
+	}
+	pthread_mutex_unlock(&pRec->mutex);
+	cpu_thread_finish();
+
+	return NULL;
+}
+
+/* Caller side : Hand the chunk being filled to the writer. */
+static void yuvrec_submit(YUVREC* pRec, OMX_BOOL isSegmentEnd) {
+	pRec->pFilling->isSegmentEnd = isSegmentEnd;
+
+	pthread_mutex_lock(&pRec->mutex);
+	pRec->pQueued[pRec->nQueued++] = pRec->pFilling;
+	pthread_cond_signal(&pRec->cond);
+	pthread_mutex_unlock(&pRec->mutex);
+	pRec->pFilling = NULL;
+}
+
+/*
+ * Caller side : Append bytes, moving on to a free chunk when one is full. Room is checked already.
+ * A full chunk goes to the writer only when more bytes come, so the end of a segment may still
+ * be marked on it.
+ */
+static void yuvrec_put(YUVREC* pRec, const OMX_U8* pData, unsigned int nSize) {
+	while(nSize > 0) {
+		if(pRec->pFilling && pRec->pFilling->nFilled == pRec->nChunkSize) {
+			yuvrec_submit(pRec, OMX_FALSE);
+		}
+		if(pRec->pFilling == NULL) {
+			pthread_mutex_lock(&pRec->mutex);
+			pRec->pFilling = pRec->pFree[--pRec->nFree];
+			pthread_mutex_unlock(&pRec->mutex);
+			pRec->pFilling->nFilled = 0;
+		}
+
+		YUVREC_BUFFER*	pChunk	= pRec->pFilling;
+		unsigned int	nCopy	= pRec->nChunkSize - pChunk->nFilled;
+		if(nCopy > nSize) nCopy = nSize;
+		memcpy(pChunk->pData + pChunk->nFilled, pData, nCopy);
+		pChunk->nFilled	+= nCopy;
+		pData			+= nCopy;
+		nSize			-= nCopy;
+	}
+}
+
+/* Caller side : Lines of a plane without padding. */
+static void yuvrec_put_plane(YUVREC* pRec, const OMX_U8* pPlane, unsigned int nWidth, unsigned int nHeight, unsigned int nStride) {
+	if(nWidth == nStride) {
+		yuvrec_put(pRec, pPlane, nWidth * nHeight);
+		return;
+	}
+	for(unsigned int y = 0; y < nHeight; y++) {
+		yuvrec_put(pRec, pPlane + y * nStride, nWidth);
+	}
+}
+
+YUVREC* yuvrec_open(const char* pPrefix, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef, unsigned int nSegmentFrames) {
+	OMX_VIDEO_PORTDEFINITIONTYPE*	pVideo	= &pPortDef->format.video;
+	YUVREC*							pRec	= calloc(1, sizeof(YUVREC));
+
+	snprintf(pRec->prefix, sizeof(pRec->prefix), "%s", pPrefix);
+	pRec->nWidth			= pVideo->nFrameWidth;
+	pRec->nHeight			= pVideo->nFrameHeight;
+	pRec->nStride			= pVideo->nStride > 0 ? pVideo->nStride : pVideo->nFrameWidth;
+	pRec->nSliceHeight		= pVideo->nSliceHeight > 0 ? pVideo->nSliceHeight : pVideo->nFrameHeight;
+	pRec->nFrameSize		= pRec->nWidth * pRec->nHeight * 3 / 2;
+	pRec->nChunkSize		= (pRec->nFrameSize + YUVREC_ALIGN - 1) & ~(YUVREC_ALIGN - 1);
+	if(pRec->nChunkSize < YUVREC_CHUNK) pRec->nChunkSize = YUVREC_CHUNK;
+	pRec->nSegmentFrames	= nSegmentFrames;
+	pRec->fd				= -1;
+	stats_histogram_reset(&pRec->writeTime);
+
+	for(int i = 0; i < YUVREC_CHUNKS; i++) {
+		if(posix_memalign((void**)&pRec->chunks[i].pData, YUVREC_ALIGN, pRec->nChunkSize) != 0) {
+			print_log("YUVREC : Failed to allocate %d bytes.", pRec->nChunkSize);
+			yuvrec_close(pRec);
+			return NULL;
+		}
+		pRec->pFree[pRec->nFree++] = &pRec->chunks[i];
+	}
+
+	// First segment is opened here, so a bad path fails at once.
+	if(!yuvrec_segment_open(pRec)) {
+		yuvrec_close(pRec);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pRec->mutex, NULL);
+	pthread_cond_init(&pRec->cond, NULL);
+	pRec->isRunning = OMX_TRUE;
+	if(pthread_create(&pRec->thread, NULL, yuvrec_thread, pRec) != 0) {
+		print_log("YUVREC : Failed to start the writer.");
+		pRec->isRunning = OMX_FALSE;
+		yuvrec_close(pRec);
+		return NULL;
+	}
+
+	print_log("YUVREC : %dx%d, %d bytes a frame, chunk of %d bytes, %d frames a segment",
+			pRec->nWidth, pRec->nHeight, pRec->nFrameSize, pRec->nChunkSize, nSegmentFrames);
+	return pRec;
+}
+
+OMX_BOOL yuvrec_write(YUVREC* pRec, OMX_BUFFERHEADERTYPE* pBuffer) {
+	// Writer only adds free chunks, so the room only grows after this.
+	pthread_mutex_lock(&pRec->mutex);
+	unsigned long long nRoom = (unsigned long long)pRec->nFree * pRec->nChunkSize;
+	OMX_BOOL isFailed = pRec->isFailed;
+	pthread_mutex_unlock(&pRec->mutex);
+	if(pRec->pFilling) nRoom += pRec->nChunkSize - pRec->pFilling->nFilled;
+
+	if(isFailed || nRoom < pRec->nFrameSize) {
+		pRec->nDropped++;
+		TRACE_INSTANT("yuvrec drop");
+		return OMX_FALSE;
+	}
+
+	TRACE_BEGIN("yuvrec_pack");
+	const OMX_U8*	pY		= pBuffer->pBuffer + pBuffer->nOffset;
+	unsigned int	nSizeY	= pRec->nStride * pRec->nSliceHeight;
+	yuvrec_put_plane(pRec, pY, pRec->nWidth, pRec->nHeight, pRec->nStride);
+	yuvrec_put_plane(pRec, pY + nSizeY, pRec->nWidth / 2, pRec->nHeight / 2, pRec->nStride / 2);
+	yuvrec_put_plane(pRec, pY + nSizeY * 5 / 4, pRec->nWidth / 2, pRec->nHeight / 2, pRec->nStride / 2);
+	TRACE_END("yuvrec_pack");
+	pRec->nFrames++;
+
+	if(pRec->nSegmentFrames > 0 && ++pRec->nFrameInSegment == pRec->nSegmentFrames) {
+		pRec->nFrameInSegment = 0;
+		if(pRec->pFilling) yuvrec_submit(pRec, OMX_TRUE);
+	}
+	return OMX_TRUE;
+}
+
+void yuvrec_close(YUVREC* pRec) {
+	if(pRec == NULL) return;
+
+	if(pRec->isRunning) {
+		if(pRec->pFilling && pRec->pFilling->nFilled > 0) {
+			yuvrec_submit(pRec, OMX_TRUE);
+		}
+
+		pthread_mutex_lock(&pRec->mutex);
+		pRec->isRunning = OMX_FALSE;
+		pthread_cond_signal(&pRec->cond);
+		pthread_mutex_unlock(&pRec->mutex);
+		pthread_join(pRec->thread, NULL);
+		pthread_cond_destroy(&pRec->cond);
+		pthread_mutex_destroy(&pRec->mutex);
+
+		unsigned long long nBusy = pRec->writeTime.nSum;
+		print_log("YUVREC : %d frames, %d dropped, %llu MB in %d segments, %.1f MB/s while writing",
+				pRec->nFrames, pRec->nDropped, pRec->nBytes >> 20, pRec->nSegment,
+				nBusy ? pRec->nBytes * 1e9 / nBusy / (1 << 20) : 0.0);
+		print_log("YUVREC : Chunk written in p50 %.1f ms, p99 %.1f ms, max %.1f ms",
+				stats_histogram_percentile(&pRec->writeTime, 50) / 1e6,
+				stats_histogram_percentile(&pRec->writeTime, 99) / 1e6,
+				pRec->writeTime.nMax / 1e6);
+	}
+
+	if(pRec->fd >= 0) close(pRec->fd);
+	for(int i = 0; i < YUVREC_CHUNKS; i++) {
+		free(pRec->chunks[i].pData);
+	}
+	free(pRec);
+}
@@ -0,0 +1,93 @@
+/*
+ ============================================================================
+ Name        : yuvrec.h
+ Author      : SonienTaegi ( https://github.com/SonienTaegi/rpi-omx-tutorial )
+ Version     :
+ Copyright   : GPLv2
+ Description : Raw YUV recorder for rpi-omx-tutorial.
+               Frames are packed as planar I420 without padding of port #71,
+               so any tool reads them with width and height alone. Packing
+               goes into one of two large page aligned chunks, and a writer
+               thread of its own writes full chunks by O_DIRECT, so storage
+               sees long sequential writes and page cache is left alone.
+
+               Caller never waits for storage. When both chunks are with
+               the writer, the frame is dropped and counted. Files are cut
+               into segments of nSegmentFrames, on frame boundary, named
+               <prefix>-0000.yuv, <prefix>-0001.yuv, ... to stay under the
+               4GB limit of FAT on SD and USB.
+ ============================================================================
+ */
+#ifndef RPI_OMX_TUTORIAL_SRC_YUVREC_H_
+#define RPI_OMX_TUTORIAL_SRC_YUVREC_H_
+
+#include <pthread.h>
+
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Component.h>
+
+#include "stats.h"
+
+#define YUVREC_CHUNK		(8 << 20)	// Bytes of a write. At least a frame.
+#define YUVREC_CHUNKS		2			// Double buffered
+#define YUVREC_ALIGN		4096		// Of memory, offset and length for O_DIRECT
+
+typedef struct YUVREC_BUFFER {
+	OMX_U8*				pData;
+	unsigned int		nFilled;
+	OMX_BOOL			isSegmentEnd;		// Last chunk of the segment
+} YUVREC_BUFFER;
+
+typedef struct YUVREC {
+	char				prefix[256];
+	unsigned int		nWidth;
+	unsigned int		nHeight;
+	unsigned int		nStride;			// Of #71
+	unsigned int		nSliceHeight;		// Of #71
+	unsigned int		nFrameSize;			// Packed I420
+	unsigned int		nChunkSize;
+	unsigned int		nSegmentFrames;
+
+	YUVREC_BUFFER		chunks[YUVREC_CHUNKS];
+	YUVREC_BUFFER*		pFilling;			// Caller side. NULL until a free one is taken.
+	YUVREC_BUFFER*		pFree[YUVREC_CHUNKS];
+	unsigned int		nFree;
+	YUVREC_BUFFER*		pQueued[YUVREC_CHUNKS];	// To the writer, in order
+	unsigned int		nQueued;
+	unsigned int		nFrameInSegment;
+
+	pthread_t			thread;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;
+	OMX_BOOL			isRunning;
+	OMX_BOOL			isFailed;			// Write failed. Frames are dropped from then on.
+
+	// Writer only
+	int					fd;
+	OMX_BOOL			isDirect;
+	unsigned int		nSegment;			// Segments opened
+
+	unsigned int		nFrames;			// Packed
+	unsigned int		nDropped;			// No chunk free or write failed
+	unsigned long long	nBytes;				// Written
+	STATS_HISTOGRAM		writeTime;			// nsec, of a chunk
+} YUVREC;
+
+/*
+ * Start the writer. Layout of frames is taken from pPortDef of camera port
+ * #71. Returns NULL on failure.
+ */
+YUVREC* yuvrec_open(const char* pPrefix, OMX_PARAM_PORTDEFINITIONTYPE* pPortDef, unsigned int nSegmentFrames);
+
+/*
+ * Pack the frame for the writer. Never waits for storage. Returns OMX_FALSE
+ * if the frame is dropped. Call from one thread.
+ */
+OMX_BOOL yuvrec_write(YUVREC* pRec, OMX_BUFFERHEADERTYPE* pBuffer);
+
+/*
+ * Write what is packed, stop the writer and report.
+ */
+void yuvrec_close(YUVREC* pRec);
+
+#endif /* RPI_OMX_TUTORIAL_SRC_YUVREC_H_ */